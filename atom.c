@@ -0,0 +1,11 @@
+/**
+ * Atom - file data format with s-expression
+ * Implementation unit of the single header atom.h
+ *
+ * @author: MaiHD
+ * @license: Free to use
+ * @copyright: MaiHD @ ${HOME}, 2017
+ */
+
+#define ATOM_IMPL
+#include "atom.h"
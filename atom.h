@@ -27,9 +27,24 @@
 #define __atomextern extern
 #endif
 
+/* Lists with this many children build a hash index on lookups
+ */
+#ifndef ATOM_INDEX_THRESHOLD
+#define ATOM_INDEX_THRESHOLD 16
+#endif
+
+/* Define ATOM_STATS to count and time the work of the runtime, see atom_getstats
+ */
+
+/* Define ATOM_TRACE to record timed events of forms, I/O and saves, see atom_trace_dump
+ * (require GCC or Clang, for thread-local storage and atomics)
+ */
+
+/* Define ATOM_THREADS to enable multi-threaded features (require pthreads)
+ */
 #ifndef __atominline
 # ifdef __GNUC__
-#  define __atominline __attribute__((always_inline))
+#  define __atominline static inline __attribute__((always_inline))
 # elif  defined(_MSC_VER)
 #  define __atominline __forceinline
 # elif  defined(__cplusplus)
@@ -92,6 +107,9 @@ enum
     ATOM_ERROR_UNBALANCED    = -3,
     ATOM_ERROR_UNEXPECTED    = -4,
     ATOM_ERROR_UNTERMINATED  = -5,
+    ATOM_ERROR_OVERFLOW      = -6,
+    ATOM_ERROR_IO            = -7,
+    ATOM_ERROR_PATCH         = -8,
 };
 
 
@@ -125,21 +143,38 @@ typedef union
  * List is more complicate than that, list can contain child nodes
  * @note: commented-line is the feature in decision
  */
-typedef struct atom_node atom_node_t;
+typedef struct atom_node  atom_node_t;
+typedef struct atom_index atom_index_t; /* Hashed children by name, see atom_find */
 struct atom_node
 {
-    atom_type_t  type;
-    atom_text_t  name;
-    atom_data_t  data;
-    atom_node_t* prev;
-    atom_node_t* next;
-    atom_node_t* parent;
-    atom_node_t* children;
-    atom_node_t* lastchild;
+    atom_type_t   type;
+    int           flags;     /* ATOM_NODE_* flags, fit in padding of type   */
+    atom_text_t   name;
+    atom_data_t   data;
+    atom_node_t*  prev;
+    atom_node_t*  next;
+    atom_node_t*  parent;
+    atom_node_t*  children;
+    atom_node_t*  lastchild;
+    uint64_t      hash;      /* Cached structural hash, 0 when not computed */
+    atom_index_t* index;     /* Children index of list, NULL when not built */
 
     /* No padding needed */
 };
 
+/**
+ * Node flags
+ */
+enum
+{
+    ATOM_NODE_CSTR     = 1 << 0, /* Texts are c-string, even when a lexer is given */
+    ATOM_NODE_OWNED    = 1 << 1, /* Texts are owned by node, freed with it         */
+    ATOM_NODE_SHARED   = 1 << 2, /* Children are shared, see atom_intern           */
+    ATOM_NODE_READONLY = 1 << 3, /* Node must not be changed                       */
+    ATOM_NODE_FROZEN   = 1 << 4, /* Node live in a block made by atom_freeze       */
+    ATOM_NODE_SORTED   = 1 << 5, /* Children are sorted by name, see atom_freeze   */
+};
+
 /**
  * Atom lexer for parsing
  */
@@ -184,6 +219,131 @@ __atomextern void atom_init(void* data, size_t size, void* (*extract)(void*, siz
  */
 __atomextern void atom_release(void);
 
+/**
+ * Memory of trees, in a heap or in a subtree
+ * Reserved bytes are node pools, indexes, owned texts and frozen blocks,
+ * used bytes are the same without the free nodes of pools. Temporary
+ * buffers of queries, tables and writers are not counted.
+ */
+typedef struct
+{
+    size_t nodes;    /* Live nodes                  */
+    size_t chunks;   /* Chunks of node pools        */
+    size_t reserved; /* Bytes allocated for trees   */
+    size_t used;     /* Bytes in use                */
+    size_t peak;     /* High-water mark of reserved */
+} atom_memory_t;
+
+/**
+ * Memory heap: allocation functions and the node pools made with them
+ */
+typedef struct atom_heap
+{
+    void*  data;
+    size_t size;
+    void*  (*extract)(void* data, size_t size);
+    void   (*collect)(void* data, void* pointer);
+
+    struct atom_nodepool* nodepool; /* Internal, initialize with NULL  */
+    atom_memory_t         memory;   /* Internal, initialize with zeros */
+} atom_heap_t;
+
+/**
+ * Make heap current, memory of the atom's runtime come from it until the
+ * next call. atom_init and atom_release work on the current heap. Nodes
+ * must be deleted while the heap they were created with is current.
+ * With ATOM_THREADS the current heap is per thread: threads that each use
+ * their own heap can parse at the same time. Otherwise, like atom_init,
+ * this is not thread-safe. Threads of atom_save_parallel and
+ * atom_table_extract_parallel only use private scratch memory, the heap
+ * of the caller is never used from them.
+ *
+ * @param heap - heap to use, NULL for the global heap
+ * @return previous heap
+ */
+__atomextern atom_heap_t* atom_useheap(atom_heap_t* heap);
+
+/**
+ * Get memory of trees in a heap, live nodes should be 0 when all trees
+ * are deleted, otherwise some are leaked
+ * @param heap - heap to report, NULL for the current heap
+ */
+__atomextern void atom_getmemory(atom_heap_t* heap, atom_memory_t* memory);
+
+/**
+ * Get memory owned by a subtree: nodes, indexes and owned texts
+ * Shared children are divided between the lists sharing them. Chunks and
+ * peak are always 0, used bytes are the same as reserved bytes.
+ */
+__atomextern void atom_memoryof(atom_node_t* node, atom_memory_t* memory);
+
+/**
+ * Print memory of subtrees down to depth, for finding what use memory
+ * Children smaller than 1% of node are summed on one line.
+ */
+__atomextern void atom_dumpmemory(atom_lexer_t* lexer, atom_node_t* node, FILE* stream, int depth);
+
+/**
+ * Counters and timers of the runtime, collected when ATOM_STATS is defined
+ * Times are in nanoseconds. Parse time include lex and number time.
+ * Counts from worker threads may be lost, they are not atomic.
+ */
+typedef struct
+{
+    size_t   bytes;     /* Characters read by lexers                 */
+    size_t   tokens;    /* Names, numbers and texts read             */
+    size_t   newnodes;  /* Nodes taken from pools                    */
+    size_t   freenodes; /* Nodes given back to pools                 */
+    size_t   refills;   /* Pool chunks allocated                     */
+    size_t   fallbacks; /* Tokens read as real after long failed     */
+    size_t   seeks;     /* Seeks of stream lexers                    */
+
+    uint64_t lextime;   /* Reading names and tokens                  */
+    uint64_t parsetime; /* atom_parse                                */
+    uint64_t numbertime;/* Decoding numbers                          */
+    uint64_t savetime;  /* Serializing with atom_save_*              */
+} atom_stats_t;
+
+/**
+ * Get the current stats, all zero when ATOM_STATS is not defined
+ * @param reset - start counting again from zero
+ */
+__atomextern void atom_getstats(atom_stats_t* stats, atom_bool_t reset);
+
+/**
+ * Print stats in human readable form
+ */
+__atomextern void atom_dumpstats(const atom_stats_t* stats, FILE* stream);
+
+/**
+ * Start or stop recording trace events, stopped by default
+ * When ATOM_TRACE is defined, the runtime record: each top-level form parsed,
+ * each chunk written to files, each save. Every thread write to its own ring
+ * of ATOM_TRACE_CAPACITY events without locks, the oldest events are overwritten.
+ */
+__atomextern void atom_trace_enable(atom_bool_t enable);
+
+/**
+ * Begin an event, 0 when not recording
+ */
+__atomextern uint64_t atom_trace_begin(void);
+
+/**
+ * End an event that begin with atom_trace_begin, nothing when begin is 0
+ * @param name  - static string, kind of work: "form", "read", "write"...
+ * @param label - copied, what is worked on: name of form, path of file. Can be NULL
+ * @param arg   - number shown with event: line of form, bytes of chunk...
+ */
+__atomextern void atom_trace_end(const char* name, const char* label, uint64_t begin, int64_t arg);
+
+/**
+ * Write events of all threads in Chrome trace JSON, open with chrome://tracing or Perfetto
+ * Events recorded while dumping may be skipped, they are never torn.
+ * @param reset - do not write the same events again on next dump
+ * @return number of events written, ATOM_ERROR_IO when writing failed
+ */
+__atomextern int atom_trace_dump(FILE* stream, atom_bool_t reset);
+
 /**
  * Initialize lexer with context
  * @params type    - Type of lexer (ATOM_LEXER_STREAM, ATOM_LEXER_STRING)
@@ -195,16 +355,90 @@ __atomextern int atom_lexer_free(atom_lexer_t*);
 __atomextern atom_node_t* atom_create(atom_type_t type, atom_text_t name);
 __atomextern void         atom_delete(atom_node_t* node);
 
-__atomextern void         atom_addchild(atom_node_t* node, atom_node_t* child);
-//__atomextern void         atom_remove_child(atom_node_t* node, atom_node_t* child);
+/**
+ * Read-only nodes (ATOM_NODE_READONLY: children of a shared list, or a frozen tree)
+ * are never changed: atom_delete does nothing, atom_removechild return NULL
+ * @return ATOM_ERROR_NONE, ATOM_ERROR_ARGUMENTS when node is read-only,
+ *         or ATOM_ERROR_OVERFLOW when copying shared children is out of memory
+ */
+__atomextern int          atom_addchild(atom_node_t* node, atom_node_t* child);
+
+/**
+ * Invalidate cached hash of node and its ancestors
+ * atom_addchild and atom_delete do it, call this after changing node fields directly
+ */
+__atomextern void         atom_touch(atom_node_t* node);
+__atomextern int          atom_insertchild(atom_node_t* node, atom_node_t* child, int index);
+__atomextern atom_node_t* atom_removechild(atom_node_t* node, atom_node_t* child);
 
 __atomextern atom_node_t* atom_parse(atom_lexer_t* lexer);
 
+/**
+ * Save node to stream
+ * @return number of bytes written, clamped to INT_MAX, or error code
+ *         use atom_save_parallel to get the size of bigger outputs
+ */
 __atomextern int atom_save_stream(atom_node_t* node, FILE* stream);
 __atomextern int atom_save_string(atom_node_t* node, char* string, size_t length);
 __atomextern int atom_save_stream_with_lexer(atom_lexer_t* lexer, atom_node_t* node, FILE* stream);  
 __atomextern int atom_save_string_with_lexer(atom_lexer_t* lexer, atom_node_t* node, char* string, size_t length);
 
+/**
+ * Save node to stream, children of node are serialized concurrently
+ * Fallback to single thread when ATOM_THREADS is not defined, or lexer is a stream
+ *
+ * @param lexer   - source of texts, NULL when texts are c-string
+ * @param threads - number of worker threads
+ * @param written - receive number of bytes written, can be NULL
+ * @return ATOM_ERROR_NONE, or error code
+ */
+__atomextern int atom_save_parallel(atom_lexer_t* lexer, atom_node_t* node, FILE* stream, int threads, size_t* written);
+
+/**
+ * Save node in canonical form: single line, single space separated,
+ * reals in shortest round-trip fixed notation
+ * Equal trees always give the same bytes, whatever the source layout was
+ *
+ * @param lexer - source of texts, NULL when texts are c-string
+ */
+__atomextern int atom_save_canonical(atom_lexer_t* lexer, atom_node_t* node, FILE* stream);
+__atomextern int atom_save_canonical_string(atom_lexer_t* lexer, atom_node_t* node, char* string, size_t length);
+
+/**
+ * Asynchronous save flags
+ */
+enum
+{
+    ATOM_SAVE_FSYNC  = 1 << 0, /* fsync the file before complete              */
+    ATOM_SAVE_RENAME = 1 << 1, /* Write to "<path>.tmp", rename when complete */
+};
+
+typedef struct atom_saveasync atom_saveasync_t;
+
+/**
+ * Save node to file in background, a serializer thread fill one buffer
+ * while an I/O thread write the other one
+ * Node and lexer must not be changed or used until the save is waited
+ * Without ATOM_THREADS, the save is done before return (ATOM_SAVE_FSYNC is ignored)
+ *
+ * @param lexer - source of texts, NULL when texts are c-string
+ * @param flags - ATOM_SAVE_FSYNC, ATOM_SAVE_RENAME
+ * @return handle of the save, NULL when the file cannot be opened
+ */
+__atomextern atom_saveasync_t* atom_save_async(atom_lexer_t* lexer, atom_node_t* node, const char* path, int flags);
+
+/**
+ * Check if the save is completed, never block
+ */
+__atomextern atom_bool_t atom_save_poll(atom_saveasync_t* handle);
+
+/**
+ * Wait for the save is completed, then free the handle
+ * @param written - receive number of bytes written, can be NULL
+ * @return ATOM_ERROR_NONE, or error code
+ */
+__atomextern int atom_save_wait(atom_saveasync_t* handle, size_t* written);
+
 __atominline atom_node_t* atom_newlist(atom_text_t name);
 __atominline atom_node_t* atom_newlong(atom_text_t name, atom_long_t value);
 __atominline atom_node_t* atom_newreal(atom_text_t name, atom_real_t value);
@@ -220,6 +454,256 @@ __atomextern atom_bool_t  atom_toreal(const char* text, atom_data_t* value);
 __atomextern size_t       atom_textcpy(atom_lexer_t* lexer, atom_text_t text, char* buffer);
 __atomextern size_t       atom_textcmp(atom_lexer_t* lexer, atom_text_t text, const char* string);
 
+/**
+ * Structural hash of the subtree, cached in nodes until they are touched
+ * Equal subtrees have equal hash, whatever their texts are from lexer or c-string
+ * @param lexer - source of texts, NULL when texts are c-string
+ */
+__atomextern uint64_t     atom_hash(atom_lexer_t* lexer, atom_node_t* node);
+
+/**
+ * Deep copy of node, texts of the copy are owned c-string (ATOM_NODE_CSTR | ATOM_NODE_OWNED)
+ * so the copy no longer depend on the lexer
+ */
+__atomextern atom_node_t* atom_clone(atom_lexer_t* lexer, atom_node_t* node);
+
+/**
+ * Deep compare of two subtrees, from different sources
+ */
+__atomextern atom_bool_t  atom_equal(atom_lexer_t* alexer, atom_node_t* a, atom_lexer_t* blexer, atom_node_t* b);
+
+/**
+ * Compute an edit script that turn a into b, the script is an atom tree:
+ *   (patch
+ *     (delete  (at 1 0))
+ *     (replace (at 2) <node>)
+ *     (insert  (at 0 3) <node>)
+ *     (move    (at 0 4) 1))
+ * Paths are child indices from the root, and refer to the tree as it is
+ * when the edit is applied. Script texts are owned, save it with lexer NULL.
+ *
+ * @return script, NULL when out of memory
+ */
+__atomextern atom_node_t* atom_diff(atom_lexer_t* alexer, atom_node_t* a, atom_lexer_t* blexer, atom_node_t* b);
+
+/**
+ * Apply an edit script to tree, new subtrees are cloned from script
+ * A script that is not well formed change nothing. Paths are checked as the
+ * edits are applied: when one does not match the tree, the edits before it
+ * stay applied. Patch an atom_clone of tree to keep the tree on errors.
+ * @param lexer - source of script texts, NULL for scripts from atom_diff
+ * @return ATOM_ERROR_NONE, ATOM_ERROR_PATCH when script does not match the tree,
+ *         or ATOM_ERROR_ARGUMENTS when tree is read-only
+ */
+__atomextern int          atom_patch(atom_node_t* tree, atom_lexer_t* lexer, atom_node_t* script);
+
+/**
+ * Share structurally identical children lists in tree (hash-consing)
+ * Lists with unique children are left as they are.
+ * A shared list keep its own name, its children are read-only and
+ * borrowed from a holder: lastchild point to the holder, and parent of
+ * the children is the holder. atom_addchild, atom_insertchild, atom_removechild,
+ * atom_patch and atom_find copy the children back before changing or handing
+ * them out (copy-on-write), atom_removechild return the copy of the removed
+ * child in that case. Children read through node->children stay shared and
+ * read-only: call atom_unshare before changing them directly.
+ *
+ * @return number of nodes released, or error code
+ */
+__atomextern int          atom_intern(atom_lexer_t* lexer, atom_node_t* tree);
+__atomextern int          atom_unshare(atom_node_t* node);
+
+/**
+ * Find the first child of list with name
+ * The children of a shared list are copied back first (see atom_intern), so
+ * the result can be changed, renamed or deleted
+ * Lists with at least ATOM_INDEX_THRESHOLD children build a hash index on
+ * the first lookup, after that finding is O(1). The index is kept up to date
+ * by atom_addchild, atom_insertchild, atom_removechild and atom_delete,
+ * call atom_index again after renaming children directly.
+ * @param lexer - source of texts, NULL when texts are c-string
+ */
+__atomextern atom_node_t* atom_find(atom_lexer_t* lexer, atom_node_t* node, const char* name);
+
+/**
+ * Build the children index of list now, instead of on the first lookup
+ * @param recursive - also index all lists in the subtree, whatever their size
+ * @return ATOM_ERROR_NONE, or ATOM_ERROR_OVERFLOW when out of memory
+ */
+__atomextern int          atom_index(atom_lexer_t* lexer, atom_node_t* node, atom_bool_t recursive);
+
+/**
+ * Freeze flags
+ */
+enum
+{
+    ATOM_FREEZE_SORTED = 1 << 0, /* Sort children by name, atom_find use binary search */
+};
+
+/**
+ * Copy tree into a single cache-line aligned block, for read-mostly data
+ * Nodes are in depth-first order and the children of a list are adjacent,
+ * so the i-th child is list->children + i. Names and texts are interned
+ * c-strings in the same block. The frozen tree is read-only, and only its
+ * root can be released with atom_delete. The source tree is not needed
+ * anymore: delete it and call atom_release to give the pool memory back.
+ * @param flags - ATOM_FREEZE_SORTED, or 0 to keep children order
+ * @return frozen tree, NULL when out of memory
+ */
+__atomextern atom_node_t* atom_freeze(atom_lexer_t* lexer, atom_node_t* tree, int flags);
+
+/**
+ * Path query, compiled once and evaluated many times
+ *   metadata/copyright/author - children by name, step by step
+ *   transform/ * /x           - '*' match any child (written without spaces)
+ *   children/prefab[0]        - '[n]' select the n-th match of the step
+ * The first step match the top-level nodes: children of an unnamed root list
+ * (as atom_parse return for many top-level lists), else the root itself
+ */
+typedef struct atom_query atom_query_t;
+
+/**
+ * Compile a path
+ * @return query, NULL when path is invalid or out of memory
+ */
+__atomextern atom_query_t* atom_query_compile(const char* path);
+__atomextern void          atom_query_free(atom_query_t* query);
+
+/**
+ * Find the first match in document order
+ * @param lexer - source of texts, NULL when texts are c-string
+ */
+__atomextern atom_node_t*  atom_query_first(atom_query_t* query, atom_lexer_t* lexer, atom_node_t* tree);
+
+/**
+ * Call callback for each match in document order, stop when it return ATOM_FALSE
+ * @return number of matches visited
+ */
+__atomextern int           atom_query_each(atom_query_t* query, atom_lexer_t* lexer, atom_node_t* tree,
+                                           atom_bool_t (*callback)(void* context, atom_node_t* node), void* context);
+
+/**
+ * Evaluate query directly on the lexer, without building the document
+ * Only matched subtrees are parsed, the others are skipped by bracket matching
+ * Callback own the matched node, and stop the scan when it return ATOM_FALSE
+ * @return number of matches, or error code of the lexer
+ */
+__atomextern int           atom_query_stream(atom_query_t* query, atom_lexer_t* lexer,
+                                             atom_bool_t (*callback)(void* context, atom_node_t* node), void* context);
+
+/**
+ * Parse only the subtrees matched by queries, with their ancestors
+ * Everything else is skipped by bracket matching, no node is created for it
+ * Ancestors keep their names but only the matched children, so '[n]' of
+ * the queries no longer apply to the result
+ * @return projected tree, an empty list when nothing match, NULL on error
+ */
+__atomextern atom_node_t*  atom_parse_projection(atom_lexer_t* lexer, atom_query_t* const* queries, int count);
+__atomextern atom_node_t*  atom_parse_paths(atom_lexer_t* lexer, const char* const* paths, int count);
+
+/**
+ * Aggregation of numbers at a path
+ */
+typedef struct
+{
+    atom_long_t  count;
+    atom_real_t  sum;
+    atom_real_t  min;
+    atom_real_t  max;
+    atom_long_t* histogram; /* Counts of bins, NULL for no histogram */
+    int          bins;
+    atom_real_t  lower;     /* Range of histogram, [lower, upper)    */
+    atom_real_t  upper;
+    atom_long_t  outliers;  /* Numbers out of range of histogram     */
+} atom_aggregate_t;
+
+/**
+ * Reset aggregation, histogram is optional and cleared here
+ */
+__atomextern void          atom_aggregate_init(atom_aggregate_t* aggregate, atom_long_t* histogram, int bins, atom_real_t lower, atom_real_t upper);
+
+/**
+ * Aggregate numbers matched by query directly on the lexer, no node is created
+ * A match give its value (x 1.5), its numbers (x 1 2 3), or is the number itself
+ * Results are added to aggregate, so it can span many documents
+ * @return ATOM_ERROR_NONE, or error code of the lexer
+ */
+__atomextern int           atom_aggregate(atom_query_t* query, atom_lexer_t* lexer, atom_aggregate_t* aggregate);
+
+/**
+ * Column of a table, a field of records in contiguous typed arrays
+ */
+typedef struct
+{
+    char*        path;     /* Path of the field in record, "pos/x"                   */
+    atom_type_t  type;     /* ATOM_LONG, ATOM_REAL or ATOM_TEXT                      */
+    atom_long_t* longs;    /* Values of ATOM_LONG column                             */
+    atom_real_t* reals;    /* Values of ATOM_REAL column                             */
+    int64_t*     offsets;  /* ATOM_TEXT, text i is bytes[offsets[i], offsets[i + 1]) */
+    char*        bytes;
+    size_t       size;     /* Capacity of bytes                                      */
+    char*        valid;    /* 1 when the record has the field, else value is 0/empty */
+} atom_column_t;
+
+/**
+ * Struct-of-arrays of top-level records, one row per record
+ */
+typedef struct
+{
+    atom_column_t* columns;
+    int            count;    /* Number of columns             */
+    int            depth;    /* Max number of steps of paths  */
+    size_t         rows;
+    size_t         capacity; /* Rows allocated in all columns */
+    atom_query_t** queries;  /* Compiled paths of columns     */
+} atom_table_t;
+
+/**
+ * Create a table with the schema: paths of fields in record and their types
+ * A field (x 1.5) give its value, ATOM_REAL columns also take integers,
+ * ATOM_TEXT columns take texts and tokens as they are written
+ */
+__atomextern atom_table_t* atom_table_create(const char* const* paths, const atom_type_t* types, int count);
+
+/**
+ * Create a table with the schema of the first record, lexer cursor is not moved
+ * @return table, NULL when there is no record or out of memory
+ */
+__atomextern atom_table_t* atom_table_infer(atom_lexer_t* lexer);
+__atomextern void          atom_table_free(atom_table_t* table);
+
+/**
+ * Append a row for each top-level list of lexer in a single pass, no node is created
+ * @return ATOM_ERROR_NONE, or error code
+ */
+__atomextern int           atom_table_extract(atom_table_t* table, atom_lexer_t* lexer);
+
+/**
+ * Same as atom_table_extract, the input is split in chunks extracted concurrently
+ * Fallback to single thread when ATOM_THREADS is not defined, or lexer is a stream
+ */
+__atomextern int           atom_table_extract_parallel(atom_table_t* table, atom_lexer_t* lexer, int threads);
+
+/**
+ * Typed reading without nodes, for the code generated by test/atom-schema.c
+ * atom_field_next move to the next field (name ...) of the list at cursor,
+ * or of the document at top level, and copy its name into buffer. Other
+ * items, and fields with longer names than the buffer, are skipped.
+ * After reading the value with atom_field_long, atom_field_real, atom_field_text
+ * or the nested fields with atom_field_next, call atom_field_leave.
+ * @return ATOM_FALSE at the close bracket of the list, or at the end of document
+ */
+__atomextern atom_bool_t   atom_field_next(atom_lexer_t* lexer, char* name, int size, int* length);
+__atomextern void          atom_field_leave(atom_lexer_t* lexer);
+__atomextern atom_bool_t   atom_field_long(atom_lexer_t* lexer, atom_long_t* value);
+__atomextern atom_bool_t   atom_field_real(atom_lexer_t* lexer, atom_real_t* value);
+__atomextern atom_bool_t   atom_field_text(atom_lexer_t* lexer, char* buffer, int size);
+
+/**
+ * Hash of field name, seeded so the generator find a perfect hash for a schema
+ */
+__atominline uint32_t      atom_field_hash(const char* name, int length, uint32_t seed);
+
 __atomextern size_t       atom_getfilesize(FILE* file);
 __atomextern void         atom_print(atom_lexer_t* lexer, atom_node_t* node);
 
@@ -237,8 +721,11 @@ __atominline atom_bool_t atom_istextnull(atom_text_t text)
  */
 __atominline atom_node_t* atom_newlist(atom_text_t name)
 {
-    atom_node_t* node  = atom_create(ATOM_LIST, name);
-    node->data.is_root = ATOM_FALSE;
+    atom_node_t* node = atom_create(ATOM_LIST, name);
+    if (node)
+    {
+        node->data.is_root = ATOM_FALSE;
+    }
     return node;
 }
 
@@ -247,8 +734,11 @@ __atominline atom_node_t* atom_newlist(atom_text_t name)
  */
 __atominline atom_node_t* atom_newlong(atom_text_t name, atom_long_t value)
 {
-    atom_node_t* node  = atom_create(ATOM_LONG, name);
-    node->data.as_long = value;
+    atom_node_t* node = atom_create(ATOM_LONG, name);
+    if (node)
+    {
+        node->data.as_long = value;
+    }
     return node;
 }
 
@@ -257,8 +747,11 @@ __atominline atom_node_t* atom_newlong(atom_text_t name, atom_long_t value)
  */
 __atominline atom_node_t* atom_newreal(atom_text_t name, atom_real_t value)
 {
-    atom_node_t* node  = atom_create(ATOM_REAL, name);
-    node->data.as_real = value;
+    atom_node_t* node = atom_create(ATOM_REAL, name);
+    if (node)
+    {
+        node->data.as_real = value;
+    }
     return node;
 }
 
@@ -267,31 +760,55 @@ __atominline atom_node_t* atom_newreal(atom_text_t name, atom_real_t value)
  */
 __atominline atom_node_t* atom_newtext(atom_text_t name, atom_text_t value)
 {
-    atom_node_t* node  = atom_create(ATOM_TEXT, name);
-    node->data.as_text = value;
+    atom_node_t* node = atom_create(ATOM_TEXT, name);
+    if (node)
+    {
+        node->data.as_text = value;
+    }
     return node;
 }
 
 
+/* @function: atom_field_hash
+ */
+__atominline uint32_t atom_field_hash(const char* name, int length, uint32_t seed)
+{
+    uint32_t hash = 2166136261u ^ seed;
+    for (int i = 0; i < length; i++)
+    {
+        hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+    }
+    return hash ^ (hash >> 15);
+}
+
+
 #ifdef ATOM_IMPL
 #include <ctype.h>
 #include <errno.h>
+#include <limits.h>
+#include <math.h>
 #include <string.h>
 #include <setjmp.h> 
 
+#ifdef ATOM_THREADS
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#endif
+
 /***********************
 * Configurable helper
 ***********************/
 #ifndef atom_assert                             
 #include <assert.h>
-#define atom_assert(exp, msg, ...) assert(exp)
+#define atom_assert(exp, ...) assert(exp)
 #endif
 
 #define __STR__(x) __VAL__(x)
 #define __VAL__(x) #x
 
 #ifdef NDEBUG
-#define atom_lexer_error(l, e) _atomLexerError(l, e)
+#define atom_lexer_error(l, e) _atom_lexer_error(l, e)
 #else
 #define atom_lexer_error(l, e)						                             \
   fprintf(stderr, "Error at:" __FILE__ ":" __STR__(__LINE__) ":%s\n", __func__); \
@@ -300,6 +817,72 @@ __atominline atom_node_t* atom_newtext(atom_text_t name, atom_text_t value)
 
 #define ATOM_BUCKETS 64
 
+#ifdef ATOM_STATS
+#include <time.h>
+
+static atom_stats_t atom_globalstats;
+
+static uint64_t atom_stat_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+#define atom_stat_add(field, n)     (atom_globalstats.field += (n))
+#define atom_stat_begin(start)      uint64_t start = atom_stat_now()
+#define atom_stat_end(field, start) (atom_globalstats.field += atom_stat_now() - (start))
+#else
+#define atom_stat_add(field, n)     ((void)0)
+#define atom_stat_begin(start)      ((void)0)
+#define atom_stat_end(field, start) ((void)0)
+#endif
+
+#ifdef ATOM_TRACE
+#include <time.h>
+
+#ifndef ATOM_TRACE_CAPACITY
+#define ATOM_TRACE_CAPACITY 4096
+#endif
+
+typedef struct
+{
+    const char* name;
+    uint64_t    begin;
+    uint64_t    end;
+    int64_t     arg;
+    char        label[24];
+} atom_traceevent_t;
+
+/**
+ * Events of one thread, only the owner write events and count,
+ * only atom_trace_dump write dumped
+ */
+typedef struct atom_tracering
+{
+    struct atom_tracering* next;
+    int                    thread;
+    size_t                 count;
+    size_t                 dumped;
+    atom_traceevent_t      events[ATOM_TRACE_CAPACITY];
+} atom_tracering_t;
+
+static int                        atom_traceon;
+static int                        atom_tracethreads;
+static atom_tracering_t*          atom_tracerings;
+static __thread atom_tracering_t* atom_tracelocal;
+
+#define atom_trace_start(start)                  uint64_t start = atom_trace_begin()
+#define atom_trace_stop(name, label, start, arg) atom_trace_end(name, label, start, (int64_t)(arg))
+#else
+#define atom_trace_start(start)                  ((void)0)
+#define atom_trace_stop(name, label, start, arg) ((void)0)
+#endif
+
+#ifndef ATOM_CACHELINE
+#define ATOM_CACHELINE 64       /* Alignment of frozen trees, power of 2 */
+#endif
+
 #define atom_isxdigit(c) isxdigit(c)
 #define atom_isalnum(c)  isalnum(c)
 #define atom_isalpha(c)  isalpha(c)
@@ -337,19 +920,40 @@ struct atom_nodepool
     atom_nodepool_t* prev;
     atom_node_t*     node;  
     /* No padding needed */
-} *atom_nodepool = NULL; 
+};
+
+/**
+ * Memory heaps, atom_membuf is the current one
+ */
+static atom_heap_t  atom_globalheap = { NULL, 0, atom_malloc, atom_free, NULL, { 0, 0, 0, 0, 0 } };
+#ifdef ATOM_THREADS
+static __thread atom_heap_t* atom_curheap = &atom_globalheap; /* Each thread makes its own heap current */
+#else
+static atom_heap_t* atom_curheap    = &atom_globalheap;
+#endif
+
+#define atom_membuf (*atom_curheap)
 
 /**
- * Memory buffer
+ * Account bytes of trees allocated from the current heap
  */
-struct
+static void atom_reserve(size_t bytes)
 {
-    void*  data;
-    size_t size;
-    void*  (*extract)(void* data, size_t size);
-    void   (*collect)(void* data, void* pointer); 
-    /* No padding needed */
-} atom_membuf = { NULL, 0, atom_malloc, atom_free };
+    atom_memory_t* memory = &atom_curheap->memory;
+    memory->reserved += bytes;
+    if (memory->reserved > memory->peak)
+    {
+        memory->peak = memory->reserved;
+    }
+}
+
+/**
+ * Account bytes of trees given back to the current heap
+ */
+static void atom_unreserve(size_t bytes)
+{
+    atom_curheap->memory.reserved -= bytes;
+}
 
 /**
 * Allocate node memory, getting from pool or craete new
@@ -357,7 +961,8 @@ struct
 */
 static atom_node_t* atom_newnode(void)
 {
-    if (!atom_nodepool || !atom_nodepool->node)
+    atom_nodepool_t* pool = atom_curheap->nodepool;
+    if (!pool || !pool->node)
     {
         const size_t size = sizeof(atom_nodepool_t) + sizeof(atom_node_t) * ATOM_BUCKETS;
 
@@ -372,16 +977,22 @@ static atom_node_t* atom_newnode(void)
         nodepool->node    = node; /* head node */
         for (int i = 0; i < ATOM_BUCKETS - 1; i++)
         {
-            node->next = node + i;
+            node[i].next = node + i + 1;
         }
-        node->next = NULL; /* tail node */
-
-        nodepool->prev = atom_nodepool;
-        atom_nodepool  = nodepool;
+        node[ATOM_BUCKETS - 1].next = NULL; /* tail node */
+
+        nodepool->prev         = pool;
+        pool                   = nodepool;
+        atom_curheap->nodepool = nodepool;
+        atom_curheap->memory.chunks++;
+        atom_reserve(size);
+        atom_stat_add(refills, 1);
     }
 
-    atom_node_t*   node = atom_nodepool->node;
-    atom_nodepool->node = node->next;
+    atom_node_t* node = pool->node;
+    pool->node        = node->next;
+    atom_curheap->memory.nodes++;
+    atom_stat_add(newnodes, 1);
     return node;
 }
 
@@ -391,10 +1002,13 @@ static atom_node_t* atom_newnode(void)
 */
 static void atom_freenode(atom_node_t* node)
 {
-    if (atom_nodepool && node)
+    atom_nodepool_t* pool = atom_curheap->nodepool;
+    if (pool && node)
     {
-        node->next          = atom_nodepool->node;
-        atom_nodepool->node = node;
+        node->next = pool->node;
+        pool->node = node;
+        atom_curheap->memory.nodes--;
+        atom_stat_add(freenodes, 1);
     }
 }
 
@@ -410,22 +1024,237 @@ void atom_init(void* data, size_t size, void* (*extract)(void*, size_t), void (*
 /* @function: atom_release */
 void atom_release(void)
 {
-    while (atom_nodepool)
+    while (atom_curheap->nodepool)
     {
-        atom_membuf.collect(atom_membuf.data, atom_nodepool);
-        atom_nodepool = atom_nodepool->prev;
+        atom_nodepool_t* nodepool = atom_curheap->nodepool;
+        atom_curheap->nodepool = nodepool->prev;
+        atom_curheap->memory.chunks--;
+        atom_unreserve(sizeof(atom_nodepool_t) + sizeof(atom_node_t) * ATOM_BUCKETS);
+        atom_membuf.collect(atom_membuf.data, nodepool);
     }
 }
 
-
-/* @function: atom_getfilesize */
-size_t atom_getfilesize(FILE* file)
+/* @function: atom_getstats */
+void atom_getstats(atom_stats_t* stats, atom_bool_t reset)
 {
-    atom_assert(file != NULL);
-    fpos_t prev = ftell(file);
-    fseek(file, 0, SEEK_END);
-    size_t size = ftell(file);
-    fsetpos(file, &prev);
+    atom_assert(stats != NULL);
+
+#ifdef ATOM_STATS
+    *stats = atom_globalstats;
+    if (reset)
+    {
+        memset(&atom_globalstats, 0, sizeof(atom_globalstats));
+    }
+#else
+    (void)reset;
+    memset(stats, 0, sizeof(*stats));
+#endif
+}
+
+/* @function: atom_dumpstats */
+void atom_dumpstats(const atom_stats_t* stats, FILE* stream)
+{
+    atom_assert(stats != NULL);
+    atom_assert(stream != NULL);
+
+    fprintf(stream, "bytes:     %zu\n", stats->bytes);
+    fprintf(stream, "tokens:    %zu\n", stats->tokens);
+    fprintf(stream, "nodes:     %zu new, %zu free, %zu refills\n", stats->newnodes, stats->freenodes, stats->refills);
+    fprintf(stream, "fallbacks: %zu\n", stats->fallbacks);
+    fprintf(stream, "seeks:     %zu\n", stats->seeks);
+    fprintf(stream, "lex:       %.3f ms\n", stats->lextime / 1e6);
+    fprintf(stream, "number:    %.3f ms\n", stats->numbertime / 1e6);
+    fprintf(stream, "parse:     %.3f ms", stats->parsetime / 1e6);
+    if (stats->parsetime > 0)
+    {
+        fprintf(stream, ", %.1f MB/s", stats->bytes / (stats->parsetime / 1e3));
+    }
+    fprintf(stream, "\n");
+    fprintf(stream, "save:      %.3f ms\n", stats->savetime / 1e6);
+}
+
+/* @function: atom_trace_enable */
+void atom_trace_enable(atom_bool_t enable)
+{
+#ifdef ATOM_TRACE
+    __atomic_store_n(&atom_traceon, enable ? 1 : 0, __ATOMIC_RELAXED);
+#else
+    (void)enable;
+#endif
+}
+
+/* @function: atom_trace_begin */
+uint64_t atom_trace_begin(void)
+{
+#ifdef ATOM_TRACE
+    if (__atomic_load_n(&atom_traceon, __ATOMIC_RELAXED))
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+    }
+#endif
+    return 0;
+}
+
+/* @function: atom_trace_end */
+void atom_trace_end(const char* name, const char* label, uint64_t begin, int64_t arg)
+{
+#ifdef ATOM_TRACE
+    if (begin == 0)
+    {
+        return;
+    }
+
+    /* First event of thread, push its ring to the list of rings
+     * Rings are not taken from heaps, they live until the process exit
+     */
+    atom_tracering_t* ring = atom_tracelocal;
+    if (!ring)
+    {
+        ring = (atom_tracering_t*)malloc(sizeof(atom_tracering_t));
+        if (!ring)
+        {
+            return; /* @error: Out of memory, event is lost */
+        }
+        ring->count  = 0;
+        ring->dumped = 0;
+        ring->thread = __atomic_add_fetch(&atom_tracethreads, 1, __ATOMIC_RELAXED);
+        ring->next   = __atomic_load_n(&atom_tracerings, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&atom_tracerings, &ring->next, ring, ATOM_TRUE, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        {
+        }
+        atom_tracelocal = ring;
+    }
+
+    /* Previous count must be seen before the slot is written, see atom_trace_dump
+     */
+    size_t             count = ring->count;
+    atom_traceevent_t* event = &ring->events[count % ATOM_TRACE_CAPACITY];
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    event->name  = name;
+    event->begin = begin;
+    event->end   = atom_trace_begin();
+    event->arg   = arg;
+    if (event->end < begin)
+    {
+        event->end = begin; /* Stopped while recording */
+    }
+
+    size_t length = 0;
+    if (label)
+    {
+        while (label[length] && length < sizeof(event->label) - 1)
+        {
+            event->label[length] = label[length];
+            length++;
+        }
+    }
+    event->label[length] = 0;
+
+    __atomic_store_n(&ring->count, count + 1, __ATOMIC_RELEASE);
+#else
+    (void)name;
+    (void)label;
+    (void)begin;
+    (void)arg;
+#endif
+}
+
+#ifdef ATOM_TRACE
+/**
+ * Write JSON string without quotes
+ */
+static void atom_trace_escape(FILE* stream, const char* string)
+{
+    for (; *string; string++)
+    {
+        unsigned char c = (unsigned char)*string;
+        if (c == '"' || c == '\\')
+        {
+            fprintf(stream, "\\%c", c);
+        }
+        else if (c < 0x20)
+        {
+            fprintf(stream, "\\u%04x", c);
+        }
+        else
+        {
+            fputc(c, stream);
+        }
+    }
+}
+#endif
+
+/* @function: atom_trace_dump */
+int atom_trace_dump(FILE* stream, atom_bool_t reset)
+{
+    atom_assert(stream != NULL);
+
+    int count = 0;
+    fprintf(stream, "{\"traceEvents\":[");
+#ifdef ATOM_TRACE
+    atom_tracering_t* ring = __atomic_load_n(&atom_tracerings, __ATOMIC_ACQUIRE);
+    for (; ring; ring = ring->next)
+    {
+        size_t end   = __atomic_load_n(&ring->count, __ATOMIC_ACQUIRE);
+        size_t begin = ring->dumped;
+        if (end - begin > ATOM_TRACE_CAPACITY)
+        {
+            begin = end - ATOM_TRACE_CAPACITY;
+        }
+
+        for (size_t i = begin; i < end; i++)
+        {
+            /* Copy then check that the owner did not write over it meanwhile
+             */
+            atom_traceevent_t event = ring->events[i % ATOM_TRACE_CAPACITY];
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&ring->count, __ATOMIC_RELAXED) >= i + ATOM_TRACE_CAPACITY)
+            {
+                continue;
+            }
+
+            /* Name the event with its label, so slow forms are found by their names
+             */
+            fprintf(stream, "%s\n{\"name\":\"", count > 0 ? "," : "");
+            atom_trace_escape(stream, event.label[0] ? event.label : event.name);
+            fprintf(stream, "\",\"cat\":\"");
+            atom_trace_escape(stream, event.name);
+            fprintf(stream, "\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"arg\":%lld}}",
+                    event.begin / 1e3, (event.end - event.begin) / 1e3, ring->thread, (long long)event.arg);
+            count++;
+        }
+
+        if (reset)
+        {
+            ring->dumped = end;
+        }
+    }
+#else
+    (void)reset;
+#endif
+    fprintf(stream, "\n]}\n");
+    return ferror(stream) ? ATOM_ERROR_IO : count;
+}
+
+/* @function: atom_useheap */
+atom_heap_t* atom_useheap(atom_heap_t* heap)
+{
+    atom_heap_t* prev = atom_curheap;
+    atom_curheap = heap ? heap : &atom_globalheap;
+    return prev;
+}
+
+
+/* @function: atom_getfilesize */
+size_t atom_getfilesize(FILE* file)
+{
+    atom_assert(file != NULL);
+    long prev = ftell(file);
+    fseek(file, 0, SEEK_END);
+    size_t size = ftell(file);
+    fseek(file, prev, SEEK_SET);
     return size;
 }
 
@@ -490,6 +1319,15 @@ static atom_bool_t atom_lexer_iseof(atom_lexer_t* lexer)
     return lexer->cursor >= lexer->length;
 }
 
+/**
+* Seek the stream of a lexer
+*/
+static int atom_lexer_seek(FILE* stream, long offset, int whence)
+{
+    atom_stat_add(seeks, 1);
+    return fseek(stream, offset, whence);
+}
+
 
 
 /**
@@ -503,8 +1341,7 @@ static char atom_lexer_get(atom_lexer_t* lexer, int cursor)
     case ATOM_LEXER_STREAM:
     {
         FILE*  stream = lexer->stream;
-        fpos_t pos = cursor;
-        fsetpos(stream, &pos);
+        atom_lexer_seek(stream, cursor, SEEK_SET);
         return fgetc(stream);
     }
 
@@ -515,6 +1352,7 @@ static char atom_lexer_get(atom_lexer_t* lexer, int cursor)
 
     default:
         atom_assert(0 && "Type of lexer (lexer->type) is invalid");
+        return 0;
     }
 }
 
@@ -536,14 +1374,13 @@ static char atom_lexer_peek(atom_lexer_t* lexer)
     case ATOM_LEXER_STREAM:
     {
         FILE*  stream = lexer->stream;
-        fpos_t cursor = ftell(stream);
+        long   cursor = ftell(stream);
         if (cursor != lexer->cursor)
         {
-            cursor = lexer->cursor;
-            fsetpos(stream, &cursor);
+            atom_lexer_seek(stream, lexer->cursor, SEEK_SET);
         }
         char result = fgetc(stream);
-        fseek(stream, -sizeof(char), SEEK_CUR); /* Go back to cursor */
+        atom_lexer_seek(stream, -(long)sizeof(char), SEEK_CUR); /* Go back to cursor */
         return result;
     }
 
@@ -554,6 +1391,7 @@ static char atom_lexer_peek(atom_lexer_t* lexer)
 
     default:
         atom_assert(0, "Type of lexer (lexer->type) is invalid");
+        return 0;
     }
 }
 
@@ -565,6 +1403,7 @@ static char atom_lexer_next(atom_lexer_t* lexer)
 {
     atom_assert(lexer != NULL);
     lexer->cursor++;
+    atom_stat_add(bytes, 1);
     char c = atom_lexer_peek(lexer);
     if (c == '\n')
     {
@@ -644,6 +1483,226 @@ static void _atom_lexer_error(atom_lexer_t* lexer, int errcode)
 }
 
 
+/**
+* Skip spaces and comments
+*/
+static void atom_lexer_skipblank(atom_lexer_t* lexer)
+{
+    atom_assert(lexer != NULL);
+
+    atom_lexer_skipspace(lexer);
+    while (atom_lexer_peek(lexer) == ';')
+    {
+        atom_lexer_skipcomment(lexer);
+        atom_lexer_skipspace(lexer);
+    }
+}
+
+
+/**
+* Skip the item at cursor without creating nodes: a list with all its content,
+* a text or a token. Brackets in texts and comments are not counted
+*/
+static atom_bool_t atom_lexer_skipitem(atom_lexer_t* lexer)
+{
+    atom_assert(lexer != NULL);
+
+    int  depth = 0;
+    char c     = atom_lexer_peek(lexer);
+    do {
+        switch (c)
+        {
+        case '(':
+        case '[':
+        case '{':
+            depth++;
+            c = atom_lexer_next(lexer);
+            break;
+
+        case ')':
+        case ']':
+        case '}':
+            if (depth == 0)
+            {
+                atom_lexer_error(lexer, ATOM_ERROR_UNEXPECTED);
+                return ATOM_FALSE;
+            }
+            depth--;
+            c = atom_lexer_next(lexer);
+            break;
+
+        case '"':
+            c = atom_lexer_next(lexer);
+            while (c && c != '"')
+            {
+                c = atom_lexer_next(lexer);
+            }
+            if (c != '"')
+            {
+                atom_lexer_error(lexer, ATOM_ERROR_UNTERMINATED);
+                return ATOM_FALSE;
+            }
+            c = atom_lexer_next(lexer);
+            break;
+
+        case ';':
+            atom_lexer_skipcomment(lexer);
+            c = atom_lexer_peek(lexer);
+            break;
+
+        default:
+            if (atom_isspace(c) || atom_ispunct(c))
+            {
+                c = atom_lexer_next(lexer); /* Space, or a separator alone */
+                break;
+            }
+            while (c && !atom_isspace(c) && !atom_ispunct(c))
+            {
+                c = atom_lexer_next(lexer);
+            }
+            break;
+        }
+    } while (depth > 0 && c);
+
+    if (depth > 0)
+    {
+        atom_lexer_error(lexer, ATOM_ERROR_UNBALANCED);
+        return ATOM_FALSE;
+    }
+    return ATOM_TRUE;
+}
+
+
+/**
+* Read the name of a list, cursor is after the open bracket
+* Cursor is not moved when the first item is not a name
+*/
+static atom_bool_t atom_lexer_readname(atom_lexer_t* lexer, atom_text_t* name)
+{
+    atom_assert(lexer != NULL);
+
+    atom_lexer_skipblank(lexer);
+
+    char c = atom_lexer_peek(lexer);
+    if (!c || c == '"' || atom_ispunct(c))
+    {
+        return ATOM_FALSE;
+    }
+
+    atom_stat_begin(lexstart);
+    int   cursor = lexer->cursor;
+    int   line   = lexer->line;
+    int   column = lexer->column;
+    char  text[1024];
+    char* ptr    = text;
+    while (c && !atom_isspace(c) && !atom_ispunct(c))
+    {
+        if (ptr < text + sizeof(text) - 1)
+        {
+            *ptr++ = c;
+        }
+        c = atom_lexer_next(lexer);
+    }
+    *ptr = 0;
+    atom_stat_end(lextime, lexstart);
+
+    /* Numbers are values, not names
+    */
+    atom_data_t value;
+    atom_stat_begin(numberstart);
+    atom_bool_t isnumber = atom_tolong(text, &value);
+    if (!isnumber)
+    {
+        atom_stat_add(fallbacks, 1);
+        isnumber = atom_toreal(text, &value);
+    }
+    atom_stat_end(numbertime, numberstart);
+    if (isnumber)
+    {
+        lexer->cursor = cursor;
+        lexer->line   = line;
+        lexer->column = column;
+        return ATOM_FALSE;
+    }
+
+    name->head = cursor;
+    name->tail = lexer->cursor;
+    atom_stat_add(tokens, 1);
+    return ATOM_TRUE;
+}
+
+
+/**
+* Read a token value, without creating node
+* Cursor is after the token, whatever it's a number or not
+* @return ATOM_LONG, ATOM_REAL, ATOM_NAME for other tokens, ATOM_NONE when no token
+*/
+static atom_type_t atom_lexer_readvalue(atom_lexer_t* lexer, atom_data_t* value)
+{
+    atom_assert(lexer != NULL);
+
+    /* Fit the longest reals in fixed notation, as atom_realcanonical and atom.hpp write them
+    */
+    char  text[384];
+    char* ptr = text;
+    char  c   = atom_lexer_peek(lexer);
+    while (c && !atom_isspace(c) && !atom_ispunct(c))
+    {
+        if (ptr == text + sizeof(text) - 1)
+        {
+            /* Too long to be a number, skip the rest
+            */
+            while (c && !atom_isspace(c) && !atom_ispunct(c))
+            {
+                c = atom_lexer_next(lexer);
+            }
+            return ATOM_NAME;
+        }
+        *ptr++ = c;
+        c = atom_lexer_next(lexer);
+    }
+    *ptr = 0;
+
+    if (ptr == text)
+    {
+        return ATOM_NONE;
+    }
+
+    atom_stat_add(tokens, 1);
+    atom_stat_begin(numberstart);
+    atom_type_t type = ATOM_LONG;
+    if (!atom_tolong(text, value))
+    {
+        atom_stat_add(fallbacks, 1);
+        type = atom_toreal(text, value) ? ATOM_REAL : ATOM_NAME;
+    }
+    atom_stat_end(numbertime, numberstart);
+    return type;
+}
+
+
+/**
+* Read a token as number, without creating node
+*/
+static atom_bool_t atom_lexer_readnumber(atom_lexer_t* lexer, atom_real_t* number)
+{
+    atom_data_t value;
+    switch (atom_lexer_readvalue(lexer, &value))
+    {
+    case ATOM_LONG:
+        *number = (atom_real_t)value.as_long;
+        return ATOM_TRUE;
+
+    case ATOM_REAL:
+        *number = value.as_real;
+        return ATOM_TRUE;
+
+    default:
+        return ATOM_FALSE;
+    }
+}
+
+
 /* @function: atom_create
 */
 atom_node_t* atom_create(atom_type_t type, atom_text_t name)
@@ -656,31 +1715,80 @@ atom_node_t* atom_create(atom_type_t type, atom_text_t name)
         return NULL;
     }
     node->type      = type;
+    node->flags     = 0;
     node->name      = name;
     node->parent    = NULL;
     node->children  = NULL;
     node->lastchild = NULL;
     node->next      = NULL;
     node->prev      = NULL;
+    node->hash      = 0;
+    node->index     = NULL;
     return node;
 }
 
 
+/**
+ * Release owned texts of node
+ */
+static void atom_freetexts(atom_node_t* node)
+{
+    if (node->flags & ATOM_NODE_OWNED)
+    {
+        if (node->name.cstr)
+        {
+            atom_unreserve(strlen(node->name.cstr) + 1);
+            atom_membuf.collect(atom_membuf.data, (void*)node->name.cstr);
+        }
+        if (node->type == ATOM_TEXT && node->data.as_text.cstr)
+        {
+            atom_unreserve(strlen(node->data.as_text.cstr) + 1);
+            atom_membuf.collect(atom_membuf.data, (void*)node->data.as_text.cstr);
+        }
+    }
+    node->flags &= ~ATOM_NODE_OWNED;
+}
+
+
+static void atom_dropshared(atom_node_t* node);
+static void atom_index_add(atom_node_t* node, atom_node_t* child);
+static void atom_index_remove(atom_node_t* node, atom_node_t* child);
+static void atom_freeindex(atom_node_t* node);
+static void atom_frozen_release(atom_node_t* root);
+
 /* @function: atom_delete
 */
 void atom_delete(atom_node_t* node)
 {
     if (node)
     {
+        /* Frozen tree is released at once, from its root
+        */
+        if (node->flags & ATOM_NODE_FROZEN)
+        {
+            atom_assert(node->parent == NULL, "Only root of frozen tree can be deleted");
+            atom_frozen_release(node);
+            return;
+        }
+        atom_assert(!(node->flags & ATOM_NODE_READONLY), "Node is shared or frozen");
+        if (node->flags & ATOM_NODE_READONLY)
+        {
+            return;
+        }
+
         /* Remove from parent
         */
+        if (node->parent && node->parent->index)
+        {
+            atom_index_remove(node->parent, node);
+        }
         if (node->prev)
         {
-            node->prev = node->next;
+            node->prev->next = node->next;
         }
         if (node->next)
         {
-            node->next = node->prev;
+            node->next->prev = node->prev;
         }
         if (node->parent)
         {
@@ -692,22 +1800,29 @@ void atom_delete(atom_node_t* node)
             {
                 node->parent->lastchild = node->prev;
             }
+            atom_touch(node->parent);
         }
 
-        /* Remove children
+        /* Remove children, shared children are only released
         */
-        if (node->type == ATOM_LIST)
+        atom_freeindex(node);
+        if (node->flags & ATOM_NODE_SHARED)
+        {
+            atom_dropshared(node);
+        }
+        else if (node->type == ATOM_LIST)
         {
+            node->hash = 0;
             while (node->children)
             {
-                atom_node_t* next = node->children->next;
+                node->children->flags &= ~ATOM_NODE_READONLY;
                 atom_delete(node->children);
-                node->children = next;
             }
         }
 
         /* Free usage heap memory
         */
+        atom_freetexts(node);
         atom_freenode(node);
     }
 }
@@ -737,16 +1852,23 @@ atom_bool_t atom_tolong(const char* text, atom_data_t* value)
         break;
     }
 
-    value->as_long = 0;
+    /* Out of range of atom_long_t is not a long, it is read as real
+    */
+    uint64_t limit  = sign < 0 ? (uint64_t)INT64_MAX + 1 : (uint64_t)INT64_MAX;
+    uint64_t number = 0;
     while ((c = *ptr++))
     {
         if (!atom_isdigit(c))
         {
             return ATOM_FALSE;
         }
-        value->as_long = value->as_long * 10 + (c - '0');
+        if (number > (limit - (uint64_t)(c - '0')) / 10)
+        {
+            return ATOM_FALSE;
+        }
+        number = number * 10 + (uint64_t)(c - '0');
     }
-    value->as_long *= sign;
+    value->as_long = sign < 0 && number > 0 ? -(atom_long_t)(number - 1) - 1 : (atom_long_t)number;
     return ATOM_TRUE;
 }
 
@@ -758,25 +1880,15 @@ atom_bool_t atom_toreal(const char* text, atom_data_t* value)
     atom_assert(text != NULL && value != NULL);
 
     const char* ptr = text;
-    char c    = *ptr;
-    int  sign = 1;
-    switch (c)
+    char c = *ptr;
+    if (c == '-' || c == '+')
     {
-    case '-':
-        sign = -1;
-        ptr++;
-        break;
-    case '+':
         ptr++;
-        break;
+    }
 
-    default:
-        break;
-    }
-
-    atom_bool_t dotfound  = ATOM_FALSE;
-    atom_real_t precision = 10;
-    value->as_real        = 0.0;
+    /* Only digits with one optional dot, no exponent, hexa, inf or nan
+    */
+    atom_bool_t dotfound = ATOM_FALSE;
     while ((c = *ptr++))
     {
         if (c == '.')
@@ -786,24 +1898,16 @@ atom_bool_t atom_toreal(const char* text, atom_data_t* value)
                 return ATOM_FALSE;
             }
             dotfound = ATOM_TRUE;
-            continue;
         }
         else if (!atom_isdigit(c))
         {
             return ATOM_FALSE;
         }
-
-        if (dotfound)
-        {
-            value->as_real = value->as_real + (c - '0') / precision;
-            precision     *= 10;
-        }
-        else
-        {
-            value->as_real = value->as_real * 10 + (c - '0');
-        }
     }
-    value->as_real *= sign;
+
+    /* Correctly rounded, so shortest round-trip output read back the same bits
+    */
+    value->as_real = strtod(text, NULL);
     return ATOM_TRUE;
 }
 
@@ -823,6 +1927,8 @@ static atom_node_t* atom_readatom(atom_lexer_t* lexer)
         return NULL;
     }
 
+    atom_stat_begin(lexstart);
+    atom_stat_add(tokens, 1);
     char c    = atom_lexer_peek(lexer);
     int  head = lexer->cursor;
     int  tail = head;
@@ -850,6 +1956,7 @@ static atom_node_t* atom_readatom(atom_lexer_t* lexer)
         /* Do the last job to finish read a text
         */
         atom_lexer_next(lexer);
+        atom_stat_end(lextime, lexstart);
         atom_text_t text;
         text.head = head;
         text.tail = tail + 1;
@@ -867,15 +1974,33 @@ static atom_node_t* atom_readatom(atom_lexer_t* lexer)
             c = atom_lexer_next(lexer);
         }
         *ptr++ = 0;
+        atom_stat_end(lextime, lexstart);
+
+        /* A lone separator like ' or , is not a token, and would not move the cursor
+        */
+        if (tail == head)
+        {
+            atom_lexer_error(lexer, ATOM_ERROR_UNEXPECTED);
+            return NULL;
+        }
 
         /* Parsing value of the token
         */
         atom_data_t value;
-        if (atom_tolong(text, &value))
+        atom_stat_begin(numberstart);
+        atom_type_t type = ATOM_LONG;
+        if (!atom_tolong(text, &value))
+        {
+            atom_stat_add(fallbacks, 1);
+            type = atom_toreal(text, &value) ? ATOM_REAL : ATOM_NAME;
+        }
+        atom_stat_end(numbertime, numberstart);
+
+        if (type == ATOM_LONG)
         {
             node = atom_newlong(ATOM_TEXT_NULL, value.as_long);
         }
-        else if (atom_toreal(text, &value))
+        else if (type == ATOM_REAL)
         {
             node = atom_newreal(ATOM_TEXT_NULL, value.as_real);
         }
@@ -888,8 +2013,12 @@ static atom_node_t* atom_readatom(atom_lexer_t* lexer)
         }
     }
 
-    /* Read without error
-    */
+    if (!node)
+    {
+        /* @error: Out of memory
+        */
+        atom_lexer_error(lexer, ATOM_ERROR_OVERFLOW);
+    }
     return node;
 }
 
@@ -903,10 +2032,14 @@ static atom_bool_t atom_list_to_single(atom_node_t* node)
     {
         atom_node_t* children = node->children;
         atom_node_t* lastchild = node->lastchild;
-        if (children && children == lastchild)
+        /* Only a single value collapse to its list, named children and
+         * sub-lists are real children
+         */
+        if (children && children == lastchild && children->type != ATOM_LIST && atom_istextnull(children->name))
         {
             node->type = children->type;
             node->data = children->data;
+            node->hash = 0;
             atom_delete(children);
             node->children = node->lastchild = NULL;
             return ATOM_TRUE;
@@ -957,12 +2090,25 @@ static atom_node_t* atom_readlist(atom_lexer_t* lexer)
                     root->type         = ATOM_LIST;
                     root->data.is_root = ATOM_TRUE;
                 }
+                else if (root->type == ATOM_LIST)
+                {
+                    root->data.is_root = ATOM_FALSE; /* A sub-list, not the list being read */
+                }
             }
             else
             {
                 if (root->type != ATOM_LIST || !root->data.is_root)
                 {
-                    atom_node_t* list  = atom_newlist(ATOM_TEXT_NULL);
+                    atom_node_t* list = atom_newlist(ATOM_TEXT_NULL);
+                    if (!list)
+                    {
+                        /* @error: Out of memory
+                        */
+                        atom_lexer_error(lexer, ATOM_ERROR_OVERFLOW);
+                        atom_delete(node);
+                        atom_delete(root);
+                        return NULL;
+                    }
                     list->data.is_root = ATOM_TRUE;
                     atom_addchild(list, root);
                     root = list;
@@ -984,8 +2130,13 @@ static atom_node_t* atom_readlist(atom_lexer_t* lexer)
         c = atom_lexer_peek(lexer);
     } while (c && c != close && node);
 
-    /* Must be end with ${close} character
+    /* Keep the error of children, then must be end with ${close} character
     */
+    if (lexer->errcode != ATOM_ERROR_NONE)
+    {
+        atom_delete(root);
+        return NULL;
+    }
     if (c != close)
     {
         atom_delete(root);
@@ -1039,6 +2190,23 @@ atom_node_t* atom_read(atom_lexer_t* lexer)
 }
 
 
+#ifdef ATOM_TRACE
+static size_t atom_textread(atom_lexer_t* lexer, atom_text_t text, size_t offset, char* buffer, size_t size);
+
+/**
+ * Record a top-level form, labelled with its name
+ */
+static void atom_trace_form(atom_lexer_t* lexer, atom_node_t* node, uint64_t start, int line)
+{
+    char label[24] = "";
+    if (start && node)
+    {
+        label[atom_textread(lexer, node->name, 0, label, sizeof(label) - 1)] = 0;
+    }
+    atom_trace_end("form", label, start, line);
+}
+#endif
+
 /**
 * Parse lexer data to atom
 */
@@ -1046,12 +2214,21 @@ atom_node_t* atom_parse(atom_lexer_t* lexer)
 {
     atom_assert(lexer != NULL);
 
+    atom_stat_begin(parsestart);
+    atom_trace_start(tracestart);
     atom_node_t* root = NULL;
     atom_node_t* node = NULL;
     atom_lexer_skipspace(lexer);
     while (!atom_lexer_iseof(lexer))
     {
+#ifdef ATOM_TRACE
+        int      formline  = lexer->line;
+        uint64_t formstart = atom_trace_begin();
+        node = atom_read(lexer);
+        atom_trace_form(lexer, node, formstart, formline);
+#else
         node = atom_read(lexer);
+#endif
 
         /* NULL pointer handling
         */
@@ -1061,6 +2238,8 @@ atom_node_t* atom_parse(atom_lexer_t* lexer)
             if (lexer->errcode != ATOM_ERROR_NONE)
             {
                 atom_delete(node);
+                atom_stat_end(parsetime, parsestart);
+                atom_trace_stop("parse", NULL, tracestart, lexer->errcode);
                 return NULL;
             }
             if (atom_lexer_iseof(lexer))
@@ -1075,12 +2254,27 @@ atom_node_t* atom_parse(atom_lexer_t* lexer)
         if (!root)
         {
             root = node;
+            if (root->type == ATOM_LIST)
+            {
+                root->data.is_root = ATOM_FALSE; /* Next top-level nodes are not its children */
+            }
         }
         else
         {
             if (root->type != ATOM_LIST || !root->data.is_root)
             {
-                atom_node_t* list  = atom_newlist(ATOM_TEXT_NULL);
+                atom_node_t* list = atom_newlist(ATOM_TEXT_NULL);
+                if (!list)
+                {
+                    /* @error: Out of memory
+                    */
+                    atom_lexer_error(lexer, ATOM_ERROR_OVERFLOW);
+                    atom_delete(node);
+                    atom_delete(root);
+                    atom_stat_end(parsetime, parsestart);
+                    atom_trace_stop("parse", NULL, tracestart, lexer->errcode);
+                    return NULL;
+                }
                 list->data.is_root = ATOM_TRUE;
                 atom_addchild(list, root);
                 root = list;
@@ -1089,474 +2283,479 @@ atom_node_t* atom_parse(atom_lexer_t* lexer)
         }
     }
     atom_list_to_single(root);
+    atom_stat_end(parsetime, parsestart);
+    atom_trace_stop("parse", NULL, tracestart, lexer->cursor);
     return root;
 }
 
-static size_t atom_totext(atom_node_t* node, char* text, size_t size)
+/**
+ * Lexer to read texts of node, NULL when texts of node are c-string
+ */
+static atom_lexer_t* atom_nodelexer(atom_lexer_t* lexer, atom_node_t* node)
 {
-    atom_assert(node != NULL);
-    atom_assert(text != NULL && size > 0);
+    return (node->flags & ATOM_NODE_CSTR) ? NULL : lexer;
+}
 
-    static int stack = 0;
-    size_t result = 0;
-    for (int i = 0; i < stack * 2; i++)
+/**
+ * Check if node has a name, lexer is the one from atom_nodelexer
+ */
+static atom_bool_t atom_hasname(atom_lexer_t* lexer, atom_node_t* node)
+{
+    return lexer ? !atom_istextnull(node->name) : node->name.cstr != NULL;
+}
+
+/**
+ * Length of a text, from lexer or c-string
+ */
+static size_t atom_textlength(atom_lexer_t* lexer, atom_text_t text)
+{
+    if (!lexer)
     {
-        *text++ = ' ';
-        result++;
+        return text.cstr ? strlen(text.cstr) : 0;
     }
+    return text.tail > text.head ? (size_t)(text.tail - text.head) : 0;
+}
 
-    if (node->type == ATOM_LIST)
+/**
+ * Read a part of text into buffer, from lexer or c-string
+ * @return number of bytes read
+ */
+static size_t atom_textread(atom_lexer_t* lexer, atom_text_t text, size_t offset, char* buffer, size_t size)
+{
+    size_t length = atom_textlength(lexer, text);
+    if (offset >= length)
     {
-        stack++;
-        char* tptr = text;
-        atom_node_t* child = node->children;
+        return 0;
+    }
+    if (size > length - offset)
+    {
+        size = length - offset;
+    }
 
-        /* Write name to text
-        */
-        *tptr++ = '(';
-        result++;
+    if (!lexer)
+    {
+        memcpy(buffer, text.cstr + offset, size);
+        return size;
+    }
 
-        if (node->name.cstr)
-        {
-            /* Open list with '(' character
-            * We not use '[' or '{', but it's still valid in using
-            * and hand-edit
-            */
-            int count = (int)(strcpy(tptr, node->name.cstr) - tptr); 
-            tptr   += count;
-            *tptr++ = ' ';
-            result += count;
-        }
+    switch (lexer->type)
+    {
+    case ATOM_LEXER_STRING:
+        memcpy(buffer, lexer->string + text.head + offset, size);
+        return size;
 
-        /* Write children values
-        */
-        while (child)
-        {
-            *tptr++ = '\n';
-            result++;
-            /* Get child value
-            */
-            size_t count = atom_totext(child, tptr, size - result);
-            child   = child->next;
-            tptr   += count;
-            result += count;
-            if (child)
-            {
-                *tptr++ = ' '; /* Must have a separator */
-                result++;
-            }
-        }
+    case ATOM_LEXER_STREAM:
+        atom_lexer_seek(lexer->stream, text.head + (long)offset, SEEK_SET);
+        return fread(buffer, 1, size, lexer->stream);
 
-        /* Close list
-        */ 
-        *tptr++ = ')';
-        result++;
-        stack--;
+    default:
+        return 0;
     }
-    else
+}
+
+/**
+ * Buffered writer, all serializers go through this
+ * Texts are read from lexer when it's available, else they are c-string
+ */
+typedef struct atom_writer atom_writer_t;
+struct atom_writer
+{
+    atom_lexer_t* lexer;
+    char*         buffer;
+    size_t        length;      /* Used bytes in buffer      */
+    size_t        capacity;    /* Size of buffer            */
+    size_t        count;       /* Total bytes written       */
+    int           depth;       /* Indentation level         */
+    int           flags;
+    int           errcode;
+
+    /* Called when the buffer is full, NULL mean fixed-size buffer
+     */
+    int         (*flush)(atom_writer_t* writer, size_t needed);
+    void*         context;
+};
+
+#define ATOM_WRITER_CAPACITY  4096
+#define ATOM_WRITER_CANONICAL (1 << 0)
+
+/**
+ * Flush writer buffer to FILE* in context
+ */
+static int atom_writer_flushstream(atom_writer_t* writer, size_t needed)
+{
+    (void)needed;
+    if (writer->length > 0)
     {
-        if (node->name.cstr)
+        atom_trace_start(tracestart);
+        if (fwrite(writer->buffer, writer->length, 1, (FILE*)writer->context) != 1)
         {
-            *text++ = '(';
-            result++;      
+            return ATOM_ERROR_IO;
+        }
+        atom_trace_stop("write", NULL, tracestart, writer->length);
+        writer->length = 0;
+    }
+    return ATOM_ERROR_NONE;
+}
 
-            int count = (int)(strcpy(text, node->name.cstr) - text);
-            text   += count;
-            *text++ = ' ';
-            result += count;
+/**
+ * Make sure writer have enough space for next ${size} bytes
+ */
+static atom_bool_t atom_writer_reserve(atom_writer_t* writer, size_t size)
+{
+    if (writer->errcode != ATOM_ERROR_NONE)
+    {
+        return ATOM_FALSE;
+    }
 
-            *text++ = ' ';
-            result++;
+    if (writer->length + size > writer->capacity)
+    {
+        if (!writer->flush)
+        {
+            writer->errcode = ATOM_ERROR_OVERFLOW;
+            return ATOM_FALSE;
         }
 
-        switch (node->type)
-        {
-        case ATOM_LONG:
+        int errcode = writer->flush(writer, size);
+        if (errcode != ATOM_ERROR_NONE)
         {
-            size_t count = sprintf(text, "%ld", node->data.as_long);
-            result += count;
-            text   += count;
-        } break;
+            writer->errcode = errcode;
+            return ATOM_FALSE;
+        }
+    }
+    return ATOM_TRUE;
+}
 
-        case ATOM_REAL:
+/**
+ * Write a sequence of bytes, split by the buffer capacity when needed
+ */
+static void atom_writer_write(atom_writer_t* writer, const char* data, size_t size)
+{
+    while (size > 0)
+    {
+        if (writer->length + size > writer->capacity && !atom_writer_reserve(writer, size))
         {
-            size_t count = sprintf(text, "%lf", node->data.as_real);
-            result += count;
-            text   += count;
-        } break;
-
-        case ATOM_TEXT:
-            result++;
-            *text++ = '\"';    
-
-            int count = (int)(strcpy(text, node->data.as_text.cstr) - text);
-            text   += count;
-            result += count;
-            
-            result++;
-            *text++ = '\"';
-            break;
-
-        default:
-            break;
+            return;
         }
 
-        if (node->name.cstr)
+        size_t count = writer->capacity - writer->length;
+        if (count > size)
         {
-            *text++ = ')';
-            result++;
+            count = size;
         }
+        memcpy(writer->buffer + writer->length, data, count);
+        writer->length += count;
+        writer->count  += count;
+        data           += count;
+        size           -= count;
     }
-    return result;
 }
 
-/* @function: atom_totext_with_lexer */
-static size_t atom_totext_with_lexer(atom_lexer_t* lexer, atom_node_t* node, char* text, size_t size)
+/**
+ * Write a single character
+ */
+static void atom_writer_putc(atom_writer_t* writer, char c)
 {
-    atom_assert(node != NULL);
-    atom_assert(text != NULL && size > 0);
-
-
-    static int stack = 0;
-    size_t result = 0;
-    for (int i = 0; i < stack * 2; i++)
+    if (writer->length < writer->capacity || atom_writer_reserve(writer, 1))
     {
-        *text++ = ' ';
-        result++;
+        writer->buffer[writer->length++] = c;
+        writer->count++;
     }
+}
 
-    if (node->type == ATOM_LIST)
+/**
+ * Write indentation of current depth
+ */
+static void atom_writer_indent(atom_writer_t* writer)
+{
+    static const char spaces[] = "                                ";
+    size_t count = (size_t)writer->depth * 2;
+    while (count > 0)
     {
-        stack++;
-        char* tptr = text;
-        atom_node_t* child = node->children;
-        /* Write name to text
-        */
-        //if (!atomIsRoot(node) || !node->name)
-        *tptr++ = '(';
-        result++;
-        if (!atom_istextnull(node->name))
-        {
-            /* Open list with '(' character
-            * We not use '[' or '{', but it's still valid in using
-            * and hand-edit
-            */
-            atom_text_t name = node->name;
-            for (int i = name.head; i <= name.tail; i++)
-            {
-                *tptr++ = atom_lexer_get(lexer, i);
-                result++;
-            }
-            *tptr++ = ' ';
-            result++;
-        }
+        size_t n = count < sizeof(spaces) - 1 ? count : sizeof(spaces) - 1;
+        atom_writer_write(writer, spaces, n);
+        count -= n;
+    }
+}
 
-        /* Write children values
-        */
-        while (child)
+/**
+ * Write a text of node, from lexer or c-string
+ */
+static void atom_writer_text(atom_writer_t* writer, atom_node_t* node, atom_text_t text)
+{
+    atom_lexer_t* lexer = atom_nodelexer(writer->lexer, node);
+    if (!lexer)
+    {
+        if (text.cstr)
         {
-            *tptr++ = '\n';
-            result++;
-            /* Get child value
-            */
-            size_t count = atom_totext_with_lexer(lexer, child, tptr, size - result);
-            child   = child->next;
-            tptr   += count;
-            result += count;
-            if (child)
-            {
-                *tptr++ = ' '; /* Must have a separator */
-                result++;
-            }
+            atom_writer_write(writer, text.cstr, strlen(text.cstr));
         }
-        /* Close list
-        */ 
-        //if (!atomIsRoot(node) || !node->name)
-        *tptr++ = ')';
-        result++;
-        stack--;
+        return;
     }
-    else
+
+    if (text.tail <= text.head)
+    {
+        return;
+    }
+
+    switch (lexer->type)
+    {
+    case ATOM_LEXER_STRING:
+        atom_writer_write(writer, lexer->string + text.head, (size_t)(text.tail - text.head));
+        break;
+
+    case ATOM_LEXER_STREAM:
     {
-        if (!atom_istextnull(node->name))
+        char   chunk[256];
+        size_t total = (size_t)(text.tail - text.head);
+        atom_lexer_seek(lexer->stream, text.head, SEEK_SET);
+        while (total > 0)
         {
-            *text++ = '(';
-            result++;
-            for (int i = node->name.head; i <= node->name.tail; i++)
+            size_t count = fread(chunk, 1, total < sizeof(chunk) ? total : sizeof(chunk), lexer->stream);
+            if (count == 0)
             {
-                result++;
-                *text++ = atom_lexer_get(lexer, i);
+                break;
             }
-            *text++ = ' ';
-            result++;
+            atom_writer_write(writer, chunk, count);
+            total -= count;
         }
+    } break;
 
-        switch (node->type)
-        {
-        case ATOM_LONG:
-        {
-            size_t count = sprintf(text, "%ld", node->data.as_long);
-            result += count;
-            text   += count;
-        } break;
+    default:
+        break;
+    }
+}
 
-        case ATOM_REAL:
-        {
-            size_t count = sprintf(text, "%lf", node->data.as_real);
-            result += count;
-            text   += count;
-        } break;
+/**
+ * Check if node has a name, depend on texts source
+ */
+static atom_bool_t atom_writer_hasname(atom_writer_t* writer, atom_node_t* node)
+{
+    return atom_hasname(atom_nodelexer(writer->lexer, node), node);
+}
 
-        case ATOM_TEXT:
-            result++;
-            *text++ = '\"';
-            for (int i = node->data.as_text.head,
-                n = node->data.as_text.tail;
-                i <= n; i++)
-            {
-                result++;
-                *text++ = atom_lexer_get(lexer, i);
-            }
-            result++;
-            *text++ = '\"';
-            break;
+/**
+ * Format real number in shortest fixed notation that read back the same value
+ * Fixed notation because atom_toreal don't support exponent
+ */
+static int atom_realcanonical(atom_real_t value, char* buffer, size_t size)
+{
+    if (value == 0.0)
+    {
+        return snprintf(buffer, size, "0.0"); /* Also normalize -0.0 */
+    }
 
-        default:
+    int count = 0;
+    for (int precision = 1; precision <= 340; precision++)
+    {
+        count = snprintf(buffer, size, "%.*f", precision, value);
+        if (count < 0 || (size_t)count >= size || strtod(buffer, NULL) == value)
+        {
             break;
         }
+    }
+    return count;
+}
+
+/**
+ * Write a value of node, without name
+ */
+static void atom_writer_value(atom_writer_t* writer, atom_node_t* node)
+{
+    char number[64];
+    switch (node->type)
+    {
+    case ATOM_LONG:
+    {
+        int count = snprintf(number, sizeof(number), "%lld", (long long)node->data.as_long);
+        atom_writer_write(writer, number, (size_t)count);
+    } break;
 
-        if (!atom_istextnull(node->name))
+    case ATOM_REAL:
+        if (writer->flags & ATOM_WRITER_CANONICAL)
         {
-            *text++ = ')';
-            result++;
+            char real[384];
+            int  count = atom_realcanonical(node->data.as_real, real, sizeof(real));
+            atom_writer_write(writer, real, (size_t)count);
         }
+        else
+        {
+            int count = snprintf(number, sizeof(number), "%lf", node->data.as_real);
+            atom_writer_write(writer, number, (size_t)count);
+        }
+        break;
+
+    case ATOM_TEXT:
+        atom_writer_putc(writer, '\"');
+        atom_writer_text(writer, node, node->data.as_text);
+        atom_writer_putc(writer, '\"');
+        break;
+
+    default:
+        break;
     }
-    return result;
 }
 
-
-/* @function: atom_save_stream */
-int atom_save_stream(atom_node_t* node, FILE* stream)
+/**
+ * Write the node and its children, indentation of node itself is written by caller
+ */
+static void atom_writer_node(atom_writer_t* writer, atom_node_t* node)
 {
     atom_assert(node != NULL);
-    atom_assert(stream != NULL);
-
-    static int stack = 0;
-    int result = 0;
-    for (int i = 0; i < stack; i += 2)
-    {
-        fputc(' ', stream);
-        fputc(' ', stream);
-        result += 2;
-    }
 
     if (node->type == ATOM_LIST)
     {
-        stack++;
-        atom_node_t* child = node->children;
-        /* Write name to text
-        */
-        fputc('(', stream);
-        result++;
-        if (node->name.cstr)
+        /* Open list with '(' character
+         * We not use '[' or '{', but it's still valid in using
+         * and hand-edit
+         */
+        atom_writer_putc(writer, '(');
+        if (atom_writer_hasname(writer, node))
         {
-            /* Open list with '(' character
-            * We not use '[' or '{', but it's still valid in using
-            * and hand-edit
-            */
-            result += fputs(node->name.cstr, stream); 
-            fputc(' ', stream);
-            result++;
+            atom_writer_text(writer, node, node->name);
+            if (!(writer->flags & ATOM_WRITER_CANONICAL))
+            {
+                atom_writer_putc(writer, ' ');
+            }
         }
 
         /* Write children values
-        */
-        while (child)
+         */
+        writer->depth++;
+        for (atom_node_t* child = node->children; child; child = child->next)
         {
-            fputc('\n', stream);
-            result++;
-            /* Get child value
-            */
-            int count = atom_save_stream(child, stream);
-            child   = child->next;
-            result += count;
-            if (child)
+            if (writer->flags & ATOM_WRITER_CANONICAL)
             {
-                fputc(' ', stream);
-                result++;
+                if (child != node->children || atom_writer_hasname(writer, node))
+                {
+                    atom_writer_putc(writer, ' ');
+                }
+                atom_writer_node(writer, child);
+                continue;
             }
-        }
-        /* Close list
-        */ 
-        fputc(')', stream);
-        result++;
-        stack--;
+
+            atom_writer_putc(writer, '\n');
+            atom_writer_indent(writer);
+            atom_writer_node(writer, child);
+            if (child->next)
+            {
+                atom_writer_putc(writer, ' '); /* Must have a separator */
+            }
+        }
+        writer->depth--;
+
+        /* Close list
+         */
+        atom_writer_putc(writer, ')');
+    }
+    else if (node->type == ATOM_NAME)
+    {
+        atom_writer_text(writer, node, node->name);
     }
     else
     {
-        if (node->name.cstr)
+        atom_bool_t hasname = atom_writer_hasname(writer, node);
+        if (hasname)
         {
-            fputc('(', stream);
-            result++; 
-            result += fputs(node->name.cstr, stream);
-            fputc(' ', stream);
-            result++;
+            atom_writer_putc(writer, '(');
+            atom_writer_text(writer, node, node->name);
+            atom_writer_putc(writer, ' ');
         }
 
-        switch (node->type)
-        {
-        case ATOM_LONG:
-        {
-            size_t count = fprintf(stream, "%ld", node->data.as_long);
-            result += count;
-        } break;
+        atom_writer_value(writer, node);
 
-        case ATOM_REAL:
+        if (hasname)
         {
-            size_t count = fprintf(stream, "%lf", node->data.as_real);
-            result += count;
-        } break;
-
-        case ATOM_TEXT:
-            result++;
-            fputc('\"', stream);
-            result += fputs(node->data.as_text.cstr, stream) + 1;
-            fputc('\"', stream);
-            break;
-
-        default:
-            break;
-        }
-
-        if (node->name.cstr)
-        {              
-            fputc(')', stream);
-            result++;
+            atom_writer_putc(writer, ')');
         }
     }
-
-    return result;
 }
 
-/* @function: atom_save_stream_with_lexer */
-int atom_save_stream_with_lexer(atom_lexer_t* lexer, atom_node_t* node, FILE* stream)
+/**
+ * Serialize node to stream through a stack buffer
+ */
+static int atom_writer_savestream(atom_lexer_t* lexer, atom_node_t* node, FILE* stream, int flags, size_t* written)
 {
-    atom_assert(node != NULL);
-    atom_assert(stream != NULL);
-
-    static int stack = 0;
-    int result = 0;
-    for (int i = 0; i < stack; i += 2)
+    char buffer[ATOM_WRITER_CAPACITY];
+
+    atom_writer_t writer;
+    memset(&writer, 0, sizeof(writer));
+    writer.lexer    = lexer;
+    writer.buffer   = buffer;
+    writer.capacity = sizeof(buffer);
+    writer.flags    = flags;
+    writer.flush    = atom_writer_flushstream;
+    writer.context  = stream;
+
+    atom_stat_begin(savestart);
+    atom_trace_start(tracestart);
+    atom_writer_node(&writer, node);
+    if (writer.errcode == ATOM_ERROR_NONE)
     {
-        fputc(' ', stream);
-        fputc(' ', stream);
-        result += 2;
+        writer.errcode = atom_writer_flushstream(&writer, 0);
     }
-
-    if (node->type == ATOM_LIST)
+    atom_stat_end(savetime, savestart);
+    atom_trace_stop("save", NULL, tracestart, writer.count);
+    if (written)
     {
-        stack++;
-        atom_node_t* child = node->children;
-        /* Write name to text
-        */
-        fputc('(', stream);
-        result++;
-        if (!atom_istextnull(node->name))
-        {
-            /* Open list with '(' character
-            * We not use '[' or '{', but it's still valid in using
-            * and hand-edit
-            */
-            atom_text_t name = node->name;
-            for (int i = name.head; i <= name.tail; i++)
-            {
-                fputc(atom_lexer_get(lexer, i), stream);
-                result++;
-            }
-            fputc(' ', stream);
-            result++;
-        }
-
-        /* Write children values
-        */
-        while (child)
-        {
-            fputc('\n', stream);
-            result++;
-            /* Get child value
-            */
-            int count = atom_save_stream(child, stream);
-            child   = child->next;
-            result += count;
-            if (child)
-            {
-                fputc(' ', stream);
-                result++;
-            }
-        }
-        /* Close list
-        */ 
-        fputc(')', stream);
-        result++;
-        stack--;
+        *written = writer.count;
     }
-    else
-    {
-        if (!atom_istextnull(node->name))
-        {
-            fputc('(', stream);
-            result++;                               
-            atom_text_t name = node->name;
-            for (int i = name.head; i <= name.tail; i++)
-            {
-                fputc(atom_lexer_get(lexer, i), stream);
-                result++;
-            }
-            fputc(' ', stream);
-            result++;
-        }
-
-        switch (node->type)
-        {
-        case ATOM_LONG:
-        {
-            size_t count = fprintf(stream, "%ld", node->data.as_long);
-            result += count;
-        } break;
+    return writer.errcode;
+}
 
-        case ATOM_REAL:
-        {
-            size_t count = fprintf(stream, "%lf", node->data.as_real);
-            result += count;
-        } break;
+/**
+ * Number of bytes written or error code, for the save functions returning int
+ */
+static int atom_writer_result(int errcode, size_t written)
+{
+    if (errcode != ATOM_ERROR_NONE)
+    {
+        return errcode;
+    }
+    return written > INT_MAX ? INT_MAX : (int)written;
+}
 
-        case ATOM_TEXT:
-            result++;
-            fputc('\"', stream);
-            
-            atom_text_t text = node->data.as_text;
-            for (int i = text.head; i <= text.tail; i++)
-            {
-                fputc(atom_lexer_get(lexer, i), stream);
-                result++;
-            }
+/**
+ * Serialize node to fixed-size string, always zero-terminated
+ */
+static int atom_writer_savestring(atom_lexer_t* lexer, atom_node_t* node, char* string, size_t length, int flags)
+{
+    atom_writer_t writer;
+    memset(&writer, 0, sizeof(writer));
+    writer.lexer    = lexer;
+    writer.buffer   = string;
+    writer.capacity = length - 1; /* Reserved for zero-terminated */
+    writer.flags    = flags;
+
+    atom_stat_begin(savestart);
+    atom_trace_start(tracestart);
+    atom_writer_node(&writer, node);
+    string[writer.length] = 0;
+    atom_stat_end(savetime, savestart);
+    atom_trace_stop("save", NULL, tracestart, writer.length);
+    return writer.errcode;
+}
 
-            result++;
-            fputc('\"', stream);
-            break;
+/* @function: atom_save_stream */
+int atom_save_stream(atom_node_t* node, FILE* stream)
+{
+    atom_assert(node != NULL);
+    atom_assert(stream != NULL);
 
-        default:
-            break;
-        }
+    size_t written = 0;
+    int    errcode = atom_writer_savestream(NULL, node, stream, 0, &written);
+    return atom_writer_result(errcode, written);
+}
 
-        if (!atom_istextnull(node->name))
-        {              
-            fputc(')', stream);
-            result++;
-        }
-    }
+/* @function: atom_save_stream_with_lexer */
+int atom_save_stream_with_lexer(atom_lexer_t* lexer, atom_node_t* node, FILE* stream)
+{
+    atom_assert(lexer != NULL);
+    atom_assert(node != NULL);
+    atom_assert(stream != NULL);
 
-    return result;
+    size_t written = 0;
+    int    errcode = atom_writer_savestream(lexer, node, stream, 0, &written);
+    return atom_writer_result(errcode, written);
 }
 
 /* @function: atom_save_string */
@@ -1567,10 +2766,7 @@ int atom_save_string(atom_node_t* node, char* string, size_t length)
         return ATOM_ERROR_ARGUMENTS;
     }
 
-    atom_assert(string != NULL && length > 0);
-    size_t count = atom_totext(node, string, length);
-    string[count] = 0;
-    return ATOM_ERROR_NONE;
+    return atom_writer_savestring(NULL, node, string, length, 0);
 }
 
 /* @function: atom_save_string_with_lexer */
@@ -1583,148 +2779,4912 @@ int atom_save_string_with_lexer(atom_lexer_t* lexer, atom_node_t* node, char* st
         return ATOM_ERROR_ARGUMENTS;
     }
 
-    atom_assert(string != NULL && length > 0);
-    size_t count = atom_totext_with_lexer(lexer, node, string, length);
-    string[count] = 0;
-    return ATOM_ERROR_NONE;
+    return atom_writer_savestring(lexer, node, string, length, 0);
 }
 
-/* @function: atomAddChild
-*/
-void atom_addchild(atom_node_t* node, atom_node_t* child)
+/* @function: atom_save_canonical */
+int atom_save_canonical(atom_lexer_t* lexer, atom_node_t* node, FILE* stream)
 {
     atom_assert(node != NULL);
-    child->parent = node;
+    atom_assert(stream != NULL);
 
-    if (child->type == ATOM_LIST)
+    size_t written = 0;
+    int    errcode = atom_writer_savestream(lexer, node, stream, ATOM_WRITER_CANONICAL, &written);
+    return atom_writer_result(errcode, written);
+}
+
+/* @function: atom_save_canonical_string */
+int atom_save_canonical_string(atom_lexer_t* lexer, atom_node_t* node, char* string, size_t length)
+{
+    if (!node || !string || length == 0)
     {
-        child->data.is_root = ATOM_FALSE;
+        return ATOM_ERROR_ARGUMENTS;
     }
 
-    if (node->lastchild)
+    return atom_writer_savestring(lexer, node, string, length, ATOM_WRITER_CANONICAL);
+}
+
+#ifdef ATOM_THREADS
+/**
+ * Grow writer buffer, the buffer memory is owned by writer
+ * Workers of atom_save_parallel grow it, so it come from malloc: the current
+ * heap is per thread, and need not be thread-safe
+ */
+static int atom_writer_grow(atom_writer_t* writer, size_t needed)
+{
+    size_t capacity = writer->capacity > 0 ? writer->capacity : ATOM_WRITER_CAPACITY;
+    while (capacity < writer->length + needed)
     {
-        child->prev     = node->lastchild; 
-        node->lastchild = node->lastchild->next = child;
+        capacity *= 2;
     }
-    else
+
+    char* buffer = (char*)realloc(writer->buffer, capacity);
+    if (!buffer)
     {
-        node->lastchild = node->children        = child;
+        /* @error: out of memory */
+        return ATOM_ERROR_OVERFLOW;
+    }
+    writer->buffer   = buffer;
+    writer->capacity = capacity;
+    return ATOM_ERROR_NONE;
+}
+
+/**
+ * Release memory owned by writer
+ */
+static void atom_writer_free(atom_writer_t* writer)
+{
+    if (writer->flush == atom_writer_grow && writer->buffer)
+    {
+        free(writer->buffer);
     }
+    writer->buffer   = NULL;
+    writer->length   = 0;
+    writer->capacity = 0;
 }
 
+/**
+ * A range of children, serialized by one worker into its own buffer
+ */
+typedef struct
+{
+    atom_node_t*  first;
+    int           count;
+    atom_bool_t   done;
+    atom_writer_t writer;
+} atom_savechunk_t;
 
-/* @function: atom_print
-*/
-void atom_print(atom_lexer_t* lexer, atom_node_t* node)
+/**
+ * Shared state of parallel serializing
+ */
+typedef struct
 {
-    static const char* types[] = {
-        "ATOM_NONE",
-        "ATOM_LIST",
-        "ATOM_LONG",
-        "ATOM_REAL",
-        "ATOM_TEXT",
-        "ATOM_NAME",
-    };
+    atom_savechunk_t* chunks;
+    int               count;
+    int               taken;     /* Next chunk to serialize     */
+    int               written;   /* Next chunk to write out     */
+    int               lookahead; /* Max chunks ahead of written */
+    int               depth;
+    atom_lexer_t*     lexer;
+    pthread_mutex_t   mutex;
+    pthread_cond_t    cond;
+} atom_savejob_t;
 
-    static int stack = 0;
-    if (node)
+/**
+ * Worker of parallel serializing
+ * Take chunks in order, but don't run too far from the writing one,
+ * that keep memory usage bounded
+ */
+static void* atom_savejob_worker(void* arg)
+{
+    atom_savejob_t* job = (atom_savejob_t*)arg;
+    while (ATOM_TRUE)
     {
-        for (int i = 0; i < stack; i++)
+        pthread_mutex_lock(&job->mutex);
+        while (job->taken < job->count && job->taken >= job->written + job->lookahead)
         {
-            fputc(' ', stdout);
+            pthread_cond_wait(&job->cond, &job->mutex);
         }
+        int index = job->taken < job->count ? job->taken++ : -1;
+        pthread_mutex_unlock(&job->mutex);
 
-        fputs(types[node->type], stdout);
-        fputs(" - ", stdout);
-        for (int i = node->name.head; i <= node->name.tail; i++)
+        if (index < 0)
         {
-            fputc(atom_lexer_get(lexer, i), stdout);
+            break;
         }
 
-        switch (node->type)
+        /* Each child start with newline and indentation, and separated by space
+         * Same layout as atom_writer_node do
+         */
+        atom_savechunk_t* chunk  = &job->chunks[index];
+        atom_writer_t*    writer = &chunk->writer;
+        memset(writer, 0, sizeof(*writer));
+        writer->lexer = job->lexer;
+        writer->depth = job->depth;
+        writer->flush = atom_writer_grow;
+
+        atom_node_t* child = chunk->first;
+        for (int i = 0; i < chunk->count; i++, child = child->next)
         {
-        case ATOM_LIST:
-            stack++;
-            atom_node_t* children = node->children;
-            if (children == NULL)
-            {
-                fputs(" - (null)\n", stdout);
-            }
-            else
-            {
-                fputc('\n', stdout);
-                while (children)
-                {
-                    atom_print(lexer, children);
-                    children = children->next;
-                }
-            }
-            stack--;
-            break;
-
-        case ATOM_LONG:
-            printf(" - %ld\n", node->data.as_long);
-            break;
-
-        case ATOM_REAL:
-            printf(" - %lf\n", node->data.as_real);
-            break;
-
-        case ATOM_TEXT:
-            fputs(" - \"", stdout);
-            for (int i = node->data.as_text.head,
-                n = node->data.as_text.tail;
-                i <= n; i++)
+            atom_writer_putc(writer, '\n');
+            atom_writer_indent(writer);
+            atom_writer_node(writer, child);
+            if (child->next)
             {
-                fputc(atom_lexer_get(lexer, i), stdout);
+                atom_writer_putc(writer, ' ');
             }
-            fputs("\"\n", stdout);
-            break;
-
-        default:
-            fputc('\n', stdout);
-            break;
         }
+
+        pthread_mutex_lock(&job->mutex);
+        chunk->done = ATOM_TRUE;
+        pthread_cond_broadcast(&job->cond);
+        pthread_mutex_unlock(&job->mutex);
     }
+    return NULL;
 }
+#endif
 
-
-/* @function: atom_textcpy
-*/
-size_t atom_textcpy(atom_lexer_t* lexer, atom_text_t text, char* string)
+/* @function: atom_save_parallel */
+int atom_save_parallel(atom_lexer_t* lexer, atom_node_t* node, FILE* stream, int threads, size_t* written)
 {
-    atom_assert(lexer != NULL);
+    atom_assert(node != NULL);
+    atom_assert(stream != NULL);
 
-    size_t size = 0;
-    for (int i = text.head, n = text.tail; i < n; i++, size++)
+#ifdef ATOM_THREADS
+    /* Count children for chunking
+     */
+    int children = 0;
+    if (node->type == ATOM_LIST)
     {
-        *string++ = atom_lexer_get(lexer, i);
+        for (atom_node_t* child = node->children; child; child = child->next)
+        {
+            children++;
+        }
     }
-    *string++ = 0;
-    return size;
-}
 
+    /* Stream lexer share the file cursor, it cannot be read concurrently
+     */
+    if (threads > 1 && children > 1 && (!lexer || lexer->type == ATOM_LEXER_STRING))
+    {
+        atom_stat_begin(savestart);
+        atom_trace_start(tracestart);
+        char buffer[ATOM_WRITER_CAPACITY];
+
+        atom_writer_t writer;
+        memset(&writer, 0, sizeof(writer));
+        writer.lexer    = lexer;
+        writer.buffer   = buffer;
+        writer.capacity = sizeof(buffer);
+        writer.flush    = atom_writer_flushstream;
+        writer.context  = stream;
+
+        /* Split children into contiguous chunks, a few per thread for balancing
+         */
+        int count = threads * 4;
+        if (count > children)
+        {
+            count = children;
+        }
+
+        atom_savejob_t job;
+        job.chunks = atom_membuf.extract(atom_membuf.data, sizeof(atom_savechunk_t) * count);
+        if (!job.chunks)
+        {
+            /* @error: out of memory */
+            return ATOM_ERROR_OVERFLOW;
+        }
+        job.count     = count;
+        job.taken     = 0;
+        job.written   = 0;
+        job.lookahead = threads * 2;
+        job.depth     = 1;
+        job.lexer     = lexer;
+        pthread_mutex_init(&job.mutex, NULL);
+        pthread_cond_init(&job.cond, NULL);
 
-/* @function: atom_textcmp
-*/
-size_t atom_textcmp(atom_lexer_t* lexer, atom_text_t text, const char* string)
-{
-    atom_assert(lexer != NULL);
+        atom_node_t* child = node->children;
+        for (int i = 0; i < count; i++)
+        {
+            atom_savechunk_t* chunk = &job.chunks[i];
+            chunk->first = child;
+            chunk->count = children / count + (i < children % count);
+            chunk->done  = ATOM_FALSE;
+            for (int j = 0; j < chunk->count; j++)
+            {
+                child = child->next;
+            }
+        }
 
-    char a, b;
-    for (int i = text.head; i < text.tail && (b = *string); i++, string++)
-    {
-        a = atom_lexer_get(lexer, i);
-        if (a < b)
+        /* Write list head while workers are busy
+         */
+        atom_writer_putc(&writer, '(');
+        if (atom_writer_hasname(&writer, node))
         {
-            return -1;
+            atom_writer_text(&writer, node, node->name);
+            atom_writer_putc(&writer, ' ');
         }
-        else if (a > b)
+
+        pthread_t* workers = atom_membuf.extract(atom_membuf.data, sizeof(pthread_t) * threads);
+        int        started = 0;
+        if (workers)
         {
-            return 1;
+            for (; started < threads; started++)
+            {
+                if (pthread_create(&workers[started], NULL, atom_savejob_worker, &job) != 0)
+                {
+                    break;
+                }
+            }
         }
-    }
-    return 0;
+        if (started == 0)
+        {
+            /* No thread available, do it ourselves
+             */
+            job.lookahead = count;
+            atom_savejob_worker(&job);
+        }
+
+        /* Stitch chunks in order, release each one as soon as it's written
+         */
+        for (int i = 0; i < count; i++)
+        {
+            atom_savechunk_t* chunk = &job.chunks[i];
+
+            pthread_mutex_lock(&job.mutex);
+            while (!chunk->done)
+            {
+                pthread_cond_wait(&job.cond, &job.mutex);
+            }
+            pthread_mutex_unlock(&job.mutex);
+
+            if (writer.errcode == ATOM_ERROR_NONE)
+            {
+                writer.errcode = chunk->writer.errcode;
+            }
+            if (writer.errcode == ATOM_ERROR_NONE)
+            {
+                writer.errcode = atom_writer_flushstream(&writer, 0);
+            }
+            if (writer.errcode == ATOM_ERROR_NONE && chunk->writer.length > 0)
+            {
+                atom_trace_start(writestart);
+                if (fwrite(chunk->writer.buffer, chunk->writer.length, 1, stream) != 1)
+                {
+                    writer.errcode = ATOM_ERROR_IO;
+                }
+                atom_trace_stop("write", NULL, writestart, chunk->writer.length);
+                writer.count += chunk->writer.length;
+            }
+            atom_writer_free(&chunk->writer);
+
+            pthread_mutex_lock(&job.mutex);
+            job.written = i + 1;
+            pthread_cond_broadcast(&job.cond);
+            pthread_mutex_unlock(&job.mutex);
+        }
+
+        for (int i = 0; i < started; i++)
+        {
+            pthread_join(workers[i], NULL);
+        }
+        if (workers)
+        {
+            atom_membuf.collect(atom_membuf.data, workers);
+        }
+        pthread_cond_destroy(&job.cond);
+        pthread_mutex_destroy(&job.mutex);
+        atom_membuf.collect(atom_membuf.data, job.chunks);
+
+        /* Close list
+         */
+        atom_writer_putc(&writer, ')');
+        if (writer.errcode == ATOM_ERROR_NONE)
+        {
+            writer.errcode = atom_writer_flushstream(&writer, 0);
+        }
+        atom_stat_end(savetime, savestart);
+        atom_trace_stop("save", NULL, tracestart, writer.count);
+        if (written)
+        {
+            *written = writer.count;
+        }
+        return writer.errcode;
+    }
+#else
+    (void)threads;
+#endif
+
+    return atom_writer_savestream(lexer, node, stream, 0, written);
+}
+
+#define ATOM_ASYNC_CAPACITY (1024 * 1024)
+
+/**
+ * Asynchronous save state
+ * Serializer thread fill one buffer while I/O thread write the other
+ */
+struct atom_saveasync
+{
+    atom_writer_t   writer;
+    atom_node_t*    node;
+    int             flags;
+    int             result;     /* Error code                  */
+    size_t          written;    /* Bytes written               */
+    atom_bool_t     done;
+    char*           path;       /* Destination path            */
+    char*           temp;       /* Path of file being written  */
+#ifdef ATOM_THREADS
+    char*           buffers[2];
+    size_t          pending[2]; /* Bytes wait for writing, 0 mean buffer is free */
+    int             current;    /* Buffer is being filled      */
+    atom_bool_t     finished;   /* Serializer has no more data */
+    int             ioerror;
+    int             fd;
+    pthread_t       serializer;
+    pthread_t       io;
+    atom_bool_t     joinable;   /* Serializer run on its own thread */
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+#endif
+};
+
+/**
+ * Copy a c-string with atom memory functions
+ */
+static char* atom_strdup(const char* string, const char* suffix)
+{
+    size_t length = strlen(string);
+    size_t extra  = suffix ? strlen(suffix) : 0;
+    char*  result = atom_membuf.extract(atom_membuf.data, length + extra + 1);
+    if (result)
+    {
+        memcpy(result, string, length);
+        memcpy(result + length, suffix ? suffix : "", extra + 1);
+    }
+    return result;
+}
+
+/**
+ * Free asynchronous save state
+ */
+static void atom_saveasync_free(atom_saveasync_t* handle)
+{
+#ifdef ATOM_THREADS
+    for (int i = 0; i < 2; i++)
+    {
+        if (handle->buffers[i])
+        {
+            atom_membuf.collect(atom_membuf.data, handle->buffers[i]);
+        }
+    }
+#endif
+    if (handle->temp && handle->temp != handle->path)
+    {
+        atom_membuf.collect(atom_membuf.data, handle->temp);
+    }
+    if (handle->path)
+    {
+        atom_membuf.collect(atom_membuf.data, handle->path);
+    }
+    atom_membuf.collect(atom_membuf.data, handle);
+}
+
+#ifdef ATOM_THREADS
+/**
+ * Hand the filled buffer to I/O thread, then wait for the other one is free
+ */
+static int atom_saveasync_flush(atom_writer_t* writer, size_t needed)
+{
+    atom_saveasync_t* handle = (atom_saveasync_t*)writer->context;
+    (void)needed;
+
+    pthread_mutex_lock(&handle->mutex);
+    if (writer->length > 0)
+    {
+        handle->pending[handle->current] = writer->length;
+        handle->current ^= 1;
+        pthread_cond_broadcast(&handle->cond);
+    }
+    while (handle->pending[handle->current] > 0 && handle->ioerror == ATOM_ERROR_NONE)
+    {
+        pthread_cond_wait(&handle->cond, &handle->mutex);
+    }
+    writer->buffer = handle->buffers[handle->current];
+    writer->length = 0;
+    int errcode = handle->ioerror;
+    pthread_mutex_unlock(&handle->mutex);
+    return errcode;
+}
+
+/**
+ * Serializer thread
+ */
+static void* atom_saveasync_serialize(void* arg)
+{
+    atom_saveasync_t* handle = (atom_saveasync_t*)arg;
+    atom_writer_t*    writer = &handle->writer;
+
+    atom_trace_start(tracestart);
+    atom_writer_node(writer, handle->node);
+    if (writer->errcode == ATOM_ERROR_NONE)
+    {
+        writer->errcode = atom_saveasync_flush(writer, 0);
+    }
+    atom_trace_stop("save", handle->path, tracestart, writer->count);
+
+    pthread_mutex_lock(&handle->mutex);
+    handle->finished = ATOM_TRUE;
+    pthread_cond_broadcast(&handle->cond);
+    pthread_mutex_unlock(&handle->mutex);
+    return NULL;
+}
+
+/**
+ * I/O thread, write buffers in order with plain write(2)
+ */
+static void* atom_saveasync_write(void* arg)
+{
+    atom_saveasync_t* handle = (atom_saveasync_t*)arg;
+    int               index  = 0;
+    int               errcode = ATOM_ERROR_NONE;
+
+    while (ATOM_TRUE)
+    {
+        pthread_mutex_lock(&handle->mutex);
+        while (handle->pending[index] == 0 && !handle->finished)
+        {
+            pthread_cond_wait(&handle->cond, &handle->mutex);
+        }
+        size_t length = handle->pending[index];
+        pthread_mutex_unlock(&handle->mutex);
+
+        if (length == 0)
+        {
+            break;
+        }
+
+        const char* data = handle->buffers[index];
+        atom_trace_start(tracestart);
+        while (length > 0 && errcode == ATOM_ERROR_NONE)
+        {
+            ssize_t count = write(handle->fd, data, length);
+            if (count < 0)
+            {
+                if (errno != EINTR)
+                {
+                    errcode = ATOM_ERROR_IO;
+                }
+                continue;
+            }
+            data   += count;
+            length -= (size_t)count;
+        }
+        atom_trace_stop("write", NULL, tracestart, data - handle->buffers[index]);
+
+        pthread_mutex_lock(&handle->mutex);
+        handle->pending[index] = 0;
+        handle->ioerror        = errcode;
+        pthread_cond_broadcast(&handle->cond);
+        pthread_mutex_unlock(&handle->mutex);
+        index ^= 1;
+    }
+
+    /* Serializer is done, now make the file durable and visible
+     */
+    if (errcode == ATOM_ERROR_NONE && handle->writer.errcode != ATOM_ERROR_NONE)
+    {
+        errcode = handle->writer.errcode;
+    }
+    if (errcode == ATOM_ERROR_NONE && (handle->flags & ATOM_SAVE_FSYNC) && fsync(handle->fd) != 0)
+    {
+        errcode = ATOM_ERROR_IO;
+    }
+    if (close(handle->fd) != 0 && errcode == ATOM_ERROR_NONE)
+    {
+        errcode = ATOM_ERROR_IO;
+    }
+    if (handle->temp != handle->path)
+    {
+        if (errcode == ATOM_ERROR_NONE && rename(handle->temp, handle->path) != 0)
+        {
+            errcode = ATOM_ERROR_IO;
+        }
+        if (errcode != ATOM_ERROR_NONE)
+        {
+            unlink(handle->temp);
+        }
+    }
+
+    pthread_mutex_lock(&handle->mutex);
+    handle->result  = errcode;
+    handle->written = handle->writer.count;
+    handle->done   = ATOM_TRUE;
+    pthread_cond_broadcast(&handle->cond);
+    pthread_mutex_unlock(&handle->mutex);
+    return NULL;
+}
+#endif
+
+/* @function: atom_save_async */
+atom_saveasync_t* atom_save_async(atom_lexer_t* lexer, atom_node_t* node, const char* path, int flags)
+{
+    atom_assert(node != NULL);
+    atom_assert(path != NULL);
+
+    atom_saveasync_t* handle = atom_membuf.extract(atom_membuf.data, sizeof(atom_saveasync_t));
+    if (!handle)
+    {
+        /* @error: out of memory */
+        return NULL;
+    }
+    memset(handle, 0, sizeof(*handle));
+    handle->node  = node;
+    handle->flags = flags;
+    handle->path  = atom_strdup(path, NULL);
+    handle->temp  = (flags & ATOM_SAVE_RENAME) ? atom_strdup(path, ".tmp") : handle->path;
+    if (!handle->path || !handle->temp)
+    {
+        atom_saveasync_free(handle);
+        return NULL;
+    }
+
+#ifdef ATOM_THREADS
+    handle->buffers[0] = atom_membuf.extract(atom_membuf.data, ATOM_ASYNC_CAPACITY);
+    handle->buffers[1] = atom_membuf.extract(atom_membuf.data, ATOM_ASYNC_CAPACITY);
+    handle->fd         = open(handle->temp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (!handle->buffers[0] || !handle->buffers[1] || handle->fd < 0)
+    {
+        if (handle->fd >= 0)
+        {
+            close(handle->fd);
+        }
+        atom_saveasync_free(handle);
+        return NULL;
+    }
+
+    handle->writer.lexer    = lexer;
+    handle->writer.buffer   = handle->buffers[0];
+    handle->writer.capacity = ATOM_ASYNC_CAPACITY;
+    handle->writer.flush    = atom_saveasync_flush;
+    handle->writer.context  = handle;
+    pthread_mutex_init(&handle->mutex, NULL);
+    pthread_cond_init(&handle->cond, NULL);
+
+    if (pthread_create(&handle->io, NULL, atom_saveasync_write, handle) != 0)
+    {
+        close(handle->fd);
+        unlink(handle->temp);
+        pthread_cond_destroy(&handle->cond);
+        pthread_mutex_destroy(&handle->mutex);
+        atom_saveasync_free(handle);
+        return NULL;
+    }
+    handle->joinable = pthread_create(&handle->serializer, NULL, atom_saveasync_serialize, handle) == 0;
+    if (!handle->joinable)
+    {
+        /* Still have I/O thread, serialize on the caller thread
+         */
+        atom_saveasync_serialize(handle);
+    }
+#else
+    /* No threads, save it now and return a completed handle
+     */
+    FILE* stream = fopen(handle->temp, "wb");
+    if (!stream)
+    {
+        atom_saveasync_free(handle);
+        return NULL;
+    }
+    handle->result = atom_writer_savestream(lexer, node, stream, 0, &handle->written);
+    if (fclose(stream) != 0 && handle->result == ATOM_ERROR_NONE)
+    {
+        handle->result = ATOM_ERROR_IO;
+    }
+    if (handle->temp != handle->path)
+    {
+        if (handle->result == ATOM_ERROR_NONE && rename(handle->temp, handle->path) != 0)
+        {
+            remove(handle->path);
+            if (rename(handle->temp, handle->path) != 0)
+            {
+                handle->result = ATOM_ERROR_IO;
+            }
+        }
+        if (handle->result != ATOM_ERROR_NONE)
+        {
+            remove(handle->temp);
+        }
+    }
+    handle->done = ATOM_TRUE;
+#endif
+
+    return handle;
+}
+
+/* @function: atom_save_poll */
+atom_bool_t atom_save_poll(atom_saveasync_t* handle)
+{
+    atom_assert(handle != NULL);
+
+#ifdef ATOM_THREADS
+    pthread_mutex_lock(&handle->mutex);
+    atom_bool_t done = handle->done;
+    pthread_mutex_unlock(&handle->mutex);
+    return done;
+#else
+    return handle->done;
+#endif
+}
+
+/* @function: atom_save_wait */
+int atom_save_wait(atom_saveasync_t* handle, size_t* written)
+{
+    atom_assert(handle != NULL);
+
+#ifdef ATOM_THREADS
+    if (handle->joinable)
+    {
+        pthread_join(handle->serializer, NULL);
+    }
+    pthread_join(handle->io, NULL);
+    pthread_cond_destroy(&handle->cond);
+    pthread_mutex_destroy(&handle->mutex);
+#endif
+
+    int result = handle->result;
+    if (written)
+    {
+        *written = handle->written;
+    }
+    atom_saveasync_free(handle);
+    return result;
+}
+
+/* @function: atomAddChild
+*/
+int atom_addchild(atom_node_t* node, atom_node_t* child)
+{
+    atom_assert(node != NULL);
+    atom_assert(!(node->flags & ATOM_NODE_READONLY), "Node is shared or frozen");
+
+    if (node->flags & ATOM_NODE_READONLY)
+    {
+        /* @error: Node is shared or frozen
+        */
+        return ATOM_ERROR_ARGUMENTS;
+    }
+    if ((node->flags & ATOM_NODE_SHARED) && atom_unshare(node) != ATOM_ERROR_NONE)
+    {
+        return ATOM_ERROR_OVERFLOW;
+    }
+    child->parent = node;
+
+    if (child->type == ATOM_LIST)
+    {
+        child->data.is_root = ATOM_FALSE;
+    }
+
+    if (node->lastchild)
+    {
+        child->prev     = node->lastchild; 
+        node->lastchild = node->lastchild->next = child;
+    }
+    else
+    {
+        node->lastchild = node->children        = child;
+    }
+    if (node->index)
+    {
+        atom_index_add(node, child);
+    }
+    atom_touch(node);
+    return ATOM_ERROR_NONE;
+}
+
+
+/* @function: atom_print
+*/
+void atom_print(atom_lexer_t* lexer, atom_node_t* node)
+{
+    static const char* types[] = {
+        "ATOM_NONE",
+        "ATOM_LIST",
+        "ATOM_LONG",
+        "ATOM_REAL",
+        "ATOM_TEXT",
+        "ATOM_NAME",
+    };
+
+    static int stack = 0;
+    if (node)
+    {
+        for (int i = 0; i < stack; i++)
+        {
+            fputc(' ', stdout);
+        }
+
+        fputs(types[node->type], stdout);
+        fputs(" - ", stdout);
+        for (int i = node->name.head; i <= node->name.tail; i++)
+        {
+            fputc(atom_lexer_get(lexer, i), stdout);
+        }
+
+        switch (node->type)
+        {
+        case ATOM_LIST:
+            stack++;
+            atom_node_t* children = node->children;
+            if (children == NULL)
+            {
+                fputs(" - (null)\n", stdout);
+            }
+            else
+            {
+                fputc('\n', stdout);
+                while (children)
+                {
+                    atom_print(lexer, children);
+                    children = children->next;
+                }
+            }
+            stack--;
+            break;
+
+        case ATOM_LONG:
+            printf(" - %ld\n", node->data.as_long);
+            break;
+
+        case ATOM_REAL:
+            printf(" - %lf\n", node->data.as_real);
+            break;
+
+        case ATOM_TEXT:
+            fputs(" - \"", stdout);
+            for (int i = node->data.as_text.head,
+                n = node->data.as_text.tail;
+                i <= n; i++)
+            {
+                fputc(atom_lexer_get(lexer, i), stdout);
+            }
+            fputs("\"\n", stdout);
+            break;
+
+        default:
+            fputc('\n', stdout);
+            break;
+        }
+    }
+}
+
+
+/* @function: atom_textcpy
+*/
+size_t atom_textcpy(atom_lexer_t* lexer, atom_text_t text, char* string)
+{
+    atom_assert(lexer != NULL);
+
+    size_t size = 0;
+    for (int i = text.head, n = text.tail; i < n; i++, size++)
+    {
+        *string++ = atom_lexer_get(lexer, i);
+    }
+    *string++ = 0;
+    return size;
+}
+
+
+/* @function: atom_textcmp
+*/
+size_t atom_textcmp(atom_lexer_t* lexer, atom_text_t text, const char* string)
+{
+    atom_assert(lexer != NULL);
+
+    char a, b;
+    for (int i = text.head; i < text.tail && (b = *string); i++, string++)
+    {
+        a = atom_lexer_get(lexer, i);
+        if (a < b)
+        {
+            return -1;
+        }
+        else if (a > b)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Mix a value into hash, order dependent
+ */
+static uint64_t atom_hashmix(uint64_t hash, uint64_t value)
+{
+    hash ^= value + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+/**
+ * FNV-1a hash of bytes
+ */
+static uint64_t atom_hashbytes(uint64_t hash, const char* data, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= (unsigned char)data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/**
+ * Hash of a text, from lexer or c-string
+ * Same bytes give same hash, whatever the source is
+ */
+static uint64_t atom_hashtext(atom_lexer_t* lexer, atom_text_t text)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    if (!lexer)
+    {
+        return text.cstr ? atom_hashbytes(hash, text.cstr, strlen(text.cstr)) : hash;
+    }
+
+    if (text.tail <= text.head)
+    {
+        return hash;
+    }
+
+    switch (lexer->type)
+    {
+    case ATOM_LEXER_STRING:
+        hash = atom_hashbytes(hash, lexer->string + text.head, (size_t)(text.tail - text.head));
+        break;
+
+    case ATOM_LEXER_STREAM:
+    {
+        char   chunk[256];
+        size_t total = (size_t)(text.tail - text.head);
+        atom_lexer_seek(lexer->stream, text.head, SEEK_SET);
+        while (total > 0)
+        {
+            size_t count = fread(chunk, 1, total < sizeof(chunk) ? total : sizeof(chunk), lexer->stream);
+            if (count == 0)
+            {
+                break;
+            }
+            hash   = atom_hashbytes(hash, chunk, count);
+            total -= count;
+        }
+    } break;
+
+    default:
+        break;
+    }
+    return hash;
+}
+
+
+/* @function: atom_touch
+*/
+void atom_touch(atom_node_t* node)
+{
+    /* A valid hash mean all descendants are valid,
+     * so stop at the first node that already invalidated
+     */
+    while (node && node->hash)
+    {
+        node->hash = 0;
+        node       = node->parent;
+    }
+}
+
+
+/* @function: atom_hash
+*/
+uint64_t atom_hash(atom_lexer_t* lexer, atom_node_t* node)
+{
+    if (!node)
+    {
+        return 0;
+    }
+
+    if (node->hash)
+    {
+        return node->hash;
+    }
+
+    atom_lexer_t* source = lexer;
+    lexer = atom_nodelexer(lexer, node);
+
+    uint64_t hash = atom_hashmix(node->type, atom_hashtext(lexer, node->name));
+    switch (node->type)
+    {
+    case ATOM_LIST:
+    {
+        uint64_t count = 0;
+        for (atom_node_t* child = node->children; child; child = child->next, count++)
+        {
+            hash = atom_hashmix(hash, atom_hash(source, child));
+        }
+        hash = atom_hashmix(hash, count);
+    } break;
+
+    case ATOM_LONG:
+        hash = atom_hashmix(hash, (uint64_t)node->data.as_long);
+        break;
+
+    case ATOM_REAL:
+    {
+        uint64_t bits;
+        atom_real_t value = node->data.as_real == 0.0 ? 0.0 : node->data.as_real;
+        memcpy(&bits, &value, sizeof(bits));
+        hash = atom_hashmix(hash, bits);
+    } break;
+
+    case ATOM_TEXT:
+        hash = atom_hashmix(hash, atom_hashtext(lexer, node->data.as_text));
+        break;
+
+    default:
+        break;
+    }
+
+    node->hash = hash ? hash : 1; /* 0 is reserved for invalid */
+    return node->hash;
+}
+
+/**
+ * Copy a text to an owned c-string
+ */
+static const char* atom_textdup(atom_lexer_t* lexer, atom_text_t text)
+{
+    size_t length = atom_textlength(lexer, text);
+    char*  result = atom_membuf.extract(atom_membuf.data, length + 1);
+    if (result)
+    {
+        result[atom_textread(lexer, text, 0, result, length)] = 0;
+        atom_reserve(length + 1);
+    }
+    return result;
+}
+
+/**
+ * Compare two texts, they may come from different sources
+ */
+static atom_bool_t atom_textequal(atom_lexer_t* alexer, atom_text_t a, atom_lexer_t* blexer, atom_text_t b)
+{
+    size_t length = atom_textlength(alexer, a);
+    if (length != atom_textlength(blexer, b))
+    {
+        return ATOM_FALSE;
+    }
+
+    char achunk[256];
+    char bchunk[256];
+    for (size_t offset = 0; offset < length; )
+    {
+        size_t count = atom_textread(alexer, a, offset, achunk, sizeof(achunk));
+        if (count == 0 || atom_textread(blexer, b, offset, bchunk, count) != count || memcmp(achunk, bchunk, count) != 0)
+        {
+            return ATOM_FALSE;
+        }
+        offset += count;
+    }
+    return ATOM_TRUE;
+}
+
+/**
+ * Compare text with a c-string
+ */
+static atom_bool_t atom_textis(atom_lexer_t* lexer, atom_text_t text, const char* string)
+{
+    atom_text_t other;
+    other.cstr = string;
+    return atom_textequal(lexer, text, NULL, other);
+}
+
+/* @function: atom_clone
+*/
+atom_node_t* atom_clone(atom_lexer_t* lexer, atom_node_t* node)
+{
+    atom_assert(node != NULL);
+
+    atom_lexer_t* source = atom_nodelexer(lexer, node);
+    atom_node_t*  clone  = atom_create(node->type, ATOM_TEXT_NULL);
+    if (!clone)
+    {
+        /* @error: Out of memory
+        */
+        return NULL;
+    }
+    clone->flags     = ATOM_NODE_CSTR | ATOM_NODE_OWNED;
+    clone->name.cstr = NULL;
+    clone->data      = node->data;
+    if (node->type == ATOM_TEXT)
+    {
+        clone->data.as_text.cstr = NULL;
+        if (!(clone->data.as_text.cstr = atom_textdup(source, node->data.as_text)))
+        {
+            atom_delete(clone);
+            return NULL;
+        }
+    }
+    if (atom_hasname(source, node) && !(clone->name.cstr = atom_textdup(source, node->name)))
+    {
+        atom_delete(clone);
+        return NULL;
+    }
+
+    if (node->type == ATOM_LIST)
+    {
+        for (atom_node_t* child = node->children; child; child = child->next)
+        {
+            atom_node_t* copy = atom_clone(lexer, child);
+            if (!copy)
+            {
+                atom_delete(clone);
+                return NULL;
+            }
+            atom_addchild(clone, copy);
+        }
+    }
+
+    /* Texts are equal so the hash is
+     */
+    clone->hash = node->hash;
+    return clone;
+}
+
+
+/* @function: atom_equal
+*/
+atom_bool_t atom_equal(atom_lexer_t* alexer, atom_node_t* a, atom_lexer_t* blexer, atom_node_t* b)
+{
+    if (!a || !b)
+    {
+        return a == b;
+    }
+
+    if (a->type != b->type || (a->hash && b->hash && a->hash != b->hash))
+    {
+        return ATOM_FALSE;
+    }
+
+    atom_lexer_t* alocal = atom_nodelexer(alexer, a);
+    atom_lexer_t* blocal = atom_nodelexer(blexer, b);
+    if (!atom_textequal(alocal, a->name, blocal, b->name))
+    {
+        return ATOM_FALSE;
+    }
+
+    switch (a->type)
+    {
+    case ATOM_LIST:
+    {
+        atom_node_t* achild = a->children;
+        atom_node_t* bchild = b->children;
+        for (; achild && bchild; achild = achild->next, bchild = bchild->next)
+        {
+            if (!atom_equal(alexer, achild, blexer, bchild))
+            {
+                return ATOM_FALSE;
+            }
+        }
+        return achild == bchild;
+    }
+
+    case ATOM_LONG:
+        return a->data.as_long == b->data.as_long;
+
+    case ATOM_REAL:
+        return a->data.as_real == b->data.as_real;
+
+    case ATOM_TEXT:
+        return atom_textequal(alocal, a->data.as_text, blocal, b->data.as_text);
+
+    default:
+        return ATOM_TRUE;
+    }
+}
+
+
+/* @function: atom_insertchild
+*/
+int atom_insertchild(atom_node_t* node, atom_node_t* child, int index)
+{
+    atom_assert(node != NULL);
+    atom_assert(child != NULL);
+    atom_assert(!(node->flags & ATOM_NODE_READONLY), "Node is shared or frozen");
+
+    if (node->flags & ATOM_NODE_READONLY)
+    {
+        /* @error: Node is shared or frozen
+        */
+        return ATOM_ERROR_ARGUMENTS;
+    }
+    if ((node->flags & ATOM_NODE_SHARED) && atom_unshare(node) != ATOM_ERROR_NONE)
+    {
+        return ATOM_ERROR_OVERFLOW;
+    }
+
+    atom_node_t* next = node->children;
+    for (int i = 0; i < index && next; i++)
+    {
+        next = next->next;
+    }
+
+    if (!next)
+    {
+        return atom_addchild(node, child);
+    }
+
+    child->parent = node;
+    if (child->type == ATOM_LIST)
+    {
+        child->data.is_root = ATOM_FALSE;
+    }
+
+    child->next = next;
+    child->prev = next->prev;
+    if (next->prev)
+    {
+        next->prev->next = child;
+    }
+    else
+    {
+        node->children = child;
+    }
+    next->prev = child;
+    if (node->index)
+    {
+        atom_index_add(node, child);
+    }
+    atom_touch(node);
+    return ATOM_ERROR_NONE;
+}
+
+
+/* @function: atom_removechild
+*/
+atom_node_t* atom_removechild(atom_node_t* node, atom_node_t* child)
+{
+    atom_assert(node != NULL);
+    atom_assert(!(node->flags & ATOM_NODE_READONLY), "Node is shared or frozen");
+
+    if (node->flags & ATOM_NODE_READONLY)
+    {
+        /* @error: Node is shared or frozen
+        */
+        return NULL;
+    }
+
+    /* Child is in the shared list, find its copy after unshare
+     */
+    if (node->flags & ATOM_NODE_SHARED)
+    {
+        int index = 0;
+        for (atom_node_t* other = node->children; other && other != child; other = other->next)
+        {
+            index++;
+        }
+        if (atom_unshare(node) != ATOM_ERROR_NONE)
+        {
+            return NULL;
+        }
+        for (child = node->children; child && index > 0; index--)
+        {
+            child = child->next;
+        }
+    }
+    atom_assert(child != NULL && child->parent == node);
+
+    if (node->index)
+    {
+        atom_index_remove(node, child);
+    }
+    if (child->prev)
+    {
+        child->prev->next = child->next;
+    }
+    else
+    {
+        node->children = child->next;
+    }
+    if (child->next)
+    {
+        child->next->prev = child->prev;
+    }
+    else
+    {
+        node->lastchild = child->prev;
+    }
+    child->parent = NULL;
+    child->prev   = NULL;
+    child->next   = NULL;
+    atom_touch(node);
+    return child;
+}
+
+
+/**
+ * Children index, open addressing with linear probing
+ * One entry per distinct name, refer to the first child with that name
+ */
+typedef struct
+{
+    atom_node_t* node;  /* First child with the name, NULL when empty */
+    uint64_t     key;   /* Hash of the name                           */
+    int          count; /* Children with the name, -1 when removed    */
+} atom_indexentry_t;
+
+struct atom_index
+{
+    atom_lexer_t*      lexer;
+    atom_indexentry_t* entries;
+    size_t             used;     /* Live and removed entries */
+    size_t             capacity; /* Power of 2               */
+};
+
+/**
+ * Release children index of node
+ */
+static void atom_freeindex(atom_node_t* node)
+{
+    if (node->index)
+    {
+        atom_unreserve(sizeof(atom_index_t) + sizeof(atom_indexentry_t) * node->index->capacity);
+        atom_membuf.collect(atom_membuf.data, node->index);
+        node->index = NULL;
+    }
+}
+
+/**
+ * Hash of child name, for the index
+ */
+static uint64_t atom_index_key(atom_index_t* index, atom_node_t* child)
+{
+    return atom_hashtext(atom_nodelexer(index->lexer, child), child->name);
+}
+
+/**
+ * Find the entry of a name, or the free slot to put it
+ */
+static atom_indexentry_t* atom_index_lookup(atom_index_t* index, uint64_t key, atom_lexer_t* lexer, atom_text_t name)
+{
+    atom_indexentry_t* removed = NULL;
+    for (size_t slot = key & (index->capacity - 1); ; slot = (slot + 1) & (index->capacity - 1))
+    {
+        atom_indexentry_t* entry = &index->entries[slot];
+        if (!entry->node)
+        {
+            if (entry->count == 0)
+            {
+                return removed ? removed : entry;
+            }
+            if (!removed)
+            {
+                removed = entry;
+            }
+        }
+        else if (entry->key == key && atom_textequal(atom_nodelexer(index->lexer, entry->node), entry->node->name, lexer, name))
+        {
+            return entry;
+        }
+    }
+}
+
+/**
+ * Allocate an empty index, entries follow the header in the same block
+ */
+static atom_index_t* atom_index_alloc(atom_lexer_t* lexer, size_t capacity)
+{
+    atom_index_t* index = atom_membuf.extract(atom_membuf.data, sizeof(atom_index_t) + sizeof(atom_indexentry_t) * capacity);
+    if (index)
+    {
+        index->lexer    = lexer;
+        index->entries  = (atom_indexentry_t*)(index + 1);
+        index->used     = 0;
+        index->capacity = capacity;
+        memset(index->entries, 0, sizeof(atom_indexentry_t) * capacity);
+        atom_reserve(sizeof(atom_index_t) + sizeof(atom_indexentry_t) * capacity);
+    }
+    return index;
+}
+
+/**
+ * Index all named children of node, replace the old index
+ */
+static atom_bool_t atom_index_build(atom_lexer_t* lexer, atom_node_t* node)
+{
+    size_t count = 0;
+    for (atom_node_t* child = node->children; child; child = child->next)
+    {
+        count++;
+    }
+
+    size_t capacity = 16;
+    while (capacity * 3 <= count * 4)
+    {
+        capacity *= 2;
+    }
+
+    atom_freeindex(node);
+    atom_index_t* index = atom_index_alloc(lexer, capacity);
+    if (!index)
+    {
+        /* @error: Out of memory, finding fall back to scan
+         */
+        return ATOM_FALSE;
+    }
+
+    for (atom_node_t* child = node->children; child; child = child->next)
+    {
+        atom_lexer_t* source = atom_nodelexer(lexer, child);
+        if (!atom_hasname(source, child))
+        {
+            continue;
+        }
+
+        uint64_t           key   = atom_index_key(index, child);
+        atom_indexentry_t* entry = atom_index_lookup(index, key, source, child->name);
+        if (entry->node)
+        {
+            entry->count++;
+        }
+        else
+        {
+            entry->node  = child;
+            entry->key   = key;
+            entry->count = 1;
+            index->used++;
+        }
+    }
+    node->index = index;
+    return ATOM_TRUE;
+}
+
+/**
+ * Add a linked child to the index of node
+ */
+static void atom_index_add(atom_node_t* node, atom_node_t* child)
+{
+    atom_index_t* index  = node->index;
+    atom_lexer_t* source = atom_nodelexer(index->lexer, child);
+    if (!atom_hasname(source, child))
+    {
+        return;
+    }
+
+    /* Keep load under 3/4, removed entries count as used
+     */
+    if ((index->used + 1) * 4 > index->capacity * 3)
+    {
+        atom_index_build(index->lexer, node); /* Child is already linked */
+        return;
+    }
+
+    uint64_t           key   = atom_index_key(index, child);
+    atom_indexentry_t* entry = atom_index_lookup(index, key, source, child->name);
+    if (!entry->node)
+    {
+        index->used += entry->count == 0;
+        entry->node  = child;
+        entry->key   = key;
+        entry->count = 1;
+        return;
+    }
+
+    /* Name already exist, the new child may come first
+     */
+    entry->count++;
+    if (child->next)
+    {
+        for (atom_node_t* other = child->next; other; other = other->next)
+        {
+            if (other == entry->node)
+            {
+                entry->node = child;
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * Remove a child from the index of node, before it is unlinked
+ */
+static void atom_index_remove(atom_node_t* node, atom_node_t* child)
+{
+    atom_index_t* index  = node->index;
+    atom_lexer_t* source = atom_nodelexer(index->lexer, child);
+    if (!atom_hasname(source, child))
+    {
+        return;
+    }
+
+    atom_indexentry_t* entry = atom_index_lookup(index, atom_index_key(index, child), source, child->name);
+    if (!entry->node)
+    {
+        return;
+    }
+
+    if (--entry->count > 0)
+    {
+        /* Duplicated name, the next one become the first
+         */
+        if (entry->node == child)
+        {
+            atom_node_t* other = child->next;
+            while (other && !atom_textequal(atom_nodelexer(index->lexer, other), other->name, source, child->name))
+            {
+                other = other->next;
+            }
+            entry->node = other;
+        }
+    }
+    else
+    {
+        entry->node  = NULL;
+        entry->count = -1;
+    }
+}
+
+
+/**
+ * Find in frozen list, binary search when children are sorted
+ */
+static atom_node_t* atom_frozen_find(atom_node_t* node, const char* name)
+{
+    atom_node_t* children = node->children;
+    if (!children)
+    {
+        return NULL;
+    }
+
+    if (node->flags & ATOM_NODE_SORTED)
+    {
+        /* Leftmost match, unnamed children are sorted first
+         */
+        size_t lower = 0;
+        size_t upper = (size_t)(node->lastchild - children) + 1;
+        while (lower < upper)
+        {
+            size_t middle = (lower + upper) / 2;
+            if (!children[middle].name.cstr || strcmp(children[middle].name.cstr, name) < 0)
+            {
+                lower = middle + 1;
+            }
+            else
+            {
+                upper = middle;
+            }
+        }
+        return children + lower <= node->lastchild && children[lower].name.cstr && strcmp(children[lower].name.cstr, name) == 0
+             ? children + lower : NULL;
+    }
+
+    for (atom_node_t* child = children; child; child = child->next)
+    {
+        if (child->name.cstr && strcmp(child->name.cstr, name) == 0)
+        {
+            return child;
+        }
+    }
+    return NULL;
+}
+
+
+/**
+ * Find the first child of list with name, shared children are not copied
+ * Queries use it, they only read
+ */
+static atom_node_t* atom_findchild(atom_lexer_t* lexer, atom_node_t* node, const char* name)
+{
+    if (node->type != ATOM_LIST)
+    {
+        return NULL;
+    }
+
+    /* Frozen children are contiguous, search them in place
+     */
+    if (node->flags & ATOM_NODE_FROZEN)
+    {
+        return atom_frozen_find(node, name);
+    }
+
+    atom_text_t text;
+    text.cstr = name;
+
+    /* Index is built with another lexer, or is not built yet
+     */
+    if (node->index && node->index->lexer != lexer)
+    {
+        atom_index_build(lexer, node);
+    }
+    if (!node->index)
+    {
+        int count = 0;
+        for (atom_node_t* child = node->children; child; child = child->next, count++)
+        {
+            atom_lexer_t* source = atom_nodelexer(lexer, child);
+            if (count == ATOM_INDEX_THRESHOLD - 1 && atom_index_build(lexer, node))
+            {
+                break;
+            }
+            if (atom_hasname(source, child) && atom_textequal(source, child->name, NULL, text))
+            {
+                return child;
+            }
+        }
+        if (!node->index)
+        {
+            return NULL;
+        }
+    }
+
+    atom_indexentry_t* entry = atom_index_lookup(node->index, atom_hashtext(NULL, text), NULL, text);
+    return entry->node;
+}
+
+
+/* @function: atom_find
+*/
+atom_node_t* atom_find(atom_lexer_t* lexer, atom_node_t* node, const char* name)
+{
+    atom_assert(node != NULL);
+    atom_assert(name != NULL);
+
+    /* Copy-on-write, the found child may be changed. Out of memory keep
+     * the list shared and the result read-only
+     */
+    if ((node->flags & ATOM_NODE_SHARED) && !(node->flags & ATOM_NODE_READONLY))
+    {
+        atom_unshare(node);
+    }
+    return atom_findchild(lexer, node, name);
+}
+
+
+/* @function: atom_index
+*/
+int atom_index(atom_lexer_t* lexer, atom_node_t* node, atom_bool_t recursive)
+{
+    atom_assert(node != NULL);
+
+    if (node->type != ATOM_LIST)
+    {
+        return ATOM_ERROR_NONE;
+    }
+
+    if (!(node->flags & ATOM_NODE_FROZEN) && !atom_index_build(lexer, node))
+    {
+        return ATOM_ERROR_OVERFLOW;
+    }
+
+    if (recursive)
+    {
+        for (atom_node_t* child = node->children; child; child = child->next)
+        {
+            int errcode = atom_index(lexer, child, ATOM_TRUE);
+            if (errcode != ATOM_ERROR_NONE)
+            {
+                return errcode;
+            }
+        }
+    }
+    return ATOM_ERROR_NONE;
+}
+
+
+/**
+ * A step of compiled path
+ */
+typedef struct
+{
+    const char* name;   /* NULL for '*'                */
+    size_t      length;
+    int         index;  /* n-th match, -1 for all      */
+} atom_querystep_t;
+
+struct atom_query
+{
+    int              count;
+    atom_querystep_t steps[1]; /* Names follow the steps in the same block */
+};
+
+/**
+ * Query evaluation state
+ */
+typedef struct atom_querystate atom_querystate_t;
+struct atom_querystate
+{
+    atom_query_t* query;
+    atom_lexer_t* lexer;
+    atom_bool_t   (*callback)(void* context, atom_node_t* node);
+    atom_bool_t   (*visit)(atom_querystate_t* state); /* Take the match at cursor, lexer only */
+    void*         context;
+    int           count;   /* Matches visited  */
+    atom_bool_t   stop;    /* Callback said no */
+};
+
+
+/* @function: atom_query_compile
+*/
+atom_query_t* atom_query_compile(const char* path)
+{
+    atom_assert(path != NULL);
+
+    int    count  = 1;
+    size_t length = strlen(path);
+    for (const char* ptr = path; *ptr; ptr++)
+    {
+        count += *ptr == '/';
+    }
+
+    size_t        size  = sizeof(atom_query_t) + sizeof(atom_querystep_t) * (count - 1);
+    atom_query_t* query = atom_membuf.extract(atom_membuf.data, size + length + count);
+    if (!query)
+    {
+        /* @error: Out of memory
+        */
+        return NULL;
+    }
+    query->count = count;
+
+    char*       names = (char*)query + size;
+    const char* ptr   = path;
+    for (int i = 0; i < count; i++)
+    {
+        atom_querystep_t* step = &query->steps[i];
+        const char*       head = ptr;
+        while (*ptr && *ptr != '/' && *ptr != '[')
+        {
+            ptr++;
+        }
+
+        size_t span = (size_t)(ptr - head);
+        if (span == 0)
+        {
+            /* @error: Empty step
+            */
+            atom_membuf.collect(atom_membuf.data, query);
+            return NULL;
+        }
+        if (span == 1 && *head == '*')
+        {
+            step->name   = NULL;
+            step->length = 0;
+        }
+        else
+        {
+            memcpy(names, head, span);
+            names[span]  = 0;
+            step->name   = names;
+            step->length = span;
+            names       += span + 1;
+        }
+
+        step->index = -1;
+        if (*ptr == '[')
+        {
+            step->index = 0;
+            ptr++;
+            if (!atom_isdigit(*ptr))
+            {
+                atom_membuf.collect(atom_membuf.data, query);
+                return NULL;
+            }
+            while (atom_isdigit(*ptr))
+            {
+                step->index = step->index * 10 + (*ptr++ - '0');
+            }
+            if (*ptr++ != ']' || (*ptr && *ptr != '/'))
+            {
+                atom_membuf.collect(atom_membuf.data, query);
+                return NULL;
+            }
+        }
+        if (*ptr == '/')
+        {
+            ptr++;
+        }
+    }
+    return query;
+}
+
+
+/* @function: atom_query_free
+*/
+void atom_query_free(atom_query_t* query)
+{
+    if (query)
+    {
+        atom_membuf.collect(atom_membuf.data, query);
+    }
+}
+
+
+/**
+ * Check if node name match the step, '*' match all
+ */
+static atom_bool_t atom_query_matchname(atom_querystep_t* step, atom_lexer_t* lexer, atom_node_t* node)
+{
+    if (!step->name)
+    {
+        return ATOM_TRUE;
+    }
+
+    lexer = atom_nodelexer(lexer, node);
+    return atom_hasname(lexer, node)
+        && atom_textlength(lexer, node->name) == step->length
+        && atom_textis(lexer, node->name, step->name);
+}
+
+/**
+ * Match a step over children of parent, or over the single node when parent is NULL
+ */
+static void atom_query_visit(atom_querystate_t* state, int index, atom_node_t* parent, atom_node_t* single)
+{
+    atom_querystep_t* step  = &state->query->steps[index];
+    atom_node_t*      first = single;
+    if (parent)
+    {
+        /* Jump to the first child with the name, indexed on wide lists
+         */
+        first = step->name ? atom_findchild(state->lexer, parent, step->name) : parent->children;
+    }
+
+    int matches = 0;
+    for (atom_node_t* node = first; node && !state->stop; node = parent ? node->next : NULL)
+    {
+        if (!atom_query_matchname(step, state->lexer, node))
+        {
+            continue;
+        }
+        if (step->index >= 0 && matches++ != step->index)
+        {
+            continue;
+        }
+
+        if (index == state->query->count - 1)
+        {
+            state->count++;
+            state->stop = !state->callback(state->context, node);
+        }
+        else if (node->type == ATOM_LIST)
+        {
+            atom_query_visit(state, index + 1, node, NULL);
+        }
+
+        if (step->index >= 0)
+        {
+            break;
+        }
+    }
+}
+
+/**
+ * Keep the first match, then stop
+ */
+static atom_bool_t atom_query_keepfirst(void* context, atom_node_t* node)
+{
+    *(atom_node_t**)context = node;
+    return ATOM_FALSE;
+}
+
+
+/* @function: atom_query_each
+*/
+int atom_query_each(atom_query_t* query, atom_lexer_t* lexer, atom_node_t* tree,
+                    atom_bool_t (*callback)(void* context, atom_node_t* node), void* context)
+{
+    atom_assert(query != NULL);
+    atom_assert(callback != NULL);
+
+    if (!tree)
+    {
+        return 0;
+    }
+
+    atom_querystate_t state;
+    state.query    = query;
+    state.lexer    = lexer;
+    state.callback = callback;
+    state.visit    = NULL;
+    state.context  = context;
+    state.count    = 0;
+    state.stop     = ATOM_FALSE;
+
+    /* Unnamed root list hold the top-level nodes
+     */
+    if (tree->type == ATOM_LIST && !atom_hasname(atom_nodelexer(lexer, tree), tree))
+    {
+        atom_query_visit(&state, 0, tree, NULL);
+    }
+    else
+    {
+        atom_query_visit(&state, 0, NULL, tree);
+    }
+    return state.count;
+}
+
+
+/* @function: atom_query_first
+*/
+atom_node_t* atom_query_first(atom_query_t* query, atom_lexer_t* lexer, atom_node_t* tree)
+{
+    atom_node_t* result = NULL;
+    atom_query_each(query, lexer, tree, atom_query_keepfirst, &result);
+    return result;
+}
+
+
+/**
+ * Parse the matched item at cursor and hand it to callback
+ * Only the matched subtrees are parsed
+ */
+static atom_bool_t atom_query_emit(atom_querystate_t* state)
+{
+    atom_node_t* node = atom_read(state->lexer);
+    if (!node)
+    {
+        if (state->lexer->errcode == ATOM_ERROR_NONE)
+        {
+            atom_lexer_error(state->lexer, ATOM_ERROR_UNEXPECTED);
+        }
+        return ATOM_FALSE;
+    }
+    state->count++;
+    state->stop = !state->callback(state->context, node);
+    return ATOM_TRUE;
+}
+
+/**
+ * Match a step over items of the list at cursor, until close character
+ * close is 0 for the top-level
+ */
+static void atom_query_scan(atom_querystate_t* state, int index, char close)
+{
+    atom_lexer_t*     lexer   = state->lexer;
+    atom_querystep_t* step    = &state->query->steps[index];
+    int               matches = 0;
+    atom_bool_t       first   = ATOM_TRUE;
+    while (!state->stop)
+    {
+        atom_lexer_skipblank(lexer);
+
+        char c = atom_lexer_peek(lexer);
+        if (c == close)
+        {
+            return;
+        }
+        if (!c)
+        {
+            atom_lexer_error(lexer, ATOM_ERROR_UNBALANCED);
+            return;
+        }
+
+        int         cursor = lexer->cursor;
+        int         line   = lexer->line;
+        int         column = lexer->column;
+        atom_bool_t islist = c == '(' || c == '[' || c == '{';
+        atom_bool_t match  = step->name == NULL;
+        if (islist && !match)
+        {
+            atom_text_t name;
+            atom_lexer_next(lexer);
+            match = atom_lexer_readname(lexer, &name)
+                 && (size_t)(name.tail - name.head) == step->length
+                 && atom_textis(lexer, name, step->name);
+        }
+        if (match && !islist && close && first)
+        {
+            /* A single value is the list itself, (x 1) is x = 1, not a child
+             */
+            atom_lexer_skipitem(lexer);
+            atom_lexer_skipblank(lexer);
+            match         = atom_lexer_peek(lexer) != close;
+            lexer->cursor = cursor;
+            lexer->line   = line;
+            lexer->column = column;
+        }
+        first = ATOM_FALSE;
+        if (match && step->index >= 0 && matches++ != step->index)
+        {
+            match = ATOM_FALSE;
+        }
+
+        if (match && index == state->query->count - 1)
+        {
+            lexer->cursor = cursor;
+            lexer->line   = line;
+            lexer->column = column;
+            if (!state->visit(state))
+            {
+                return;
+            }
+        }
+        else if (match && islist)
+        {
+            if (step->name == NULL)
+            {
+                atom_lexer_next(lexer);
+                atom_text_t name;
+                atom_lexer_readname(lexer, &name);
+            }
+
+            char end = c == '(' ? ')' : (c == '[' ? ']' : '}');
+            atom_query_scan(state, index + 1, end);
+            if (lexer->errcode != ATOM_ERROR_NONE || state->stop)
+            {
+                return;
+            }
+            atom_lexer_next(lexer);
+        }
+        else
+        {
+            lexer->cursor = cursor;
+            lexer->line   = line;
+            lexer->column = column;
+            if (!atom_lexer_skipitem(lexer))
+            {
+                return;
+            }
+        }
+    }
+}
+
+
+/* @function: atom_query_stream
+*/
+int atom_query_stream(atom_query_t* query, atom_lexer_t* lexer,
+                      atom_bool_t (*callback)(void* context, atom_node_t* node), void* context)
+{
+    atom_assert(query != NULL);
+    atom_assert(lexer != NULL);
+    atom_assert(callback != NULL);
+
+    atom_querystate_t state;
+    state.query    = query;
+    state.lexer    = lexer;
+    state.callback = callback;
+    state.visit    = atom_query_emit;
+    state.context  = context;
+    state.count    = 0;
+    state.stop     = ATOM_FALSE;
+
+    atom_query_scan(&state, 0, 0);
+    return lexer->errcode != ATOM_ERROR_NONE ? lexer->errcode : state.count;
+}
+
+
+/**
+ * Projection parsing state, one slice of steps per depth
+ */
+typedef struct
+{
+    atom_query_t* query;
+    int           step;
+    int           matches;  /* Matches of step among the siblings */
+} atom_projectstep_t;
+
+typedef struct
+{
+    atom_lexer_t*       lexer;
+    atom_projectstep_t* steps;
+    int                 count;  /* Number of queries, size of a slice */
+} atom_projection_t;
+
+/**
+ * Read items of the list at cursor, until close character, keep the matched ones
+ * Matched subtrees are parsed as usual, their ancestors are kept with names only
+ */
+static void atom_project_list(atom_projection_t* projection, atom_projectstep_t* active, int count, atom_node_t* parent, char close)
+{
+    atom_lexer_t*       lexer = projection->lexer;
+    atom_projectstep_t* next  = active + projection->count;
+    atom_bool_t         first = ATOM_TRUE;
+    for (int i = 0; i < count; i++)
+    {
+        active[i].matches = 0;
+    }
+
+    while (lexer->errcode == ATOM_ERROR_NONE)
+    {
+        atom_lexer_skipblank(lexer);
+
+        char c = atom_lexer_peek(lexer);
+        if (c == close)
+        {
+            return;
+        }
+        if (!c)
+        {
+            atom_lexer_error(lexer, ATOM_ERROR_UNBALANCED);
+            return;
+        }
+
+        int         cursor  = lexer->cursor;
+        int         line    = lexer->line;
+        int         column  = lexer->column;
+        atom_bool_t islist  = c == '(' || c == '[' || c == '{';
+        atom_bool_t hasname = ATOM_FALSE;
+        atom_bool_t single  = ATOM_FALSE;
+        atom_text_t name    = ATOM_TEXT_NULL;
+        if (islist)
+        {
+            atom_lexer_next(lexer);
+            hasname = atom_lexer_readname(lexer, &name);
+        }
+        else if (close && first)
+        {
+            /* A single value is the list itself, (x 1) is x = 1, not a child
+             */
+            atom_lexer_skipitem(lexer);
+            atom_lexer_skipblank(lexer);
+            single        = atom_lexer_peek(lexer) == close;
+            lexer->cursor = cursor;
+            lexer->line   = line;
+            lexer->column = column;
+        }
+        first = ATOM_FALSE;
+
+        /* Advance all queries, a finished one take the whole subtree
+         */
+        int         descend  = 0;
+        atom_bool_t finished = ATOM_FALSE;
+        for (int i = 0; i < count; i++)
+        {
+            atom_querystep_t* step  = &active[i].query->steps[active[i].step];
+            atom_bool_t       match = step->name
+                ? hasname && (size_t)(name.tail - name.head) == step->length && atom_textis(lexer, name, step->name)
+                : !single;
+            if (!match || (step->index >= 0 && active[i].matches++ != step->index))
+            {
+                continue;
+            }
+
+            if (active[i].step == active[i].query->count - 1)
+            {
+                finished = ATOM_TRUE;
+            }
+            else if (islist)
+            {
+                next[descend].query = active[i].query;
+                next[descend].step  = active[i].step + 1;
+                descend++;
+            }
+        }
+
+        if (finished)
+        {
+            lexer->cursor = cursor;
+            lexer->line   = line;
+            lexer->column = column;
+            atom_node_t* node = atom_read(lexer);
+            if (!node)
+            {
+                if (lexer->errcode == ATOM_ERROR_NONE)
+                {
+                    atom_lexer_error(lexer, ATOM_ERROR_UNEXPECTED);
+                }
+                return;
+            }
+            atom_addchild(parent, node);
+        }
+        else if (descend > 0)
+        {
+            atom_node_t* list = atom_newlist(hasname ? name : ATOM_TEXT_NULL);
+            if (!list)
+            {
+                lexer->errcode = ATOM_ERROR_OVERFLOW;
+                return;
+            }
+
+            char end = c == '(' ? ')' : (c == '[' ? ']' : '}');
+            atom_project_list(projection, next, descend, list, end);
+            if (lexer->errcode != ATOM_ERROR_NONE)
+            {
+                atom_delete(list);
+                return;
+            }
+            atom_lexer_next(lexer);
+
+            /* Ancestors are only kept for matched subtrees
+             */
+            if (list->children)
+            {
+                atom_addchild(parent, list);
+            }
+            else
+            {
+                atom_delete(list);
+            }
+        }
+        else
+        {
+            lexer->cursor = cursor;
+            lexer->line   = line;
+            lexer->column = column;
+            atom_lexer_skipitem(lexer);
+        }
+    }
+}
+
+
+/* @function: atom_parse_projection
+*/
+atom_node_t* atom_parse_projection(atom_lexer_t* lexer, atom_query_t* const* queries, int count)
+{
+    atom_assert(lexer != NULL);
+    atom_assert(queries != NULL || count == 0);
+
+    int depth = 0;
+    for (int i = 0; i < count; i++)
+    {
+        depth = queries[i]->count > depth ? queries[i]->count : depth;
+    }
+
+    atom_projection_t projection;
+    projection.lexer = lexer;
+    projection.count = count;
+    projection.steps = atom_membuf.extract(atom_membuf.data, sizeof(atom_projectstep_t) * (size_t)(count * depth + 1));
+    atom_node_t* root = atom_newlist(ATOM_TEXT_NULL);
+    if (!projection.steps || !root)
+    {
+        /* @error: Out of memory
+        */
+        if (projection.steps)
+        {
+            atom_membuf.collect(atom_membuf.data, projection.steps);
+        }
+        atom_delete(root);
+        return NULL;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        projection.steps[i].query = queries[i];
+        projection.steps[i].step  = 0;
+    }
+    atom_project_list(&projection, projection.steps, count, root, 0);
+    atom_membuf.collect(atom_membuf.data, projection.steps);
+
+    if (lexer->errcode != ATOM_ERROR_NONE)
+    {
+        atom_delete(root);
+        return NULL;
+    }
+
+    /* Same shape as atom_parse: a single top-level node is the root
+     */
+    if (root->children && root->children == root->lastchild)
+    {
+        atom_node_t* node = atom_removechild(root, root->children);
+        atom_delete(root);
+        return node;
+    }
+    root->data.is_root = ATOM_TRUE;
+    return root;
+}
+
+
+/* @function: atom_parse_paths
+*/
+atom_node_t* atom_parse_paths(atom_lexer_t* lexer, const char* const* paths, int count)
+{
+    atom_assert(lexer != NULL);
+    atom_assert(paths != NULL || count == 0);
+
+    atom_query_t** queries = atom_membuf.extract(atom_membuf.data, sizeof(atom_query_t*) * (size_t)(count + 1));
+    if (!queries)
+    {
+        /* @error: Out of memory
+        */
+        return NULL;
+    }
+
+    atom_node_t* root  = NULL;
+    int          index = 0;
+    for (; index < count; index++)
+    {
+        if (!(queries[index] = atom_query_compile(paths[index])))
+        {
+            lexer->errcode = ATOM_ERROR_ARGUMENTS;
+            break;
+        }
+    }
+    if (index == count)
+    {
+        root = atom_parse_projection(lexer, queries, count);
+    }
+
+    while (index > 0)
+    {
+        atom_query_free(queries[--index]);
+    }
+    atom_membuf.collect(atom_membuf.data, queries);
+    return root;
+}
+
+
+#define ATOM_AGGREGATE_BATCH 256
+
+/**
+ * Aggregation state, numbers are packed in batch before accumulating
+ */
+typedef struct
+{
+    atom_aggregate_t* result;
+    int               length;
+    atom_real_t       values[ATOM_AGGREGATE_BATCH];
+} atom_aggregator_t;
+
+/**
+ * Accumulate packed numbers, lanes are independent so the loops vectorize
+ */
+static void atom_aggregator_flush(atom_aggregator_t* aggregator)
+{
+    atom_aggregate_t*  result = aggregator->result;
+    const atom_real_t* values = aggregator->values;
+    int                length = aggregator->length;
+    if (length == 0)
+    {
+        return;
+    }
+
+    atom_real_t sum[4] = { 0.0, 0.0, 0.0, 0.0 };
+    atom_real_t min[4] = { result->min, result->min, result->min, result->min };
+    atom_real_t max[4] = { result->max, result->max, result->max, result->max };
+    int i = 0;
+    for (; i + 4 <= length; i += 4)
+    {
+        for (int lane = 0; lane < 4; lane++)
+        {
+            atom_real_t value = values[i + lane];
+            sum[lane] += value;
+            min[lane]  = value < min[lane] ? value : min[lane];
+            max[lane]  = value > max[lane] ? value : max[lane];
+        }
+    }
+    for (; i < length; i++)
+    {
+        sum[0] += values[i];
+        min[0]  = values[i] < min[0] ? values[i] : min[0];
+        max[0]  = values[i] > max[0] ? values[i] : max[0];
+    }
+    for (int lane = 0; lane < 4; lane++)
+    {
+        result->sum += sum[lane];
+        result->min  = min[lane] < result->min ? min[lane] : result->min;
+        result->max  = max[lane] > result->max ? max[lane] : result->max;
+    }
+    result->count += length;
+
+    if (result->histogram && result->bins > 0 && result->upper > result->lower)
+    {
+        atom_real_t scale = result->bins / (result->upper - result->lower);
+        for (i = 0; i < length; i++)
+        {
+            atom_real_t value = values[i];
+            if (value >= result->lower && value < result->upper)
+            {
+                int bin = (int)((value - result->lower) * scale);
+                result->histogram[bin < result->bins ? bin : result->bins - 1]++;
+            }
+            else
+            {
+                result->outliers++;
+            }
+        }
+    }
+
+    aggregator->length = 0;
+}
+
+/**
+ * Pack a number
+ */
+static void atom_aggregator_push(atom_aggregator_t* aggregator, atom_real_t value)
+{
+    aggregator->values[aggregator->length++] = value;
+    if (aggregator->length == ATOM_AGGREGATE_BATCH)
+    {
+        atom_aggregator_flush(aggregator);
+    }
+}
+
+/**
+ * Take the numbers of the matched item at cursor: the value of (x 1.0),
+ * the numbers directly in (x 1 2 3), or the number itself
+ */
+static atom_bool_t atom_aggregator_visit(atom_querystate_t* state)
+{
+    atom_aggregator_t* aggregator = (atom_aggregator_t*)state->context;
+    atom_lexer_t*      lexer      = state->lexer;
+    atom_real_t        value;
+
+    char c = atom_lexer_peek(lexer);
+    state->count++;
+    if (c != '(' && c != '[' && c != '{')
+    {
+        if (atom_ispunct(c))
+        {
+            return atom_lexer_skipitem(lexer);
+        }
+        if (atom_lexer_readnumber(lexer, &value))
+        {
+            atom_aggregator_push(aggregator, value);
+        }
+        return ATOM_TRUE;
+    }
+
+    char        close = c == '(' ? ')' : (c == '[' ? ']' : '}');
+    atom_text_t name;
+    atom_lexer_next(lexer);
+    atom_lexer_readname(lexer, &name);
+    while (ATOM_TRUE)
+    {
+        atom_lexer_skipblank(lexer);
+        c = atom_lexer_peek(lexer);
+        if (c == close)
+        {
+            atom_lexer_next(lexer);
+            return ATOM_TRUE;
+        }
+        if (!c)
+        {
+            atom_lexer_error(lexer, ATOM_ERROR_UNBALANCED);
+            return ATOM_FALSE;
+        }
+
+        if (atom_ispunct(c))
+        {
+            /* Texts and sub-lists are not aggregated
+            */
+            if (!atom_lexer_skipitem(lexer))
+            {
+                return ATOM_FALSE;
+            }
+        }
+        else if (atom_lexer_readnumber(lexer, &value))
+        {
+            atom_aggregator_push(aggregator, value);
+        }
+    }
+}
+
+
+/* @function: atom_aggregate_init
+*/
+void atom_aggregate_init(atom_aggregate_t* aggregate, atom_long_t* histogram, int bins, atom_real_t lower, atom_real_t upper)
+{
+    atom_assert(aggregate != NULL);
+
+    aggregate->count     = 0;
+    aggregate->sum       = 0.0;
+    aggregate->min       = HUGE_VAL;
+    aggregate->max       = -HUGE_VAL;
+    aggregate->histogram = histogram;
+    aggregate->bins      = histogram ? bins : 0;
+    aggregate->lower     = lower;
+    aggregate->upper     = upper;
+    aggregate->outliers  = 0;
+    if (histogram)
+    {
+        memset(histogram, 0, sizeof(atom_long_t) * (size_t)bins);
+    }
+}
+
+
+/* @function: atom_aggregate
+*/
+int atom_aggregate(atom_query_t* query, atom_lexer_t* lexer, atom_aggregate_t* aggregate)
+{
+    atom_assert(query != NULL);
+    atom_assert(lexer != NULL);
+    atom_assert(aggregate != NULL);
+
+    atom_aggregator_t aggregator;
+    aggregator.result = aggregate;
+    aggregator.length = 0;
+
+    atom_querystate_t state;
+    state.query    = query;
+    state.lexer    = lexer;
+    state.callback = NULL;
+    state.visit    = atom_aggregator_visit;
+    state.context  = &aggregator;
+    state.count    = 0;
+    state.stop     = ATOM_FALSE;
+
+    atom_query_scan(&state, 0, 0);
+    atom_aggregator_flush(&aggregator);
+    return lexer->errcode;
+}
+
+
+/**
+ * Active step of a column path while scanning a record
+ */
+typedef struct
+{
+    int column;
+    int step;
+    int matches;  /* Matches of step among the siblings */
+} atom_tablestep_t;
+
+/**
+ * Move array to a bigger block, old block is released on success
+ */
+static void* atom_table_regrow(void* array, size_t used, size_t size)
+{
+    void* result = atom_membuf.extract(atom_membuf.data, size);
+    if (result && array)
+    {
+        memcpy(result, array, used);
+        atom_membuf.collect(atom_membuf.data, array);
+    }
+    return result;
+}
+
+/**
+ * Make room for rows in all columns
+ */
+static atom_bool_t atom_table_reserve(atom_table_t* table, size_t rows)
+{
+    if (rows <= table->capacity)
+    {
+        return ATOM_TRUE;
+    }
+
+    size_t capacity = table->capacity > 0 ? table->capacity * 2 : 1024;
+    while (capacity < rows)
+    {
+        capacity *= 2;
+    }
+
+    for (int i = 0; i < table->count; i++)
+    {
+        atom_column_t* column = &table->columns[i];
+        void*          values;
+        switch (column->type)
+        {
+        case ATOM_LONG:
+            values = atom_table_regrow(column->longs, sizeof(atom_long_t) * table->rows, sizeof(atom_long_t) * capacity);
+            column->longs = values ? (atom_long_t*)values : column->longs;
+            break;
+
+        case ATOM_REAL:
+            values = atom_table_regrow(column->reals, sizeof(atom_real_t) * table->rows, sizeof(atom_real_t) * capacity);
+            column->reals = values ? (atom_real_t*)values : column->reals;
+            break;
+
+        default:
+            values = atom_table_regrow(column->offsets, sizeof(int64_t) * (table->rows + 1), sizeof(int64_t) * (capacity + 1));
+            column->offsets = values ? (int64_t*)values : column->offsets;
+            break;
+        }
+
+        char* valid = values ? atom_table_regrow(column->valid, table->rows, capacity) : NULL;
+        if (!valid)
+        {
+            /* @error: Out of memory, columns grown so far keep the bigger arrays
+            */
+            return ATOM_FALSE;
+        }
+        column->valid = valid;
+    }
+    table->capacity = capacity;
+    return ATOM_TRUE;
+}
+
+/**
+ * Append a text to the last row of a text column
+ */
+static atom_bool_t atom_table_puttext(atom_column_t* column, size_t row, atom_lexer_t* lexer, atom_text_t text)
+{
+    size_t length = atom_textlength(lexer, text);
+    size_t offset = (size_t)column->offsets[row];
+    if (offset + length > column->size)
+    {
+        size_t size  = column->size > 0 ? column->size * 2 : 4096;
+        while (size < offset + length)
+        {
+            size *= 2;
+        }
+
+        char* bytes = atom_table_regrow(column->bytes, offset, size);
+        if (!bytes)
+        {
+            /* @error: Out of memory
+            */
+            return ATOM_FALSE;
+        }
+        column->bytes = bytes;
+        column->size  = size;
+    }
+
+    atom_textread(lexer, text, 0, column->bytes + offset, length);
+    column->offsets[row + 1] = (int64_t)(offset + length);
+    return ATOM_TRUE;
+}
+
+/**
+ * Read a single value at cursor into column, values of other type are skipped
+ * Cursor stop at close character of the list
+ */
+static void atom_table_readscalar(atom_column_t* column, size_t row, atom_lexer_t* lexer)
+{
+    atom_text_t text;
+    atom_data_t value;
+
+    char c = atom_lexer_peek(lexer);
+    if (c == '"')
+    {
+        text.head = lexer->cursor + 1;
+        if (atom_lexer_skipitem(lexer) && column->type == ATOM_TEXT)
+        {
+            text.tail = lexer->cursor - 1;
+            column->valid[row] = atom_table_puttext(column, row, lexer, text);
+        }
+        return;
+    }
+    if (c == '(' || c == '[' || c == '{')
+    {
+        atom_lexer_skipitem(lexer);
+        return;
+    }
+    if (!c || atom_ispunct(c))
+    {
+        return;
+    }
+
+    text.head = lexer->cursor;
+    switch (atom_lexer_readvalue(lexer, &value))
+    {
+    case ATOM_LONG:
+        if (column->type == ATOM_LONG)
+        {
+            column->longs[row] = value.as_long;
+            column->valid[row] = ATOM_TRUE;
+            return;
+        }
+        if (column->type == ATOM_REAL)
+        {
+            column->reals[row] = (atom_real_t)value.as_long;
+            column->valid[row] = ATOM_TRUE;
+            return;
+        }
+        break;
+
+    case ATOM_REAL:
+        if (column->type == ATOM_REAL)
+        {
+            column->reals[row] = value.as_real;
+            column->valid[row] = ATOM_TRUE;
+            return;
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    /* Text column take tokens as they are written
+    */
+    if (column->type == ATOM_TEXT)
+    {
+        text.tail = lexer->cursor;
+        column->valid[row] = atom_table_puttext(column, row, lexer, text);
+    }
+}
+
+/**
+ * Read the field value at cursor, (x 1.5) or the value itself
+ */
+static void atom_table_readfield(atom_column_t* column, size_t row, atom_lexer_t* lexer)
+{
+    char c = atom_lexer_peek(lexer);
+    if (column->valid[row] || (c != '(' && c != '[' && c != '{'))
+    {
+        /* Only the first field of the record is taken
+        */
+        if (column->valid[row])
+        {
+            atom_lexer_skipitem(lexer);
+        }
+        else
+        {
+            atom_table_readscalar(column, row, lexer);
+        }
+        return;
+    }
+
+    char        close = c == '(' ? ')' : (c == '[' ? ']' : '}');
+    atom_text_t name;
+    atom_lexer_next(lexer);
+    atom_lexer_readname(lexer, &name);
+    atom_lexer_skipblank(lexer);
+    atom_table_readscalar(column, row, lexer);
+    while (lexer->errcode == ATOM_ERROR_NONE)
+    {
+        atom_lexer_skipblank(lexer);
+        c = atom_lexer_peek(lexer);
+        if (c == close)
+        {
+            atom_lexer_next(lexer);
+            return;
+        }
+        if (!c)
+        {
+            atom_lexer_error(lexer, ATOM_ERROR_UNBALANCED);
+            return;
+        }
+        atom_lexer_skipitem(lexer);
+    }
+}
+
+/**
+ * Match column paths over items of the record list at cursor, until close character
+ */
+static void atom_table_scan(atom_table_t* table, atom_lexer_t* lexer, atom_tablestep_t* active, int count, char close)
+{
+    atom_tablestep_t* next  = active + table->count;
+    size_t            row   = table->rows;
+    atom_bool_t       first = ATOM_TRUE;
+    for (int i = 0; i < count; i++)
+    {
+        active[i].matches = 0;
+    }
+
+    while (lexer->errcode == ATOM_ERROR_NONE)
+    {
+        atom_lexer_skipblank(lexer);
+
+        char c = atom_lexer_peek(lexer);
+        if (c == close)
+        {
+            return;
+        }
+        if (!c)
+        {
+            atom_lexer_error(lexer, ATOM_ERROR_UNBALANCED);
+            return;
+        }
+
+        int         cursor  = lexer->cursor;
+        int         line    = lexer->line;
+        int         column  = lexer->column;
+        atom_bool_t islist  = c == '(' || c == '[' || c == '{';
+        atom_bool_t hasname = ATOM_FALSE;
+        atom_bool_t single  = ATOM_FALSE;
+        atom_text_t name    = ATOM_TEXT_NULL;
+        if (islist)
+        {
+            atom_lexer_next(lexer);
+            hasname = atom_lexer_readname(lexer, &name);
+        }
+        else if (first)
+        {
+            /* A single value is the list itself, (x 1) is x = 1, not a child
+             */
+            atom_lexer_skipitem(lexer);
+            atom_lexer_skipblank(lexer);
+            single = atom_lexer_peek(lexer) == close;
+        }
+        first = ATOM_FALSE;
+
+        int         descend  = 0;
+        atom_bool_t finished = ATOM_FALSE; /* Cursor is after the item */
+        for (int i = 0; i < count; i++)
+        {
+            atom_query_t*     query = table->queries[active[i].column];
+            atom_querystep_t* step  = &query->steps[active[i].step];
+            atom_bool_t       match = step->name
+                ? hasname && (size_t)(name.tail - name.head) == step->length && atom_textis(lexer, name, step->name)
+                : !single;
+            if (!match || (step->index >= 0 && active[i].matches++ != step->index))
+            {
+                continue;
+            }
+
+            if (active[i].step == query->count - 1)
+            {
+                lexer->cursor = cursor;
+                lexer->line   = line;
+                lexer->column = column;
+                atom_table_readfield(&table->columns[active[i].column], row, lexer);
+                finished = ATOM_TRUE;
+            }
+            else if (islist)
+            {
+                next[descend].column = active[i].column;
+                next[descend].step   = active[i].step + 1;
+                descend++;
+            }
+        }
+
+        if (descend > 0 || !finished)
+        {
+            lexer->cursor = cursor;
+            lexer->line   = line;
+            lexer->column = column;
+        }
+        if (descend > 0)
+        {
+            char end = c == '(' ? ')' : (c == '[' ? ']' : '}');
+            atom_lexer_next(lexer);
+            atom_lexer_readname(lexer, &name);
+            atom_table_scan(table, lexer, next, descend, end);
+            if (lexer->errcode != ATOM_ERROR_NONE)
+            {
+                return;
+            }
+            atom_lexer_next(lexer);
+        }
+        else if (!finished)
+        {
+            atom_lexer_skipitem(lexer);
+        }
+    }
+}
+
+/**
+ * Extract top-level records until cursor reach end
+ */
+static int atom_table_extractrange(atom_table_t* table, atom_lexer_t* lexer, size_t end)
+{
+    atom_tablestep_t* steps = atom_membuf.extract(atom_membuf.data, sizeof(atom_tablestep_t) * (size_t)(table->count * table->depth + 1));
+    if (!steps)
+    {
+        /* @error: Out of memory
+        */
+        return ATOM_ERROR_OVERFLOW;
+    }
+
+    while (lexer->errcode == ATOM_ERROR_NONE)
+    {
+        atom_lexer_skipblank(lexer);
+        if (atom_lexer_iseof(lexer) || (size_t)lexer->cursor >= end)
+        {
+            break;
+        }
+
+        char c = atom_lexer_peek(lexer);
+        if (c != '(' && c != '[' && c != '{')
+        {
+            atom_lexer_skipitem(lexer);
+            continue;
+        }
+
+        /* A new row, fields not found in the record stay invalid
+        */
+        size_t row = table->rows;
+        if (!atom_table_reserve(table, row + 1))
+        {
+            lexer->errcode = ATOM_ERROR_OVERFLOW;
+            break;
+        }
+        for (int i = 0; i < table->count; i++)
+        {
+            atom_column_t* column = &table->columns[i];
+            column->valid[row] = ATOM_FALSE;
+            switch (column->type)
+            {
+            case ATOM_LONG: column->longs[row]       = 0;                    break;
+            case ATOM_REAL: column->reals[row]       = 0.0;                  break;
+            default:        column->offsets[row + 1] = column->offsets[row]; break;
+            }
+            steps[i].column = i;
+            steps[i].step   = 0;
+        }
+
+        char        close = c == '(' ? ')' : (c == '[' ? ']' : '}');
+        atom_text_t name;
+        atom_lexer_next(lexer);
+        atom_lexer_readname(lexer, &name);
+        atom_table_scan(table, lexer, steps, table->count, close);
+        if (lexer->errcode != ATOM_ERROR_NONE)
+        {
+            break;
+        }
+        atom_lexer_next(lexer);
+        table->rows++;
+    }
+
+    atom_membuf.collect(atom_membuf.data, steps);
+    return lexer->errcode;
+}
+
+
+
+/* @function: atom_table_create
+*/
+atom_table_t* atom_table_create(const char* const* paths, const atom_type_t* types, int count)
+{
+    atom_assert(paths != NULL || count == 0);
+    atom_assert(types != NULL || count == 0);
+
+    atom_table_t* table = atom_membuf.extract(atom_membuf.data, sizeof(atom_table_t) + (sizeof(atom_column_t) + sizeof(atom_query_t*)) * (size_t)count);
+    if (!table)
+    {
+        /* @error: Out of memory
+        */
+        return NULL;
+    }
+    memset(table, 0, sizeof(atom_table_t) + (sizeof(atom_column_t) + sizeof(atom_query_t*)) * (size_t)count);
+    table->columns = (atom_column_t*)(table + 1);
+    table->queries = (atom_query_t**)(table->columns + count);
+
+    for (; table->count < count; table->count++)
+    {
+        atom_assert(types[table->count] == ATOM_LONG || types[table->count] == ATOM_REAL || types[table->count] == ATOM_TEXT);
+
+        atom_column_t* column = &table->columns[table->count];
+        atom_query_t*  query  = atom_query_compile(paths[table->count]);
+        column->path = atom_strdup(paths[table->count], NULL);
+        column->type = types[table->count];
+        table->queries[table->count] = query;
+        if (!query || !column->path)
+        {
+            table->count++;
+            atom_table_free(table);
+            return NULL;
+        }
+        table->depth = query->count > table->depth ? query->count : table->depth;
+    }
+
+    if (!atom_table_reserve(table, 1))
+    {
+        atom_table_free(table);
+        return NULL;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        if (table->columns[i].type == ATOM_TEXT)
+        {
+            table->columns[i].offsets[0] = 0;
+        }
+    }
+    return table;
+}
+
+
+/**
+ * Collect leaf fields of a record, paths are joined with '/'
+ */
+static int atom_table_leaves(atom_lexer_t* lexer, atom_node_t* node, char* path, size_t length, char** paths, atom_type_t* types, int count)
+{
+    for (atom_node_t* child = node->children; child; child = child->next)
+    {
+        atom_lexer_t* source = atom_nodelexer(lexer, child);
+        size_t        size   = atom_textlength(source, child->name);
+        if (!atom_hasname(source, child) || length + size + 2 > 1024)
+        {
+            continue;
+        }
+
+        size_t end = length;
+        if (end > 0)
+        {
+            path[end++] = '/';
+        }
+        end += atom_textread(source, child->name, 0, path + end, size);
+        path[end] = 0;
+
+        if (child->type == ATOM_LIST)
+        {
+            count = atom_table_leaves(lexer, child, path, end, paths, types, count);
+            continue;
+        }
+
+        /* Only count when paths is NULL, else the first field win as extraction do
+        */
+        int i = 0;
+        while (paths && i < count && strcmp(paths[i], path) != 0)
+        {
+            i++;
+        }
+        if (!paths)
+        {
+            count++;
+        }
+        else if (i == count)
+        {
+            if (!(paths[count] = atom_strdup(path, NULL)))
+            {
+                return -1;
+            }
+            types[count++] = child->type;
+        }
+    }
+    return count;
+}
+
+/* @function: atom_table_infer
+*/
+atom_table_t* atom_table_infer(atom_lexer_t* lexer)
+{
+    atom_assert(lexer != NULL);
+
+    /* Read the first record, then rewind
+    */
+    int cursor = lexer->cursor;
+    int line   = lexer->line;
+    int column = lexer->column;
+    atom_lexer_skipblank(lexer);
+    while (!atom_lexer_iseof(lexer) && atom_lexer_peek(lexer) != '(' && atom_lexer_peek(lexer) != '[' && atom_lexer_peek(lexer) != '{')
+    {
+        if (!atom_lexer_skipitem(lexer))
+        {
+            return NULL;
+        }
+        atom_lexer_skipblank(lexer);
+    }
+    atom_node_t* record = atom_lexer_iseof(lexer) ? NULL : atom_read(lexer);
+    lexer->cursor = cursor;
+    lexer->line   = line;
+    lexer->column = column;
+    if (!record || record->type != ATOM_LIST)
+    {
+        atom_delete(record);
+        return NULL;
+    }
+
+    /* Count leaves first, duplicates are counted so it's an upper bound
+     */
+    char path[1024];
+    path[0] = 0;
+    int count = atom_table_leaves(lexer, record, path, 0, NULL, NULL, 0);
+
+    char**        paths = atom_membuf.extract(atom_membuf.data, (sizeof(char*) + sizeof(atom_type_t)) * (size_t)(count + 1));
+    atom_table_t* table = NULL;
+    if (paths)
+    {
+        atom_type_t* types = (atom_type_t*)(paths + count + 1);
+        count = atom_table_leaves(lexer, record, path, 0, paths, types, 0);
+        if (count >= 0)
+        {
+            table = atom_table_create((const char* const*)paths, types, count);
+        }
+        for (int i = 0; i < count; i++)
+        {
+            atom_membuf.collect(atom_membuf.data, paths[i]);
+        }
+        atom_membuf.collect(atom_membuf.data, paths);
+    }
+    atom_delete(record);
+    return table;
+}
+
+
+/* @function: atom_table_free
+*/
+void atom_table_free(atom_table_t* table)
+{
+    if (!table)
+    {
+        return;
+    }
+
+    for (int i = 0; i < table->count; i++)
+    {
+        atom_column_t* column = &table->columns[i];
+        void* arrays[] = { column->path, column->longs, column->reals, column->offsets, column->bytes, column->valid };
+        for (size_t j = 0; j < sizeof(arrays) / sizeof(arrays[0]); j++)
+        {
+            if (arrays[j])
+            {
+                atom_membuf.collect(atom_membuf.data, arrays[j]);
+            }
+        }
+        atom_query_free(table->queries[i]);
+    }
+    atom_membuf.collect(atom_membuf.data, table);
+}
+
+
+/* @function: atom_table_extract
+*/
+int atom_table_extract(atom_table_t* table, atom_lexer_t* lexer)
+{
+    atom_assert(table != NULL);
+    atom_assert(lexer != NULL);
+
+    return atom_table_extractrange(table, lexer, lexer->length);
+}
+
+
+#ifdef ATOM_THREADS
+/**
+ * Append rows of other table with the same schema
+ */
+static atom_bool_t atom_table_append(atom_table_t* table, atom_table_t* other)
+{
+    if (!atom_table_reserve(table, table->rows + other->rows))
+    {
+        return ATOM_FALSE;
+    }
+
+    for (int i = 0; i < table->count; i++)
+    {
+        atom_column_t* column = &table->columns[i];
+        atom_column_t* source = &other->columns[i];
+        memcpy(column->valid + table->rows, source->valid, other->rows);
+        switch (column->type)
+        {
+        case ATOM_LONG:
+            memcpy(column->longs + table->rows, source->longs, sizeof(atom_long_t) * other->rows);
+            break;
+
+        case ATOM_REAL:
+            memcpy(column->reals + table->rows, source->reals, sizeof(atom_real_t) * other->rows);
+            break;
+
+        default:
+        {
+            size_t offset = (size_t)column->offsets[table->rows];
+            size_t length = (size_t)source->offsets[other->rows];
+            if (offset + length > column->size)
+            {
+                char* bytes = atom_table_regrow(column->bytes, offset, offset + length);
+                if (!bytes)
+                {
+                    return ATOM_FALSE;
+                }
+                column->bytes = bytes;
+                column->size  = offset + length;
+            }
+            if (length > 0)
+            {
+                memcpy(column->bytes + offset, source->bytes, length);
+            }
+            for (size_t row = 1; row <= other->rows; row++)
+            {
+                column->offsets[table->rows + row] = (int64_t)offset + source->offsets[row];
+            }
+        } break;
+        }
+    }
+    table->rows += other->rows;
+    return ATOM_TRUE;
+}
+
+/**
+ * A range of the input, extracted by one worker into its own table
+ * The range start is a guess: a list at the start of a line
+ */
+typedef struct
+{
+    atom_table_t* table;
+    atom_heap_t   heap;    /* Scratch heap of table, the current heap may not be thread-safe */
+    atom_lexer_t  lexer;
+    size_t        end;
+    int           errcode;
+    pthread_t     thread;
+    atom_bool_t   started;
+} atom_tablechunk_t;
+
+/**
+ * Worker of parallel extraction
+ */
+static void* atom_tablechunk_worker(void* arg)
+{
+    atom_tablechunk_t* chunk = (atom_tablechunk_t*)arg;
+    atom_heap_t*       prev  = atom_useheap(&chunk->heap);
+    chunk->errcode = atom_table_extractrange(chunk->table, &chunk->lexer, chunk->end);
+    atom_useheap(prev);
+    return NULL;
+}
+#endif
+
+/* @function: atom_table_extract_parallel
+*/
+int atom_table_extract_parallel(atom_table_t* table, atom_lexer_t* lexer, int threads)
+{
+    atom_assert(table != NULL);
+    atom_assert(lexer != NULL);
+
+#ifdef ATOM_THREADS
+    if (threads > 1 && lexer->type == ATOM_LEXER_STRING)
+    {
+        atom_tablechunk_t* chunks = atom_membuf.extract(atom_membuf.data, sizeof(atom_tablechunk_t) * (size_t)threads);
+        if (!chunks)
+        {
+            /* @error: Out of memory
+            */
+            return ATOM_ERROR_OVERFLOW;
+        }
+
+        /* Guess record starts near equal offsets, a wrong guess is found later
+         * when the previous chunk does not end exactly there
+         */
+        const char* string = lexer->string;
+        size_t      length = lexer->length;
+        size_t      start  = (size_t)lexer->cursor;
+        int         count  = 0;
+        for (int i = 0; i < threads; i++)
+        {
+            size_t offset = start + (length - start) * (size_t)i / (size_t)threads;
+            if (i > 0)
+            {
+                while (offset < length && !(string[offset] == '(' && string[offset - 1] == '\n'))
+                {
+                    offset++;
+                }
+                if (offset >= length || offset <= (size_t)chunks[count - 1].lexer.cursor)
+                {
+                    continue;
+                }
+                chunks[count - 1].end = offset;
+            }
+
+            atom_tablechunk_t* chunk = &chunks[count++];
+            chunk->lexer        = *lexer;
+            chunk->lexer.cursor = (int)offset;
+            chunk->end          = length;
+            chunk->errcode      = ATOM_ERROR_NONE;
+            chunk->started      = ATOM_FALSE;
+            chunk->table        = NULL;
+            memset(&chunk->heap, 0, sizeof(chunk->heap));
+            chunk->heap.extract = atom_malloc;
+            chunk->heap.collect = atom_free;
+        }
+
+        /* Chunk tables share the schema of table
+        */
+        int errcode = ATOM_ERROR_NONE;
+        for (int i = 0; i < count && errcode == ATOM_ERROR_NONE; i++)
+        {
+            const char** paths = atom_membuf.extract(atom_membuf.data, (sizeof(char*) + sizeof(atom_type_t)) * (size_t)(table->count + 1));
+            if (!paths)
+            {
+                errcode = ATOM_ERROR_OVERFLOW;
+                break;
+            }
+            atom_type_t* types = (atom_type_t*)(paths + table->count + 1);
+            for (int j = 0; j < table->count; j++)
+            {
+                paths[j] = table->columns[j].path;
+                types[j] = table->columns[j].type;
+            }
+            atom_heap_t* prev = atom_useheap(&chunks[i].heap);
+            chunks[i].table = atom_table_create(paths, types, table->count);
+            atom_useheap(prev);
+            atom_membuf.collect(atom_membuf.data, paths);
+            if (!chunks[i].table)
+            {
+                errcode = ATOM_ERROR_OVERFLOW;
+            }
+        }
+
+        if (errcode == ATOM_ERROR_NONE)
+        {
+            for (int i = 1; i < count; i++)
+            {
+                chunks[i].started = pthread_create(&chunks[i].thread, NULL, atom_tablechunk_worker, &chunks[i]) == 0;
+            }
+            atom_tablechunk_worker(&chunks[0]);
+            for (int i = 1; i < count; i++)
+            {
+                if (chunks[i].started)
+                {
+                    pthread_join(chunks[i].thread, NULL);
+                }
+                else
+                {
+                    atom_tablechunk_worker(&chunks[i]);
+                }
+            }
+
+            /* Merge chunks while their starts are confirmed,
+             * the rest after a wrong guess is extracted again
+             */
+            int merged = 0;
+            for (; merged < count; merged++)
+            {
+                atom_tablechunk_t* chunk = &chunks[merged];
+                if (chunk->errcode != ATOM_ERROR_NONE)
+                {
+                    errcode = chunk->errcode;
+                    *lexer  = chunk->lexer;
+                    break;
+                }
+                if (!atom_table_append(table, chunk->table))
+                {
+                    errcode = ATOM_ERROR_OVERFLOW;
+                    break;
+                }
+                lexer->cursor = chunk->lexer.cursor;
+                if (merged + 1 < count && (size_t)chunk->lexer.cursor != chunk->end)
+                {
+                    merged++;
+                    break;
+                }
+            }
+            if (errcode == ATOM_ERROR_NONE && merged < count)
+            {
+                errcode = atom_table_extractrange(table, lexer, length);
+            }
+        }
+
+        for (int i = 0; i < count; i++)
+        {
+            atom_heap_t* prev = atom_useheap(&chunks[i].heap);
+            atom_table_free(chunks[i].table);
+            atom_useheap(prev);
+        }
+        atom_membuf.collect(atom_membuf.data, chunks);
+        return errcode;
+    }
+#else
+    (void)threads;
+#endif
+
+    return atom_table_extract(table, lexer);
+}
+
+
+/**
+ * Diff state
+ */
+typedef struct
+{
+    atom_lexer_t* alexer;
+    atom_lexer_t* blexer;
+    atom_node_t*  script;
+    int*          path;     /* Indices from root to current list */
+    int           depth;
+    int           capacity;
+    int           errcode;
+} atom_differ_t;
+
+/**
+ * Create a list with a keyword name
+ */
+static atom_node_t* atom_differ_keyword(const char* keyword)
+{
+    atom_node_t* node = atom_newlist(ATOM_TEXT_NULL);
+    if (node)
+    {
+        node->flags     = ATOM_NODE_CSTR;
+        node->name.cstr = keyword;
+    }
+    return node;
+}
+
+/**
+ * Create a path index value
+ */
+static atom_node_t* atom_differ_index(int index)
+{
+    atom_node_t* node = atom_newlong(ATOM_TEXT_NULL, index);
+    if (node)
+    {
+        node->flags     = ATOM_NODE_CSTR;
+        node->name.cstr = NULL;
+    }
+    return node;
+}
+
+/**
+ * Append an edit to script: (keyword (at path... index) [node] [target])
+ * @param index  - index in current list, negative mean the current list itself
+ * @param node   - new subtree for insert and replace, owned by script after call
+ * @param target - destination index for move, negative mean none
+ */
+static void atom_differ_emit(atom_differ_t* differ, const char* keyword, int index, atom_node_t* node, int target)
+{
+    atom_node_t* edit = atom_differ_keyword(keyword);
+    atom_node_t* at   = atom_differ_keyword("at");
+    if (!edit || !at)
+    {
+        differ->errcode = ATOM_ERROR_OVERFLOW;
+        atom_delete(edit);
+        atom_delete(at);
+        atom_delete(node);
+        return;
+    }
+    atom_addchild(edit, at);
+    atom_addchild(differ->script, edit);
+
+    for (int i = 0; i <= differ->depth; i++)
+    {
+        int value = i < differ->depth ? differ->path[i] : index;
+        if (value < 0)
+        {
+            break;
+        }
+
+        atom_node_t* child = atom_differ_index(value);
+        if (!child)
+        {
+            differ->errcode = ATOM_ERROR_OVERFLOW;
+            atom_delete(node);
+            return;
+        }
+        atom_addchild(at, child);
+    }
+
+    if (node)
+    {
+        atom_addchild(edit, node);
+    }
+    if (target >= 0)
+    {
+        atom_node_t* child = atom_differ_index(target);
+        if (!child)
+        {
+            differ->errcode = ATOM_ERROR_OVERFLOW;
+            return;
+        }
+        atom_addchild(edit, child);
+    }
+}
+
+/**
+ * Emit an edit with a copy of b as new subtree
+ */
+static void atom_differ_emitcopy(atom_differ_t* differ, const char* keyword, int index, atom_node_t* b)
+{
+    atom_node_t* copy = atom_clone(differ->blexer, b);
+    if (!copy)
+    {
+        differ->errcode = ATOM_ERROR_OVERFLOW;
+        return;
+    }
+    atom_differ_emit(differ, keyword, index, copy, -1);
+}
+
+/**
+ * Find index of value in array
+ */
+static int atom_differ_find(const int* array, int count, int value)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (array[i] == value)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void atom_differ_node(atom_differ_t* differ, atom_node_t* a, atom_node_t* b, int index);
+
+/**
+ * Diff children of two lists with same name
+ * Children are matched by subtree hash first, then by name. Matched children
+ * that are not equal are diffed recursively, the rest are deleted or inserted,
+ * and matched children out of the longest increasing order are moved.
+ */
+static void atom_differ_list(atom_differ_t* differ, atom_node_t* a, atom_node_t* b)
+{
+    int n = 0;
+    int m = 0;
+    for (atom_node_t* child = a->children; child; child = child->next) n++;
+    for (atom_node_t* child = b->children; child; child = child->next) m++;
+
+    int buckets = 1;
+    while (buckets < 2 * n)
+    {
+        buckets *= 2;
+    }
+
+    /* Temporary memory, all in one block
+     */
+    size_t        size   = sizeof(atom_node_t*) * (n + m) + sizeof(int) * (buckets + 7 * n + 2 * m + 2);
+    atom_node_t** achild = atom_membuf.extract(atom_membuf.data, size);
+    if (!achild)
+    {
+        differ->errcode = ATOM_ERROR_OVERFLOW;
+        return;
+    }
+    atom_node_t** bchild = achild + n;
+    int*          heads  = (int*)(bchild + m);
+    int*          chain  = heads + buckets;
+    int*          used   = chain + n;      /* A child is matched              */
+    int*          rank   = used + n;       /* Position of A child in matched B order */
+    int*          order  = rank + n;       /* Current order of matched A children    */
+    int*          sorted = order + n;      /* Matched A children in B order   */
+    int*          tails  = sorted + n;     /* LIS helpers                     */
+    int*          links  = tails + n + 1;
+    int*          match  = links + n + 1;  /* A child matched to B child, -1 if none */
+    int*          paired = match + m;      /* Match by name, not by equality  */
+
+    int i = 0;
+    for (atom_node_t* child = a->children; child; child = child->next) achild[i++] = child;
+    i = 0;
+    for (atom_node_t* child = b->children; child; child = child->next) bchild[i++] = child;
+
+    for (i = 0; i < n; i++) used[i] = 0;
+    for (i = 0; i < m; i++) match[i] = -1, paired[i] = 0;
+
+    /* Match equal subtrees, chains keep lower index first
+     */
+    for (i = 0; i < buckets; i++) heads[i] = -1;
+    for (i = n - 1; i >= 0; i--)
+    {
+        int bucket = (int)(atom_hash(differ->alexer, achild[i]) & (buckets - 1));
+        chain[i]   = heads[bucket];
+        heads[bucket] = i;
+    }
+    for (int j = 0; j < m && n > 0; j++)
+    {
+        uint64_t hash = atom_hash(differ->blexer, bchild[j]);
+        for (i = heads[hash & (buckets - 1)]; i >= 0; i = chain[i])
+        {
+            if (!used[i] && achild[i]->hash == hash && atom_equal(differ->alexer, achild[i], differ->blexer, bchild[j]))
+            {
+                used[i]  = 1;
+                match[j] = i;
+                break;
+            }
+        }
+    }
+
+    /* Match the rest by name
+     */
+    for (i = 0; i < buckets; i++) heads[i] = -1;
+    for (i = n - 1; i >= 0; i--)
+    {
+        if (!used[i])
+        {
+            atom_lexer_t* lexer = atom_nodelexer(differ->alexer, achild[i]);
+            int bucket    = (int)(atom_hashtext(lexer, achild[i]->name) & (buckets - 1));
+            chain[i]      = heads[bucket];
+            heads[bucket] = i;
+        }
+    }
+    for (int j = 0; j < m && n > 0; j++)
+    {
+        if (match[j] >= 0)
+        {
+            continue;
+        }
+
+        atom_lexer_t* blexer = atom_nodelexer(differ->blexer, bchild[j]);
+        uint64_t      hash   = atom_hashtext(blexer, bchild[j]->name);
+        for (i = heads[hash & (buckets - 1)]; i >= 0; i = chain[i])
+        {
+            atom_lexer_t* alexer = atom_nodelexer(differ->alexer, achild[i]);
+            if (!used[i] && atom_textequal(alexer, achild[i]->name, blexer, bchild[j]->name))
+            {
+                used[i]   = 1;
+                match[j]  = i;
+                paired[j] = 1;
+                break;
+            }
+        }
+    }
+
+    /* Diff paired children first, while indices are still the original ones
+     */
+    for (int j = 0; j < m && differ->errcode == ATOM_ERROR_NONE; j++)
+    {
+        if (paired[j])
+        {
+            atom_differ_node(differ, achild[match[j]], bchild[j], match[j]);
+        }
+    }
+
+    /* Delete from the back, so indices of the rest are not changed
+     */
+    for (i = n - 1; i >= 0 && differ->errcode == ATOM_ERROR_NONE; i--)
+    {
+        if (!used[i])
+        {
+            atom_differ_emit(differ, "delete", i, NULL, -1);
+        }
+    }
+
+    /* Longest increasing subsequence of matched children stay, others move
+     */
+    int count = 0;
+    for (int j = 0; j < m; j++)
+    {
+        if (match[j] >= 0)
+        {
+            rank[match[j]]  = count;
+            sorted[count++] = match[j];
+        }
+    }
+    int k = 0;
+    for (i = 0; i < n; i++)
+    {
+        if (used[i])
+        {
+            order[k++] = i;
+        }
+    }
+
+    int length = 0;
+    for (int t = 0; t < k; t++)
+    {
+        int lo = 0;
+        int hi = length;
+        while (lo < hi)
+        {
+            int mid = (lo + hi) / 2;
+            if (rank[order[tails[mid]]] < rank[order[t]]) lo = mid + 1;
+            else                                          hi = mid;
+        }
+        links[t]  = lo > 0 ? tails[lo - 1] : -1;
+        tails[lo] = t;
+        if (lo == length)
+        {
+            length++;
+        }
+    }
+    for (i = 0; i < n; i++)
+    {
+        chain[i] = 0; /* Reuse as "stay" marks */
+    }
+    for (int t = length > 0 ? tails[length - 1] : -1; t >= 0; t = links[t])
+    {
+        chain[order[t]] = 1;
+    }
+
+    /* Move the others right after their predecessor in B order
+     */
+    for (int t = 0; t < count && differ->errcode == ATOM_ERROR_NONE; t++)
+    {
+        int x = sorted[t];
+        if (chain[x])
+        {
+            continue;
+        }
+
+        int from = atom_differ_find(order, k, x);
+        memmove(order + from, order + from + 1, sizeof(int) * (k - from - 1));
+        int to = t > 0 ? atom_differ_find(order, k - 1, sorted[t - 1]) + 1 : 0;
+        memmove(order + to + 1, order + to, sizeof(int) * (k - 1 - to));
+        order[to] = x;
+        chain[x]  = 1;
+        if (from != to)
+        {
+            atom_differ_emit(differ, "move", from, NULL, to);
+        }
+    }
+
+    /* Insert new children in order, the matched ones are already in B order
+     */
+    for (int j = 0; j < m && differ->errcode == ATOM_ERROR_NONE; j++)
+    {
+        if (match[j] < 0)
+        {
+            atom_differ_emitcopy(differ, "insert", j, bchild[j]);
+        }
+    }
+
+    atom_membuf.collect(atom_membuf.data, achild);
+}
+
+/**
+ * Diff two nodes at index of current list
+ */
+static void atom_differ_node(atom_differ_t* differ, atom_node_t* a, atom_node_t* b, int index)
+{
+    if (atom_hash(differ->alexer, a) == atom_hash(differ->blexer, b) && atom_equal(differ->alexer, a, differ->blexer, b))
+    {
+        return;
+    }
+
+    atom_lexer_t* alexer = atom_nodelexer(differ->alexer, a);
+    atom_lexer_t* blexer = atom_nodelexer(differ->blexer, b);
+    if (a->type != ATOM_LIST || b->type != ATOM_LIST || !atom_textequal(alexer, a->name, blexer, b->name))
+    {
+        atom_differ_emitcopy(differ, "replace", index, b);
+        return;
+    }
+
+    if (index >= 0)
+    {
+        if (differ->depth == differ->capacity)
+        {
+            int  capacity = differ->capacity > 0 ? differ->capacity * 2 : 16;
+            int* path     = atom_membuf.extract(atom_membuf.data, sizeof(int) * capacity);
+            if (!path)
+            {
+                differ->errcode = ATOM_ERROR_OVERFLOW;
+                return;
+            }
+            if (differ->path)
+            {
+                memcpy(path, differ->path, sizeof(int) * differ->depth);
+                atom_membuf.collect(atom_membuf.data, differ->path);
+            }
+            differ->path     = path;
+            differ->capacity = capacity;
+        }
+        differ->path[differ->depth++] = index;
+    }
+
+    atom_differ_list(differ, a, b);
+
+    if (index >= 0)
+    {
+        differ->depth--;
+    }
+}
+
+
+/* @function: atom_diff
+*/
+atom_node_t* atom_diff(atom_lexer_t* alexer, atom_node_t* a, atom_lexer_t* blexer, atom_node_t* b)
+{
+    atom_assert(a != NULL && b != NULL);
+
+    atom_differ_t differ;
+    memset(&differ, 0, sizeof(differ));
+    differ.alexer = alexer;
+    differ.blexer = blexer;
+    differ.script = atom_differ_keyword("patch");
+    if (!differ.script)
+    {
+        return NULL;
+    }
+
+    atom_differ_node(&differ, a, b, -1);
+
+    if (differ.path)
+    {
+        atom_membuf.collect(atom_membuf.data, differ.path);
+    }
+    if (differ.errcode != ATOM_ERROR_NONE)
+    {
+        atom_delete(differ.script);
+        return NULL;
+    }
+    return differ.script;
+}
+
+
+/**
+ * Get the node at path of an edit
+ * @param parent - get the parent of target, and index of target in it
+ */
+static atom_node_t* atom_patch_resolve(atom_node_t* tree, atom_node_t* at, atom_bool_t parent, int* index)
+{
+    atom_node_t* indices = NULL;
+    int          count   = 0;
+    switch (at->type)
+    {
+    case ATOM_LONG:     /* Single index list was collapsed by parser */
+        count = 1;
+        break;
+
+    case ATOM_LIST:
+        indices = at->children;
+        for (atom_node_t* child = indices; child; child = child->next)
+        {
+            if (child->type != ATOM_LONG)
+            {
+                return NULL;
+            }
+            count++;
+        }
+        break;
+
+    default:
+        return NULL;
+    }
+
+    if (parent && count == 0)
+    {
+        return NULL;
+    }
+
+    atom_node_t* node = tree;
+    for (int i = 0; i < count; i++)
+    {
+        atom_long_t value = indices ? indices->data.as_long : at->data.as_long;
+        indices = indices ? indices->next : NULL;
+
+        if (parent && i == count - 1)
+        {
+            *index = (int)value;
+            if (node->type != ATOM_LIST || ((node->flags & ATOM_NODE_SHARED) && atom_unshare(node) != ATOM_ERROR_NONE))
+            {
+                return NULL;
+            }
+            return node;
+        }
+
+        if (node->type != ATOM_LIST || value < 0)
+        {
+            return NULL;
+        }
+        if ((node->flags & ATOM_NODE_SHARED) && atom_unshare(node) != ATOM_ERROR_NONE)
+        {
+            return NULL;
+        }
+        node = node->children;
+        for (atom_long_t j = 0; j < value && node; j++)
+        {
+            node = node->next;
+        }
+        if (!node)
+        {
+            return NULL;
+        }
+    }
+    return node;
+}
+
+/**
+ * Replace content of node by content of other, other is released
+ * Node keep its place in the tree, and in the index of its parent
+ */
+static void atom_patch_replace(atom_node_t* node, atom_node_t* other)
+{
+    atom_node_t* parent = node->parent;
+    if (parent && parent->index)
+    {
+        atom_index_remove(parent, node); /* Name may change */
+    }
+    atom_freeindex(node);
+    if (node->flags & ATOM_NODE_SHARED)
+    {
+        atom_dropshared(node);
+    }
+    while (node->children)
+    {
+        atom_delete(node->children);
+    }
+    atom_freetexts(node);
+
+    node->type      = other->type;
+    node->flags     = other->flags;
+    node->name      = other->name;
+    node->data      = other->data;
+    node->children  = other->children;
+    node->lastchild = other->lastchild;
+    for (atom_node_t* child = node->children; child; child = child->next)
+    {
+        child->parent = node;
+    }
+
+    uint64_t hash   = other->hash;
+    other->type     = ATOM_NONE;
+    other->flags    = 0;
+    other->children = other->lastchild = NULL;
+    atom_delete(other);
+
+    if (parent && parent->index)
+    {
+        atom_index_add(parent, node);
+    }
+    atom_touch(node);
+    node->hash = hash; /* Content is a clone, so is the hash */
+}
+
+/**
+ * Check the form of edits, before any of them is applied
+ * Paths are checked when applied, they refer to the tree changed by the edits before
+ */
+static atom_bool_t atom_patch_check(atom_lexer_t* lexer, atom_node_t* script)
+{
+    for (atom_node_t* edit = script->children; edit; edit = edit->next)
+    {
+        atom_lexer_t* source = atom_nodelexer(lexer, edit);
+        atom_node_t*  at     = edit->children;
+        if (edit->type != ATOM_LIST || !at || (at->type != ATOM_LONG && at->type != ATOM_LIST))
+        {
+            return ATOM_FALSE;
+        }
+        for (atom_node_t* index = at->type == ATOM_LIST ? at->children : NULL; index; index = index->next)
+        {
+            if (index->type != ATOM_LONG || index->data.as_long < 0)
+            {
+                return ATOM_FALSE;
+            }
+        }
+        if (at->type == ATOM_LONG && at->data.as_long < 0)
+        {
+            return ATOM_FALSE;
+        }
+
+        atom_node_t* value = at->next;
+        atom_bool_t  empty = at->type == ATOM_LIST && !at->children;
+        if (atom_textis(source, edit->name, "delete"))
+        {
+            if (empty)
+            {
+                return ATOM_FALSE; /* The root itself */
+            }
+        }
+        else if (atom_textis(source, edit->name, "replace"))
+        {
+            if (!value)
+            {
+                return ATOM_FALSE;
+            }
+        }
+        else if (atom_textis(source, edit->name, "insert"))
+        {
+            if (empty || !value)
+            {
+                return ATOM_FALSE;
+            }
+        }
+        else if (atom_textis(source, edit->name, "move"))
+        {
+            if (empty || !value || value->type != ATOM_LONG || value->data.as_long < 0)
+            {
+                return ATOM_FALSE;
+            }
+        }
+        else
+        {
+            return ATOM_FALSE;
+        }
+    }
+    return ATOM_TRUE;
+}
+
+
+/* @function: atom_patch
+*/
+int atom_patch(atom_node_t* tree, atom_lexer_t* lexer, atom_node_t* script)
+{
+    if (!tree || !script || script->type != ATOM_LIST || (tree->flags & ATOM_NODE_READONLY))
+    {
+        return ATOM_ERROR_ARGUMENTS;
+    }
+    if (!atom_patch_check(lexer, script))
+    {
+        return ATOM_ERROR_PATCH;
+    }
+
+    for (atom_node_t* edit = script->children; edit; edit = edit->next)
+    {
+        atom_lexer_t* source = atom_nodelexer(lexer, edit);
+        atom_node_t*  at     = edit->children;
+        if (edit->type != ATOM_LIST || !at)
+        {
+            return ATOM_ERROR_PATCH;
+        }
+
+        int index = 0;
+        if (atom_textis(source, edit->name, "delete"))
+        {
+            atom_node_t* node = atom_patch_resolve(tree, at, ATOM_FALSE, NULL);
+            if (!node || node == tree)
+            {
+                return ATOM_ERROR_PATCH;
+            }
+            atom_delete(node);
+        }
+        else if (atom_textis(source, edit->name, "replace"))
+        {
+            atom_node_t* node = atom_patch_resolve(tree, at, ATOM_FALSE, NULL);
+            atom_node_t* copy = at->next ? atom_clone(lexer, at->next) : NULL;
+            if (!node || !copy)
+            {
+                atom_delete(copy);
+                return ATOM_ERROR_PATCH;
+            }
+            atom_patch_replace(node, copy);
+        }
+        else if (atom_textis(source, edit->name, "insert"))
+        {
+            atom_node_t* node = atom_patch_resolve(tree, at, ATOM_TRUE, &index);
+            atom_node_t* copy = at->next ? atom_clone(lexer, at->next) : NULL;
+            if (!node || !copy || index < 0)
+            {
+                atom_delete(copy);
+                return ATOM_ERROR_PATCH;
+            }
+            int errcode = atom_insertchild(node, copy, index);
+            if (errcode != ATOM_ERROR_NONE)
+            {
+                atom_delete(copy);
+                return errcode;
+            }
+        }
+        else if (atom_textis(source, edit->name, "move"))
+        {
+            atom_node_t* node   = atom_patch_resolve(tree, at, ATOM_TRUE, &index);
+            atom_node_t* target = at->next;
+            if (!node || index < 0 || !target || target->type != ATOM_LONG || target->data.as_long < 0)
+            {
+                return ATOM_ERROR_PATCH;
+            }
+
+            atom_node_t* child = node->children;
+            for (int i = 0; i < index && child; i++)
+            {
+                child = child->next;
+            }
+            if (!child)
+            {
+                return ATOM_ERROR_PATCH;
+            }
+            child = atom_removechild(node, child);
+            if (!child)
+            {
+                return ATOM_ERROR_ARGUMENTS;
+            }
+
+            /* Put the child back where it was when it cannot be moved
+             */
+            int errcode = atom_insertchild(node, child, (int)target->data.as_long);
+            if (errcode != ATOM_ERROR_NONE)
+            {
+                if (atom_insertchild(node, child, index) != ATOM_ERROR_NONE)
+                {
+                    atom_delete(child);
+                }
+                return errcode;
+            }
+        }
+        else
+        {
+            return ATOM_ERROR_PATCH;
+        }
+    }
+    return ATOM_ERROR_NONE;
+}
+
+/**
+ * Copy structure of node, texts are copied only when node owns them
+ * Unlike atom_clone, the copy still read texts from the same lexer
+ */
+static atom_node_t* atom_copy(atom_node_t* node)
+{
+    atom_node_t* copy = atom_create(node->type, node->name);
+    if (!copy)
+    {
+        /* @error: Out of memory
+        */
+        return NULL;
+    }
+    copy->flags = node->flags & (ATOM_NODE_CSTR | ATOM_NODE_OWNED);
+    copy->data  = node->data;
+    if (copy->flags & ATOM_NODE_OWNED)
+    {
+        copy->name.cstr = NULL;
+        if (node->type == ATOM_TEXT)
+        {
+            copy->data.as_text.cstr = NULL;
+        }
+
+        if ((node->name.cstr && !(copy->name.cstr = atom_textdup(NULL, node->name))) ||
+            (node->type == ATOM_TEXT && !(copy->data.as_text.cstr = atom_textdup(NULL, node->data.as_text))))
+        {
+            atom_delete(copy);
+            return NULL;
+        }
+    }
+
+    if (node->type == ATOM_LIST)
+    {
+        for (atom_node_t* child = node->children; child; child = child->next)
+        {
+            atom_node_t* other = atom_copy(child);
+            if (!other)
+            {
+                atom_delete(copy);
+                return NULL;
+            }
+            atom_addchild(copy, other);
+        }
+    }
+    copy->hash = node->hash;
+    return copy;
+}
+
+/**
+ * Stop sharing children, release the holder when it's the last reference
+ */
+static void atom_dropshared(atom_node_t* node)
+{
+    atom_node_t* holder = node->lastchild;
+    atom_freeindex(node);
+    node->flags        &= ~ATOM_NODE_SHARED;
+    node->children      = NULL;
+    node->lastchild     = NULL;
+    if (--holder->data.as_long == 0)
+    {
+        holder->flags &= ~ATOM_NODE_READONLY;
+        atom_delete(holder);
+    }
+}
+
+
+/* @function: atom_unshare
+*/
+int atom_unshare(atom_node_t* node)
+{
+    atom_assert(node != NULL);
+
+    if (!(node->flags & ATOM_NODE_SHARED))
+    {
+        return ATOM_ERROR_NONE;
+    }
+
+    /* Copy first, the proxy is still valid when out of memory
+     */
+    atom_node_t* holder = node->lastchild;
+    atom_node_t* first  = NULL;
+    atom_node_t* last   = NULL;
+    for (atom_node_t* child = holder->children; child; child = child->next)
+    {
+        atom_node_t* copy = atom_copy(child);
+        if (!copy)
+        {
+            while (first)
+            {
+                atom_node_t* next = first->next;
+                first->prev = first->next = NULL;
+                atom_delete(first);
+                first = next;
+            }
+            return ATOM_ERROR_OVERFLOW;
+        }
+        copy->parent = node;
+        copy->prev   = last;
+        if (last)
+        {
+            last->next = copy;
+        }
+        else
+        {
+            first = copy;
+        }
+        last = copy;
+    }
+
+    atom_dropshared(node);
+    node->children  = first;
+    node->lastchild = last;
+    return ATOM_ERROR_NONE;
+}
+
+
+/**
+ * Shared children table, used while interning
+ * A slot hold the first list with its children, or the holder once they are shared
+ */
+typedef struct
+{
+    atom_lexer_t* lexer;
+    atom_node_t** holders;
+    uint64_t*     keys;
+    size_t        count;
+    size_t        capacity;  /* Power of 2 */
+    int           saved;     /* Number of nodes released */
+    int           errcode;
+} atom_interner_t;
+
+/**
+ * Hash of children sequence, name of the list is not included
+ * so (position (x 0.0) ...) and (rotation (x 0.0) ...) share
+ */
+static uint64_t atom_interner_key(atom_lexer_t* lexer, atom_node_t* node)
+{
+    uint64_t key   = 0;
+    uint64_t count = 0;
+    for (atom_node_t* child = node->children; child; child = child->next, count++)
+    {
+        key = atom_hashmix(key, atom_hash(lexer, child));
+    }
+    return atom_hashmix(key, count);
+}
+
+/**
+ * Count nodes owned by subtree
+ */
+static int atom_interner_count(atom_node_t* node)
+{
+    int count = 1;
+    if (node->type == ATOM_LIST && !(node->flags & ATOM_NODE_SHARED))
+    {
+        for (atom_node_t* child = node->children; child; child = child->next)
+        {
+            count += atom_interner_count(child);
+        }
+    }
+    return count;
+}
+
+/**
+ * Check if two children sequences are equal
+ */
+static atom_bool_t atom_interner_equal(atom_lexer_t* lexer, atom_node_t* a, atom_node_t* b)
+{
+    atom_node_t* achild = a->children;
+    atom_node_t* bchild = b->children;
+    for (; achild && bchild; achild = achild->next, bchild = bchild->next)
+    {
+        if (!atom_equal(lexer, achild, lexer, bchild))
+        {
+            return ATOM_FALSE;
+        }
+    }
+    return achild == bchild;
+}
+
+/**
+ * Mark holder subtree as read-only, proxies inside keep their own flag
+ */
+static void atom_interner_seal(atom_node_t* node)
+{
+    for (atom_node_t* child = node->children; child; child = child->next)
+    {
+        child->flags |= ATOM_NODE_READONLY;
+        if (child->type == ATOM_LIST && !(child->flags & ATOM_NODE_SHARED))
+        {
+            atom_interner_seal(child);
+        }
+    }
+}
+
+/**
+ * Grow the table, linear probing
+ */
+static atom_bool_t atom_interner_grow(atom_interner_t* interner)
+{
+    size_t        capacity = interner->capacity > 0 ? interner->capacity * 2 : 256;
+    atom_node_t** holders  = atom_membuf.extract(atom_membuf.data, (sizeof(atom_node_t*) + sizeof(uint64_t)) * capacity);
+    if (!holders)
+    {
+        interner->errcode = ATOM_ERROR_OVERFLOW;
+        return ATOM_FALSE;
+    }
+    uint64_t* keys = (uint64_t*)(holders + capacity);
+    memset(holders, 0, sizeof(atom_node_t*) * capacity);
+
+    for (size_t i = 0; i < interner->capacity; i++)
+    {
+        if (interner->holders[i])
+        {
+            size_t slot = interner->keys[i] & (capacity - 1);
+            while (holders[slot])
+            {
+                slot = (slot + 1) & (capacity - 1);
+            }
+            holders[slot] = interner->holders[i];
+            keys[slot]    = interner->keys[i];
+        }
+    }
+
+    if (interner->holders)
+    {
+        atom_membuf.collect(atom_membuf.data, interner->holders);
+    }
+    interner->holders  = holders;
+    interner->keys     = keys;
+    interner->capacity = capacity;
+    return ATOM_TRUE;
+}
+
+/**
+ * Intern children of node, top-down so a shared subtree is not visited twice
+ */
+static void atom_interner_visit(atom_interner_t* interner, atom_node_t* node)
+{
+    if (node->type != ATOM_LIST || !node->children || (node->flags & (ATOM_NODE_SHARED | ATOM_NODE_READONLY)))
+    {
+        return;
+    }
+
+    if (interner->count * 2 >= interner->capacity && !atom_interner_grow(interner))
+    {
+        return;
+    }
+
+    uint64_t key  = atom_interner_key(interner->lexer, node);
+    size_t   slot = key & (interner->capacity - 1);
+    for (; interner->holders[slot]; slot = (slot + 1) & (interner->capacity - 1))
+    {
+        atom_node_t* holder = interner->holders[slot];
+        if (interner->keys[slot] != key || !atom_interner_equal(interner->lexer, holder, node))
+        {
+            continue;
+        }
+
+        /* Second time seen, the first list is in the table: move its children
+         * into a new holder, holders are the only lists without parent
+         */
+        if (holder->parent)
+        {
+            atom_node_t* first = holder;
+            if (!(holder = atom_newlist(ATOM_TEXT_NULL)))
+            {
+                interner->errcode = ATOM_ERROR_OVERFLOW;
+                return;
+            }
+            atom_freeindex(first);
+            holder->flags        = ATOM_NODE_READONLY;
+            holder->data.as_long = 1;
+            holder->children     = first->children;
+            holder->lastchild    = first->lastchild;
+            for (atom_node_t* child = holder->children; child; child = child->next)
+            {
+                child->parent = holder;
+            }
+            atom_interner_seal(holder);
+            first->flags    |= ATOM_NODE_SHARED;
+            first->lastchild = holder;
+            interner->holders[slot] = holder;
+            interner->saved--; /* Holder cost a node */
+        }
+
+        /* Same children already exist, release ours and refer to the holder
+         * Index is rebuilt on the next lookup
+         */
+        atom_freeindex(node);
+        while (node->children)
+        {
+            atom_node_t* child = node->children;
+            node->children = child->next;
+            child->parent  = NULL;
+            child->prev    = NULL;
+            child->next    = NULL;
+            interner->saved += atom_interner_count(child);
+            atom_delete(child);
+        }
+        node->flags    |= ATOM_NODE_SHARED;
+        node->children  = holder->children;
+        node->lastchild = holder;
+        holder->data.as_long++;
+        return;
+    }
+
+    /* First time seen, keep the list as it is until an equal one is found
+     */
+    interner->holders[slot] = node;
+    interner->keys[slot]    = key;
+    interner->count++;
+
+    for (atom_node_t* child = node->children; child && interner->errcode == ATOM_ERROR_NONE; child = child->next)
+    {
+        atom_interner_visit(interner, child);
+    }
+}
+
+
+/* @function: atom_intern
+*/
+int atom_intern(atom_lexer_t* lexer, atom_node_t* tree)
+{
+    atom_assert(tree != NULL);
+
+    atom_interner_t interner;
+    memset(&interner, 0, sizeof(interner));
+    interner.lexer = lexer;
+
+    /* The root itself is never shared
+     */
+    if (tree->type == ATOM_LIST && !(tree->flags & ATOM_NODE_SHARED))
+    {
+        for (atom_node_t* child = tree->children; child && interner.errcode == ATOM_ERROR_NONE; child = child->next)
+        {
+            atom_interner_visit(&interner, child);
+        }
+    }
+
+    if (interner.holders)
+    {
+        atom_membuf.collect(atom_membuf.data, interner.holders);
+    }
+    return interner.errcode != ATOM_ERROR_NONE ? interner.errcode : interner.saved;
+}
+
+
+/**
+ * Header of a frozen block, right before the root
+ */
+typedef struct
+{
+    void*  base;  /* Address to release */
+    size_t size;  /* Size of the block  */
+    size_t count; /* Number of nodes    */
+} atom_frozenheader_t;
+
+/**
+ * Interned text of a frozen block
+ */
+typedef struct
+{
+    uint64_t      key;
+    size_t        offset;  /* Offset in strings area */
+    atom_lexer_t* lexer;   /* Source of text, first seen */
+    atom_text_t   text;
+    atom_bool_t   written;
+} atom_frozentext_t;
+
+/**
+ * Child waiting for its place in a frozen list
+ */
+typedef struct
+{
+    atom_node_t* source;
+    const char*  name;
+    size_t       order;
+} atom_frozenslot_t;
+
+/**
+ * State of atom_freeze
+ * First pass count nodes and interned bytes, second pass place them
+ */
+typedef struct
+{
+    atom_lexer_t*      lexer;
+    atom_frozentext_t* texts;
+    size_t             count;
+    size_t             capacity; /* Power of 2 */
+    size_t             nodes;
+    size_t             bytes;
+    char*              strings;
+    atom_node_t*       cursor;   /* Next free node */
+    int                flags;
+    int                errcode;
+} atom_freezer_t;
+
+/**
+ * Find or add text to the interned texts, linear probing
+ */
+static atom_frozentext_t* atom_freezer_intern(atom_freezer_t* freezer, atom_lexer_t* lexer, atom_text_t text)
+{
+    uint64_t key = atom_hashtext(lexer, text) | 1; /* 0 mark empty slot */
+    if (freezer->capacity > 0)
+    {
+        size_t slot = key & (freezer->capacity - 1);
+        for (; freezer->texts[slot].key; slot = (slot + 1) & (freezer->capacity - 1))
+        {
+            atom_frozentext_t* entry = &freezer->texts[slot];
+            if (entry->key == key && atom_textequal(entry->lexer, entry->text, lexer, text))
+            {
+                return entry;
+            }
+        }
+    }
+
+    /* New text, keep load factor under 3/4
+     */
+    if ((freezer->count + 1) * 4 > freezer->capacity * 3)
+    {
+        size_t             capacity = freezer->capacity > 0 ? freezer->capacity * 2 : 256;
+        atom_frozentext_t* texts    = atom_membuf.extract(atom_membuf.data, sizeof(atom_frozentext_t) * capacity);
+        if (!texts)
+        {
+            freezer->errcode = ATOM_ERROR_OVERFLOW;
+            return NULL;
+        }
+        memset(texts, 0, sizeof(atom_frozentext_t) * capacity);
+
+        for (size_t i = 0; i < freezer->capacity; i++)
+        {
+            if (freezer->texts[i].key)
+            {
+                size_t slot = freezer->texts[i].key & (capacity - 1);
+                while (texts[slot].key)
+                {
+                    slot = (slot + 1) & (capacity - 1);
+                }
+                texts[slot] = freezer->texts[i];
+            }
+        }
+
+        if (freezer->texts)
+        {
+            atom_membuf.collect(atom_membuf.data, freezer->texts);
+        }
+        freezer->texts    = texts;
+        freezer->capacity = capacity;
+    }
+
+    size_t slot = key & (freezer->capacity - 1);
+    while (freezer->texts[slot].key)
+    {
+        slot = (slot + 1) & (freezer->capacity - 1);
+    }
+
+    atom_frozentext_t* entry = &freezer->texts[slot];
+    entry->key     = key;
+    entry->offset  = freezer->bytes;
+    entry->lexer   = lexer;
+    entry->text    = text;
+    entry->written = ATOM_FALSE;
+    freezer->bytes += atom_textlength(lexer, text) + 1;
+    freezer->count++;
+    return entry;
+}
+
+/**
+ * Interned c-string of text, written into the block on first use
+ */
+static const char* atom_freezer_string(atom_freezer_t* freezer, atom_lexer_t* lexer, atom_text_t text)
+{
+    atom_frozentext_t* entry  = atom_freezer_intern(freezer, lexer, text);
+    char*              string = freezer->strings + entry->offset;
+    if (!entry->written)
+    {
+        size_t length = atom_textlength(entry->lexer, entry->text);
+        string[atom_textread(entry->lexer, entry->text, 0, string, length)] = 0;
+        entry->written = ATOM_TRUE;
+    }
+    return string;
+}
+
+/**
+ * First pass, count nodes and intern texts
+ */
+static void atom_freezer_count(atom_freezer_t* freezer, atom_node_t* node)
+{
+    atom_lexer_t* lexer = atom_nodelexer(freezer->lexer, node);
+
+    freezer->nodes++;
+    if (atom_hasname(lexer, node) && !atom_freezer_intern(freezer, lexer, node->name))
+    {
+        return;
+    }
+    if (node->type == ATOM_TEXT && !atom_freezer_intern(freezer, lexer, node->data.as_text))
+    {
+        return;
+    }
+
+    if (node->type == ATOM_LIST)
+    {
+        for (atom_node_t* child = node->children; child && freezer->errcode == ATOM_ERROR_NONE; child = child->next)
+        {
+            atom_freezer_count(freezer, child);
+        }
+    }
+}
+
+/**
+ * Copy node without its children, texts are already interned
+ */
+static void atom_freezer_copy(atom_freezer_t* freezer, atom_node_t* source, atom_node_t* node, const char* name)
+{
+    memset(node, 0, sizeof(atom_node_t));
+    node->type      = source->type;
+    node->flags     = ATOM_NODE_CSTR | ATOM_NODE_READONLY | ATOM_NODE_FROZEN;
+    node->name.cstr = name;
+    node->data      = source->data;
+    node->hash      = source->hash;
+    if (source->type == ATOM_TEXT)
+    {
+        node->data.as_text.cstr = atom_freezer_string(freezer, atom_nodelexer(freezer->lexer, source), source->data.as_text);
+    }
+}
+
+/**
+ * Order of children in a sorted list, unnamed children first
+ */
+static int atom_frozenslot_compare(const void* a, const void* b)
+{
+    const atom_frozenslot_t* aslot = (const atom_frozenslot_t*)a;
+    const atom_frozenslot_t* bslot = (const atom_frozenslot_t*)b;
+    if (aslot->name != bslot->name)
+    {
+        if (!aslot->name || !bslot->name)
+        {
+            return aslot->name ? 1 : -1;
+        }
+        int result = strcmp(aslot->name, bslot->name);
+        if (result != 0)
+        {
+            return result;
+        }
+    }
+    return aslot->order < bslot->order ? -1 : (aslot->order > bslot->order);
+}
+
+/**
+ * Second pass, place children of source as a run after the last placed node
+ */
+static void atom_freezer_place(atom_freezer_t* freezer, atom_node_t* source, atom_node_t* node)
+{
+    if (source->type != ATOM_LIST || !source->children)
+    {
+        return;
+    }
+
+    size_t count = 0;
+    for (atom_node_t* child = source->children; child; child = child->next)
+    {
+        count++;
+    }
+
+    atom_frozenslot_t* slots = NULL;
+    if (count > 1 && (freezer->flags & ATOM_FREEZE_SORTED))
+    {
+        if (!(slots = atom_membuf.extract(atom_membuf.data, sizeof(atom_frozenslot_t) * count)))
+        {
+            freezer->errcode = ATOM_ERROR_OVERFLOW;
+            return;
+        }
+    }
+
+    /* Names are interned first, so sorting compare c-strings
+     */
+    atom_node_t* run   = freezer->cursor;
+    size_t       index = 0;
+    freezer->cursor   += count;
+    for (atom_node_t* child = source->children; child; child = child->next, index++)
+    {
+        atom_lexer_t*     lexer = atom_nodelexer(freezer->lexer, child);
+        atom_frozenslot_t entry;
+        entry.source = child;
+        entry.name   = atom_hasname(lexer, child) ? atom_freezer_string(freezer, lexer, child->name) : NULL;
+        entry.order  = index;
+        if (slots)
+        {
+            slots[index] = entry;
+        }
+        else
+        {
+            atom_freezer_copy(freezer, child, run + index, entry.name);
+        }
+    }
+
+    if (slots)
+    {
+        qsort(slots, count, sizeof(atom_frozenslot_t), atom_frozenslot_compare);
+        for (size_t i = 0; i < count; i++)
+        {
+            atom_freezer_copy(freezer, slots[i].source, run + i, slots[i].name);
+        }
+        node->flags |= ATOM_NODE_SORTED;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        run[i].parent = node;
+        run[i].prev   = i > 0 ? run + i - 1 : NULL;
+        run[i].next   = i + 1 < count ? run + i + 1 : NULL;
+    }
+    node->children  = run;
+    node->lastchild = run + count - 1;
+
+    /* Children of each child follow, depth-first
+     */
+    atom_node_t* child = source->children;
+    for (size_t i = 0; i < count && freezer->errcode == ATOM_ERROR_NONE; i++, child = child->next)
+    {
+        atom_freezer_place(freezer, slots ? slots[i].source : child, run + i);
+    }
+
+    if (slots)
+    {
+        atom_membuf.collect(atom_membuf.data, slots);
+    }
+}
+
+/**
+ * Release the block of a frozen tree
+ */
+static void atom_frozen_release(atom_node_t* root)
+{
+    atom_frozenheader_t* header = (atom_frozenheader_t*)root - 1;
+    atom_unreserve(header->size);
+    atom_membuf.collect(atom_membuf.data, header->base);
+}
+
+
+/* @function: atom_freeze
+*/
+atom_node_t* atom_freeze(atom_lexer_t* lexer, atom_node_t* tree, int flags)
+{
+    atom_assert(tree != NULL);
+
+    atom_freezer_t freezer;
+    memset(&freezer, 0, sizeof(freezer));
+    freezer.lexer = lexer;
+    freezer.flags = flags;
+
+    atom_freezer_count(&freezer, tree);
+
+    /* Header, padding to the cache line, nodes then strings
+     */
+    size_t size = sizeof(atom_frozenheader_t) + ATOM_CACHELINE - 1 + freezer.nodes * sizeof(atom_node_t) + freezer.bytes;
+    char*  base = freezer.errcode == ATOM_ERROR_NONE ? atom_membuf.extract(atom_membuf.data, size) : NULL;
+    if (!base)
+    {
+        /* @error: Out of memory
+        */
+        if (freezer.texts)
+        {
+            atom_membuf.collect(atom_membuf.data, freezer.texts);
+        }
+        return NULL;
+    }
+
+    uintptr_t            address = ((uintptr_t)base + sizeof(atom_frozenheader_t) + ATOM_CACHELINE - 1) & ~(uintptr_t)(ATOM_CACHELINE - 1);
+    atom_node_t*         root    = (atom_node_t*)address;
+    atom_frozenheader_t* header  = (atom_frozenheader_t*)root - 1;
+    header->base     = base;
+    header->size     = size;
+    header->count    = freezer.nodes;
+    freezer.strings  = (char*)(root + freezer.nodes);
+    freezer.cursor   = root + 1;
+
+    atom_lexer_t* source = atom_nodelexer(lexer, tree);
+    atom_freezer_copy(&freezer, tree, root, atom_hasname(source, tree) ? atom_freezer_string(&freezer, source, tree->name) : NULL);
+    atom_freezer_place(&freezer, tree, root);
+
+    if (freezer.texts)
+    {
+        atom_membuf.collect(atom_membuf.data, freezer.texts);
+    }
+    if (freezer.errcode != ATOM_ERROR_NONE)
+    {
+        atom_membuf.collect(atom_membuf.data, base);
+        return NULL;
+    }
+    atom_reserve(size);
+    return root;
+}
+
+
+/* @function: atom_field_next
+*/
+atom_bool_t atom_field_next(atom_lexer_t* lexer, char* name, int size, int* length)
+{
+    atom_assert(lexer != NULL && name != NULL && size > 0 && length != NULL);
+
+    while (lexer->errcode == ATOM_ERROR_NONE)
+    {
+        atom_lexer_skipblank(lexer);
+
+        char c = atom_lexer_peek(lexer);
+        if (!c || c == ')' || c == ']' || c == '}')
+        {
+            return ATOM_FALSE;
+        }
+        if (c != '(' && c != '[' && c != '{')
+        {
+            atom_lexer_skipitem(lexer);
+            continue;
+        }
+
+        atom_text_t text;
+        atom_lexer_next(lexer);
+        if (atom_lexer_readname(lexer, &text) && text.tail - text.head < size)
+        {
+            *length = (int)atom_textread(lexer, text, 0, name, (size_t)(text.tail - text.head));
+            name[*length] = 0;
+            return ATOM_TRUE;
+        }
+        atom_field_leave(lexer);
+    }
+    return ATOM_FALSE;
+}
+
+
+/* @function: atom_field_leave
+*/
+void atom_field_leave(atom_lexer_t* lexer)
+{
+    atom_assert(lexer != NULL);
+
+    while (lexer->errcode == ATOM_ERROR_NONE)
+    {
+        atom_lexer_skipblank(lexer);
+
+        char c = atom_lexer_peek(lexer);
+        if (c == ')' || c == ']' || c == '}')
+        {
+            atom_lexer_next(lexer);
+            return;
+        }
+        if (!c)
+        {
+            atom_lexer_error(lexer, ATOM_ERROR_UNBALANCED);
+            return;
+        }
+        atom_lexer_skipitem(lexer);
+    }
+}
+
+
+/* @function: atom_field_long
+*/
+atom_bool_t atom_field_long(atom_lexer_t* lexer, atom_long_t* value)
+{
+    atom_assert(lexer != NULL && value != NULL);
+
+    atom_data_t data;
+    atom_lexer_skipblank(lexer);
+    if (atom_lexer_readvalue(lexer, &data) != ATOM_LONG)
+    {
+        return ATOM_FALSE;
+    }
+    *value = data.as_long;
+    return ATOM_TRUE;
+}
+
+
+/* @function: atom_field_real
+*/
+atom_bool_t atom_field_real(atom_lexer_t* lexer, atom_real_t* value)
+{
+    atom_assert(lexer != NULL && value != NULL);
+
+    atom_lexer_skipblank(lexer);
+    return atom_lexer_readnumber(lexer, value);
+}
+
+
+/* @function: atom_field_text
+*/
+atom_bool_t atom_field_text(atom_lexer_t* lexer, char* buffer, int size)
+{
+    atom_assert(lexer != NULL && buffer != NULL && size > 0);
+
+    atom_lexer_skipblank(lexer);
+
+    /* Quoted text, or a token as it is written, truncated to buffer
+    */
+    atom_text_t text;
+    char        c = atom_lexer_peek(lexer);
+    if (c == '"')
+    {
+        text.head = lexer->cursor + 1;
+        if (!atom_lexer_skipitem(lexer))
+        {
+            return ATOM_FALSE;
+        }
+        text.tail = lexer->cursor - 1;
+    }
+    else if (c && !atom_isspace(c) && !atom_ispunct(c))
+    {
+        text.head = lexer->cursor;
+        atom_lexer_skipitem(lexer);
+        text.tail = lexer->cursor;
+    }
+    else
+    {
+        return ATOM_FALSE;
+    }
+
+    size_t length = atom_textlength(lexer, text);
+    length = length < (size_t)size ? length : (size_t)size - 1;
+    buffer[atom_textread(lexer, text, 0, buffer, length)] = 0;
+    return ATOM_TRUE;
+}
+
+
+/* @function: atom_getmemory
+*/
+void atom_getmemory(atom_heap_t* heap, atom_memory_t* memory)
+{
+    atom_assert(memory != NULL);
+
+    heap    = heap ? heap : atom_curheap;
+    *memory = heap->memory;
+
+    /* Free nodes are only in the chunks of pools
+     */
+    size_t slots = memory->chunks * ATOM_BUCKETS;
+    size_t free  = slots > memory->nodes ? slots - memory->nodes : 0;
+    memory->used = memory->reserved - free * sizeof(atom_node_t);
+}
+
+/**
+ * Nodes and bytes of a subtree, shared children count for a part
+ */
+static void atom_memory_walk(atom_node_t* node, double share, double* nodes, double* bytes)
+{
+    *nodes += share;
+    *bytes += share * sizeof(atom_node_t);
+    if (node->index)
+    {
+        *bytes += share * (sizeof(atom_index_t) + sizeof(atom_indexentry_t) * node->index->capacity);
+    }
+    if (node->flags & ATOM_NODE_OWNED)
+    {
+        *bytes += node->name.cstr ? share * (strlen(node->name.cstr) + 1) : 0;
+        *bytes += node->type == ATOM_TEXT && node->data.as_text.cstr ? share * (strlen(node->data.as_text.cstr) + 1) : 0;
+    }
+
+    if (node->type == ATOM_LIST)
+    {
+        if (node->flags & ATOM_NODE_SHARED)
+        {
+            share /= (double)node->lastchild->data.as_long; /* Holder count references */
+        }
+        for (atom_node_t* child = node->children; child; child = child->next)
+        {
+            atom_memory_walk(child, share, nodes, bytes);
+        }
+    }
+}
+
+/* @function: atom_memoryof
+*/
+void atom_memoryof(atom_node_t* node, atom_memory_t* memory)
+{
+    atom_assert(node != NULL);
+    atom_assert(memory != NULL);
+
+    double nodes = 0;
+    double bytes = 0;
+    atom_memory_walk(node, 1.0, &nodes, &bytes);
+
+    memset(memory, 0, sizeof(*memory));
+    memory->nodes    = (size_t)(nodes + 0.5);
+    memory->reserved = (size_t)(bytes + 0.5);
+    memory->used     = memory->reserved;
+}
+
+/**
+ * Print a line of subtree, then its large children
+ */
+static void atom_dumpmemory_node(atom_lexer_t* lexer, atom_node_t* node, const atom_memory_t* memory, FILE* stream, int level, int depth, const char* name, size_t total)
+{
+    fprintf(stream, "%12zu %10zu %6.1f%% %*s%s\n", memory->reserved, memory->nodes, total > 0 ? 100.0 * memory->reserved / total : 0.0, level * 2, "", name);
+    if (level >= depth || node->type != ATOM_LIST)
+    {
+        return;
+    }
+
+    atom_memory_t others;
+    size_t        count = 0;
+    int           index = 0;
+    memset(&others, 0, sizeof(others));
+    for (atom_node_t* child = node->children; child; child = child->next, index++)
+    {
+        atom_memory_t childmemory;
+        atom_memoryof(child, &childmemory);
+        if (childmemory.reserved * 100 < memory->reserved)
+        {
+            others.reserved += childmemory.reserved;
+            others.nodes    += childmemory.nodes;
+            count++;
+            continue;
+        }
+
+        char          childname[64];
+        atom_lexer_t* source = atom_nodelexer(lexer, child);
+        if (atom_hasname(source, child))
+        {
+            childname[atom_textread(source, child->name, 0, childname, sizeof(childname) - 1)] = 0;
+        }
+        else
+        {
+            snprintf(childname, sizeof(childname), "[%d]", index);
+        }
+        atom_dumpmemory_node(lexer, child, &childmemory, stream, level + 1, depth, childname, total);
+    }
+
+    if (count > 0)
+    {
+        char othersname[64];
+        snprintf(othersname, sizeof(othersname), "(%zu others)", count);
+        fprintf(stream, "%12zu %10zu %6.1f%% %*s%s\n", others.reserved, others.nodes, total > 0 ? 100.0 * others.reserved / total : 0.0, (level + 1) * 2, "", othersname);
+    }
+}
+
+/* @function: atom_dumpmemory
+*/
+void atom_dumpmemory(atom_lexer_t* lexer, atom_node_t* node, FILE* stream, int depth)
+{
+    atom_assert(node != NULL);
+    atom_assert(stream != NULL);
+
+    char          name[64] = "(root)";
+    atom_lexer_t* source   = atom_nodelexer(lexer, node);
+    if (atom_hasname(source, node))
+    {
+        name[atom_textread(source, node->name, 0, name, sizeof(name) - 1)] = 0;
+    }
+
+    atom_memory_t memory;
+    atom_memoryof(node, &memory);
+    fprintf(stream, "%12s %10s %7s %s\n", "bytes", "nodes", "share", "subtree");
+    atom_dumpmemory_node(lexer, node, &memory, stream, 0, depth, name, memory.reserved);
 }
 
 #endif 
@@ -0,0 +1,1527 @@
+/**
+ * Atom - file data format with s-expression
+ * C++ wrapper of atom.h, header-only, C++17
+ *
+ * @author: MaiHD
+ * @license: Free to use
+ * @copyright: MaiHD @ ${HOME}, 2017 - 2018
+ */
+
+#ifndef __ATOM_HPP__
+#define __ATOM_HPP__
+
+#include "atom.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <memory_resource>
+#include <new>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+
+#if __cplusplus >= 202002L
+#include <coroutine>
+#include <exception>
+#include <iterator>
+#include <utility>
+#include <vector>
+#endif
+
+namespace atom
+{
+    /**
+     * Non-owning reference to a node, cheap to copy (two pointers)
+     * Names and texts are views into the source buffer of the document,
+     * they live as long as the document. A null reference is returned for
+     * missing nodes, getters of a null reference return empty results,
+     * so lookups can be chained: doc.root()["metadata"]["author"].as_text()
+     */
+    class node_ref
+    {
+    public:
+        class iterator
+        {
+        public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type        = node_ref;
+            using difference_type   = std::ptrdiff_t;
+            using pointer           = const node_ref*;
+            using reference         = node_ref;
+
+            iterator() noexcept = default;
+            iterator(atom_lexer_t* lexer, atom_node_t* node) noexcept : lexer_(lexer), node_(node) {}
+
+            node_ref  operator*() const noexcept { return node_ref(lexer_, node_); }
+            iterator& operator++() noexcept      { node_ = node_->next; return *this; }
+            iterator  operator++(int) noexcept   { iterator prev = *this; node_ = node_->next; return prev; }
+
+            bool operator==(const iterator& other) const noexcept { return node_ == other.node_; }
+            bool operator!=(const iterator& other) const noexcept { return node_ != other.node_; }
+
+        private:
+            atom_lexer_t* lexer_ = nullptr;
+            atom_node_t*  node_  = nullptr;
+        };
+
+        node_ref() noexcept = default;
+        node_ref(atom_lexer_t* lexer, atom_node_t* node) noexcept : lexer_(lexer), node_(node) {}
+
+        explicit operator bool() const noexcept { return node_ != nullptr; }
+
+        atom_node_t*  get() const noexcept   { return node_; }
+        atom_lexer_t* lexer() const noexcept { return lexer_; }
+        atom_type_t   type() const noexcept  { return node_ ? node_->type : ATOM_NONE; }
+        bool          is_list() const noexcept { return type() == ATOM_LIST; }
+
+        /**
+         * Name of node, empty when node has no name
+         */
+        std::string_view name() const noexcept
+        {
+            return node_ ? view(node_->name) : std::string_view();
+        }
+
+        /**
+         * Typed getters, empty when node is not of the type
+         * as_real also take integers, as (x 0) is written for (x 0.0)
+         */
+        std::optional<atom_long_t> as_long() const noexcept
+        {
+            if (type() == ATOM_LONG)
+            {
+                return node_->data.as_long;
+            }
+            return std::nullopt;
+        }
+
+        std::optional<atom_real_t> as_real() const noexcept
+        {
+            switch (type())
+            {
+            case ATOM_REAL:
+                return node_->data.as_real;
+
+            case ATOM_LONG:
+                return (atom_real_t)node_->data.as_long;
+
+            default:
+                return std::nullopt;
+            }
+        }
+
+        std::optional<std::string_view> as_text() const noexcept
+        {
+            if (type() == ATOM_TEXT)
+            {
+                return view(node_->data.as_text);
+            }
+            return std::nullopt;
+        }
+
+        /**
+         * First child with name, see atom_find
+         */
+        node_ref find(const char* name) const noexcept
+        {
+            return node_ref(lexer_, is_list() ? atom_find(lexer_, node_, name) : nullptr);
+        }
+
+        node_ref operator[](const char* name) const noexcept
+        {
+            return find(name);
+        }
+
+        /**
+         * Children of list, a value node has no children
+         */
+        iterator begin() const noexcept { return iterator(lexer_, is_list() ? node_->children : nullptr); }
+        iterator end() const noexcept   { return iterator(lexer_, nullptr); }
+
+        size_t size() const noexcept
+        {
+            size_t count = 0;
+            for (atom_node_t* child = is_list() ? node_->children : nullptr; child; child = child->next)
+            {
+                count++;
+            }
+            return count;
+        }
+
+    private:
+        /* Texts of node come from the string lexer, or are c-string
+         */
+        std::string_view view(atom_text_t text) const noexcept
+        {
+            if (!lexer_ || (node_->flags & ATOM_NODE_CSTR))
+            {
+                return text.cstr ? std::string_view(text.cstr) : std::string_view();
+            }
+            return text.tail > text.head ? std::string_view(lexer_->string + text.head, (size_t)(text.tail - text.head)) : std::string_view();
+        }
+
+        atom_lexer_t* lexer_ = nullptr;
+        atom_node_t*  node_  = nullptr;
+    };
+
+    /**
+     * Make heap current for the scope, nothing is done for a null heap
+     */
+    class heap_scope
+    {
+    public:
+        explicit heap_scope(atom_heap_t* heap) noexcept : heap_(heap), prev_(heap ? atom_useheap(heap) : nullptr) {}
+
+        heap_scope(const heap_scope&)            = delete;
+        heap_scope& operator=(const heap_scope&) = delete;
+
+        ~heap_scope()
+        {
+            if (heap_)
+            {
+                atom_useheap(prev_);
+            }
+        }
+
+    private:
+        atom_heap_t* heap_;
+        atom_heap_t* prev_;
+    };
+
+    /**
+     * Parsed document, own the tree and the source buffer it refer to
+     * Move-only. The lexer and the source are in one block which never
+     * move, so node_ref stay valid when the document is moved.
+     *
+     * With a memory resource, the block, nodes and indexes of the document
+     * come from it, for example a monotonic_buffer_resource on the stack.
+     * The document has its own heap, use heap_scope(doc.heap()) to call
+     * functions of atom.h that create or delete its nodes.
+     */
+    class document
+    {
+    public:
+        document() noexcept = default;
+
+        document(document&& other) noexcept
+            : lexer_(other.lexer_), heap_(other.heap_), root_(other.root_), errcode_(other.errcode_)
+        {
+            other.lexer_ = nullptr;
+            other.heap_  = nullptr;
+            other.root_  = nullptr;
+        }
+
+        document& operator=(document&& other) noexcept
+        {
+            if (this != &other)
+            {
+                release();
+                lexer_   = other.lexer_;
+                heap_    = other.heap_;
+                root_    = other.root_;
+                errcode_ = other.errcode_;
+                other.lexer_ = nullptr;
+                other.heap_  = nullptr;
+                other.root_  = nullptr;
+            }
+            return *this;
+        }
+
+        document(const document&)            = delete;
+        document& operator=(const document&) = delete;
+
+        ~document()
+        {
+            release();
+        }
+
+        /**
+         * Parse a copy of text
+         * @param resource - memory of the document, nullptr for the global heap
+         * @return document, check with operator bool and error()
+         */
+        static document parse(std::string_view text, std::pmr::memory_resource* resource = nullptr) noexcept
+        {
+            document doc;
+            char*    source = doc.allocate(text.size(), resource);
+            if (source)
+            {
+                std::memcpy(source, text.data(), text.size());
+                source[text.size()] = 0;
+                doc.build(source);
+            }
+            return doc;
+        }
+
+        /**
+         * Read the whole file then parse it, texts are views into memory
+         * @param resource - memory of the document, nullptr for the global heap
+         */
+        static document load(const char* path, std::pmr::memory_resource* resource = nullptr) noexcept
+        {
+            document doc;
+            FILE*    file = std::fopen(path, "rb");
+            if (!file)
+            {
+                doc.errcode_ = ATOM_ERROR_IO;
+                return doc;
+            }
+
+            size_t   size   = atom_getfilesize(file);
+            char*    source = doc.allocate(size, resource);
+            uint64_t start  = atom_trace_begin();
+            if (source && std::fread(source, 1, size, file) != size)
+            {
+                doc.release();
+                doc.errcode_ = ATOM_ERROR_IO;
+                source       = nullptr;
+            }
+            std::fclose(file);
+            const char* name = std::strrchr(path, '/');
+            atom_trace_end("read", name ? name + 1 : path, start, (int64_t)size);
+            if (source)
+            {
+                source[size] = 0;
+                doc.build(source);
+            }
+            return doc;
+        }
+
+        explicit operator bool() const noexcept { return root_ != nullptr; }
+
+        /**
+         * ATOM_ERROR_NONE, or the reason document has no root
+         */
+        int error() const noexcept { return errcode_; }
+
+        node_ref          root() const noexcept   { return node_ref(lexer_, root_); }
+        atom_lexer_t*     lexer() const noexcept  { return lexer_; }
+        atom_heap_t*      heap() const noexcept   { return heap_; }
+        std::string_view  source() const noexcept { return lexer_ ? std::string_view(lexer_->string, lexer_->length) : std::string_view(); }
+
+        node_ref operator[](const char* name) const noexcept
+        {
+            return root()[name];
+        }
+
+        /**
+         * Memory of the document: its heap when it has one, otherwise its tree
+         */
+        atom_memory_t memory() const noexcept
+        {
+            atom_memory_t result{};
+            if (heap_)
+            {
+                atom_getmemory(heap_, &result);
+            }
+            else if (root_)
+            {
+                atom_memoryof(root_, &result);
+            }
+            return result;
+        }
+
+    private:
+        /* Sizes are kept before the memory, memory_resource need them
+         */
+        static constexpr size_t header = alignof(std::max_align_t);
+
+        static void* extract(void* data, size_t size) noexcept
+        {
+            try
+            {
+                char* block = (char*)((std::pmr::memory_resource*)data)->allocate(size + header, header);
+                *(size_t*)block = size;
+                return block + header;
+            }
+            catch (...)
+            {
+                return nullptr;
+            }
+        }
+
+        static void collect(void* data, void* pointer) noexcept
+        {
+            if (pointer)
+            {
+                char* block = (char*)pointer - header;
+                ((std::pmr::memory_resource*)data)->deallocate(block, *(size_t*)block + header, header);
+            }
+        }
+
+        /**
+         * Allocate the block: lexer, heap when there is a resource, source
+         * @return source buffer, size + 1 bytes
+         */
+        char* allocate(size_t size, std::pmr::memory_resource* resource) noexcept
+        {
+            size_t heapsize = resource ? sizeof(atom_heap_t) : 0;
+            size_t total    = sizeof(atom_lexer_t) + heapsize + size + 1;
+            void*  block    = resource ? extract(resource, total) : ::operator new(total, std::nothrow);
+            if (!block)
+            {
+                errcode_ = ATOM_ERROR_OVERFLOW;
+                return nullptr;
+            }
+
+            lexer_ = (atom_lexer_t*)block;
+            if (resource)
+            {
+                heap_          = (atom_heap_t*)(lexer_ + 1);
+                *heap_         = atom_heap_t{};
+                heap_->data    = resource;
+                heap_->extract = extract;
+                heap_->collect = collect;
+            }
+            return (char*)block + sizeof(atom_lexer_t) + heapsize;
+        }
+
+        void build(char* source) noexcept
+        {
+            heap_scope scope(heap_);
+            atom_lexer_init(lexer_, ATOM_LEXER_STRING, source);
+            root_    = atom_parse(lexer_);
+            errcode_ = root_ ? ATOM_ERROR_NONE : (lexer_->errcode != ATOM_ERROR_NONE ? lexer_->errcode : ATOM_ERROR_OVERFLOW);
+
+            /* atom_find build indexes of large lists on demand, with the
+             * current heap. Build them now, so lookups never allocate.
+             */
+            if (root_ && heap_ && !prebuild(root_))
+            {
+                atom_delete(root_);
+                root_    = nullptr;
+                errcode_ = ATOM_ERROR_OVERFLOW;
+            }
+        }
+
+        bool prebuild(atom_node_t* node) noexcept
+        {
+            int count = 0;
+            for (atom_node_t* child = node->children; child; child = child->next, count++)
+            {
+                if (child->type == ATOM_LIST && !prebuild(child))
+                {
+                    return false;
+                }
+            }
+            return count < ATOM_INDEX_THRESHOLD || atom_index(lexer_, node, ATOM_FALSE) == ATOM_ERROR_NONE;
+        }
+
+        void release() noexcept
+        {
+            if (heap_)
+            {
+                {
+                    heap_scope scope(heap_);
+                    atom_delete(root_);
+                    atom_release();
+                }
+                collect(heap_->data, lexer_);
+            }
+            else
+            {
+                atom_delete(root_);
+                ::operator delete(lexer_);
+            }
+            lexer_ = nullptr;
+            heap_  = nullptr;
+            root_  = nullptr;
+        }
+
+        atom_lexer_t* lexer_   = nullptr;
+        atom_heap_t*  heap_    = nullptr;
+        atom_node_t*  root_    = nullptr;
+        int           errcode_ = ATOM_ERROR_NONE;
+    };
+
+    /**
+     * Same as atom_field_hash, usable in constant expressions
+     */
+    constexpr uint32_t field_hash(const char* name, int length, uint32_t seed = 0) noexcept
+    {
+        uint32_t hash = 2166136261u ^ seed;
+        for (int i = 0; i < length; i++)
+        {
+            hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+        }
+        return hash ^ (hash >> 15);
+    }
+
+    constexpr int field_length(const char* name) noexcept
+    {
+        int length = 0;
+        while (name[length])
+        {
+            length++;
+        }
+        return length;
+    }
+
+    /**
+     * Field of a reflected struct, name and hash are computed at compile time
+     */
+    template <typename T, typename M>
+    struct field
+    {
+        const char* name;
+        int         length;
+        uint32_t    hash;
+        M T::*      member;
+    };
+
+    template <typename T, typename M>
+    constexpr field<T, M> make_field(const char* name, M T::* member) noexcept
+    {
+        return field<T, M>{ name, field_length(name), field_hash(name, field_length(name)), member };
+    }
+
+    /**
+     * Fields of T, specialized by ATOM_REFLECT
+     */
+    template <typename T>
+    struct reflect;
+
+    template <typename T, typename = void>
+    struct is_reflected : std::false_type {};
+
+    template <typename T>
+    struct is_reflected<T, std::void_t<decltype(reflect<T>::fields)>> : std::true_type {};
+
+    template <typename T>
+    int read(atom_lexer_t* lexer, T& value) noexcept;
+
+    /**
+     * Read the value of field at cursor, the member keep its value on error
+     * @return ATOM_ERROR_NONE, ATOM_ERROR_UNEXPECTED when the value has other type,
+     *         or ATOM_ERROR_OVERFLOW when it is out of range of the member
+     */
+    template <typename M>
+    int read_value(atom_lexer_t* lexer, M& value) noexcept
+    {
+        if constexpr (is_reflected<M>::value)
+        {
+            return read(lexer, value);
+        }
+        else if constexpr (std::is_floating_point_v<M>)
+        {
+            atom_real_t real;
+            if (!atom_field_real(lexer, &real))
+            {
+                return ATOM_ERROR_UNEXPECTED;
+            }
+            if (std::fabs(real) > (atom_real_t)std::numeric_limits<M>::max())
+            {
+                return ATOM_ERROR_OVERFLOW;
+            }
+            value = (M)real;
+        }
+        else if constexpr (std::is_integral_v<M>)
+        {
+            atom_long_t integer;
+            if (!atom_field_long(lexer, &integer))
+            {
+                return ATOM_ERROR_UNEXPECTED;
+            }
+            if constexpr (std::is_signed_v<M>)
+            {
+                if (integer < (atom_long_t)std::numeric_limits<M>::min() || integer > (atom_long_t)std::numeric_limits<M>::max())
+                {
+                    return ATOM_ERROR_OVERFLOW;
+                }
+            }
+            else if (integer < 0 || (uint64_t)integer > (uint64_t)std::numeric_limits<M>::max())
+            {
+                return ATOM_ERROR_OVERFLOW;
+            }
+            value = (M)integer;
+        }
+        else if constexpr (std::is_array_v<M> && std::is_same_v<std::remove_extent_t<M>, char>)
+        {
+            if (!atom_field_text(lexer, value, (int)std::extent_v<M>))
+            {
+                return ATOM_ERROR_UNEXPECTED;
+            }
+        }
+        else
+        {
+            static_assert(is_reflected<M>::value, "Field type must be a number, a char array or a reflected struct");
+        }
+        return ATOM_ERROR_NONE;
+    }
+
+    /**
+     * Read fields of a reflected struct at lexer cursor, no node is created
+     * Missing fields keep their value, unknown fields are skipped, fields with
+     * a value of other type or out of range keep their value and are reported
+     * after the other fields are read. Texts are truncated to char arrays.
+     * @return ATOM_ERROR_NONE, error code of lexer, or the first error of read_value
+     */
+    template <typename T>
+    int read(atom_lexer_t* lexer, T& value) noexcept
+    {
+        static_assert(is_reflected<T>::value, "Declare fields of the struct with ATOM_REFLECT");
+
+        char name[64];
+        int  length;
+        int  errcode = ATOM_ERROR_NONE;
+        while (atom_field_next(lexer, name, sizeof(name), &length))
+        {
+            const uint32_t hash   = field_hash(name, length);
+            int            result = ATOM_ERROR_NONE;
+            std::apply([&](const auto&... fields) {
+                (void)((fields.hash == hash && fields.length == length && std::memcmp(fields.name, name, (size_t)length) == 0
+                        && (result = read_value(lexer, value.*fields.member), true)) || ...);
+            }, reflect<T>::fields);
+            atom_field_leave(lexer);
+            errcode = errcode != ATOM_ERROR_NONE ? errcode : result;
+        }
+        return lexer->errcode != ATOM_ERROR_NONE ? lexer->errcode : errcode;
+    }
+
+    /**
+     * Read a document from c-string
+     */
+    template <typename T>
+    int read(const char* text, T& value) noexcept
+    {
+        atom_lexer_t lexer;
+        int          errcode = atom_lexer_init(&lexer, ATOM_LEXER_STRING, (void*)text);
+        return errcode != ATOM_ERROR_NONE ? errcode : read(&lexer, value);
+    }
+
+    template <typename T>
+    int write(std::string& out, const T& value);
+
+    /**
+     * Append the value of field to output
+     * @return ATOM_ERROR_NONE, or ATOM_ERROR_ARGUMENTS when a real is not finite
+     */
+    template <typename M>
+    int write_value(std::string& out, const M& value)
+    {
+        char number[384];
+        if constexpr (is_reflected<M>::value)
+        {
+            return write(out, value);
+        }
+        else if constexpr (std::is_floating_point_v<M>)
+        {
+            /* Fixed notation, atom_toreal don't support exponent
+            */
+            if (!std::isfinite(value))
+            {
+                return ATOM_ERROR_ARGUMENTS;
+            }
+            char* end = std::to_chars(number, number + sizeof(number), value, std::chars_format::fixed).ptr;
+            out.append(number, end);
+            if (!std::memchr(number, '.', (size_t)(end - number)))
+            {
+                out += ".0";
+            }
+        }
+        else if constexpr (std::is_integral_v<M>)
+        {
+            out.append(number, std::to_chars(number, number + sizeof(number), (long long)value).ptr);
+        }
+        else if constexpr (std::is_array_v<M> && std::is_same_v<std::remove_extent_t<M>, char>)
+        {
+            /* Atom texts have no escape, '"' is written as '\'' as json to atom does
+            */
+            const char* end  = (const char*)std::memchr(value, 0, std::extent_v<M>);
+            size_t      head = out.size();
+            out += '"';
+            out.append(value, end ? (size_t)(end - value) : std::extent_v<M>);
+            std::replace(out.begin() + (std::ptrdiff_t)head + 1, out.end(), '"', '\'');
+            out += '"';
+        }
+        else
+        {
+            static_assert(is_reflected<M>::value, "Field type must be a number, a char array or a reflected struct");
+        }
+        return ATOM_ERROR_NONE;
+    }
+
+    /**
+     * Append fields of a reflected struct as atom text: (x 1.5) (y 0.0) ...
+     * Output keep its capacity when cleared, so writing many objects into
+     * the same string does not allocate
+     * @return ATOM_ERROR_NONE, or the first error of write_value, output is left unchanged
+     */
+    template <typename T>
+    int write(std::string& out, const T& value)
+    {
+        static_assert(is_reflected<T>::value, "Declare fields of the struct with ATOM_REFLECT");
+
+        bool   first   = true;
+        int    errcode = ATOM_ERROR_NONE;
+        size_t size    = out.size();
+        std::apply([&](const auto&... fields) {
+            ((out += first ? "(" : " (", first = false,
+              out.append(fields.name, (size_t)fields.length), out += ' ',
+              errcode = errcode != ATOM_ERROR_NONE ? errcode : write_value(out, value.*fields.member), out += ')'), ...);
+        }, reflect<T>::fields);
+        if (errcode != ATOM_ERROR_NONE)
+        {
+            out.resize(size);
+        }
+        return errcode;
+    }
+
+#if __cplusplus >= 202002L
+    /**
+     * Node of a compile-time document, children of a list are adjacent
+     */
+    struct literal_node
+    {
+        atom_type_t      type     = ATOM_NONE;
+        std::string_view name;
+        std::string_view text;
+        atom_long_t      as_long  = 0;
+        atom_real_t      as_real  = 0;
+        int              children = 0; /* Index of the first child */
+        int              count    = 0; /* Number of children       */
+    };
+
+    /**
+     * Reference to a node of a compile-time document, same getters as node_ref
+     */
+    class literal_ref
+    {
+    public:
+        constexpr literal_ref() noexcept = default;
+        constexpr literal_ref(const literal_node* nodes, int index) noexcept : nodes_(nodes), index_(index) {}
+
+        constexpr explicit operator bool() const noexcept { return nodes_ != nullptr; }
+
+        constexpr atom_type_t      type() const noexcept    { return nodes_ ? node().type : ATOM_NONE; }
+        constexpr bool             is_list() const noexcept { return type() == ATOM_LIST; }
+        constexpr std::string_view name() const noexcept    { return nodes_ ? node().name : std::string_view(); }
+        constexpr int              size() const noexcept    { return nodes_ ? node().count : 0; }
+
+        constexpr std::optional<atom_long_t> as_long() const noexcept
+        {
+            return type() == ATOM_LONG ? std::optional<atom_long_t>(node().as_long) : std::nullopt;
+        }
+
+        constexpr std::optional<atom_real_t> as_real() const noexcept
+        {
+            switch (type())
+            {
+            case ATOM_REAL: return node().as_real;
+            case ATOM_LONG: return (atom_real_t)node().as_long;
+            default:        return std::nullopt;
+            }
+        }
+
+        constexpr std::optional<std::string_view> as_text() const noexcept
+        {
+            return type() == ATOM_TEXT ? std::optional<std::string_view>(node().text) : std::nullopt;
+        }
+
+        /**
+         * First child with name
+         */
+        constexpr literal_ref operator[](std::string_view name) const noexcept
+        {
+            for (int i = 0; i < size(); i++)
+            {
+                if (nodes_[node().children + i].name == name)
+                {
+                    return literal_ref(nodes_, node().children + i);
+                }
+            }
+            return literal_ref();
+        }
+
+        constexpr literal_ref child(int i) const noexcept
+        {
+            return i >= 0 && i < size() ? literal_ref(nodes_, node().children + i) : literal_ref();
+        }
+
+    private:
+        constexpr const literal_node& node() const noexcept { return nodes_[index_]; }
+
+        const literal_node* nodes_ = nullptr;
+        int                 index_ = 0;
+    };
+
+    /**
+     * Document parsed at compile time, the root is the first node
+     */
+    template <size_t N>
+    struct literal
+    {
+        literal_node nodes[N];
+
+        constexpr literal_ref root() const noexcept                          { return literal_ref(nodes, 0); }
+        constexpr literal_ref operator[](std::string_view name) const noexcept { return root()[name]; }
+    };
+
+    /**
+     * Not constexpr: calling it while parsing a literal is the compile error,
+     * the compiler show the message in its diagnostic
+     */
+    inline void literal_error(const char* message)
+    {
+        std::fputs(message, stderr);
+    }
+
+    /**
+     * Compile-time parser, same grammar and tree shapes as atom_parse
+     */
+    class literal_parser
+    {
+    public:
+        struct item
+        {
+            literal_node node;
+            bool         is_root   = false;
+            int          first     = -1;
+            int          last      = -1;
+            int          next      = -1;
+        };
+
+        constexpr explicit literal_parser(std::string_view text) : text_(text) {}
+
+        /**
+         * Parse all top-level items
+         * @return index of root, -1 for empty document
+         */
+        constexpr int parse()
+        {
+            int root = -1;
+            skipspace();
+            while (cursor_ < text_.size())
+            {
+                int node = read();
+                if (node < 0)
+                {
+                    skipspace();
+                    continue;
+                }
+                if (items_[node].node.type == ATOM_NAME)
+                {
+                    literal_error("atom literal: unexpected name, texts must be quoted");
+                }
+
+                if (root < 0)
+                {
+                    root = node;
+                    items_[root].is_root = false;
+                }
+                else
+                {
+                    if (items_[root].node.type != ATOM_LIST || !items_[root].is_root)
+                    {
+                        root = wrap(root);
+                    }
+                    addchild(root, node);
+                }
+            }
+            tosingle(root);
+            return root;
+        }
+
+        /**
+         * Number of nodes reachable from root
+         */
+        constexpr int count(int node) const
+        {
+            int result = 1;
+            for (int child = items_[node].first; child >= 0; child = items_[child].next)
+            {
+                result += count(child);
+            }
+            return result;
+        }
+
+        /**
+         * Copy tree into nodes, children of each list adjacent, depth-first
+         */
+        constexpr int place(int node, literal_node* nodes, int index, int cursor) const
+        {
+            int children = cursor;
+            int count    = 0;
+            for (int child = items_[node].first; child >= 0; child = items_[child].next)
+            {
+                nodes[cursor++] = items_[child].node;
+                count++;
+            }
+            nodes[index]          = items_[node].node;
+            nodes[index].children = children;
+            nodes[index].count    = count;
+
+            int i = 0;
+            for (int child = items_[node].first; child >= 0; child = items_[child].next, i++)
+            {
+                cursor = place(child, nodes, children + i, cursor);
+            }
+            return cursor;
+        }
+
+    private:
+        constexpr char peek() const { return cursor_ < text_.size() ? text_[cursor_] : 0; }
+        constexpr char next()       { cursor_++; return peek(); }
+
+        static constexpr bool isspace(char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r'; }
+        static constexpr bool isdigit(char c) { return c >= '0' && c <= '9'; }
+        static constexpr bool ispunct(char c)
+        {
+            return c == '(' || c == ')' || c == '[' || c == ']' || c == '{' || c == '}' || c == '\'' || c == '"' || c == ',';
+        }
+
+        constexpr void skipspace()
+        {
+            while (isspace(peek()))
+            {
+                next();
+            }
+        }
+
+        constexpr void skipcomment()
+        {
+            char c = peek();
+            while (c && c != '\n' && c != '\r')
+            {
+                c = next();
+            }
+            next();
+        }
+
+        constexpr int create(atom_type_t type)
+        {
+            item value;
+            value.node.type = type;
+            items_.push_back(value);
+            return (int)items_.size() - 1;
+        }
+
+        constexpr void addchild(int node, int child)
+        {
+            if (items_[child].node.type == ATOM_LIST)
+            {
+                items_[child].is_root = false;
+            }
+            if (items_[node].last >= 0)
+            {
+                items_[items_[node].last].next = child;
+            }
+            else
+            {
+                items_[node].first = child;
+            }
+            items_[node].last = child;
+        }
+
+        /* Next items are not children of root, put them in a new unnamed list
+         */
+        constexpr int wrap(int root)
+        {
+            int list = create(ATOM_LIST);
+            items_[list].is_root = true;
+            addchild(list, root);
+            return list;
+        }
+
+        /* Same as atom_list_to_single
+         */
+        constexpr void tosingle(int node)
+        {
+            if (node < 0)
+            {
+                return;
+            }
+            int child = items_[node].first;
+            if (child >= 0 && child == items_[node].last && items_[child].node.type != ATOM_LIST && items_[child].node.name.empty())
+            {
+                std::string_view name = items_[node].node.name;
+                items_[node].node      = items_[child].node;
+                items_[node].node.name = name;
+                items_[node].first     = items_[node].last = -1;
+            }
+        }
+
+        /* Same as atom_tolong, so values are the same bits
+         */
+        static constexpr bool tolong(std::string_view token, atom_long_t& value)
+        {
+            size_t      i    = 0;
+            atom_long_t sign = 1;
+            if (i < token.size() && (token[i] == '-' || token[i] == '+'))
+            {
+                sign = token[i++] == '-' ? -1 : 1;
+            }
+            uint64_t limit  = sign < 0 ? (uint64_t)INT64_MAX + 1 : (uint64_t)INT64_MAX;
+            uint64_t number = 0;
+            for (; i < token.size(); i++)
+            {
+                if (!isdigit(token[i]))
+                {
+                    return false;
+                }
+                if (number > (limit - (uint64_t)(token[i] - '0')) / 10)
+                {
+                    return false;
+                }
+                number = number * 10 + (uint64_t)(token[i] - '0');
+            }
+            value = sign < 0 && number > 0 ? -(atom_long_t)(number - 1) - 1 : (atom_long_t)number;
+            return true;
+        }
+
+        /* Same tokens as atom_toreal. strtod is not constexpr: values with at most
+         * 15 significant digits, the ones written by hand, are an exact integer
+         * divided by an exact power of ten so they are correctly rounded and have
+         * the same bits as at runtime. Longer values are summed digit by digit,
+         * and may differ by one ulp.
+         */
+        static constexpr bool toreal(std::string_view token, atom_real_t& value)
+        {
+            size_t i    = 0;
+            int    sign = 1;
+            if (i < token.size() && (token[i] == '-' || token[i] == '+'))
+            {
+                sign = token[i++] == '-' ? -1 : 1;
+            }
+
+            size_t      start     = i;
+            size_t      dot       = token.size();
+            atom_real_t slow      = 0.0;
+            atom_real_t precision = 10;
+            for (; i < token.size(); i++)
+            {
+                char c = token[i];
+                if (c == '.')
+                {
+                    if (dot < token.size())
+                    {
+                        return false;
+                    }
+                    dot = i;
+                    continue;
+                }
+                else if (!isdigit(c))
+                {
+                    return false;
+                }
+
+                if (dot < token.size())
+                {
+                    slow       = slow + (c - '0') / precision;
+                    precision *= 10;
+                }
+                else
+                {
+                    slow = slow * 10 + (c - '0');
+                }
+            }
+
+            /* Trailing zeros after dot change nothing
+             */
+            size_t end = token.size();
+            while (end > dot + 1 && token[end - 1] == '0')
+            {
+                end--;
+            }
+
+            constexpr atom_real_t powers[] = {
+                1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+            };
+
+            uint64_t mantissa = 0;
+            int      digits   = 0; /* Significant digits */
+            int      scale    = 0; /* Digits after dot   */
+            for (i = start; i < end && digits <= 15; i++)
+            {
+                if (i == dot)
+                {
+                    continue;
+                }
+                scale   += i > dot;
+                mantissa = mantissa * 10 + (uint64_t)(token[i] - '0');
+                digits  += mantissa > 0;
+            }
+
+            value = digits <= 15 && scale <= 22 ? (atom_real_t)mantissa / powers[scale] : slow;
+            value *= sign;
+            return true;
+        }
+
+        constexpr int readatom()
+        {
+            skipspace();
+            if (cursor_ >= text_.size())
+            {
+                return -1;
+            }
+
+            char   c    = peek();
+            size_t head = cursor_;
+            if (c == '"')
+            {
+                c = next();
+                while (c && c != '"')
+                {
+                    c = next();
+                }
+                if (c != '"')
+                {
+                    literal_error("atom literal: unterminated text");
+                }
+                next();
+
+                int node = create(ATOM_TEXT);
+                items_[node].node.text = text_.substr(head + 1, cursor_ - head - 2);
+                return node;
+            }
+
+            while (c && !isspace(c) && !ispunct(c))
+            {
+                c = next();
+            }
+            std::string_view token = text_.substr(head, cursor_ - head);
+            if (token.empty())
+            {
+                literal_error("atom literal: unexpected character");
+            }
+
+            atom_long_t integer = 0;
+            atom_real_t real    = 0;
+            if (tolong(token, integer))
+            {
+                int node = create(ATOM_LONG);
+                items_[node].node.as_long = integer;
+                return node;
+            }
+            if (toreal(token, real))
+            {
+                int node = create(ATOM_REAL);
+                items_[node].node.as_real = real;
+                return node;
+            }
+            int node = create(ATOM_NAME);
+            items_[node].node.name = token;
+            return node;
+        }
+
+        constexpr int readlist()
+        {
+            char c     = peek();
+            char close = c == '(' ? ')' : (c == '[' ? ']' : '}');
+            c = next();
+
+            int root = -1;
+            int node = -1;
+            do {
+                skipspace();
+                if ((node = read()) >= 0)
+                {
+                    if (root < 0)
+                    {
+                        root = node;
+                        if (items_[root].node.type == ATOM_NAME)
+                        {
+                            items_[root].node.type = ATOM_LIST;
+                            items_[root].is_root   = true;
+                        }
+                        else if (items_[root].node.type == ATOM_LIST)
+                        {
+                            items_[root].is_root = false;
+                        }
+                    }
+                    else
+                    {
+                        if (items_[root].node.type != ATOM_LIST || !items_[root].is_root)
+                        {
+                            root = wrap(root);
+                        }
+                        if (items_[node].node.type == ATOM_NAME)
+                        {
+                            literal_error("atom literal: unexpected name, texts must be quoted");
+                        }
+                        addchild(root, node);
+                    }
+                }
+
+                skipspace();
+                c = peek();
+            } while (c && c != close && node >= 0);
+
+            if (c != close)
+            {
+                literal_error("atom literal: unbalanced brackets");
+            }
+            next();
+            tosingle(root);
+            return root;
+        }
+
+        constexpr int read()
+        {
+            skipspace();
+            if (cursor_ >= text_.size())
+            {
+                return -1;
+            }
+
+            switch (peek())
+            {
+            case ';':
+                skipcomment();
+                return read();
+
+            case '(':
+            case '[':
+            case '{':
+                return readlist();
+
+            case ')':
+            case ']':
+            case '}':
+                literal_error("atom literal: unexpected close bracket");
+                return -1;
+
+            default:
+                return readatom();
+            }
+        }
+
+        std::string_view  text_;
+        size_t            cursor_ = 0;
+        std::vector<item> items_;
+    };
+
+    consteval int literal_count(std::string_view text)
+    {
+        literal_parser parser(text);
+        int            root = parser.parse();
+        return root < 0 ? 1 : parser.count(root);
+    }
+
+    template <size_t N>
+    consteval literal<N> literal_parse(std::string_view text)
+    {
+        literal<N>     result{};
+        literal_parser parser(text);
+        int            root = parser.parse();
+        if (root >= 0)
+        {
+            parser.place(root, result.nodes, 0, 1);
+        }
+        return result;
+    }
+
+    /**
+     * Minimal generator coroutine, move-only, used with range-for
+     */
+    template <typename T>
+    class generator
+    {
+    public:
+        struct promise_type
+        {
+            T value{};
+
+            generator           get_return_object() noexcept { return generator(handle::from_promise(*this)); }
+            std::suspend_always initial_suspend() noexcept   { return {}; }
+            std::suspend_always final_suspend() noexcept     { return {}; }
+            std::suspend_always yield_value(T next) noexcept { value = next; return {}; }
+            void                return_void() noexcept       {}
+            void                unhandled_exception()        { std::terminate(); }
+        };
+        using handle = std::coroutine_handle<promise_type>;
+
+        class iterator
+        {
+        public:
+            explicit iterator(handle coroutine) noexcept : coroutine_(coroutine) {}
+
+            T         operator*() const noexcept { return coroutine_.promise().value; }
+            iterator& operator++()               { coroutine_.resume(); return *this; }
+
+            bool operator==(std::default_sentinel_t) const noexcept { return !coroutine_ || coroutine_.done(); }
+
+        private:
+            handle coroutine_;
+        };
+
+        generator(generator&& other) noexcept : coroutine_(std::exchange(other.coroutine_, nullptr)) {}
+        generator(const generator&)            = delete;
+        generator& operator=(const generator&) = delete;
+        generator& operator=(generator&&)      = delete;
+
+        ~generator()
+        {
+            if (coroutine_)
+            {
+                coroutine_.destroy();
+            }
+        }
+
+        iterator begin()
+        {
+            if (coroutine_)
+            {
+                coroutine_.resume();
+            }
+            return iterator(coroutine_);
+        }
+
+        std::default_sentinel_t end() const noexcept { return {}; }
+
+    private:
+        explicit generator(handle coroutine) noexcept : coroutine_(coroutine) {}
+
+        handle coroutine_;
+    };
+
+    /**
+     * Split chunks of input into top-level items, without parsing them
+     * Brackets in texts and comments are not counted. Comments between
+     * records are dropped, comments inside a record are kept.
+     */
+    class record_scanner
+    {
+    public:
+        /**
+         * Feed characters until a record is complete
+         * @return number of characters consumed, record() is complete when ready() is true
+         */
+        size_t feed(const char* data, size_t size)
+        {
+            size_t i = 0;
+            ready_ = false;
+            for (; i < size && !ready_ && errcode_ == ATOM_ERROR_NONE; i++)
+            {
+                char c = data[i];
+                if (comment_)
+                {
+                    comment_ = c != '\n' && c != '\r';
+                    if (depth_ > 0)
+                    {
+                        record_ += c;
+                    }
+                    continue;
+                }
+                if (text_)
+                {
+                    record_ += c;
+                    text_    = c != '"';
+                    ready_   = !text_ && depth_ == 0;
+                    continue;
+                }
+
+                /* A token at top level end before the separator
+                 */
+                bool separator = c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r' || c == ';'
+                              || c == '(' || c == ')' || c == '[' || c == ']' || c == '{' || c == '}' || c == '"' || c == '\'' || c == ',';
+                if (token_ && separator)
+                {
+                    token_ = false;
+                    ready_ = true;
+                    return i;
+                }
+
+                switch (c)
+                {
+                case ';':
+                    comment_ = true;
+                    if (depth_ > 0)
+                    {
+                        record_ += c;
+                    }
+                    break;
+
+                case '(':
+                case '[':
+                case '{':
+                    depth_++;
+                    record_ += c;
+                    break;
+
+                case ')':
+                case ']':
+                case '}':
+                    if (depth_ == 0)
+                    {
+                        errcode_ = ATOM_ERROR_UNEXPECTED;
+                        break;
+                    }
+                    record_ += c;
+                    ready_    = --depth_ == 0;
+                    break;
+
+                case '"':
+                    text_    = true;
+                    record_ += c;
+                    break;
+
+                default:
+                    if (depth_ > 0 || !separator)
+                    {
+                        record_ += c;
+                        token_   = token_ || depth_ == 0;
+                    }
+                    break;
+                }
+            }
+            return i;
+        }
+
+        /**
+         * End of input, complete the last token
+         * @return true when there is a record
+         */
+        bool finish()
+        {
+            ready_ = token_;
+            token_ = false;
+            if (depth_ > 0 || text_)
+            {
+                errcode_ = depth_ > 0 ? ATOM_ERROR_UNBALANCED : ATOM_ERROR_UNTERMINATED;
+            }
+            return ready_ && errcode_ == ATOM_ERROR_NONE;
+        }
+
+        bool         ready() const noexcept   { return ready_ && errcode_ == ATOM_ERROR_NONE; }
+        int          error() const noexcept   { return errcode_; }
+        std::string& record() noexcept        { return record_; }
+
+    private:
+        std::string record_;
+        int         depth_   = 0;
+        int         errcode_ = ATOM_ERROR_NONE;
+        bool        text_    = false;
+        bool        comment_ = false;
+        bool        token_   = false;
+        bool        ready_   = false;
+    };
+
+    /**
+     * Lazily parse and yield each top-level item of input
+     * Input is read in chunks with read(buffer, size), which return 0 at the
+     * end. Only one record is in memory: the tree of the previous record is
+     * deleted before parsing the next one, its nodes are reused from the pool,
+     * and the record buffer keep its capacity. The node_ref is valid until
+     * the next iteration.
+     * @param errcode - ATOM_ERROR_NONE, or the error which stopped the iteration
+     */
+    template <typename Read>
+    generator<node_ref> records(Read read, int* errcode = nullptr)
+    {
+        struct tree
+        {
+            atom_node_t* node = nullptr;
+            ~tree() { atom_delete(node); }
+        };
+
+        record_scanner scanner;
+        atom_lexer_t   lexer;
+        tree           current;
+        char           chunk[16384];
+        size_t         length = 0;
+        size_t         offset = 0;
+        bool           ended  = false;
+        int            result = ATOM_ERROR_NONE;
+        while (result == ATOM_ERROR_NONE)
+        {
+            if (offset == length && !ended)
+            {
+                uint64_t start = atom_trace_begin();
+                length = read(chunk, sizeof(chunk));
+                atom_trace_end("read", nullptr, start, (int64_t)length);
+                offset = 0;
+                ended  = length == 0;
+            }
+
+            bool ready = ended ? scanner.finish() : (offset += scanner.feed(chunk + offset, length - offset), scanner.ready());
+            if ((result = scanner.error()) != ATOM_ERROR_NONE || (ended && !ready))
+            {
+                break;
+            }
+            if (!ready)
+            {
+                continue;
+            }
+
+            atom_delete(current.node);
+            atom_lexer_init(&lexer, ATOM_LEXER_STRING, (void*)scanner.record().c_str());
+            if (!(current.node = atom_parse(&lexer)))
+            {
+                result = lexer.errcode != ATOM_ERROR_NONE ? lexer.errcode : ATOM_ERROR_OVERFLOW;
+                break;
+            }
+            co_yield node_ref(&lexer, current.node);
+            scanner.record().clear();
+        }
+
+        if (errcode)
+        {
+            *errcode = result;
+        }
+    }
+
+    /**
+     * Records of a file, see records(read)
+     */
+    inline generator<node_ref> records(FILE* file, int* errcode = nullptr)
+    {
+        return records([file](char* buffer, size_t size) { return std::fread(buffer, 1, size, file); }, errcode);
+    }
+#endif
+}
+
+/**
+ * Declare fields of a struct once, for atom::read and atom::write
+ * Use at global scope after the struct, up to 16 fields:
+ *   struct vec3 { float x, y, z; };
+ *   ATOM_REFLECT(vec3, x, y, z)
+ */
+#define ATOM_REFLECT(type, ...)                                                     \
+    template <>                                                                     \
+    struct atom::reflect<type>                                                      \
+    {                                                                               \
+        static constexpr auto fields = std::make_tuple(ATOM_PP_FOREACH(ATOM_REFLECT_FIELD, type, __VA_ARGS__)); \
+    };
+
+#define ATOM_REFLECT_FIELD(type, name) atom::make_field(#name, &type::name)
+
+/**
+ * Parse an atom string literal at compile time (C++20), errors are compile errors
+ *   constexpr auto config = ATOM_LITERAL(R"((name "libatom") (version 100000))");
+ *   static_assert(config["version"].as_long() == 100000);
+ * An empty document give a root of type ATOM_NONE
+ */
+#define ATOM_LITERAL(text) atom::literal_parse<(size_t)atom::literal_count(text)>(text)
+
+#define ATOM_PP_EXPAND(x) x
+#define ATOM_PP_COUNT(...) ATOM_PP_EXPAND(ATOM_PP_COUNT_(__VA_ARGS__, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1))
+#define ATOM_PP_COUNT_(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, N, ...) N
+#define ATOM_PP_CONCAT(a, b)  ATOM_PP_CONCAT_(a, b)
+#define ATOM_PP_CONCAT_(a, b) a##b
+#define ATOM_PP_FOREACH(m, t, ...) ATOM_PP_EXPAND(ATOM_PP_CONCAT(ATOM_PP_FOREACH_, ATOM_PP_COUNT(__VA_ARGS__))(m, t, __VA_ARGS__))
+#define ATOM_PP_FOREACH_1(m, t, x)       m(t, x)
+#define ATOM_PP_FOREACH_2(m, t, x, ...)  m(t, x), ATOM_PP_EXPAND(ATOM_PP_FOREACH_1(m, t, __VA_ARGS__))
+#define ATOM_PP_FOREACH_3(m, t, x, ...)  m(t, x), ATOM_PP_EXPAND(ATOM_PP_FOREACH_2(m, t, __VA_ARGS__))
+#define ATOM_PP_FOREACH_4(m, t, x, ...)  m(t, x), ATOM_PP_EXPAND(ATOM_PP_FOREACH_3(m, t, __VA_ARGS__))
+#define ATOM_PP_FOREACH_5(m, t, x, ...)  m(t, x), ATOM_PP_EXPAND(ATOM_PP_FOREACH_4(m, t, __VA_ARGS__))
+#define ATOM_PP_FOREACH_6(m, t, x, ...)  m(t, x), ATOM_PP_EXPAND(ATOM_PP_FOREACH_5(m, t, __VA_ARGS__))
+#define ATOM_PP_FOREACH_7(m, t, x, ...)  m(t, x), ATOM_PP_EXPAND(ATOM_PP_FOREACH_6(m, t, __VA_ARGS__))
+#define ATOM_PP_FOREACH_8(m, t, x, ...)  m(t, x), ATOM_PP_EXPAND(ATOM_PP_FOREACH_7(m, t, __VA_ARGS__))
+#define ATOM_PP_FOREACH_9(m, t, x, ...)  m(t, x), ATOM_PP_EXPAND(ATOM_PP_FOREACH_8(m, t, __VA_ARGS__))
+#define ATOM_PP_FOREACH_10(m, t, x, ...) m(t, x), ATOM_PP_EXPAND(ATOM_PP_FOREACH_9(m, t, __VA_ARGS__))
+#define ATOM_PP_FOREACH_11(m, t, x, ...) m(t, x), ATOM_PP_EXPAND(ATOM_PP_FOREACH_10(m, t, __VA_ARGS__))
+#define ATOM_PP_FOREACH_12(m, t, x, ...) m(t, x), ATOM_PP_EXPAND(ATOM_PP_FOREACH_11(m, t, __VA_ARGS__))
+#define ATOM_PP_FOREACH_13(m, t, x, ...) m(t, x), ATOM_PP_EXPAND(ATOM_PP_FOREACH_12(m, t, __VA_ARGS__))
+#define ATOM_PP_FOREACH_14(m, t, x, ...) m(t, x), ATOM_PP_EXPAND(ATOM_PP_FOREACH_13(m, t, __VA_ARGS__))
+#define ATOM_PP_FOREACH_15(m, t, x, ...) m(t, x), ATOM_PP_EXPAND(ATOM_PP_FOREACH_14(m, t, __VA_ARGS__))
+#define ATOM_PP_FOREACH_16(m, t, x, ...) m(t, x), ATOM_PP_EXPAND(ATOM_PP_FOREACH_15(m, t, __VA_ARGS__))
+
+#endif /* __ATOM_HPP__ */
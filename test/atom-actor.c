@@ -0,0 +1,100 @@
+/**
+ * Atom - file data format with s-expression
+ * Checks of the reader generated by atom-schema from samples/actor-schema.atom,
+ * exit code is the number of failures
+ *
+ * @author: MaiHD
+ * @license: Free to use
+ * @copyright: MaiHD @ ${HOME}, 2017
+ */
+
+#define ACTOR_SCHEMA_IMPL
+#include "actor-schema.h"
+#include <string.h>
+
+static int failures = 0;
+
+static void check(int condition, const char* what)
+{
+    if (!condition)
+    {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+/**
+ * Values the sample does not have, so unread fields are seen
+ */
+static void check_reset(actor_t* actor)
+{
+    vec3_t unset = { -1.0, -1.0, -1.0 };
+    strcpy(actor->name, "unset");
+    actor->transform.position        = unset;
+    actor->transform.rotation        = unset;
+    actor->transform.scale           = unset;
+    actor->transform.children.prefab = -1;
+}
+
+static int check_read(const char* text, actor_t* actor)
+{
+    atom_lexer_t lexer;
+    atom_lexer_init(&lexer, ATOM_LEXER_STRING, (void*)text);
+    check_reset(actor);
+    int errcode = actor_read(&lexer, actor);
+    atom_lexer_free(&lexer);
+    return errcode;
+}
+
+/* Every field of the sample is read, comments are skipped
+ */
+static void check_sample(const char* path)
+{
+    actor_t actor;
+    FILE*   file = fopen(path, "rb");
+    if (!file)
+    {
+        printf("FAILED: cannot open %s\n", path);
+        failures++;
+        return;
+    }
+
+    atom_lexer_t lexer;
+    atom_lexer_init(&lexer, ATOM_LEXER_STREAM, file);
+    check_reset(&actor);
+    check(actor_read(&lexer, &actor) == ATOM_ERROR_NONE, "read sample");
+    atom_lexer_free(&lexer);
+    fclose(file);
+
+    check(strcmp(actor.name, "Actor") == 0, "text field");
+    check(actor.transform.position.x == 0.0 && actor.transform.position.y == 0.0 && actor.transform.position.z == 0.0, "nested struct");
+    check(actor.transform.rotation.z == 0.0 && actor.transform.scale.x == 0.0, "struct type used twice");
+    check(actor.transform.children.prefab == 1010, "long field");
+}
+
+/* Fields of another type keep their value and are reported, the others are read
+ */
+static void check_errors(void)
+{
+    actor_t actor;
+    check(check_read("(name \"hero\") (transform (scale (y 2) (z 3.5)) (position (x 1.25)))", &actor) == ATOM_ERROR_NONE, "read text");
+    check(!strcmp(actor.name, "hero") && actor.transform.scale.y == 2.0 && actor.transform.scale.z == 3.5 && actor.transform.position.x == 1.25, "read values");
+    check(actor.transform.scale.x == -1.0 && actor.transform.children.prefab == -1, "missing fields keep their value");
+
+    check(check_read("(transform (position (x \"a\") (y 2)) (children (prefab 1.5)) (scale (z 4)))", &actor) == ATOM_ERROR_UNEXPECTED, "field of other type");
+    check(actor.transform.position.x == -1.0 && actor.transform.position.y == 2.0, "real field of other type keep its value");
+    check(actor.transform.children.prefab == -1 && actor.transform.scale.z == 4.0, "long field of other type keep its value");
+
+    check(check_read("(transform (position (x 1)", &actor) == ATOM_ERROR_UNBALANCED, "truncated document");
+}
+
+int main(int argc, char* argv[])
+{
+    printf("Atom schema reader checks v1.0 - MaiHD\n");
+
+    check_sample(argc > 1 ? argv[1] : "samples/actor.atom");
+    check_errors();
+
+    printf("%s, %d failed\n", failures ? "Failed" : "Passed", failures);
+    return failures;
+}
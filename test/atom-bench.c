@@ -0,0 +1,664 @@
+/**
+ * Atom - file data format with s-expression
+ * Benchmark of parse, traverse, save, delete and JSON conversion
+ *
+ * @author: MaiHD
+ * @license: Free to use
+ * @copyright: MaiHD @ ${HOME}, 2017
+ */
+
+#include "../atom.h"
+#include <errno.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+
+/**
+ * Corpora are generated once in a directory, with a fixed seed so every
+ * build read the same bytes. Results are written as CSV, one line per
+ * corpus, lexer and phase:
+ *   corpus,lexer,phase,bytes,nodes,seconds,mb_per_s,nodes_per_s,peak_rss_kb
+ * Peak RSS is reset before each phase when the kernel allow it
+ * (/proc/self/clear_refs), otherwise it's the peak of the process.
+ */
+
+typedef struct
+{
+    const char* corpusdir;
+    const char* output;
+    const char* only;
+    const char* actor;
+    size_t      stringsize;
+    size_t      streamsize;
+    int         rounds;
+} bench_options_t;
+
+typedef struct
+{
+    char*  data;
+    size_t length;
+    size_t capacity;
+} bench_buffer_t;
+
+typedef struct
+{
+    const char* name;
+    void        (*generate)(FILE* file, size_t size, const char* actor);
+} bench_corpus_t;
+
+static uint32_t bench_seed;
+
+static uint32_t bench_random(void)
+{
+    bench_seed ^= bench_seed << 13;
+    bench_seed ^= bench_seed >> 17;
+    bench_seed ^= bench_seed << 5;
+    return bench_seed;
+}
+
+static double bench_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * Reset the peak RSS of the process, Linux only
+ */
+static void bench_resetpeak(void)
+{
+    FILE* file = fopen("/proc/self/clear_refs", "w");
+    if (file)
+    {
+	fputs("5", file);
+	fclose(file);
+    }
+}
+
+/**
+ * Peak RSS in KB, since the last reset
+ */
+static long bench_peak(void)
+{
+    char  line[256];
+    long  peak = 0;
+    FILE* file = fopen("/proc/self/status", "r");
+    if (file)
+    {
+	while (fgets(line, sizeof(line), file))
+	{
+	    if (strncmp(line, "VmHWM:", 6) == 0)
+	    {
+		peak = atol(line + 6);
+		break;
+	    }
+	}
+	fclose(file);
+    }
+    if (peak == 0)
+    {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	peak = usage.ru_maxrss;
+    }
+    return peak;
+}
+
+static void bench_append(bench_buffer_t* buffer, const char* data, size_t length)
+{
+    if (buffer->length + length > buffer->capacity)
+    {
+	size_t capacity = buffer->capacity > 0 ? buffer->capacity : 4096;
+	while (capacity < buffer->length + length)
+	{
+	    capacity *= 2;
+	}
+	char* grown = realloc(buffer->data, capacity);
+	if (!grown)
+	{
+	    fprintf(stderr, "Out of memory\n");
+	    exit(1);
+	}
+	buffer->data     = grown;
+	buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+}
+
+/******
+ * Corpus generators
+ * Top-level items are written until the size is reached
+ */
+
+static void bench_deep(FILE* file, size_t size, const char* actor)
+{
+    (void)actor;
+    size_t written = 0;
+    while (written < size)
+    {
+	int depth = 32 + bench_random() % 96;
+	for (int i = 0; i < depth; i++)
+	{
+	    written += fprintf(file, "(d%d ", i);
+	}
+	written += fprintf(file, "%u", bench_random() % 100000);
+	for (int i = 0; i < depth; i++)
+	{
+	    fputc(')', file);
+	}
+	fputc('\n', file);
+	written += depth + 1;
+    }
+}
+
+static void bench_wide(FILE* file, size_t size, const char* actor)
+{
+    (void)actor;
+    size_t written = fprintf(file, "(wide");
+    while (written + 1 < size)
+    {
+	written += fprintf(file, " (item %u)", bench_random() % 1000);
+    }
+    fprintf(file, ")\n");
+}
+
+static void bench_numeric(FILE* file, size_t size, const char* actor)
+{
+    (void)actor;
+    size_t written = 0;
+    while (written < size)
+    {
+	written += fprintf(file, "(row");
+	for (int i = 0; i < 16; i++)
+	{
+	    uint32_t value = bench_random();
+	    if (i & 1)
+	    {
+		written += fprintf(file, " %d.%03u", (int)(value % 20001) - 10000, value % 1000);
+	    }
+	    else
+	    {
+		written += fprintf(file, " %d", (int)value);
+	    }
+	}
+	written += fprintf(file, ")\n");
+    }
+}
+
+static const char* bench_words[] = {
+    "atom", "list", "node", "text", "value", "lexer", "parse", "tree",
+    "actor", "scene", "position", "rotation", "scale", "prefab", "name", "guid",
+};
+
+static size_t bench_sentence(FILE* file, int count)
+{
+    size_t written = 0;
+    for (int i = 0; i < count; i++)
+    {
+	written += fprintf(file, i > 0 ? " %s" : "%s", bench_words[bench_random() % 16]);
+    }
+    return written;
+}
+
+static void bench_text(FILE* file, size_t size, const char* actor)
+{
+    (void)actor;
+    size_t written = 0;
+    while (written < size)
+    {
+	written += fprintf(file, "(line \"");
+	written += bench_sentence(file, 4 + bench_random() % 32);
+	written += fprintf(file, "\")\n");
+    }
+}
+
+static void bench_comment(FILE* file, size_t size, const char* actor)
+{
+    (void)actor;
+    size_t written = 0;
+    while (written < size)
+    {
+	written += fprintf(file, "; ");
+	written += bench_sentence(file, 8 + bench_random() % 16);
+	written += fprintf(file, "\n(item %u) ; ", bench_random() % 1000);
+	written += bench_sentence(file, 4);
+	written += fprintf(file, "\n");
+    }
+}
+
+static void bench_actor(FILE* file, size_t size, const char* actor)
+{
+    FILE* sample = fopen(actor, "rb");
+    if (!sample)
+    {
+	fprintf(stderr, "Cannot open %s: %s\n", actor, strerror(errno));
+	exit(1);
+    }
+    size_t length = atom_getfilesize(sample);
+    char*  text   = malloc(length + 1);
+    if (!text || fread(text, 1, length, sample) != length)
+    {
+	fprintf(stderr, "Cannot read %s\n", actor);
+	exit(1);
+    }
+    fclose(sample);
+
+    for (size_t written = 0; written < size; written += length + 1)
+    {
+	fwrite(text, 1, length, file);
+	fputc('\n', file);
+    }
+    free(text);
+}
+
+static const bench_corpus_t bench_corpora[] = {
+    { "deep",    bench_deep    },
+    { "wide",    bench_wide    },
+    { "numeric", bench_numeric },
+    { "text",    bench_text    },
+    { "comment", bench_comment },
+    { "actor",   bench_actor   },
+};
+
+/**
+ * Path of a corpus, generate it when it does not exist
+ */
+static void bench_corpus(const bench_options_t* options, const bench_corpus_t* corpus, size_t size, char* path, size_t length)
+{
+    snprintf(path, length, "%s/%s-%zuM.atom", options->corpusdir, corpus->name, size >> 20);
+
+    struct stat info;
+    if (stat(path, &info) == 0)
+    {
+	return;
+    }
+
+    FILE* file = fopen(path, "wb");
+    if (!file)
+    {
+	fprintf(stderr, "Cannot create %s: %s\n", path, strerror(errno));
+	exit(1);
+    }
+    printf("Generating %s\n", path);
+    bench_seed = 2463534242u;
+    corpus->generate(file, size, options->actor);
+    fclose(file);
+}
+
+/******
+ * Phases
+ */
+
+static void bench_walk(atom_lexer_t* lexer, atom_node_t* node, size_t* count, double* sum)
+{
+    for (atom_node_t* child = node->children; child; child = child->next)
+    {
+	(*count)++;
+	switch (child->type)
+	{
+	case ATOM_LIST:
+	    bench_walk(lexer, child, count, sum);
+	    break;
+
+	case ATOM_LONG:
+	    *sum += (double)child->data.as_long;
+	    break;
+
+	case ATOM_REAL:
+	    *sum += child->data.as_real;
+	    break;
+
+	case ATOM_TEXT:
+	    *sum += (child->flags & ATOM_NODE_CSTR) ? strlen(child->data.as_text.cstr) : (size_t)(child->data.as_text.tail - child->data.as_text.head);
+	    break;
+
+	default:
+	    break;
+	}
+    }
+}
+
+/**
+ * Write a text as JSON string, texts of stream lexer are copied first
+ */
+static void bench_jsontext(bench_buffer_t* out, atom_lexer_t* lexer, atom_node_t* node, atom_text_t text)
+{
+    char        stack[1024];
+    char*       copy  = NULL;
+    const char* chars = text.cstr;
+    size_t      length;
+    if (node->flags & ATOM_NODE_CSTR)
+    {
+	length = chars ? strlen(chars) : 0;
+    }
+    else if (lexer->type == ATOM_LEXER_STRING)
+    {
+	chars  = lexer->string + text.head;
+	length = text.tail > text.head ? (size_t)(text.tail - text.head) : 0;
+    }
+    else
+    {
+	length = text.tail > text.head ? (size_t)(text.tail - text.head) : 0;
+	copy   = length < sizeof(stack) ? stack : malloc(length + 1);
+	chars  = copy;
+	atom_textcpy(lexer, text, copy);
+    }
+
+    /* Copy runs of plain characters, escape the others
+     */
+    char   escaped[8];
+    size_t start = 0;
+    bench_append(out, "\"", 1);
+    for (size_t i = 0; i < length; i++)
+    {
+	unsigned char c = (unsigned char)chars[i];
+	if (c == '"' || c == '\\' || c < 0x20)
+	{
+	    bench_append(out, chars + start, i - start);
+	    bench_append(out, escaped, c < 0x20 ? (size_t)sprintf(escaped, "\\u%04x", c) : (size_t)sprintf(escaped, "\\%c", c));
+	    start = i + 1;
+	}
+    }
+    bench_append(out, chars + start, length - start);
+    bench_append(out, "\"", 1);
+
+    if (copy && copy != stack)
+    {
+	free(copy);
+    }
+}
+
+/**
+ * Convert to JSON: a list with only named children is an object, other
+ * lists are arrays, names of values in arrays are dropped
+ */
+static void bench_json(bench_buffer_t* out, atom_lexer_t* lexer, atom_node_t* node)
+{
+    char number[64];
+    switch (node->type)
+    {
+    case ATOM_LIST:
+    {
+	atom_bool_t object = node->children != NULL;
+	for (atom_node_t* child = node->children; child && object; child = child->next)
+	{
+	    object = (child->flags & ATOM_NODE_CSTR) ? child->name.cstr != NULL : child->name.tail > child->name.head;
+	}
+	bench_append(out, object ? "{" : "[", 1);
+	for (atom_node_t* child = node->children; child; child = child->next)
+	{
+	    if (child != node->children)
+	    {
+		bench_append(out, ",", 1);
+	    }
+	    if (object)
+	    {
+		bench_jsontext(out, lexer, child, child->name);
+		bench_append(out, ":", 1);
+	    }
+	    bench_json(out, lexer, child);
+	}
+	bench_append(out, object ? "}" : "]", 1);
+	break;
+    }
+
+    case ATOM_LONG:
+	bench_append(out, number, snprintf(number, sizeof(number), "%lld", (long long)node->data.as_long));
+	break;
+
+    case ATOM_REAL:
+	bench_append(out, number, snprintf(number, sizeof(number), "%.17g", node->data.as_real));
+	break;
+
+    case ATOM_TEXT:
+	bench_jsontext(out, lexer, node, node->data.as_text);
+	break;
+
+    case ATOM_NAME:
+	bench_jsontext(out, lexer, node, node->name);
+	break;
+
+    default:
+	bench_append(out, "null", 4);
+	break;
+    }
+}
+
+static FILE* bench_results;
+
+static void bench_report(const char* corpus, const char* lexer, const char* phase, size_t bytes, size_t nodes, double seconds, long peak)
+{
+    double mbs = seconds > 0 ? bytes / seconds / (1 << 20) : 0;
+    double nps = seconds > 0 ? nodes / seconds : 0;
+    printf("%-8s %-6s %-9s %10.1f MB/s %12.0f nodes/s %9.3f s %8ld KB\n", corpus, lexer, phase, mbs, nps, seconds, peak);
+    fprintf(bench_results, "%s,%s,%s,%zu,%zu,%.6f,%.3f,%.0f,%ld\n", corpus, lexer, phase, bytes, nodes, seconds, mbs, nps, peak);
+    fflush(bench_results);
+}
+
+/**
+ * Run all phases on a corpus with one type of lexer, best of rounds
+ */
+static void bench_run(const bench_options_t* options, const char* corpus, const char* path, int type)
+{
+    const char* lexername = type == ATOM_LEXER_STRING ? "string" : "stream";
+    const char* phases[]  = { "parse", "traverse", "save", "json", "delete" };
+    double      best[5];
+    long        peak[5];
+    size_t      bytes = 0;
+    size_t      nodes = 0;
+
+    FILE* file = fopen(path, "rb");
+    if (!file)
+    {
+	fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+	return;
+    }
+    bytes = atom_getfilesize(file);
+
+    char* source = NULL;
+    if (type == ATOM_LEXER_STRING)
+    {
+	source = malloc(bytes + 1);
+	if (!source || fread(source, 1, bytes, file) != bytes)
+	{
+	    fprintf(stderr, "Cannot read %s\n", path);
+	    fclose(file);
+	    free(source);
+	    return;
+	}
+	source[bytes] = 0;
+    }
+
+    bench_buffer_t out;
+    memset(&out, 0, sizeof(out));
+    for (int i = 0; i < 5; i++)
+    {
+	best[i] = 1e30;
+	peak[i] = 0;
+    }
+
+    for (int round = 0; round < options->rounds; round++)
+    {
+	double       sum   = 0;
+	double       times[5];
+	long         peaks[5];
+	atom_lexer_t lexer;
+
+	fseek(file, 0, SEEK_SET);
+	atom_lexer_init(&lexer, type, type == ATOM_LEXER_STRING ? (void*)source : (void*)file);
+
+	bench_resetpeak();
+	double       start = bench_now();
+	atom_node_t* root  = atom_parse(&lexer);
+	times[0] = bench_now() - start;
+	peaks[0] = bench_peak();
+	if (!root)
+	{
+	    fprintf(stderr, "Parsing %s failed, error code: %d\n", path, lexer.errcode);
+	    break;
+	}
+
+	bench_resetpeak();
+	start    = bench_now();
+	nodes    = 1;
+	if (root->type == ATOM_LIST)
+	{
+	    bench_walk(&lexer, root, &nodes, &sum);
+	}
+	times[1] = bench_now() - start;
+	peaks[1] = bench_peak();
+
+	/* Output is indented, grow the buffer until it fits
+	 */
+	if (out.capacity < bytes * 2 + 4096)
+	{
+	    free(out.data);
+	    out.capacity = bytes * 2 + 4096;
+	    out.data     = malloc(out.capacity);
+	}
+	int save;
+	do {
+	    bench_resetpeak();
+	    start    = bench_now();
+	    save     = atom_save_string_with_lexer(&lexer, root, out.data, out.capacity);
+	    times[2] = bench_now() - start;
+	    peaks[2] = bench_peak();
+	    if (save == ATOM_ERROR_OVERFLOW)
+	    {
+		free(out.data);
+		out.capacity *= 2;
+		out.data      = malloc(out.capacity);
+	    }
+	} while (save == ATOM_ERROR_OVERFLOW && out.data);
+	if (save != ATOM_ERROR_NONE)
+	{
+	    fprintf(stderr, "Saving %s failed, error code: %d\n", path, save);
+	}
+
+	bench_resetpeak();
+	out.length = 0;
+	start      = bench_now();
+	bench_json(&out, &lexer, root);
+	times[3]   = bench_now() - start;
+	peaks[3]   = bench_peak();
+
+	bench_resetpeak();
+	start    = bench_now();
+	atom_delete(root);
+	atom_release();
+	times[4] = bench_now() - start;
+	peaks[4] = bench_peak();
+
+	for (int i = 0; i < 5; i++)
+	{
+	    best[i] = times[i] < best[i] ? times[i] : best[i];
+	    peak[i] = peaks[i] > peak[i] ? peaks[i] : peak[i];
+	}
+	if (sum == 0.5)
+	{
+	    printf("\n"); /* Keep the walk from being optimized out */
+	}
+    }
+
+    if (best[0] < 1e30)
+    {
+	for (int i = 0; i < 5; i++)
+	{
+	    bench_report(corpus, lexername, phases[i], bytes, nodes, best[i], peak[i]);
+	}
+    }
+    free(out.data);
+    free(source);
+    fclose(file);
+}
+
+static void bench_usage(const char* program)
+{
+    fprintf(stderr,
+	    "Usage: %s [options]\n"
+	    "  -s MB    size of corpora for the string lexer (default 32)\n"
+	    "  -S MB    size of corpora for the stream lexer, 0 to skip (default 1)\n"
+	    "  -r N     rounds, the best time is reported (default 3)\n"
+	    "  -c name  only run this corpus: deep, wide, numeric, text, comment, actor\n"
+	    "  -d dir   directory of generated corpora (default bench-corpus)\n"
+	    "  -a path  actor sample to scale up (default samples/actor.atom)\n"
+	    "  -o path  CSV results (default bench.csv)\n",
+	    program);
+}
+
+int main(int argc, char* argv[])
+{
+    printf("Atom benchmark v1.0 - MaiHD\n");
+
+    bench_options_t options;
+    options.corpusdir  = "bench-corpus";
+    options.output     = "bench.csv";
+    options.only       = NULL;
+    options.actor      = "samples/actor.atom";
+    options.stringsize = (size_t)32 << 20;
+    options.streamsize = (size_t)1 << 20;
+    options.rounds     = 3;
+
+    for (int i = 1; i < argc; i++)
+    {
+	if (argv[i][0] != '-' || argv[i][1] == 0 || argv[i][2] != 0 || i + 1 >= argc)
+	{
+	    bench_usage(argv[0]);
+	    return 1;
+	}
+	const char* value = argv[++i];
+	switch (argv[i - 1][1])
+	{
+	case 's': options.stringsize = (size_t)atol(value) << 20; break;
+	case 'S': options.streamsize = (size_t)atol(value) << 20; break;
+	case 'r': options.rounds     = atoi(value) > 0 ? atoi(value) : 1; break;
+	case 'c': options.only       = value; break;
+	case 'd': options.corpusdir  = value; break;
+	case 'a': options.actor      = value; break;
+	case 'o': options.output     = value; break;
+	default:
+	    bench_usage(argv[0]);
+	    return 1;
+	}
+    }
+
+    if (mkdir(options.corpusdir, 0755) != 0 && errno != EEXIST)
+    {
+	fprintf(stderr, "Cannot create %s: %s\n", options.corpusdir, strerror(errno));
+	return 1;
+    }
+    if (!(bench_results = fopen(options.output, "w")))
+    {
+	fprintf(stderr, "Cannot create %s: %s\n", options.output, strerror(errno));
+	return 1;
+    }
+    fprintf(bench_results, "corpus,lexer,phase,bytes,nodes,seconds,mb_per_s,nodes_per_s,peak_rss_kb\n");
+
+    char path[1024];
+    for (size_t i = 0; i < sizeof(bench_corpora) / sizeof(bench_corpora[0]); i++)
+    {
+	const bench_corpus_t* corpus = &bench_corpora[i];
+	if (options.only && strcmp(options.only, corpus->name) != 0)
+	{
+	    continue;
+	}
+
+	if (options.stringsize > 0)
+	{
+	    bench_corpus(&options, corpus, options.stringsize, path, sizeof(path));
+	    bench_run(&options, corpus->name, path, ATOM_LEXER_STRING);
+	}
+	if (options.streamsize > 0)
+	{
+	    bench_corpus(&options, corpus, options.streamsize, path, sizeof(path));
+	    bench_run(&options, corpus->name, path, ATOM_LEXER_STREAM);
+	}
+    }
+
+    fclose(bench_results);
+    printf("Results are written to %s\n", options.output);
+    return 0;
+}
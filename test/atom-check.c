@@ -0,0 +1,512 @@
+/**
+ * Atom - file data format with s-expression
+ * Checks of the runtime, exit code is the number of failures
+ *
+ * @author: MaiHD
+ * @license: Free to use
+ * @copyright: MaiHD @ ${HOME}, 2017
+ */
+
+#include "../atom.h"
+#include <string.h>
+
+static int failures = 0;
+
+static void check(int condition, const char* what)
+{
+    if (!condition)
+    {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+static void* check_extract(void* data, size_t size)
+{
+    (void)data;
+    return malloc(size);
+}
+
+static void check_collect(void* data, void* pointer)
+{
+    (void)data;
+    free(pointer);
+}
+
+/**
+ * Read all bytes of a file, the result is zero-terminated and must be freed
+ */
+static char* check_readfile(FILE* file, size_t* length)
+{
+    *length = atom_getfilesize(file);
+    char* data = (char*)malloc(*length + 1);
+    rewind(file);
+    if (fread(data, 1, *length, file) != *length)
+    {
+        *length = 0;
+    }
+    data[*length] = 0;
+    return data;
+}
+
+static char* check_loadfile(const char* path, size_t* length)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file)
+    {
+        *length = 0;
+        return NULL;
+    }
+    char* data = check_readfile(file, length);
+    fclose(file);
+    return data;
+}
+
+/**
+ * Document with many top-level lists, so saves have chunks to split
+ */
+static char* check_document(int count)
+{
+    size_t size = (size_t)count * 96 + 1;
+    char*  text = (char*)malloc(size);
+    size_t used = 0;
+    for (int i = 0; i < count; i++)
+    {
+        used += snprintf(text + used, size - used, "(item%d (id %d) (scale %d.25) (tag \"t%d\") (pos (x %d) (y -%d)))\n", i, i, i, i % 7, i, i);
+    }
+    return text;
+}
+
+/* Parallel and asynchronous saves give the same bytes as the plain stream save
+ */
+static void check_save(void)
+{
+    char*        text = check_document(500);
+    atom_lexer_t lexer;
+    atom_lexer_init(&lexer, ATOM_LEXER_STRING, text);
+    atom_node_t* root = atom_parse(&lexer);
+    check(root != NULL, "parse document to save");
+
+    FILE*  stream   = tmpfile();
+    int    count    = atom_save_stream_with_lexer(&lexer, root, stream);
+    size_t expected = 0;
+    char*  bytes    = check_readfile(stream, &expected);
+    fclose(stream);
+    check(count > 0 && (size_t)count == expected, "stream save return the number of bytes");
+
+    FILE*  parallel = tmpfile();
+    size_t written  = 0;
+    check(atom_save_parallel(&lexer, root, parallel, 4, &written) == ATOM_ERROR_NONE, "parallel save");
+    size_t length = 0;
+    char*  result = check_readfile(parallel, &length);
+    fclose(parallel);
+    check(written == expected && length == expected && memcmp(result, bytes, length) == 0, "parallel save match stream save");
+    free(result);
+
+    const char*       path   = "atom-check.tmp";
+    atom_saveasync_t* handle = atom_save_async(&lexer, root, path, ATOM_SAVE_RENAME);
+    check(handle != NULL, "start asynchronous save");
+    if (handle)
+    {
+        written = 0;
+        check(atom_save_wait(handle, &written) == ATOM_ERROR_NONE, "asynchronous save");
+        result = check_loadfile(path, &length);
+        check(result && written == expected && length == expected && memcmp(result, bytes, length) == 0, "asynchronous save match stream save");
+        free(result);
+        remove(path);
+    }
+
+    free(bytes);
+    atom_delete(root);
+    atom_lexer_free(&lexer);
+    free(text);
+}
+
+/* Canonical output read back give the same tree, so the same bytes and hash
+ */
+static void check_canonical(void)
+{
+    static const atom_real_t reals[] = { 0.1, 0.289383, 1.0 / 3.0, 2.5e-8, 123456.789e3, 9007199254740993.0, 1e300, 5e-324 };
+
+    size_t size = 1 << 20;
+    char*  text = (char*)malloc(size);
+    char*  save = (char*)malloc(size);
+    size_t used = snprintf(text, size, "(reals");
+    for (int i = 0; i < 10000; i += 7)
+    {
+        used += snprintf(text + used, size - used, " (x %d.289383) (y -%.17g)", i, i / 3.0);
+    }
+    for (size_t i = 0; i < sizeof(reals) / sizeof(reals[0]); i++)
+    {
+        used += snprintf(text + used, size - used, " %.340f", reals[i]);
+    }
+    snprintf(text + used, size - used, ")");
+
+    atom_lexer_t lexer;
+    atom_lexer_init(&lexer, ATOM_LEXER_STRING, text);
+    atom_node_t* first = atom_parse(&lexer);
+    check(first && atom_save_canonical_string(&lexer, first, save, size) == ATOM_ERROR_NONE, "canonical save");
+
+    atom_lexer_t again;
+    atom_lexer_init(&again, ATOM_LEXER_STRING, save);
+    atom_node_t* second = atom_parse(&again);
+    char*        resave = (char*)malloc(size);
+    check(second && atom_save_canonical_string(&again, second, resave, size) == ATOM_ERROR_NONE, "canonical save of reparsed tree");
+    check(strcmp(save, resave) == 0, "canonical bytes are stable across a reparse");
+    check(atom_hash(&lexer, first) == atom_hash(&again, second), "hash is stable across a reparse");
+    check(atom_equal(&lexer, first, &again, second), "reparsed tree equal the source");
+
+    atom_node_t* last = second ? second->lastchild : NULL;
+    check(last && last->type == ATOM_REAL && last->data.as_real == 5e-324, "smallest real read back");
+
+    free(resave);
+    atom_delete(second);
+    atom_lexer_free(&again);
+    atom_delete(first);
+    atom_lexer_free(&lexer);
+    free(save);
+    free(text);
+}
+
+/* Applying the diff of a and b to a copy of a give b
+ */
+static void check_patch(void)
+{
+    static const char* pairs[][2] = {
+        { "(a 1) (b 2) (c 3)",                   "(a 1) (c 4) (d 5)"                   },
+        { "(root (x 1) (y (z 2) (w 3)))",        "(root (y (w 3) (z 2)) (x 1.5))"      },
+        { "(list 1 2 3 4 5)",                    "(list 5 4 3 2 1 0)"                  },
+        { "(name \"a\") (items (i 1) (i 2))",    "(items (i 2) (i 1) (i 3)) (name \"b\")" },
+        { "(empty)",                             "(full (of (nested (lists 1))))"      },
+    };
+
+    for (size_t i = 0; i < sizeof(pairs) / sizeof(pairs[0]); i++)
+    {
+        atom_lexer_t alexer, blexer;
+        atom_lexer_init(&alexer, ATOM_LEXER_STRING, (void*)pairs[i][0]);
+        atom_lexer_init(&blexer, ATOM_LEXER_STRING, (void*)pairs[i][1]);
+        atom_node_t* a = atom_parse(&alexer);
+        atom_node_t* b = atom_parse(&blexer);
+
+        atom_node_t* script = atom_diff(&alexer, a, &blexer, b);
+        atom_node_t* tree   = atom_clone(&alexer, a);
+        check(script && tree, "diff of two trees");
+        if (script && tree)
+        {
+            check(atom_patch(tree, NULL, script) == ATOM_ERROR_NONE, "patch with diff");
+            check(atom_equal(NULL, tree, &blexer, b), "patched tree equal the target");
+            check(atom_hash(NULL, tree) == atom_hash(&blexer, b), "patched tree hash equal the target hash");
+        }
+
+        atom_delete(script);
+        atom_delete(tree);
+        atom_delete(a);
+        atom_delete(b);
+        atom_lexer_free(&alexer);
+        atom_lexer_free(&blexer);
+    }
+}
+
+/* Patch keep the index up to date, and a malformed script change nothing
+ */
+static void check_patchindex(void)
+{
+    const char*  text = "(root (a 1) (b 2) (c 3))";
+    atom_lexer_t lexer;
+    atom_lexer_init(&lexer, ATOM_LEXER_STRING, (void*)text);
+    atom_node_t* root = atom_parse(&lexer);
+    check(atom_index(&lexer, root, ATOM_TRUE) == ATOM_ERROR_NONE, "index before patch");
+
+    static const char* scripts[] = {
+        "(patch (replace (at 1) (q 9)))",
+        "(patch (move (at 0) 2))",
+        "(patch (replace (at 0) (z 1)) (bogus (at 1)))",
+        "(patch (delete (at 0)) (move (at 0) -1))",
+        "(patch (delete (at 7)))",
+    };
+    static const int results[] = { ATOM_ERROR_NONE, ATOM_ERROR_NONE, ATOM_ERROR_PATCH, ATOM_ERROR_PATCH, ATOM_ERROR_PATCH };
+
+    for (int i = 0; i < 5; i++)
+    {
+        atom_lexer_t slexer;
+        atom_lexer_init(&slexer, ATOM_LEXER_STRING, (void*)scripts[i]);
+        atom_node_t* script = atom_parse(&slexer);
+        uint64_t     hash   = atom_hash(&lexer, root);
+        check(atom_patch(root, &slexer, script) == results[i], "patch result");
+        if (results[i] != ATOM_ERROR_NONE)
+        {
+            check(atom_hash(&lexer, root) == hash, "failed patch change nothing");
+        }
+        atom_delete(script);
+        atom_lexer_free(&slexer);
+    }
+
+    atom_node_t* q = atom_find(&lexer, root, "q");
+    check(q && q->data.as_long == 9 && atom_find(&lexer, root, "b") == NULL, "find replaced child in index");
+    check(root->lastchild == atom_find(&lexer, root, "a") && root->children == q, "find moved child in index");
+
+    atom_delete(root);
+    atom_lexer_free(&lexer);
+}
+
+/* Children found in an interned list can be changed, the other lists keep sharing
+ */
+static void check_intern(void)
+{
+    const char*  text = "(a (p (x 1) (y 2)) (q (x 1) (y 2)) (r (x 1) (y 2)))";
+    atom_lexer_t lexer;
+    atom_lexer_init(&lexer, ATOM_LEXER_STRING, (void*)text);
+    atom_node_t* root = atom_parse(&lexer);
+    check(atom_intern(&lexer, root) > 0, "intern equal lists");
+
+    atom_node_t* p = atom_find(&lexer, root, "p");
+    atom_node_t* q = atom_find(&lexer, root, "q");
+    atom_node_t* r = atom_find(&lexer, root, "r");
+    check(p && q && r && (p->flags & q->flags & r->flags & ATOM_NODE_SHARED), "lists are shared");
+
+    atom_query_t* query = atom_query_compile("a/r/x");
+    check(atom_query_first(query, &lexer, root) && (r->flags & ATOM_NODE_SHARED), "query keep lists shared");
+    atom_query_free(query);
+
+    atom_node_t* x = atom_find(&lexer, p, "x");
+    check(x && !(x->flags & ATOM_NODE_READONLY) && x->parent == p, "found child is a private copy");
+    atom_delete(x);
+    check(atom_find(&lexer, p, "x") == NULL, "delete through interned list");
+
+    atom_node_t* y = atom_find(&lexer, q, "y");
+    y->flags    |= ATOM_NODE_CSTR;
+    y->name.cstr = "z";
+    check(atom_find(&lexer, q, "z") == y && atom_find(&lexer, q, "y") == NULL, "rename through interned list");
+
+    char buffer[128];
+    check(atom_save_canonical_string(&lexer, root, buffer, sizeof(buffer)) == ATOM_ERROR_NONE, "save interned tree");
+    check(strcmp(buffer, "(a (p (y 2)) (q (x 1) (z 2)) (r (x 1) (y 2)))") == 0, "other lists are not changed");
+    check((r->flags & ATOM_NODE_SHARED) && !(p->flags & ATOM_NODE_SHARED), "unchanged list is still shared");
+
+    atom_delete(root);
+    atom_lexer_free(&lexer);
+}
+
+/* Index of a big list follow insert, remove and rename
+ */
+static void check_index(void)
+{
+    atom_text_t  name = { 0 };
+    atom_node_t* list = atom_newlist(name);
+    list->flags |= ATOM_NODE_CSTR;
+
+    static const char* names[] = {
+        "n00", "n01", "n02", "n03", "n04", "n05", "n06", "n07", "n08", "n09",
+        "n10", "n11", "n12", "n13", "n14", "n15", "n16", "n17", "n18", "n19",
+    };
+    for (int i = 0; i < 20; i++)
+    {
+        name.cstr = names[i];
+        atom_node_t* child = atom_newlong(name, i);
+        child->flags |= ATOM_NODE_CSTR;
+        atom_addchild(list, child);
+    }
+    check(atom_index(NULL, list, ATOM_FALSE) == ATOM_ERROR_NONE && list->index != NULL, "build index");
+    check(atom_find(NULL, list, "n13") && atom_find(NULL, list, "n13")->data.as_long == 13, "find in index");
+
+    name.cstr = "inserted";
+    atom_node_t* inserted = atom_newlong(name, 100);
+    inserted->flags |= ATOM_NODE_CSTR;
+    check(atom_insertchild(list, inserted, 5) == ATOM_ERROR_NONE, "insert into indexed list");
+    check(atom_find(NULL, list, "inserted") == inserted, "find inserted child");
+
+    atom_node_t* removed = atom_removechild(list, atom_find(NULL, list, "n07"));
+    check(removed && atom_find(NULL, list, "n07") == NULL, "removed child is not found");
+    atom_delete(removed);
+
+    atom_node_t* renamed = atom_find(NULL, list, "n19");
+    renamed->name.cstr = "last";
+    check(atom_index(NULL, list, ATOM_FALSE) == ATOM_ERROR_NONE, "index again after rename");
+    check(atom_find(NULL, list, "last") == renamed && atom_find(NULL, list, "n19") == NULL, "find renamed child");
+    check(atom_find(NULL, list, "n00") && atom_find(NULL, list, "n18"), "other children are still found");
+
+    atom_delete(list);
+}
+
+static atom_bool_t check_count(void* context, atom_node_t* node)
+{
+    (void)node;
+    (*(int*)context)++;
+    return ATOM_TRUE;
+}
+
+static atom_bool_t check_drop(void* context, atom_node_t* node)
+{
+    (*(int*)context)++;
+    atom_delete(node);
+    return ATOM_TRUE;
+}
+
+/* Query, projection, aggregate and table of the actor sample
+ */
+static void check_actor(const char* text)
+{
+    atom_lexer_t lexer;
+    atom_lexer_init(&lexer, ATOM_LEXER_STRING, (void*)text);
+    atom_node_t* root = atom_parse(&lexer);
+    check(root != NULL, "parse actor sample");
+
+    atom_query_t* prefab = atom_query_compile("transform/children/prefab");
+    atom_query_t* axes   = atom_query_compile("transform/*/x");
+    check(prefab && axes, "compile queries");
+
+    atom_node_t* found = atom_query_first(prefab, &lexer, root);
+    check(found && found->type == ATOM_LONG && found->data.as_long == 1010, "query first");
+
+    int count = 0;
+    check(atom_query_each(axes, &lexer, root, check_count, &count) == 3 && count == 3, "query each with '*'");
+
+    atom_lexer_t stream;
+    atom_lexer_init(&stream, ATOM_LEXER_STRING, (void*)text);
+    count = 0;
+    check(atom_query_stream(axes, &stream, check_drop, &count) == 3 && count == 3, "query on lexer");
+    atom_lexer_free(&stream);
+
+    atom_lexer_init(&stream, ATOM_LEXER_STRING, (void*)text);
+    const char*  paths[]   = { "transform/scale", "name" };
+    atom_node_t* projected = atom_parse_paths(&stream, paths, 2);
+    char         buffer[256];
+    check(projected && atom_save_canonical_string(&stream, projected, buffer, sizeof(buffer)) == ATOM_ERROR_NONE, "projection");
+    check(strcmp(buffer, "((name \"Actor\") (transform (scale (x 0.0) (y 0.0) (z 0.0))))") == 0, "projection keep matched subtrees");
+    atom_delete(projected);
+    atom_lexer_free(&stream);
+
+    atom_lexer_init(&stream, ATOM_LEXER_STRING, (void*)text);
+    atom_aggregate_t aggregate;
+    atom_aggregate_init(&aggregate, NULL, 0, 0, 0);
+    check(atom_aggregate(prefab, &stream, &aggregate) == ATOM_ERROR_NONE, "aggregate");
+    check(aggregate.count == 1 && aggregate.sum == 1010 && aggregate.min == 1010 && aggregate.max == 1010, "aggregate of prefab");
+    atom_lexer_free(&stream);
+
+    atom_lexer_init(&stream, ATOM_LEXER_STRING, (void*)text);
+    const char*        columns[] = { "position/x", "children/prefab" };
+    const atom_type_t  types[]   = { ATOM_REAL, ATOM_LONG };
+    atom_table_t*      table     = atom_table_create(columns, types, 2);
+    check(table && atom_table_extract(table, &stream) == ATOM_ERROR_NONE, "table extract");
+    if (table)
+    {
+        check(table->rows == 2, "a row per top-level list");
+        check(!table->columns[1].valid[0] && table->columns[1].valid[1] && table->columns[1].longs[1] == 1010, "table values");
+        check(table->columns[0].valid[1] && table->columns[0].reals[1] == 0.0, "real column");
+        atom_table_free(table);
+    }
+    atom_lexer_free(&stream);
+
+    atom_query_free(prefab);
+    atom_query_free(axes);
+    atom_delete(root);
+    atom_lexer_free(&lexer);
+}
+
+/* Lookups in a frozen sorted tree give the same nodes as in the source tree
+ */
+static void check_freeze(const char* text)
+{
+    atom_lexer_t lexer;
+    atom_lexer_init(&lexer, ATOM_LEXER_STRING, (void*)text);
+    atom_node_t* root   = atom_parse(&lexer);
+    atom_node_t* frozen = atom_freeze(&lexer, root, ATOM_FREEZE_SORTED);
+    check(frozen && (frozen->flags & ATOM_NODE_FROZEN), "freeze tree");
+    if (frozen)
+    {
+        atom_node_t* transform = atom_find(NULL, frozen, "transform");
+        atom_node_t* rotation  = transform ? atom_find(NULL, transform, "rotation") : NULL;
+        atom_node_t* prefab    = transform ? atom_find(NULL, atom_find(NULL, transform, "children"), "prefab") : NULL;
+        check(rotation && atom_find(NULL, rotation, "z") && atom_find(NULL, rotation, "z")->type == ATOM_REAL, "find in frozen tree");
+        check(prefab && prefab->data.as_long == 1010, "find nested in frozen tree");
+        check(transform && atom_find(NULL, transform, "missing") == NULL, "missing name in frozen tree");
+        atom_delete(frozen);
+    }
+
+    frozen = atom_freeze(&lexer, root, 0);
+    check(frozen && atom_equal(&lexer, root, NULL, frozen) && atom_hash(&lexer, root) == atom_hash(NULL, frozen), "frozen tree equal the source");
+    if (frozen)
+    {
+        atom_delete(frozen);
+    }
+    atom_delete(root);
+    atom_lexer_free(&lexer);
+}
+
+/* Stats, trace and memory counters move with the work done
+ */
+static void check_counters(const char* text)
+{
+    atom_heap_t   heap     = { NULL, 0, NULL, NULL, NULL, { 0, 0, 0, 0, 0 } };
+    atom_heap_t*  previous = atom_useheap(&heap);
+    atom_stats_t  stats;
+    atom_memory_t memory;
+    atom_init(NULL, 0, check_extract, check_collect);
+    atom_getstats(&stats, ATOM_TRUE);
+    atom_trace_enable(ATOM_TRUE);
+
+    atom_lexer_t lexer;
+    atom_lexer_init(&lexer, ATOM_LEXER_STRING, (void*)text);
+    atom_node_t* root = atom_parse(&lexer);
+
+    atom_getstats(&stats, ATOM_FALSE);
+#ifdef ATOM_STATS
+    check(stats.bytes > 0 && stats.tokens > 0 && stats.newnodes > 0, "stats count parse");
+#endif
+
+    atom_getmemory(NULL, &memory);
+    atom_memory_t subtree;
+    atom_memoryof(root, &subtree);
+    check(memory.nodes > 0 && memory.nodes == subtree.nodes && memory.reserved >= memory.used, "memory of heap");
+
+    atom_delete(root);
+    atom_getmemory(&heap, &memory);
+    check(memory.nodes == 0, "no live node after delete");
+#ifdef ATOM_STATS
+    atom_getstats(&stats, ATOM_FALSE);
+    check(stats.freenodes == stats.newnodes, "stats count freed nodes");
+#endif
+
+    atom_trace_enable(ATOM_FALSE);
+    FILE* trace = tmpfile();
+    int   count = atom_trace_dump(trace, ATOM_TRUE);
+    fclose(trace);
+#ifdef ATOM_TRACE
+    check(count > 0, "trace record forms");
+#else
+    check(count == 0, "no trace without ATOM_TRACE");
+#endif
+
+    atom_release();
+    atom_getmemory(&heap, &memory);
+    check(memory.chunks == 0 && memory.reserved == 0 && memory.peak > 0, "memory given back");
+    atom_lexer_free(&lexer);
+    atom_useheap(previous);
+}
+
+int main(int argc, char* argv[])
+{
+    printf("Atom runtime checks v1.0 - MaiHD\n");
+
+    size_t length = 0;
+    char*  actor  = check_loadfile(argc > 1 ? argv[1] : "samples/actor.atom", &length);
+    if (!actor)
+    {
+        printf("Cannot open sample\n");
+        return 1;
+    }
+
+    check_save();
+    check_canonical();
+    check_patch();
+    check_patchindex();
+    check_intern();
+    check_index();
+    check_actor(actor);
+    check_freeze(actor);
+    check_counters(actor);
+
+    free(actor);
+    printf("%s, %d failed\n", failures ? "Failed" : "Passed", failures);
+    return failures;
+}
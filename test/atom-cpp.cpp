@@ -0,0 +1,239 @@
+/**
+ * Atom - file data format with s-expression
+ * Checks of the C++17 parts of atom.hpp, and benchmark against the same work
+ * done with the C calls. Exit code is the number of failures, a wrapper
+ * clearly slower than the C calls is a failure
+ *
+ * @author: MaiHD
+ * @license: Free to use
+ * @copyright: MaiHD @ ${HOME}, 2017
+ */
+
+#include "../atom.hpp"
+
+#include <chrono>
+#include <string>
+#include <utility>
+
+/* Keep results alive, so the compiler does not remove the work
+ */
+static volatile double sink;
+
+/* Slowest accepted ratio of atom.hpp time to C calls time, above is a failure
+ */
+static const double slowest = 1.5;
+
+static int failures = 0;
+
+static void check(bool condition, const char* what)
+{
+    if (!condition)
+    {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+/* Moved documents keep their nodes, moved-from documents are empty
+ */
+static void check_document()
+{
+    atom::document doc = atom::document::parse("(player (name \"hero\") (hp 100) (pos (x 1.5) (y -2)))");
+    check(doc && doc.error() == ATOM_ERROR_NONE, "parse document");
+
+    atom::node_ref hp    = doc["hp"];
+    atom::document moved = std::move(doc);
+    check(!doc && !doc.root() && doc.source().empty(), "moved-from document is empty");
+    check(moved && moved["hp"].get() == hp.get() && hp.as_long() == 100, "node_ref stay valid after move");
+
+    atom::document other = atom::document::parse("(other 1)");
+    other = std::move(moved);
+    check(!moved && other && other.root().name() == "player", "move assignment");
+    other = std::move(other);
+    check(other && other["hp"].as_long() == 100, "self move assignment keep the document");
+
+    atom::document broken = atom::document::parse("(a (b 1)");
+    check(!broken && broken.error() == ATOM_ERROR_UNBALANCED, "parse error");
+    check(!atom::document::load("missing.atom") && atom::document::load("missing.atom").error() == ATOM_ERROR_IO, "load error");
+}
+
+/* Views into the source, chained lookups and iteration
+ */
+static void check_views()
+{
+    atom::document doc  = atom::document::parse("(player (name \"hero\") (hp 100) (pos (x 1.5) (y -2)) (tags \"a\" \"b\" 3))");
+    std::string_view name = doc.root().name();
+    check(name == "player" && name.data() >= doc.source().data() && name.data() < doc.source().data() + doc.source().size(), "names are views into the source");
+    check(doc["name"].as_text() == "hero" && doc["name"].as_text()->data() > doc.source().data(), "texts are views into the source");
+    check(doc["pos"]["y"].as_real() == -2.0 && !doc["pos"]["z"] && !doc["missing"]["x"]["y"], "chained lookups");
+    check(doc["pos"].size() == 2 && doc["hp"].size() == 0 && !doc["hp"].is_list(), "size of lists and values");
+
+    size_t count = 0;
+    for (atom::node_ref tag : doc["tags"])
+    {
+        check(tag.name().empty(), "unnamed items");
+        count++;
+    }
+    check(count == 3 && std::distance(doc["tags"].begin(), doc["tags"].end()) == 3, "iterate children");
+    check(doc["missing"].begin() == doc["missing"].end(), "null reference has no children");
+}
+
+/* Getters are empty for other types, as_real also take integers
+ */
+static void check_getters()
+{
+    atom::document doc = atom::document::parse("(values (l -7) (r 0.25) (t \"text\") (list (a 1)))");
+    check(doc["l"].as_long() == -7 && doc["l"].as_real() == -7.0 && !doc["l"].as_text(), "long getters");
+    check(!doc["r"].as_long() && doc["r"].as_real() == 0.25 && !doc["r"].as_text(), "real getters");
+    check(!doc["t"].as_long() && !doc["t"].as_real() && doc["t"].as_text() == "text", "text getters");
+    check(!doc["list"].as_long() && !doc["list"].as_real() && !doc["list"].as_text(), "list has no value");
+    check(!doc["missing"].as_long() && doc["missing"].type() == ATOM_NONE, "null reference has no value");
+}
+
+static double walk_c(atom_lexer_t* lexer, atom_node_t* node, size_t* names)
+{
+    double sum = 0;
+    for (atom_node_t* child = node->children; child; child = child->next)
+    {
+        if (!(child->flags & ATOM_NODE_CSTR) && child->name.tail > child->name.head)
+        {
+            *names += (size_t)(child->name.tail - child->name.head);
+        }
+        switch (child->type)
+        {
+        case ATOM_LIST: sum += walk_c(lexer, child, names); break;
+        case ATOM_LONG: sum += (double)child->data.as_long; break;
+        case ATOM_REAL: sum += child->data.as_real;         break;
+        default:        break;
+        }
+    }
+    return sum;
+}
+
+static double walk_cpp(atom::node_ref node, size_t* names)
+{
+    double sum = 0;
+    for (atom::node_ref child : node)
+    {
+        *names += child.name().size();
+        if (child.is_list())
+        {
+            sum += walk_cpp(child, names);
+        }
+        else if (auto value = child.as_real())
+        {
+            sum += *value;
+        }
+    }
+    return sum;
+}
+
+/* What hand-written wrappers did: copy each name to a std::string
+ */
+static double walk_copy(atom_lexer_t* lexer, atom_node_t* node, size_t* names)
+{
+    double sum = 0;
+    char   buffer[1024];
+    for (atom_node_t* child = node->children; child; child = child->next)
+    {
+        std::string name(buffer, child->name.tail > child->name.head ? atom_textcpy(lexer, child->name, buffer) : 0);
+        *names += name.size();
+        switch (child->type)
+        {
+        case ATOM_LIST: sum += walk_copy(lexer, child, names); break;
+        case ATOM_LONG: sum += (double)child->data.as_long;    break;
+        case ATOM_REAL: sum += child->data.as_real;            break;
+        default:        break;
+        }
+    }
+    return sum;
+}
+
+/* Best time of rounds, less noisy than the mean on a loaded machine
+ */
+template <typename F>
+static double measure(const char* title, int rounds, F&& work)
+{
+    double ms = 0;
+    for (int i = 0; i < rounds; i++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        work();
+        double round = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        ms = i == 0 || round < ms ? round : ms;
+    }
+    printf("%-24s %10.3f ms\n", title, ms);
+    return ms;
+}
+
+int main(int argc, char* argv[])
+{
+    printf("Atom C++ wrapper benchmark v1.0 - MaiHD\n");
+
+    check_document();
+    check_views();
+    check_getters();
+
+    /* Synthetic document: records of transforms, or the given file
+     */
+    atom::document doc;
+    if (argc > 1)
+    {
+        doc = atom::document::load(argv[1]);
+    }
+    else
+    {
+        std::string text = "(scene";
+        char        record[256];
+        for (int i = 0; i < 20000; i++)
+        {
+            snprintf(record, sizeof(record), " (actor (name \"actor%d\") (guid %d) (position (x %d.5) (y 1.0) (z -2.0)) (scale (x 1) (y 1) (z 1)))", i, i, i);
+            text += record;
+        }
+        text += ")";
+        doc = atom::document::parse(text);
+    }
+    if (!doc)
+    {
+        fprintf(stderr, "Parsing error! code: %d\n", doc.error());
+        return 1;
+    }
+
+    const int     rounds = 20;
+    atom_lexer_t* lexer  = doc.lexer();
+    atom_node_t*  root   = doc.root().get();
+    size_t        names  = 0;
+
+    double c   = measure("walk, C calls", rounds, [&] { sink = walk_c(lexer, root, &names); });
+    double cpp = measure("walk, atom.hpp", rounds, [&] { sink = walk_cpp(doc.root(), &names); });
+    measure("walk, copy names", rounds, [&] { sink = walk_copy(lexer, root, &names); });
+
+    /* Lookups by name, after the index is built
+     */
+    atom_index(lexer, root, ATOM_TRUE);
+    double cfind = measure("find x1000, C calls", rounds, [&] {
+        double sum = 0;
+        for (int i = 0; i < 1000; i++)
+        {
+            atom_node_t* actor = atom_find(lexer, root, "actor");
+            atom_node_t* guid  = actor ? atom_find(lexer, actor, "guid") : NULL;
+            sum += guid && guid->type == ATOM_LONG ? (double)guid->data.as_long : 0;
+        }
+        sink = sum;
+    });
+    double cppfind = measure("find x1000, atom.hpp", rounds, [&] {
+        double sum = 0;
+        for (int i = 0; i < 1000; i++)
+        {
+            sum += (double)doc["actor"]["guid"].as_long().value_or(0);
+        }
+        sink = sum;
+    });
+
+    printf("atom.hpp / C: walk %.2f, find %.2f\n", cpp / c, cppfind / cfind);
+    check(cpp / c <= slowest, "walk with atom.hpp is not slower than with C calls");
+    check(cppfind / cfind <= slowest, "find with atom.hpp is not slower than with C calls");
+
+    printf("%s, %d failed\n", failures ? "Failed" : "Passed", failures);
+    return failures;
+}
@@ -0,0 +1,211 @@
+/**
+ * Atom - file data format with s-expression
+ * Checks of the C++20 parts of atom.hpp, exit code is the number of failures
+ *
+ * @author: MaiHD
+ * @license: Free to use
+ * @copyright: MaiHD @ ${HOME}, 2017
+ */
+
+#include "../atom.hpp"
+
+#include <cstddef>
+#include <cstdio>
+#include <memory_resource>
+#include <string>
+#include <vector>
+
+struct vec3
+{
+    float x, y, z;
+};
+ATOM_REFLECT(vec3, x, y, z)
+
+struct actor
+{
+    char     name[32];
+    int64_t  guid;
+    vec3     position;
+    double   scale;
+    uint8_t  layer;
+};
+ATOM_REFLECT(actor, name, guid, position, scale, layer)
+
+static int failures = 0;
+
+static void check(bool condition, const char* what)
+{
+    if (!condition)
+    {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+/* Literals are parsed at compile time, a wrong value fails the build
+ */
+constexpr auto config = ATOM_LITERAL(R"atom(
+    ; comments and brackets in texts are not nodes
+    (name "lib(atom)")
+    (version 100000)
+    (scale -2.5)
+    (window (width 1280) (height 720)))atom");
+
+static_assert(config["name"].as_text() == "lib(atom)");
+static_assert(config["version"].as_long() == 100000);
+static_assert(config["scale"].as_real() == -2.5);
+static_assert(config["window"]["height"].as_long() == 720);
+static_assert(config["window"].size() == 2);
+static_assert(!config["missing"]);
+
+constexpr auto empty = ATOM_LITERAL("");
+static_assert(empty.root().type() == ATOM_NONE);
+
+constexpr auto reals = ATOM_LITERAL("(a 30886.289383) (b 0.1) (c -1234.5678) (d 0.000000000000000000012)");
+
+static void check_literal()
+{
+    check(config["window"]["width"].as_real() == 1280.0, "literal long read as real");
+    check(!config["name"].as_long(), "literal text is not a long");
+
+    atom::document doc = atom::document::parse("(a 30886.289383) (b 0.1) (c -1234.5678) (d 0.000000000000000000012)");
+    for (const char* name : { "a", "b", "c", "d" })
+    {
+        check(doc && reals[name].as_real() == doc[name].as_real(), "literal reals have the same bits as at runtime");
+    }
+}
+
+/* Write then read back a struct with a nested reflected struct
+ */
+static void check_reflect()
+{
+    actor       hero = { "hero \"one\"", -9223372036854775807 - 1, { 1.5f, -2.0f, 0.1f }, 1e-3, 7 };
+    std::string text;
+    check(atom::write(text, hero) == ATOM_ERROR_NONE, "write reflected struct");
+
+    actor back = {};
+    check(atom::read(text.c_str(), back) == ATOM_ERROR_NONE, "read reflected struct");
+    check(std::strcmp(back.name, "hero 'one'") == 0, "quotes of texts are written as '");
+    check(back.guid == hero.guid && back.scale == hero.scale && back.layer == hero.layer, "round trip of numbers");
+    check(back.position.x == hero.position.x && back.position.y == hero.position.y && back.position.z == hero.position.z, "round trip of nested struct");
+
+    /* Invalid fields keep their value and are reported, the others are read
+     */
+    actor other = back;
+    check(atom::read("(layer 300) (guid 5)", other) == ATOM_ERROR_OVERFLOW && other.layer == 7 && other.guid == 5, "out of range field");
+    check(atom::read("(scale \"big\") (position (x 4.0))", other) == ATOM_ERROR_UNEXPECTED && other.scale == hero.scale && other.position.x == 4.0f, "field of other type");
+
+    std::string written = text;
+    hero.position.y = std::numeric_limits<float>::infinity();
+    check(atom::write(text, hero) == ATOM_ERROR_ARGUMENTS && text == written, "non-finite real is rejected");
+}
+
+/* Reals are written in shortest fixed notation, reading them back give the same bits
+ */
+struct sample
+{
+    double value;
+    float  ratio;
+};
+ATOM_REFLECT(sample, value, ratio)
+
+static void check_reals()
+{
+    int drifts = 0;
+    for (int i = 0; i < 10000; i++)
+    {
+        sample      out = { i + 0.289383, (float)i / 7.0f };
+        std::string text;
+        sample      back = {};
+        if (atom::write(text, out) != ATOM_ERROR_NONE || atom::read(text.c_str(), back) != ATOM_ERROR_NONE
+            || back.value != out.value || back.ratio != out.ratio)
+        {
+            drifts++;
+        }
+    }
+    check(drifts == 0, "round trip of doubles and floats");
+
+    const double limits[] = { 1e300, -1.7976931348623157e308, 2.2250738585072014e-308, 5e-324, 0.1, -0.0 };
+    for (double value : limits)
+    {
+        sample      out = { value, 0.0f };
+        std::string text;
+        sample      back = { 1.0, 1.0f };
+        check(atom::write(text, out) == ATOM_ERROR_NONE && atom::read(text.c_str(), back) == ATOM_ERROR_NONE && back.value == value, "round trip of extreme doubles");
+    }
+}
+
+/* Records are fed 5 bytes at a time, so brackets, texts and comments cross chunks
+ */
+static void check_records()
+{
+    std::string_view input  = "; leading (comment\n(a \"x)(\" 1) ; between (\n(b ; inside )\n 2) token \"text (\" (c [1 2]) (d (e";
+    size_t           offset = 0;
+    auto             read   = [&](char* buffer, size_t size) {
+        size_t count = std::min<size_t>({ size, 5, input.size() - offset });
+        std::memcpy(buffer, input.data() + offset, count);
+        offset += count;
+        return count;
+    };
+
+    std::vector<std::string> names;
+    int                      errcode = ATOM_ERROR_NONE;
+    for (atom::node_ref record : atom::records(read, &errcode))
+    {
+        names.emplace_back(record.name());
+        if (record.name() == "a")
+        {
+            auto text = (*record.begin()).as_text();
+            check(text && *text == "x)(", "record text with brackets");
+        }
+        else if (record.name() == "b")
+        {
+            check(record.as_long() == 2, "record with comment inside");
+        }
+        else if (record.type() == ATOM_TEXT)
+        {
+            check(record.as_text() == "text (", "top-level text record");
+        }
+    }
+    check(names == std::vector<std::string>{ "a", "b", "token", "", "c" }, "records in order, comments dropped");
+    check(errcode == ATOM_ERROR_UNBALANCED, "truncated tail is unbalanced");
+}
+
+/* Documents in a fixed buffer, the upstream throws so any fallback to the heap fails
+ */
+static void check_resource()
+{
+    std::byte                           buffer[64 * 1024];
+    std::pmr::monotonic_buffer_resource arena(buffer, sizeof(buffer), std::pmr::null_memory_resource());
+    {
+        atom::document doc = atom::document::parse("(player (name \"hero\") (hp 100) (pos (x 1.5) (y -2.0)))", &arena);
+        check(doc && doc.heap() && doc.root().name() == "player", "parse into a buffer");
+        check(doc["hp"].as_long() == 100, "find in a buffer document");
+        check(doc["pos"]["y"].as_real() == -2.0, "nested find in a buffer document");
+    }
+
+    std::byte                           small[4096];
+    std::pmr::monotonic_buffer_resource tight(small, sizeof(small), std::pmr::null_memory_resource());
+    std::string                         text = "(list";
+    for (int i = 0; i < 100; i++)
+    {
+        text += " (item " + std::to_string(i) + ")";
+    }
+    text += ")";
+    atom::document doc = atom::document::parse(text, &tight);
+    check(!doc && doc.error() == ATOM_ERROR_OVERFLOW, "buffer too small is an error, not an exception");
+}
+
+int main()
+{
+    printf("Atom C++20 checks v1.0 - MaiHD\n");
+
+    check_literal();
+    check_records();
+    check_resource();
+    check_reflect();
+    check_reals();
+
+    printf("%s, %d failed\n", failures ? "Failed" : "Passed", failures);
+    return failures;
+}
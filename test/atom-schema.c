@@ -0,0 +1,405 @@
+/**
+ * Atom - file data format with s-expression
+ *
+ * @author: MaiHD
+ * @license: Free to use
+ * @copyright: MaiHD @ ${HOME}, 2017
+ */
+
+#include "atom-test.c"
+#include <ctype.h>
+
+/**
+ * Schema generator, emit a C header which read documents into structs
+ * A schema is a list of structs, the last one is the document:
+ *   (vec3
+ *     (x "real")
+ *     (y "real"))
+ *   (actor
+ *     (name     "text" 32) ; char name[32]
+ *     (guid     "long")
+ *     (position "vec3"))   ; struct declared before
+ * The generated code read fields with a perfect hash switch on their names,
+ * numbers are parsed in place and no node is created.
+ */
+
+#define SCHEMA_NAME_SIZE  64
+#define SCHEMA_MAX_FIELDS 64
+#define SCHEMA_MAX_STRUCT 64
+
+typedef struct
+{
+    char name[SCHEMA_NAME_SIZE];
+    char type[SCHEMA_NAME_SIZE]; /* long, real, text or name of struct */
+    int  size;                   /* Size of text buffer */
+} schema_field_t;
+
+typedef struct
+{
+    char           name[SCHEMA_NAME_SIZE];
+    schema_field_t fields[SCHEMA_MAX_FIELDS];
+    int            count;
+    uint32_t       seed;
+    uint32_t       mask;
+} schema_struct_t;
+
+static schema_struct_t schema_structs[SCHEMA_MAX_STRUCT];
+static int             schema_count;
+
+/**
+ * Copy a text of schema, fail when it's too long
+ */
+static atom_bool_t schema_text(atom_lexer_t* lexer, atom_text_t text, char* buffer)
+{
+    if (text.tail - text.head >= SCHEMA_NAME_SIZE)
+    {
+	fprintf(stderr, "Name is too long, max length is %d\n", SCHEMA_NAME_SIZE - 1);
+	return ATOM_FALSE;
+    }
+    atom_textcpy(lexer, text, buffer);
+    return ATOM_TRUE;
+}
+
+/**
+ * Check if name can be used as C identifier
+ */
+static atom_bool_t schema_isident(const char* name)
+{
+    if (!isalpha((unsigned char)name[0]) && name[0] != '_')
+    {
+	return ATOM_FALSE;
+    }
+    for (const char* c = name; *c; c++)
+    {
+	if (!isalnum((unsigned char)*c) && *c != '_')
+	{
+	    return ATOM_FALSE;
+	}
+    }
+    return ATOM_TRUE;
+}
+
+/**
+ * Find a struct declared before
+ */
+static schema_struct_t* schema_find(const char* name)
+{
+    for (int i = 0; i < schema_count; i++)
+    {
+	if (strcmp(schema_structs[i].name, name) == 0)
+	{
+	    return &schema_structs[i];
+	}
+    }
+    return NULL;
+}
+
+/**
+ * Read a field: (name "type") or (name "text" size)
+ */
+static atom_bool_t schema_loadfield(atom_lexer_t* lexer, atom_node_t* node, schema_field_t* field)
+{
+    if (atom_istextnull(node->name) || !schema_text(lexer, node->name, field->name))
+    {
+	fprintf(stderr, "Field must be (name \"type\")\n");
+	return ATOM_FALSE;
+    }
+
+    atom_node_t* type = node;
+    atom_node_t* size = NULL;
+    if (node->type == ATOM_LIST)
+    {
+	type = node->children;
+	size = type ? type->next : NULL;
+    }
+    if (!type || type->type != ATOM_TEXT || !schema_text(lexer, type->data.as_text, field->type))
+    {
+	fprintf(stderr, "Type of field '%s' must be a text\n", field->name);
+	return ATOM_FALSE;
+    }
+
+    field->size = size && size->type == ATOM_LONG ? (int)size->data.as_long : 0;
+    if (strcmp(field->type, "text") == 0 && field->size <= 0)
+    {
+	fprintf(stderr, "Text field '%s' need a size: (%s \"text\" 32)\n", field->name, field->name);
+	return ATOM_FALSE;
+    }
+    if (strcmp(field->type, "long") != 0 && strcmp(field->type, "real") != 0
+	&& strcmp(field->type, "text") != 0 && !schema_find(field->type))
+    {
+	fprintf(stderr, "Type '%s' of field '%s' is not declared before\n", field->type, field->name);
+	return ATOM_FALSE;
+    }
+    if (!schema_isident(field->name))
+    {
+	fprintf(stderr, "Field '%s' is not a C identifier\n", field->name);
+	return ATOM_FALSE;
+    }
+    return ATOM_TRUE;
+}
+
+/**
+ * Read a struct: (name field...)
+ */
+static atom_bool_t schema_loadstruct(atom_lexer_t* lexer, atom_node_t* node)
+{
+    if (schema_count == SCHEMA_MAX_STRUCT)
+    {
+	fprintf(stderr, "Too many structs, max is %d\n", SCHEMA_MAX_STRUCT);
+	return ATOM_FALSE;
+    }
+
+    schema_struct_t* type = &schema_structs[schema_count];
+    if (node->type != ATOM_LIST || atom_istextnull(node->name) || !schema_text(lexer, node->name, type->name))
+    {
+	fprintf(stderr, "Struct must be (name field...)\n");
+	return ATOM_FALSE;
+    }
+    if (!schema_isident(type->name) || schema_find(type->name)
+	|| !strcmp(type->name, "long") || !strcmp(type->name, "real") || !strcmp(type->name, "text"))
+    {
+	fprintf(stderr, "Struct '%s' is declared twice, or is not a C identifier\n", type->name);
+	return ATOM_FALSE;
+    }
+
+    for (atom_node_t* child = node->children; child; child = child->next)
+    {
+	if (type->count == SCHEMA_MAX_FIELDS)
+	{
+	    fprintf(stderr, "Struct '%s' has too many fields, max is %d\n", type->name, SCHEMA_MAX_FIELDS);
+	    return ATOM_FALSE;
+	}
+
+	schema_field_t* field = &type->fields[type->count];
+	if (!schema_loadfield(lexer, child, field))
+	{
+	    return ATOM_FALSE;
+	}
+	for (int i = 0; i < type->count; i++)
+	{
+	    if (strcmp(type->fields[i].name, field->name) == 0)
+	    {
+		fprintf(stderr, "Field '%s' of struct '%s' is declared twice\n", field->name, type->name);
+		return ATOM_FALSE;
+	    }
+	}
+	type->count++;
+    }
+
+    if (type->count == 0)
+    {
+	fprintf(stderr, "Struct '%s' has no field\n", type->name);
+	return ATOM_FALSE;
+    }
+    schema_count++;
+    return ATOM_TRUE;
+}
+
+/**
+ * Find seed and mask so hashes of field names do not collide
+ */
+static void schema_perfecthash(schema_struct_t* type)
+{
+    uint32_t size = 1;
+    while (size < (uint32_t)type->count)
+    {
+	size *= 2;
+    }
+
+    char used[SCHEMA_MAX_FIELDS * 8];
+    for (;; size *= 2)
+    {
+	assert(size <= sizeof(used));
+	for (uint32_t seed = 0; seed < 4096; seed++)
+	{
+	    memset(used, 0, size);
+
+	    int i = 0;
+	    for (; i < type->count; i++)
+	    {
+		const char* name = type->fields[i].name;
+		uint32_t    slot = atom_field_hash(name, (int)strlen(name), seed) & (size - 1);
+		if (used[slot])
+		{
+		    break;
+		}
+		used[slot] = 1;
+	    }
+
+	    if (i == type->count)
+	    {
+		type->seed = seed;
+		type->mask = size - 1;
+		return;
+	    }
+	}
+    }
+}
+
+/**
+ * Emit the header, declarations first then the implementation
+ */
+static void schema_emit(FILE* out, const char* guard)
+{
+    fprintf(out, "/* Generated by atom-schema, do not edit */\n\n");
+    fprintf(out, "#ifndef __%s_H__\n#define __%s_H__\n\n#include \"atom.h\"\n\n", guard, guard);
+
+    for (int i = 0; i < schema_count; i++)
+    {
+	schema_struct_t* type = &schema_structs[i];
+	fprintf(out, "typedef struct\n{\n");
+	for (int j = 0; j < type->count; j++)
+	{
+	    schema_field_t* field = &type->fields[j];
+	    if (strcmp(field->type, "long") == 0)
+	    {
+		fprintf(out, "    atom_long_t %s;\n", field->name);
+	    }
+	    else if (strcmp(field->type, "real") == 0)
+	    {
+		fprintf(out, "    atom_real_t %s;\n", field->name);
+	    }
+	    else if (strcmp(field->type, "text") == 0)
+	    {
+		fprintf(out, "    char        %s[%d];\n", field->name, field->size);
+	    }
+	    else
+	    {
+		fprintf(out, "    %s_t %s;\n", field->type, field->name);
+	    }
+	}
+	fprintf(out, "} %s_t;\n\n", type->name);
+    }
+
+    for (int i = 0; i < schema_count; i++)
+    {
+	fprintf(out, "/**\n * Read fields of %s at lexer cursor, missing fields keep their value\n", schema_structs[i].name);
+	fprintf(out, " * Fields of another type keep their value too, the others are still read\n");
+	fprintf(out, " * @return ATOM_ERROR_NONE, ATOM_ERROR_UNEXPECTED when a field has another type,\n");
+	fprintf(out, " *         or error code of the lexer\n */\n");
+	fprintf(out, "int %s_read(atom_lexer_t* lexer, %s_t* value);\n\n", schema_structs[i].name, schema_structs[i].name);
+    }
+
+    fprintf(out, "#ifdef %s_IMPL\n#include <string.h>\n", guard);
+    for (int i = 0; i < schema_count; i++)
+    {
+	schema_struct_t* type = &schema_structs[i];
+	fprintf(out, "\n/* @function: %s_read\n*/\n", type->name);
+	fprintf(out, "int %s_read(atom_lexer_t* lexer, %s_t* value)\n{\n", type->name, type->name);
+	fprintf(out, "    char name[%d];\n    int  length;\n    int  errcode = ATOM_ERROR_NONE;\n", SCHEMA_NAME_SIZE);
+	fprintf(out, "    while (atom_field_next(lexer, name, sizeof(name), &length))\n    {\n");
+	fprintf(out, "        switch (atom_field_hash(name, length, %uu) & %uu)\n        {\n", type->seed, type->mask);
+	for (int j = 0; j < type->count; j++)
+	{
+	    schema_field_t* field  = &type->fields[j];
+	    int             length = (int)strlen(field->name);
+	    fprintf(out, "        case %uu:\n", atom_field_hash(field->name, length, type->seed) & type->mask);
+	    fprintf(out, "            if (length == %d && memcmp(name, \"%s\", %d) == 0)\n            {\n", length, field->name, length);
+	    if (strcmp(field->type, "long") == 0)
+	    {
+		fprintf(out, "                if (!atom_field_long(lexer, &value->%s) && errcode == ATOM_ERROR_NONE)\n", field->name);
+		fprintf(out, "                {\n                    errcode = ATOM_ERROR_UNEXPECTED;\n                }\n");
+	    }
+	    else if (strcmp(field->type, "real") == 0)
+	    {
+		fprintf(out, "                if (!atom_field_real(lexer, &value->%s) && errcode == ATOM_ERROR_NONE)\n", field->name);
+		fprintf(out, "                {\n                    errcode = ATOM_ERROR_UNEXPECTED;\n                }\n");
+	    }
+	    else if (strcmp(field->type, "text") == 0)
+	    {
+		fprintf(out, "                if (!atom_field_text(lexer, value->%s, sizeof(value->%s)) && errcode == ATOM_ERROR_NONE)\n", field->name, field->name);
+		fprintf(out, "                {\n                    errcode = ATOM_ERROR_UNEXPECTED;\n                }\n");
+	    }
+	    else
+	    {
+		fprintf(out, "                int nested = %s_read(lexer, &value->%s);\n", field->type, field->name);
+		fprintf(out, "                errcode    = errcode == ATOM_ERROR_NONE ? nested : errcode;\n");
+	    }
+	    fprintf(out, "            }\n            break;\n\n");
+	}
+	fprintf(out, "        default:\n            break;\n        }\n");
+	fprintf(out, "        atom_field_leave(lexer);\n    }\n");
+	fprintf(out, "    return lexer->errcode != ATOM_ERROR_NONE ? lexer->errcode : errcode;\n}\n");
+    }
+    fprintf(out, "#endif\n\n#endif /* __%s_H__ */\n", guard);
+}
+
+int main(int argc, char* argv[])
+{
+    /* Generator require a schema file name
+     */
+    if (argc < 2)
+    {
+	fprintf(stderr, "usage: %s <schema> [output]\n", argv[0]);
+	return 1;
+    }
+
+    const char* filename = argv[1];
+    FILE* file = fopen(filename, "rb");
+    if (!file)
+    {
+	fprintf(stderr, "File not found! path: %s\n", filename);
+	return 1;
+    }
+
+    atom_bool_t  success = ATOM_FALSE;
+    atom_node_t* node    = NULL;
+    atom_lexer_t lexer;
+    if (atom_lexer_init(&lexer, ATOM_LEXER_STREAM, file) == ATOM_ERROR_NONE && (node = atom_parse(&lexer)))
+    {
+	/* A single struct is parsed as the root itself
+	 */
+	success = ATOM_TRUE;
+	if (!atom_istextnull(node->name))
+	{
+	    success = schema_loadstruct(&lexer, node);
+	}
+	else
+	{
+	    for (atom_node_t* child = node->children; child && success; child = child->next)
+	    {
+		success = schema_loadstruct(&lexer, child);
+	    }
+	}
+	atom_delete(node);
+    }
+    else
+    {
+	fprintf(stderr, "Parsing error!\n");
+    }
+    fclose(file);
+
+    if (!success || schema_count == 0)
+    {
+	return 1;
+    }
+
+    /* Guard is the uppercase base name of schema: actor-schema.atom give ACTOR_SCHEMA
+     */
+    char        guard[SCHEMA_NAME_SIZE];
+    const char* base = strrchr(filename, '/') ? strrchr(filename, '/') + 1 : filename;
+    int         i    = 0;
+    for (; base[i] && base[i] != '.' && i < SCHEMA_NAME_SIZE - 1; i++)
+    {
+	guard[i] = isalnum((unsigned char)base[i]) ? (char)toupper((unsigned char)base[i]) : '_';
+    }
+    guard[i] = 0;
+
+    for (i = 0; i < schema_count; i++)
+    {
+	schema_perfecthash(&schema_structs[i]);
+    }
+
+    FILE* out = argc > 2 ? fopen(argv[2], "w") : stdout;
+    if (!out)
+    {
+	fprintf(stderr, "Cannot open output! path: %s\n", argv[2]);
+	return 1;
+    }
+    schema_emit(out, guard);
+    if (out != stdout)
+    {
+	fclose(out);
+    }
+    return 0;
+}
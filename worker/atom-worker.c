@@ -6,259 +6,3131 @@
  * @copyright: MaiHD @ ${HOME}, 2017
  */
 
-#define JSMN_STRICT
-
 #include <errno.h>
+#include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <assert.h>
+#include <math.h>
 #include <string.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "../atom.h"
+
+/**
+ * Json is read and atom is written by chunks of this size
+ */
+#ifndef ATOM_WORKER_CHUNK
+#define ATOM_WORKER_CHUNK (64 * 1024)
+#endif
+
+/**
+ * Json to atom: deeper levels are indented as this one, so output stays linear
+ * in the size of deeply nested json
+ */
+#ifndef ATOM_WORKER_INDENT_MAX
+#define ATOM_WORKER_INDENT_MAX 64
+#endif
+
+/**
+ * Batch mode: larger files are streamed instead of converted in memory,
+ * and the default count of files read or written at once
+ */
+#ifndef ATOM_WORKER_BATCH_INLINE
+#define ATOM_WORKER_BATCH_INLINE (8 * 1024 * 1024)
+#endif
+
+#ifndef ATOM_WORKER_BATCH_IO
+#define ATOM_WORKER_BATCH_IO 4
+#endif
+
+/**
+ * Daemon mode: largest request, and documents and queries kept per thread
+ */
+#ifndef ATOM_WORKER_DAEMON_MAX
+#define ATOM_WORKER_DAEMON_MAX (64 * 1024 * 1024)
+#endif
 
-#include "../src/atom.h"
-#include "jsmn/jsmn.h"
+#ifndef ATOM_WORKER_DAEMON_DOCUMENTS
+#define ATOM_WORKER_DAEMON_DOCUMENTS 8
+#endif
+
+#ifndef ATOM_WORKER_DAEMON_QUERIES
+#define ATOM_WORKER_DAEMON_QUERIES 32
+#endif
+
+/**
+ * Output buffered by chunks of ATOM_WORKER_CHUNK, or kept in memory when
+ * there is no file
+ */
+typedef struct {
+  FILE*       file;
+  char*       buffer;
+  size_t      length;
+  size_t      capacity;
+  size_t      written; /* Total bytes           */
+  const char* error;   /* First error of writes */
+} AtomOutput;
+
+/**
+ * Streaming json to atom transcoder
+ * Json is fed by chunks, atom text is written as soon as possible, no node
+ * is created. Memory is one byte per level of nesting, plus fixed buffers.
+ *
+ * Mapping, the same as atom_save of the converted tree, except indentation
+ * that stops at ATOM_WORKER_INDENT_MAX levels:
+ *   object -> list of members, member -> (key value) or (key children...)
+ *   array  -> unnamed list, true/false -> 1/0, null -> "null"
+ *   numbers with exponent are written in fixed notation, atom has no exponent
+ *   integers out of range of atom_long_t are written as real
+ *
+ * Atom cannot represent everything json can, these are counted as lossy:
+ *   '"' in strings become '\'', \u0000 is dropped, empty unnamed lists are dropped,
+ *   numbers that double cannot hold: out of range are written as a text of the
+ *   number, underflow to a signed zero, large integers are rounded when read
+ * Characters of keys that cannot be in names become '_', keys that would be
+ * read as numbers get a '_' prefix ("1" -> _1) and are counted as lossy.
+ */
+typedef struct {
+  AtomOutput     output;
+
+  unsigned char* frames;      /* Flags of open objects and arrays     */
+  size_t         depth;
+  size_t         capacity;
+  int            forms;       /* Top-level values written             */
+
+  int            state;
+  bool           key;         /* Current string is a key              */
+  size_t         keyLength;
+  bool           keyNumber;   /* Key read so far is a number          */
+  bool           keyDot;
+  char           keyHeld[64]; /* Key held while it is a number        */
+  unsigned       unicode;     /* Code point of \uXXXX being read      */
+  unsigned       surrogate;   /* High surrogate waiting for its pair  */
+  int            digits;
+  char           token[1024]; /* Number or literal being read         */
+  size_t         tokenLength;
+
+  size_t         lossy;
+  int            line;
+  int            column;
+  const char*    error;
+} AtomJsonTranscoder;
+
+enum {
+  JSON_VALUE,   /* Value expected                        */
+  JSON_ITEM,    /* Value or ']' expected, after '['      */
+  JSON_MEMBER,  /* Key or '}' expected, after '{'        */
+  JSON_KEY,     /* Key expected, after ','               */
+  JSON_COLON,
+  JSON_NEXT,    /* ',' or closing expected, after values */
+  JSON_STRING,
+  JSON_ESCAPE,
+  JSON_UNICODE,
+  JSON_NUMBER,
+  JSON_LITERAL,
+};
+
+enum {
+  FRAME_OBJECT = 1 << 0,
+  FRAME_OPENED = 1 << 1, /* '(' is written, unnamed lists open on their first child */
+  FRAME_CHILD  = 1 << 2, /* A child is written                                      */
+  FRAME_MEMBER = 1 << 3, /* List is the value of a member, already opened           */
+};
 
 static char* atomGetLine(char* line, size_t size)
 {
   assert(line != NULL);
-  char c = fgetc(stdin);
-  while (size-- && c != '\n' && c != '\r') {
-    *line++ = c;
+  int c = fgetc(stdin);
+  if (c == EOF) {
+    return NULL;
+  }
+  while (size-- && c != EOF && c != '\n' && c != '\r') {
+    *line++ = (char)c;
     c = fgetc(stdin);
   }
   *line = 0;
   return line;
 }
 
-/**
- * Parse json then convert to atom node
- */
-static atom_node_t* atomFromJson(const char* line, jsmntok_t* tokens,int* size);
-static bool         atomJsonToAtom(const char* json, const char* atom);
+static void atomJsonInit(AtomJsonTranscoder* json, FILE* output, char* buffer);
+static void atomJsonFree(AtomJsonTranscoder* json);
+static bool atomJsonFeed(AtomJsonTranscoder* json, const char* chunk, size_t size);
+static bool atomJsonFinish(AtomJsonTranscoder* json);
+static bool atomJsonToAtom(const char* json, const char* atom);
+static bool atomAtomToJson(const char* atom, const char* json, bool ndjson);
+static bool atomBatchConvertAll(const char* input, const char* outdir, bool toJson, bool ndjson, int threads, int io);
+static bool atomServe(const char* path, int threads);
 
-int main(int argc, char* argv[])
+static bool atomHasExtension(const char* path, const char* extension)
 {
-  printf("Atom worker v1.0 - MaiHD\n");
+  size_t length = strlen(path);
+  size_t count  = strlen(extension);
+  return length >= count && strcmp(path + length - count, extension) == 0;
+}
 
+int main(int argc, char* argv[])
+{
   if (argc > 1) {
-    if (argc < 3) {
-      printf("Usage: %s <json-file> <atom-file>", argv[0]);
+    bool        toJson  = false;
+    bool        ndjson  = false;
+    bool        batch   = false;
+    bool        serve   = false;
+    int         threads = 0;
+    int         io      = 0;
+    const char* outdir  = NULL;
+    int         arg     = 1;
+    for (; arg < argc && argv[arg][0] == '-' && argv[arg][1]; arg++) {
+      if (strcmp(argv[arg], "-j") == 0) {
+	toJson = true;
+      } else if (strcmp(argv[arg], "-n") == 0) {
+	toJson = ndjson = true;
+      } else if (strcmp(argv[arg], "-b") == 0) {
+	batch = true;
+      } else if (strcmp(argv[arg], "-s") == 0) {
+	serve = true;
+      } else if (strcmp(argv[arg], "-t") == 0 && arg + 1 < argc) {
+	threads = atoi(argv[++arg]);
+      } else if (strcmp(argv[arg], "-i") == 0 && arg + 1 < argc) {
+	io = atoi(argv[++arg]);
+      } else if (strcmp(argv[arg], "-o") == 0 && arg + 1 < argc) {
+	outdir = argv[++arg];
+      } else {
+	break;
+      }
+    }
+    if (argc - arg != (batch || serve ? 1 : 2)) {
+      fprintf(stderr, "Usage: %s [-j] [-n] <input> <output>, '-' for stdin or stdout\n", argv[0]);
+      fprintf(stderr, "       %s -b [-j] [-n] [-t threads] [-i files] [-o directory] <directory | list>\n", argv[0]);
+      fprintf(stderr, "       %s -s [-t threads] <socket>\n", argv[0]);
+      fprintf(stderr, "  json is converted to atom, atom (-j or *.atom) is exported to json\n");
+      fprintf(stderr, "  -n  export one line of json per top-level form (NDJSON)\n");
+      fprintf(stderr, "  -b  convert all *.json (*.atom with -j) of a directory, or the files listed one per line, '-' for stdin\n");
+      fprintf(stderr, "  -t  threads of -b and -s, default is the number of processors\n");
+      fprintf(stderr, "  -i  files read or written at once by -b, default is %d\n", ATOM_WORKER_BATCH_IO);
+      fprintf(stderr, "  -o  write outputs of -b below this directory, default is next to inputs\n");
+      fprintf(stderr, "  -s  serve parse, validate, convert and query requests on a Unix socket until SIGINT or SIGTERM\n");
       return 1;
     }
-    return !atomJsonToAtom(argv[1], argv[2]);
+    if (serve) {
+      return !atomServe(argv[arg], threads);
+    }
+    if (batch) {
+      return !atomBatchConvertAll(argv[arg], outdir, toJson, ndjson, threads, io);
+    }
+    if (toJson || atomHasExtension(argv[arg], ".atom")) {
+      return !atomAtomToJson(argv[arg], argv[arg + 1], ndjson);
+    }
+    return !atomJsonToAtom(argv[arg], argv[arg + 1]);
   }
-  
+
+  printf("Atom worker v1.0 - MaiHD\n");
+
+  static char buffer[ATOM_WORKER_CHUNK];
   char line[1024];
   while (true) {
     printf(">> ");
-    atomGetLine(line, sizeof(line) - 1);
-
-    jsmn_parser parser;
-    jsmntok_t token[128];
-    jsmn_init(&parser);
-    int r = jsmn_parse(&parser, line, sizeof(line) - 1, token, 128);
-    if (r < 0) {
-      printf("Failed to parse json\n");
-      continue;
+    fflush(stdout);
+    if (!atomGetLine(line, sizeof(line) - 1)) {
+      break;
     }
 
-    if (r < 1 || token[0].type != JSMN_OBJECT) {
-      printf("Object expected\n");
-      continue;
-    }
-    atom_lexer_t lexer;
-    if (atomLexerInit(&lexer, ATOM_LEXER_STREAM, line)) {
-      atom_node_t* node = atomFromJson(line, token, NULL);
-      if (node) {
-	atomSaveText(&lexer, node, line, sizeof(line) - 1);
-	printf("%s\n", line);
-	atomDelete(node);
-      }
+    AtomJsonTranscoder json;
+    atomJsonInit(&json, stdout, buffer);
+    if (atomJsonFeed(&json, line, strlen(line)) && atomJsonFinish(&json)) {
+      printf("\n");
+    } else {
+      printf("Failed to parse json, %d:%d: %s\n", json.line, json.column, json.error);
     }
+    atomJsonFree(&json);
   }
-  
+
   return 0;
 }
 
 
-atom_node_t* atomFromJson(const char* context, jsmntok_t* tokens, int* size)
+static void atomOutputInit(AtomOutput* output, FILE* file, char* buffer)
 {
-  atom_node_t* node = NULL;
-  switch (tokens->type) {
-  case JSMN_OBJECT:
-    node = atomNewList(ATOM_TEXT_NULL);
-    int count    = tokens->size;
-    int nodeSize = 1;
-    for (int i = 0; i < count; i++) {
-      jsmntok_t* key   = tokens + nodeSize++;
-      jsmntok_t* value = tokens + nodeSize++;
-      
-      /* Get name
-       */
-      atom_text_t name = { key->start, key->end - 1 };
+  memset(output, 0, sizeof(*output));
+  output->file     = file;
+  output->buffer   = buffer;
+  output->capacity = ATOM_WORKER_CHUNK;
+}
 
-      /* Get value
-       */
-      atom_node_t* child = NULL; 
-      if (value->type == JSMN_ARRAY || value->type == JSMN_OBJECT) {
-	int childSize;
-	child = atomFromJson(context, value, &childSize);
-	atomSetName(child, name);
-	nodeSize += childSize - 1;
-      } else {
-        char  text[1024];
-        char* tptr = text;
-	for (int c = value->start; c < value->end; c++) {
-	  *tptr++ = context[c];
-	}
-	*tptr = 0;
-	atom_data_t data;
-	if (strcmp(text, "false") == 0) {
-	  child = atomNewLong(name, 0);
-	} else if (strcmp(text, "true") == 0) {
-	  child = atomNewLong(name, 1);
-	} else if (tokens->type == JSMN_STRING) {
-	  child = atomNewText(name, (atom_text_t){ value->start, value->end - 1 });
-	} else if (atomToLong(text, &data)) {
-	  child = atomNewLong(name, data.asLong);
-	} else if (atomToReal(text, &data)) {
-	  child = atomNewReal(name, data.asReal);
-	} else {
-	  child = atomNewText(name, (atom_text_t){ value->start, value->end - 1 });
-	}
-      }
-      atomAddChild(node, child);
+/**
+ * Output to memory, the buffer is grown with realloc, take it back from
+ * output->buffer when done
+ */
+static void atomOutputInitMemory(AtomOutput* output, char* buffer, size_t capacity)
+{
+  memset(output, 0, sizeof(*output));
+  output->buffer   = buffer;
+  output->capacity = buffer ? capacity : 0;
+}
+
+/**
+ * Make room when the buffer is full, return false on error
+ */
+static bool atomOutputDrain(AtomOutput* output)
+{
+  if (output->file) {
+    if (fwrite(output->buffer, output->length, 1, output->file) != 1 && !output->error) {
+      output->error = strerror(errno);
     }
-    if (size) *size = nodeSize;
-    break;
-	
-  case JSMN_ARRAY: {
-    node = atomNewList(ATOM_TEXT_NULL);
-    int count    = tokens->size;
-    int nodeSize = 1;
-    for (int i = 0; i < count; i++) {
-      int childSize;
-      jsmntok_t* value   = tokens + nodeSize;
-      atom_node_t* child = atomFromJson(context, value, &childSize);
-      atomAddChild(node, child);
-      nodeSize += childSize;
+    output->length = 0;
+    return true;
+  }
+
+  size_t capacity = output->capacity > 0 ? output->capacity * 2 : ATOM_WORKER_CHUNK;
+  char*  buffer   = (char*)realloc(output->buffer, capacity);
+  if (!buffer) {
+    if (!output->error) {
+      output->error = "Out of memory";
     }
-    if (size) *size = nodeSize; 
-  } break;
+    return false;
+  }
+  output->buffer   = buffer;
+  output->capacity = capacity;
+  return true;
+}
 
-  case JSMN_STRING:
-  case JSMN_PRIMITIVE: {
-    char  text[1024];
-    char* tptr = text;
-    for (int c = tokens->start; c < tokens->end; c++) {
-      *tptr++ = context[c];
-    }
-    *tptr = 0;
-    atom_data_t data;
-    if (strcmp(text, "false") == 0) {
-      node = atomNewLong(ATOM_TEXT_NULL, 0);
-    } else if (strcmp(text, "true") == 0) {
-      node = atomNewLong(ATOM_TEXT_NULL, 1);
-    } else if (tokens->type == JSMN_STRING) {
-      data.asText = (atom_text_t){ tokens->start, tokens->end - 1 };
-      node = atomNewText(ATOM_TEXT_NULL, data.asText);
-    } else if (atomToLong(text, &data)) {
-      node = atomNewLong(ATOM_TEXT_NULL, data.asLong);
-    } else if (atomToReal(text, &data)) {
-      node = atomNewReal(ATOM_TEXT_NULL, data.asReal);
-    } else {
-      data.asText = (atom_text_t){ tokens->start, tokens->end - 1 };
-      node = atomNewText(ATOM_TEXT_NULL, data.asText);
+/**
+ * Write data to output buffer, the buffer is written to file when full
+ */
+static void atomOutputWrite(AtomOutput* output, const char* data, size_t size)
+{
+  while (size > 0) {
+    if (output->length == output->capacity && !atomOutputDrain(output)) {
+      return;
     }
-    if (size) *size = 1;
-  } break;
-    
-  default:
-    break;
+
+    size_t count = output->capacity - output->length;
+    if (count > size) {
+      count = size;
+    }
+    memcpy(output->buffer + output->length, data, count);
+    output->length  += count;
+    output->written += count;
+    data            += count;
+    size            -= count;
   }
-  return node;
 }
 
+static void atomOutputPutc(AtomOutput* output, char c)
+{
+  if (output->length < output->capacity) {
+    output->buffer[output->length++] = c;
+    output->written++;
+  } else {
+    atomOutputWrite(output, &c, 1);
+  }
+}
 
-/* @function: 
+/**
+ * Write the rest of buffer, return false on error
  */
-bool atomJsonToAtom(const char* json, const char* atom)
+static bool atomOutputFlush(AtomOutput* output)
 {
-  /* Open given file
-   */
-  FILE* file = fopen(json, "r");
-  if (!file) {
-    fprintf(stderr, "Json not found! path: %s\n", json);
-    return false;
+  if (!output->file) {
+    return output->error == NULL;
   }
+  if (output->length > 0) {
+    if (fwrite(output->buffer, output->length, 1, output->file) != 1 && !output->error) {
+      output->error = strerror(errno);
+    }
+    output->length = 0;
+  }
+  if (fflush(output->file) != 0 && !output->error) {
+    output->error = strerror(errno);
+  }
+  return output->error == NULL;
+}
 
-  /* Read the content from file
-   */
-  size_t fileSize = atomGetFileSize(file);
-  char* buffer = malloc(fileSize);  /* Super large buffer */
+/**
+ * Write a code point in UTF-8
+ */
+static void atomJsonPutUnicode(AtomJsonTranscoder* json, unsigned code)
+{
+  char utf8[4];
+  if (code < 0x80) {
+    utf8[0] = (char)code;
+    atomOutputWrite(&json->output, utf8, 1);
+  } else if (code < 0x800) {
+    utf8[0] = (char)(0xC0 | (code >> 6));
+    utf8[1] = (char)(0x80 | (code & 0x3F));
+    atomOutputWrite(&json->output, utf8, 2);
+  } else if (code < 0x10000) {
+    utf8[0] = (char)(0xE0 | (code >> 12));
+    utf8[1] = (char)(0x80 | ((code >> 6) & 0x3F));
+    utf8[2] = (char)(0x80 | (code & 0x3F));
+    atomOutputWrite(&json->output, utf8, 3);
+  } else {
+    utf8[0] = (char)(0xF0 | (code >> 18));
+    utf8[1] = (char)(0x80 | ((code >> 12) & 0x3F));
+    utf8[2] = (char)(0x80 | ((code >> 6) & 0x3F));
+    utf8[3] = (char)(0x80 | (code & 0x3F));
+    atomOutputWrite(&json->output, utf8, 4);
+  }
+}
 
-  printf("File size: %zu\n", fileSize);
-  fread(buffer, fileSize, 1, file);
-  buffer[fileSize - 1] = 0;
-  fclose(file); file = NULL;
+/**
+ * Character of key that can be in a name
+ */
+static char atomJsonNameChar(unsigned char c)
+{
+  return c <= ' ' || strchr("()[]{}'\",;", c) ? '_' : (char)c;
+}
 
-  /* Parse json
-   */
-  jsmn_parser parser;
-  jsmntok_t* tokens = malloc(sizeof(jsmntok_t) * fileSize);
-  jsmn_init(&parser);
-  int r = jsmn_parse(&parser, buffer, fileSize, tokens, fileSize);
-  if (r < 0) {
-    printf("Failed to parse json\n");
-    return false;
+/**
+ * Write the held key, it's not a number. Keys too long to hold are prefixed,
+ * they are still numbers so far
+ */
+static void atomJsonReleaseKey(AtomJsonTranscoder* json, bool prefix)
+{
+  if (json->keyNumber) {
+    json->keyNumber = false;
+    if (prefix) {
+      atomOutputPutc(&json->output, '_');
+      json->lossy++;
+    }
+    atomOutputWrite(&json->output, json->keyHeld, json->keyLength);
   }
-  if (r < 1 || tokens->type != JSMN_OBJECT) {
-    printf("Object expected in the root of json\n");
-    return false;
+}
+
+/**
+ * Write a character of key, the key is held while atom_tolong or atom_toreal
+ * would accept it, then it need a prefix to be a name
+ */
+static void atomJsonPutKey(AtomJsonTranscoder* json, char c)
+{
+  if (json->keyNumber) {
+    bool sign = (c == '-' || c == '+') && json->keyLength == 0;
+    bool dot  = c == '.' && !json->keyDot;
+    bool full = json->keyLength == sizeof(json->keyHeld);
+    if ((sign || dot || (c >= '0' && c <= '9')) && !full) {
+      json->keyHeld[json->keyLength++] = c;
+      json->keyDot |= dot;
+      return;
+    }
+    atomJsonReleaseKey(json, full);
   }
+  atomOutputPutc(&json->output, c);
+  json->keyLength++;
+}
 
-  /* Convert json to atom
-   */
-  atom_node_t* node = atomFromJson(buffer, tokens, NULL);
-  if (!node) {
-    fprintf(stderr, "Failed to convert json to atom!");
-    return false;
+/**
+ * Write a decoded character of string, keys are written as names
+ */
+static void atomJsonPutChar(AtomJsonTranscoder* json, unsigned code)
+{
+  if (json->key) {
+    if (code < 0x80) {
+      atomJsonPutKey(json, atomJsonNameChar((unsigned char)code));
+      return;
+    }
+    atomJsonReleaseKey(json, json->keyLength == sizeof(json->keyHeld));
+    json->keyLength++;
+  } else if (code == '"') {
+    code = '\'';
+    json->lossy++;
+  } else if (code == 0) {
+    json->lossy++;
+    return;
+  }
+  atomJsonPutUnicode(json, code);
+}
+
+/**
+ * High surrogate without its pair
+ */
+static void atomJsonLoneSurrogate(AtomJsonTranscoder* json)
+{
+  if (json->surrogate) {
+    json->surrogate = 0;
+    json->lossy++;
+    atomJsonPutChar(json, 0xFFFD);
+  }
+}
+
+static void atomJsonIndent(AtomJsonTranscoder* json, size_t depth)
+{
+  static const char spaces[] = "                                ";
+  size_t count = (depth < ATOM_WORKER_INDENT_MAX ? depth : ATOM_WORKER_INDENT_MAX) * 2;
+  while (count > 0) {
+    size_t n = count < sizeof(spaces) - 1 ? count : sizeof(spaces) - 1;
+    atomOutputWrite(&json->output, spaces, n);
+    count -= n;
+  }
+}
+
+/**
+ * Write separator before a child of frames[depth - 1], or before a top-level value
+ * Open the unnamed lists that contain the child first
+ */
+static void atomJsonSeparate(AtomJsonTranscoder* json, size_t depth)
+{
+  if (depth == 0) {
+    if (json->forms++ > 0) {
+      atomOutputPutc(&json->output, '\n');
+    }
+    return;
+  }
+
+  unsigned char* frame = &json->frames[depth - 1];
+  if (!(*frame & FRAME_OPENED)) {
+    atomJsonSeparate(json, depth - 1);
+    atomOutputPutc(&json->output, '(');
+    *frame |= FRAME_OPENED;
+  }
+  if (*frame & FRAME_CHILD) {
+    atomOutputPutc(&json->output, ' ');
+  }
+  atomOutputPutc(&json->output, '\n');
+  atomJsonIndent(json, depth);
+  *frame |= FRAME_CHILD;
+}
+
+/**
+ * Start a value: a member of object is already written as "(key "
+ */
+static bool atomJsonIsMember(AtomJsonTranscoder* json)
+{
+  return json->depth > 0 && (json->frames[json->depth - 1] & FRAME_OBJECT);
+}
+
+static void atomJsonBeginValue(AtomJsonTranscoder* json)
+{
+  if (!atomJsonIsMember(json)) {
+    atomJsonSeparate(json, json->depth);
+  }
+}
+
+static void atomJsonEndValue(AtomJsonTranscoder* json)
+{
+  if (atomJsonIsMember(json)) {
+    atomOutputPutc(&json->output, ')');
+  }
+  json->state = json->depth > 0 ? JSON_NEXT : JSON_VALUE;
+}
+
+static bool atomJsonPush(AtomJsonTranscoder* json, bool object)
+{
+  if (json->depth == json->capacity) {
+    size_t         capacity = json->capacity ? json->capacity * 2 : 64;
+    unsigned char* frames   = (unsigned char*)realloc(json->frames, capacity);
+    if (!frames) {
+      json->error = "Out of memory";
+      return false;
+    }
+    json->frames   = frames;
+    json->capacity = capacity;
   }
 
-  /* Write to file
+  /* Value of member is opened by its key, unnamed lists wait for their first child:
+   * '()' cannot be read back, empty unnamed lists are dropped
    */
-  file = fopen(atom, "w+");
-  if (!file) {
-    fprintf(stderr, "Open atom file for writing failed! path: %s\n", atom);
-    return false;
+  unsigned char flags = object ? FRAME_OBJECT : 0;
+  if (atomJsonIsMember(json)) {
+    flags |= FRAME_OPENED | FRAME_MEMBER;
   }
-  
-  bool result = true;
-  atom_lexer_t lexer;
-  if (atomLexerInit(&lexer, ATOM_LEXER_STRING, buffer)) {
-    char* atomBuffer = malloc(fileSize * 10);
-    if (!atomSaveText(&lexer, node, atomBuffer, fileSize)) {
-      printf("Failed to convert json to atom!"); 
-      atomDelete(node);
+  json->frames[json->depth++] = flags;
+  json->state = object ? JSON_MEMBER : JSON_ITEM;
+  return true;
+}
+
+static void atomJsonPop(AtomJsonTranscoder* json)
+{
+  unsigned char flags = json->frames[--json->depth];
+  if (flags & FRAME_OPENED) {
+    atomOutputPutc(&json->output, ')');
+  } else {
+    json->lossy++;
+  }
+  json->state = json->depth > 0 ? JSON_NEXT : JSON_VALUE;
+}
+
+/**
+ * Shortest fixed notation that read back the same value, atom_toreal don't support exponent
+ * Return -1 when the value cannot be written in size
+ */
+static int atomJsonFixed(double value, char* buffer, size_t size)
+{
+  if (value == 0.0) {
+    return snprintf(buffer, size, signbit(value) ? "-0.0" : "0.0");
+  }
+
+  for (int precision = 1; precision <= 340; precision++) {
+    int count = snprintf(buffer, size, "%.*f", precision, value);
+    if (count < 0 || (size_t)count >= size) {
+      break;
+    }
+    if (strtod(buffer, NULL) == value) {
+      return count;
+    }
+  }
+  return -1;
+}
+
+/**
+ * Check if digits of integer fit in atom_long_t
+ */
+static bool atomJsonIsLong(const char* digits)
+{
+  uint64_t value = 0;
+  for (; *digits; digits++) {
+    unsigned digit = (unsigned)(*digits - '0');
+    if (value > (INT64_MAX - digit) / 10) {
       return false;
     }
-    
-    if (fwrite(atomBuffer, strlen(atomBuffer), 1, file) != 1) {
-      fprintf(stderr, "Write content to atom file failed!");
-      result = false;
+    value = value * 10 + digit;
+  }
+  return true;
+}
+
+/**
+ * Check if mantissa of number has a non-zero digit
+ */
+static bool atomJsonIsNonZero(const char* token)
+{
+  for (; *token && *token != 'e' && *token != 'E'; token++) {
+    if (*token >= '1' && *token <= '9') {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Write number or literal in token
+ */
+static bool atomJsonToken(AtomJsonTranscoder* json)
+{
+  const char* token  = json->token;
+  size_t      length = json->tokenLength;
+  json->token[length] = 0;
+
+  if (json->state == JSON_LITERAL) {
+    if (strcmp(token, "true") == 0) {
+      token = "1";
+    } else if (strcmp(token, "false") == 0) {
+      token = "0";
+    } else if (strcmp(token, "null") == 0) {
+      token = "\"null\"";
+    } else {
+      json->error = "Invalid literal";
+      return false;
+    }
+    atomJsonBeginValue(json);
+    atomOutputWrite(&json->output, token, strlen(token));
+    atomJsonEndValue(json);
+    return true;
+  }
+
+  /* Validate: -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+   */
+  const char* ptr = token + (*token == '-');
+  size_t      integers = 0;
+  bool        fraction = false;
+  bool        exponent = false;
+  if (*ptr == '0') {
+    ptr++;
+    integers = 1;
+  } else {
+    while (*ptr >= '0' && *ptr <= '9') {
+      ptr++;
+      integers++;
+    }
+  }
+  if (integers > 0 && *ptr == '.') {
+    fraction = true;
+    ptr++;
+    if (!(*ptr >= '0' && *ptr <= '9')) {
+      integers = 0;
+    }
+    while (*ptr >= '0' && *ptr <= '9') {
+      ptr++;
+    }
+  }
+  if (integers > 0 && (*ptr == 'e' || *ptr == 'E')) {
+    exponent = true;
+    ptr++;
+    if (*ptr == '+' || *ptr == '-') {
+      ptr++;
+    }
+    if (!(*ptr >= '0' && *ptr <= '9')) {
+      integers = 0;
+    }
+    while (*ptr >= '0' && *ptr <= '9') {
+      ptr++;
     }
-  
-    atomDelete(node);
-    printf("Json to atom converted!\n");
-    printf("Atom: %s\n", atomBuffer);
+  }
+  if (integers == 0 || *ptr) {
+    json->error = "Invalid number";
+    return false;
+  }
+
+  /* Exponent is written in fixed notation, integer too large for atom_long_t as real.
+   * A value that cannot be written as the same double is lossy, one out of range
+   * of double is written as a text of the token.
+   */
+  atomJsonBeginValue(json);
+  if (exponent) {
+    char   real[384];
+    double value = strtod(token, NULL);
+    int    count = isinf(value) ? -1 : atomJsonFixed(value, real, sizeof(real));
+    if (count < 0) {
+      json->lossy++;
+      atomOutputPutc(&json->output, '"');
+      atomOutputWrite(&json->output, token, length);
+      atomOutputPutc(&json->output, '"');
+    } else {
+      if (value == 0.0 && atomJsonIsNonZero(token)) {
+	json->lossy++;
+      }
+      atomOutputWrite(&json->output, real, (size_t)count);
+    }
+  } else if (fraction || atomJsonIsLong(token + (*token == '-'))) {
+    atomOutputWrite(&json->output, token, length);
   } else {
-    fprintf(stderr, "Failed to initialize lexer!\n");
+    char   exact[384];
+    double value = strtod(token, NULL);
+    if (isinf(value) || snprintf(exact, sizeof(exact), "%.0f", value) < 0 || strcmp(exact, token) != 0) {
+      json->lossy++;
+    }
+    if (isinf(value)) {
+      atomOutputPutc(&json->output, '"');
+      atomOutputWrite(&json->output, token, length);
+      atomOutputPutc(&json->output, '"');
+    } else {
+      atomOutputWrite(&json->output, token, length);
+      atomOutputWrite(&json->output, ".0", 2);
+    }
+  }
+  atomJsonEndValue(json);
+  return true;
+}
+
+static bool atomJsonIsSpace(char c)
+{
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+/**
+ * Begin a value with its first character, return false on error
+ */
+static bool atomJsonValue(AtomJsonTranscoder* json, char c)
+{
+  switch (c) {
+  case '{':
+  case '[':
+    return atomJsonPush(json, c == '{');
+
+  case '"':
+    atomJsonBeginValue(json);
+    atomOutputPutc(&json->output, '"');
+    json->key    = false;
+    json->state  = JSON_STRING;
+    return true;
+
+  case '-':
+  case '0': case '1': case '2': case '3': case '4':
+  case '5': case '6': case '7': case '8': case '9':
+    json->token[0]    = c;
+    json->tokenLength = 1;
+    json->state       = JSON_NUMBER;
+    return true;
+
+  case 't':
+  case 'f':
+  case 'n':
+    json->token[0]    = c;
+    json->tokenLength = 1;
+    json->state       = JSON_LITERAL;
+    return true;
+
+  default:
+    json->error = "Value expected";
     return false;
   }
-  fclose(file);
+}
 
- cleanup:
-  free(buffer);
-  free(tokens);
-  
-  printf("Atom file is written!\n");
+/**
+ * End a string, keys continue with ':'
+ */
+static void atomJsonEndString(AtomJsonTranscoder* json)
+{
+  if (json->key) {
+    if (json->keyNumber) {
+      /* Empty key is a name too, others would be read as numbers
+       */
+      atomOutputPutc(&json->output, '_');
+      atomOutputWrite(&json->output, json->keyHeld, json->keyLength);
+      json->lossy += json->keyLength > 0;
+    }
+    atomOutputPutc(&json->output, ' ');
+    json->state = JSON_COLON;
+  } else {
+    atomOutputPutc(&json->output, '"');
+    atomJsonEndValue(json);
+  }
+}
+
+/**
+ * Close the current object or array with c, return false when it does not match
+ */
+static bool atomJsonClose(AtomJsonTranscoder* json, char c)
+{
+  bool object = (json->frames[json->depth - 1] & FRAME_OBJECT) != 0;
+  if ((c == '}') != object) {
+    json->error = "Mismatched bracket";
+    return false;
+  }
+  atomJsonPop(json);
+  return true;
+}
+
+/**
+ * Process one character, return 0 on error, 1 when consumed, 2 to process it again
+ */
+static int atomJsonStep(AtomJsonTranscoder* json, char c)
+{
+  switch (json->state) {
+  case JSON_VALUE:
+    if (atomJsonIsSpace(c)) {
+      return 1;
+    }
+    return atomJsonValue(json, c) ? 1 : 0;
+
+  case JSON_ITEM:
+    if (atomJsonIsSpace(c)) {
+      return 1;
+    }
+    if (c == ']') {
+      return atomJsonClose(json, c) ? 1 : 0;
+    }
+    return atomJsonValue(json, c) ? 1 : 0;
+
+  case JSON_MEMBER:
+  case JSON_KEY:
+    if (atomJsonIsSpace(c)) {
+      return 1;
+    }
+    if (c == '}' && json->state == JSON_MEMBER) {
+      return atomJsonClose(json, c) ? 1 : 0;
+    }
+    if (c != '"') {
+      json->error = "Key expected";
+      return 0;
+    }
+    atomJsonSeparate(json, json->depth);
+    atomOutputPutc(&json->output, '(');
+    json->key       = true;
+    json->keyLength = 0;
+    json->keyNumber = true;
+    json->keyDot    = false;
+    json->state     = JSON_STRING;
+    return 1;
+
+  case JSON_COLON:
+    if (atomJsonIsSpace(c)) {
+      return 1;
+    }
+    if (c != ':') {
+      json->error = "':' expected";
+      return 0;
+    }
+    json->state = JSON_VALUE;
+    return 1;
+
+  case JSON_NEXT:
+    if (atomJsonIsSpace(c)) {
+      return 1;
+    }
+    if (c == ',') {
+      json->state = (json->frames[json->depth - 1] & FRAME_OBJECT) ? JSON_KEY : JSON_VALUE;
+      return 1;
+    }
+    if (c == '}' || c == ']') {
+      return atomJsonClose(json, c) ? 1 : 0;
+    }
+    json->error = "',' or closing bracket expected";
+    return 0;
+
+  case JSON_STRING:
+    if (c == '"') {
+      atomJsonEndString(json);
+    } else if (c == '\\') {
+      json->state = JSON_ESCAPE;
+    } else if ((unsigned char)c < 0x20) {
+      json->error = "Control character in string";
+      return 0;
+    } else if (json->key) {
+      atomJsonPutKey(json, atomJsonNameChar((unsigned char)c));
+    } else {
+      atomOutputPutc(&json->output, c); /* UTF-8 bytes are copied as they are */
+    }
+    return 1;
+
+  case JSON_ESCAPE:
+    json->state = JSON_STRING;
+    if (c != 'u') {
+      atomJsonLoneSurrogate(json);
+    }
+    switch (c) {
+    case '"':  atomJsonPutChar(json, '"');  return 1;
+    case '\\': atomJsonPutChar(json, '\\'); return 1;
+    case '/':  atomJsonPutChar(json, '/');  return 1;
+    case 'b':  atomJsonPutChar(json, '\b'); return 1;
+    case 'f':  atomJsonPutChar(json, '\f'); return 1;
+    case 'n':  atomJsonPutChar(json, '\n'); return 1;
+    case 'r':  atomJsonPutChar(json, '\r'); return 1;
+    case 't':  atomJsonPutChar(json, '\t'); return 1;
+    case 'u':
+      json->unicode = 0;
+      json->digits  = 0;
+      json->state   = JSON_UNICODE;
+      return 1;
+    default:
+      json->error = "Invalid escape";
+      return 0;
+    }
+
+  case JSON_UNICODE:
+    if (c >= '0' && c <= '9') {
+      json->unicode = json->unicode * 16 + (unsigned)(c - '0');
+    } else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') {
+      json->unicode = json->unicode * 16 + (unsigned)((c | 0x20) - 'a' + 10);
+    } else {
+      json->error = "Invalid \\u escape";
+      return 0;
+    }
+    if (++json->digits < 4) {
+      return 1;
+    }
+
+    json->state = JSON_STRING;
+    if (json->unicode >= 0xDC00 && json->unicode < 0xE000 && json->surrogate) {
+      atomJsonPutChar(json, 0x10000 + ((json->surrogate - 0xD800) << 10) + (json->unicode - 0xDC00));
+      json->surrogate = 0;
+      return 1;
+    }
+    atomJsonLoneSurrogate(json);
+    if (json->unicode >= 0xD800 && json->unicode < 0xDC00) {
+      json->surrogate = json->unicode;
+    } else if (json->unicode >= 0xDC00 && json->unicode < 0xE000) {
+      json->lossy++;
+      atomJsonPutChar(json, 0xFFFD);
+    } else {
+      atomJsonPutChar(json, json->unicode);
+    }
+    return 1;
+
+  case JSON_NUMBER:
+  case JSON_LITERAL:
+    if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || c == '.' || c == '-' || c == '+' || c == 'E') {
+      if (json->tokenLength == sizeof(json->token) - 1) {
+	json->error = "Token too long";
+	return 0;
+      }
+      json->token[json->tokenLength++] = c;
+      return 1;
+    }
+    return atomJsonToken(json) ? 2 : 0;
+
+  default:
+    return 0;
+  }
+}
+
+static void atomJsonInit(AtomJsonTranscoder* json, FILE* output, char* buffer)
+{
+  memset(json, 0, sizeof(*json));
+  atomOutputInit(&json->output, output, buffer);
+  json->state  = JSON_VALUE;
+  json->line   = 1;
+  json->column = 1;
+}
+
+static void atomJsonFree(AtomJsonTranscoder* json)
+{
+  free(json->frames);
+  json->frames   = NULL;
+  json->capacity = 0;
+}
+
+/**
+ * Feed a chunk of json, return false on error
+ */
+static bool atomJsonFeed(AtomJsonTranscoder* json, const char* chunk, size_t size)
+{
+  for (size_t i = 0; i < size && !json->error; i++) {
+    char c = chunk[i];
+
+    /* High surrogate must be followed right away by \u of its pair
+     */
+    if (json->surrogate && json->state == JSON_STRING && c != '\\') {
+      atomJsonLoneSurrogate(json);
+    }
+
+    /* Copy plain characters of texts at once, they are most of the bytes
+     */
+    if (json->state == JSON_STRING && !json->key) {
+      size_t end = i;
+      while (end < size && chunk[end] != '"' && chunk[end] != '\\' && (unsigned char)chunk[end] >= 0x20) {
+	end++;
+      }
+      if (end > i) {
+	atomOutputWrite(&json->output, chunk + i, end - i);
+	json->column += (int)(end - i);
+	i = end - 1;
+	continue;
+      }
+    }
+
+    int step;
+    while ((step = atomJsonStep(json, c)) == 2) {
+    }
+    if (step == 0) {
+      if (!json->error) {
+	json->error = "Unexpected character";
+      }
+      return false;
+    }
+
+    if (c == '\n') {
+      json->line++;
+      json->column = 1;
+    } else {
+      json->column++;
+    }
+  }
+  if (!json->error && json->output.error) {
+    json->error = json->output.error;
+  }
+  return json->error == NULL;
+}
+
+/**
+ * End of json, flush output, return false on error
+ */
+static bool atomJsonFinish(AtomJsonTranscoder* json)
+{
+  if (!json->error && (json->state == JSON_NUMBER || json->state == JSON_LITERAL) && json->depth == 0) {
+    atomJsonToken(json);
+  }
+  if (!json->error && (json->depth > 0 || json->state != JSON_VALUE)) {
+    json->error = "Unexpected end of json";
+  }
+  if (!atomOutputFlush(&json->output) && !json->error) {
+    json->error = json->output.error;
+  }
+  return json->error == NULL;
+}
+
+
+/**
+ * Files are written to <path>.tmp and renamed once complete, so that a failed
+ * conversion never leaves a truncated file at path
+ */
+static FILE* atomCreateFile(const char* path, char* temp, size_t size)
+{
+  if (snprintf(temp, size, "%s.tmp", path) >= (int)size) {
+    errno = ENAMETOOLONG;
+    return NULL;
+  }
+  return fopen(temp, "wb");
+}
+
+/**
+ * Rename temporary file of atomCreateFile to path on success, remove it on failure
+ */
+static bool atomFinishFile(const char* temp, const char* path, bool result)
+{
+  if (result && rename(temp, path) == 0) {
+    return true;
+  }
+
+  int error = errno;
+  unlink(temp);
+  errno = error;
+  return false;
+}
+
+
+/* @function: atomJsonToAtom
+ */
+bool atomJsonToAtom(const char* json, const char* atom)
+{
+  /* Open given files
+   */
+  FILE* input = strcmp(json, "-") == 0 ? stdin : fopen(json, "rb");
+  if (!input) {
+    fprintf(stderr, "Json not found! path: %s\n", json);
+    return false;
+  }
+
+  char  temp[4096];
+  FILE* output = strcmp(atom, "-") == 0 ? stdout : atomCreateFile(atom, temp, sizeof(temp));
+  if (!output) {
+    fprintf(stderr, "Open atom file for writing failed! path: %s\n", atom);
+    if (input != stdin) fclose(input);
+    return false;
+  }
+
+  /* Convert chunk by chunk
+   */
+  char* chunk  = (char*)malloc(ATOM_WORKER_CHUNK);
+  char* buffer = (char*)malloc(ATOM_WORKER_CHUNK);
+  if (!chunk || !buffer) {
+    fprintf(stderr, "Out of memory!\n");
+    free(chunk);
+    free(buffer);
+    if (input != stdin) fclose(input);
+    if (output != stdout) {
+      fclose(output);
+      atomFinishFile(temp, atom, false);
+    }
+    return false;
+  }
+
+  struct timespec    start, end;
+  size_t             total = 0;
+  AtomJsonTranscoder transcoder;
+  atomJsonInit(&transcoder, output, buffer);
+  timespec_get(&start, TIME_UTC);
+
+  bool   result = true;
+  size_t count;
+  while (result && (count = fread(chunk, 1, ATOM_WORKER_CHUNK, input)) > 0) {
+    result = atomJsonFeed(&transcoder, chunk, count);
+    total += count;
+  }
+  if (result && ferror(input)) {
+    transcoder.error = strerror(errno);
+    result = false;
+  }
+  result = atomJsonFinish(&transcoder) && result;
+
+  if (!result) {
+    fprintf(stderr, "Failed to convert json to atom! %s:%d:%d: %s\n", json, transcoder.line, transcoder.column, transcoder.error);
+  } else {
+    timespec_get(&end, TIME_UTC);
+    double seconds = (double)(end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf(stderr, "Json to atom converted! %zu bytes to %zu bytes in %.3f s", total, transcoder.output.written, seconds);
+    if (seconds > 0) {
+      fprintf(stderr, ", %.1f MB/s", total / seconds / 1e6);
+    }
+    fprintf(stderr, "\n");
+    if (transcoder.lossy > 0) {
+      fprintf(stderr, "Warning: %zu values cannot be written exactly in atom\n", transcoder.lossy);
+    }
+  }
+
+  atomJsonFree(&transcoder);
+  free(chunk);
+  free(buffer);
+  if (input != stdin) fclose(input);
+  if (output != stdout && fclose(output) != 0 && result) {
+    fprintf(stderr, "Write content to atom file failed!\n");
+    result = false;
+  }
+  if (output != stdout && !atomFinishFile(temp, atom, result) && result) {
+    fprintf(stderr, "Rename atom file failed! path: %s: %s\n", atom, strerror(errno));
+    result = false;
+  }
+  return result;
+}
+
+
+/**
+ * Atom to json exporter
+ * The input is mapped in memory and parsed one top-level form at a time,
+ * nodes only live while their form is written.
+ *
+ * Mapping, the reverse of json to atom:
+ *   list whose children all have different names -> object, other lists -> array
+ *   named child of array, named top-level form   -> object of one member
+ *   texts and name tokens -> strings, reals are the shortest that read back the same
+ * Bytes of texts that are not valid UTF-8 become U+FFFD.
+ */
+typedef struct {
+  AtomOutput   output;
+  atom_lexer_t lexer;     /* Lexer of the current form          */
+  atom_node_t** slots;    /* Hash set to check names of a list  */
+  size_t       capacity;
+  size_t       forms;
+  const char*  error;
+} AtomJsonExporter;
+
+static void atomExportNode(AtomJsonExporter* exporter, atom_node_t* node);
+
+/**
+ * Child is a member of object, name tokens are values
+ */
+static bool atomExportHasName(atom_node_t* node)
+{
+  return node->type != ATOM_NAME && node->name.tail > node->name.head;
+}
+
+/**
+ * Length of valid UTF-8 sequence at data, 0 when invalid
+ */
+static size_t atomExportUtf8(const unsigned char* data, size_t size)
+{
+  unsigned char c = data[0];
+  size_t        length;
+  unsigned      code;
+  if (c >= 0xC2 && c <= 0xDF) {
+    length = 2;
+    code   = c & 0x1F;
+  } else if (c >= 0xE0 && c <= 0xEF) {
+    length = 3;
+    code   = c & 0x0F;
+  } else if (c >= 0xF0 && c <= 0xF4) {
+    length = 4;
+    code   = c & 0x07;
+  } else {
+    return 0;
+  }
+  if (length > size) {
+    return 0;
+  }
+
+  for (size_t i = 1; i < length; i++) {
+    if ((data[i] & 0xC0) != 0x80) {
+      return 0;
+    }
+    code = (code << 6) | (data[i] & 0x3F);
+  }
+
+  /* Overlong forms, surrogates and out of range
+   */
+  if ((length == 3 && code < 0x800) || (length == 4 && (code < 0x10000 || code > 0x10FFFF)) || (code >= 0xD800 && code < 0xE000)) {
+    return 0;
+  }
+  return length;
+}
+
+/**
+ * Write json string with escapes
+ */
+static void atomExportString(AtomOutput* output, const char* data, size_t size)
+{
+  static const char hex[] = "0123456789abcdef";
+  const unsigned char* ptr = (const unsigned char*)data;
+  const unsigned char* end = ptr + size;
+
+  atomOutputPutc(output, '"');
+  while (ptr < end) {
+    /* Copy printable ASCII at once
+     */
+    const unsigned char* run = ptr;
+    while (ptr < end && *ptr >= 0x20 && *ptr < 0x80 && *ptr != '"' && *ptr != '\\') {
+      ptr++;
+    }
+    if (ptr > run) {
+      atomOutputWrite(output, (const char*)run, (size_t)(ptr - run));
+      continue;
+    }
+
+    unsigned char c = *ptr;
+    if (c >= 0x80) {
+      size_t length = atomExportUtf8(ptr, (size_t)(end - ptr));
+      if (length > 0) {
+	atomOutputWrite(output, (const char*)ptr, length);
+	ptr += length;
+      } else {
+	atomOutputWrite(output, "\\ufffd", 6);
+	ptr++;
+      }
+      continue;
+    }
+
+    char escape[6] = { '\\', 0 };
+    switch (c) {
+    case '"':  escape[1] = '"';  break;
+    case '\\': escape[1] = '\\'; break;
+    case '\b': escape[1] = 'b';  break;
+    case '\f': escape[1] = 'f';  break;
+    case '\n': escape[1] = 'n';  break;
+    case '\r': escape[1] = 'r';  break;
+    case '\t': escape[1] = 't';  break;
+    default:
+      memcpy(escape + 1, "u00", 3);
+      escape[4] = hex[c >> 4];
+      escape[5] = hex[c & 15];
+      break;
+    }
+    atomOutputWrite(output, escape, escape[1] == 'u' ? 6 : 2);
+    ptr++;
+  }
+  atomOutputPutc(output, '"');
+}
+
+static void atomExportText(AtomJsonExporter* exporter, atom_text_t text)
+{
+  size_t size = text.tail > text.head ? (size_t)(text.tail - text.head) : 0;
+  atomExportString(&exporter->output, exporter->lexer.string + text.head, size);
+}
+
+/**
+ * Shortest digits that read back the same value, always with '.' or exponent
+ */
+static void atomExportReal(AtomOutput* output, atom_real_t value)
+{
+  char number[32];
+  int  count = 0;
+  if (value != value || value - value != 0) {
+    atomOutputWrite(output, "null", 4); /* NaN and infinity are not json */
+    return;
+  }
+
+  for (int precision = 15; precision <= 17; precision++) {
+    count = snprintf(number, sizeof(number), "%.*g", precision, value);
+    if (strtod(number, NULL) == value) {
+      break;
+    }
+  }
+  if (!strpbrk(number, ".e")) {
+    memcpy(number + count, ".0", 3);
+    count += 2;
+  }
+  atomOutputWrite(output, number, (size_t)count);
+}
+
+static uint32_t atomExportHash(const char* data, size_t size)
+{
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ (unsigned char)data[i]) * 16777619u;
+  }
+  return hash;
+}
+
+/**
+ * List is written as object when its children all have different names
+ */
+static bool atomExportIsObject(AtomJsonExporter* exporter, atom_node_t* list)
+{
+  size_t count = 0;
+  for (atom_node_t* child = list->children; child; child = child->next) {
+    if (!atomExportHasName(child)) {
+      return false;
+    }
+    count++;
+  }
+  if (count == 0) {
+    return false;
+  }
+
+  /* Open addressing on hashes of names
+   */
+  size_t capacity = 16;
+  while (capacity < count * 2) {
+    capacity *= 2;
+  }
+  if (capacity > exporter->capacity) {
+    atom_node_t** slots = (atom_node_t**)realloc(exporter->slots, capacity * sizeof(atom_node_t*));
+    if (!slots) {
+      exporter->error = "Out of memory";
+      return false;
+    }
+    exporter->slots    = slots;
+    exporter->capacity = capacity;
+  }
+  memset(exporter->slots, 0, capacity * sizeof(atom_node_t*));
+
+  const char* string = exporter->lexer.string;
+  for (atom_node_t* child = list->children; child; child = child->next) {
+    const char* name   = string + child->name.head;
+    size_t      length = (size_t)(child->name.tail - child->name.head);
+    size_t      slot   = atomExportHash(name, length) & (capacity - 1);
+    for (; exporter->slots[slot]; slot = (slot + 1) & (capacity - 1)) {
+      atom_node_t* other = exporter->slots[slot];
+      if ((size_t)(other->name.tail - other->name.head) == length && memcmp(string + other->name.head, name, length) == 0) {
+	return false;
+      }
+    }
+    exporter->slots[slot] = child;
+  }
+  return true;
+}
+
+/**
+ * Write "name":value
+ */
+static void atomExportMember(AtomJsonExporter* exporter, atom_node_t* node)
+{
+  atomExportText(exporter, node->name);
+  atomOutputPutc(&exporter->output, ':');
+  atomExportNode(exporter, node);
+}
+
+/**
+ * Write value of node, without its name
+ */
+static void atomExportNode(AtomJsonExporter* exporter, atom_node_t* node)
+{
+  AtomOutput* output = &exporter->output;
+  char        number[32];
+  switch (node->type) {
+  case ATOM_LIST: {
+    bool object = atomExportIsObject(exporter, node);
+    atomOutputPutc(output, object ? '{' : '[');
+    for (atom_node_t* child = node->children; child; child = child->next) {
+      if (child != node->children) {
+	atomOutputPutc(output, ',');
+      }
+      if (object) {
+	atomExportMember(exporter, child);
+      } else if (atomExportHasName(child)) {
+	atomOutputPutc(output, '{');
+	atomExportMember(exporter, child);
+	atomOutputPutc(output, '}');
+      } else {
+	atomExportNode(exporter, child);
+      }
+    }
+    atomOutputPutc(output, object ? '}' : ']');
+  } break;
+
+  case ATOM_LONG: {
+    int count = snprintf(number, sizeof(number), "%lld", (long long)node->data.as_long);
+    atomOutputWrite(output, number, (size_t)count);
+  } break;
+
+  case ATOM_REAL:
+    atomExportReal(output, node->data.as_real);
+    break;
+
+  case ATOM_TEXT:
+    atomExportText(exporter, node->data.as_text);
+    break;
+
+  case ATOM_NAME:
+    atomExportText(exporter, node->name);
+    break;
+
+  default:
+    atomOutputWrite(output, "null", 4);
+    break;
+  }
+}
+
+/**
+ * Characters that end a token, a zero is a part of token the parser will reject
+ */
+static bool atomIsDelimiter(char c)
+{
+  return c && strchr(" \t\r\n()[]{}'\",;", c);
+}
+
+/**
+ * Skip spaces and comments, count lines
+ */
+static size_t atomSkipSpace(const char* text, size_t size, size_t cursor, int* line)
+{
+  while (cursor < size) {
+    char c = text[cursor];
+    if (c == ';') {
+      while (cursor < size && text[cursor] != '\n') {
+	cursor++;
+      }
+    } else if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+      *line += c == '\n';
+      cursor++;
+    } else {
+      break;
+    }
+  }
+  return cursor;
+}
+
+/**
+ * End of the form at cursor, 0 when brackets or texts are not closed
+ */
+static size_t atomFormEnd(const char* text, size_t size, size_t cursor, int* line)
+{
+  size_t depth = 0;
+  do {
+    char c = text[cursor];
+    if (c == '(' || c == '[' || c == '{') {
+      depth++;
+      cursor++;
+    } else if (c == ')' || c == ']' || c == '}') {
+      if (depth == 0) {
+	return 0;
+      }
+      depth--;
+      cursor++;
+    } else if (c == '"') {
+      for (cursor++; cursor < size && text[cursor] != '"'; cursor++) {
+	*line += text[cursor] == '\n';
+      }
+      if (cursor == size) {
+	return 0;
+      }
+      cursor++;
+    } else if (c == ';' || c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+      cursor = atomSkipSpace(text, size, cursor, line);
+    } else if (c == '\'' || c == ',') {
+      cursor++;
+    } else {
+      while (cursor < size && !atomIsDelimiter(text[cursor])) {
+	cursor++;
+      }
+      if (depth == 0) {
+	break;
+      }
+    }
+  } while (depth > 0 && cursor < size);
+  return depth > 0 ? 0 : cursor;
+}
+
+/**
+ * Content of file, mapped in memory when possible
+ */
+static char* atomMapFile(const char* path, size_t* size, bool* mapped)
+{
+  *size   = 0;
+  *mapped = false;
+  if (strcmp(path, "-") != 0) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+      return NULL;
+    }
+
+    struct stat info;
+    char*       data = NULL;
+    if (fstat(fd, &info) == 0) {
+      *size = (size_t)info.st_size;
+      data  = *size > 0 ? (char*)mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0) : (char*)"";
+      if (data == MAP_FAILED) {
+	data = NULL;
+      } else if (*size > 0) {
+	madvise(data, *size, MADV_SEQUENTIAL);
+	*mapped = true;
+      }
+    }
+    close(fd);
+    return data;
+  }
+
+  /* Pipes cannot be mapped
+   */
+  size_t capacity = ATOM_WORKER_CHUNK;
+  char*  data     = (char*)malloc(capacity);
+  size_t count;
+  while (data && (count = fread(data + *size, 1, capacity - *size, stdin)) > 0) {
+    *size += count;
+    if (*size == capacity) {
+      char* grown = (char*)realloc(data, capacity *= 2);
+      if (!grown) {
+	free(data);
+      }
+      data = grown;
+    }
+  }
+  return data;
+}
+
+
+/**
+ * Export top-level forms of text, return false on error of atom
+ * Line of the error is in *line, write errors are in exporter->output.error
+ */
+static bool atomExportForms(AtomJsonExporter* exporter, const char* text, size_t size, bool ndjson, int* line)
+{
+  /* Parse and write one form at a time, the lexer see only the form
+   */
+  size_t cursor = atomSkipSpace(text, size, 0, line);
+  while (cursor < size && !exporter->error && !exporter->output.error) {
+    int    formLine = *line;
+    size_t formEnd  = atomFormEnd(text, size, cursor, line);
+    if (formEnd == 0) {
+      exporter->error = "Unbalanced form";
+      *line = formLine;
+      break;
+    }
+
+    atom_lexer_t* lexer = &exporter->lexer;
+    lexer->string  = text + cursor;
+    lexer->length  = formEnd - cursor;
+    lexer->cursor  = 0;
+    lexer->line    = formLine;
+    lexer->column  = 1;
+    atom_node_t* node = atom_parse(lexer);
+    if (!node || lexer->errcode != ATOM_ERROR_NONE) {
+      atom_delete(node);
+      exporter->error = "Invalid form";
+      *line = lexer->line;
+      break;
+    }
+
+    cursor = atomSkipSpace(text, size, formEnd, line);
+    if (ndjson) {
+      if (atomExportHasName(node)) {
+	atomOutputPutc(&exporter->output, '{');
+	atomExportMember(exporter, node);
+	atomOutputPutc(&exporter->output, '}');
+      } else {
+	atomExportNode(exporter, node);
+      }
+      atomOutputPutc(&exporter->output, '\n');
+    } else {
+      /* Many top-level forms are an array, like atom_parse make them a list
+       */
+      if (exporter->forms == 0 && cursor < size) {
+	atomOutputPutc(&exporter->output, '[');
+      } else if (exporter->forms > 0) {
+	atomOutputPutc(&exporter->output, ',');
+      }
+      if (atomExportHasName(node)) {
+	atomOutputPutc(&exporter->output, '{');
+	atomExportMember(exporter, node);
+	atomOutputPutc(&exporter->output, '}');
+      } else {
+	atomExportNode(exporter, node);
+      }
+      if (exporter->forms > 0 && cursor == size) {
+	atomOutputPutc(&exporter->output, ']');
+      }
+    }
+    exporter->forms++;
+    atom_delete(node);
+  }
+  if (!ndjson && exporter->forms > 0 && !exporter->error) {
+    atomOutputPutc(&exporter->output, '\n');
+  }
+
+  return exporter->error == NULL;
+}
+
+
+/* @function: atomAtomToJson
+ */
+bool atomAtomToJson(const char* atom, const char* json, bool ndjson)
+{
+  size_t size;
+  bool   mapped;
+  char*  text = atomMapFile(atom, &size, &mapped);
+  if (!text) {
+    fprintf(stderr, "Atom not found! path: %s\n", atom);
+    return false;
+  }
+
+  char  temp[4096];
+  FILE* output = strcmp(json, "-") == 0 ? stdout : atomCreateFile(json, temp, sizeof(temp));
+  char* buffer = (char*)malloc(ATOM_WORKER_CHUNK);
+  if (!output || !buffer) {
+    fprintf(stderr, "Open json file for writing failed! path: %s\n", json);
+    if (output && output != stdout) {
+      fclose(output);
+      atomFinishFile(temp, json, false);
+    }
+    free(buffer);
+    if (mapped) munmap(text, size); else if (strcmp(atom, "-") == 0) free(text);
+    return false;
+  }
+
+  struct timespec  start, end;
+  AtomJsonExporter exporter;
+  memset(&exporter, 0, sizeof(exporter));
+  atomOutputInit(&exporter.output, output, buffer);
+  atom_lexer_init(&exporter.lexer, ATOM_LEXER_STRING, (void*)"");
+  timespec_get(&start, TIME_UTC);
+
+  int  line   = 1;
+  bool result = atomExportForms(&exporter, text, size, ndjson, &line);
+  result = atomOutputFlush(&exporter.output) && result;
+  if (!result) {
+    fprintf(stderr, "Failed to export atom to json! %s:%d: %s\n", atom, line, exporter.error ? exporter.error : exporter.output.error);
+  } else {
+    timespec_get(&end, TIME_UTC);
+    double seconds = (double)(end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf(stderr, "Atom to json exported! %zu forms, %zu bytes to %zu bytes in %.3f s", exporter.forms, size, exporter.output.written, seconds);
+    if (seconds > 0) {
+      fprintf(stderr, ", %.1f MB/s", size / seconds / 1e6);
+    }
+    fprintf(stderr, "\n");
+  }
+
+  free(exporter.slots);
+  free(buffer);
+  if (mapped) munmap(text, size); else if (strcmp(atom, "-") == 0) free(text);
+  if (output != stdout && fclose(output) != 0 && result) {
+    fprintf(stderr, "Write content to json file failed!\n");
+    result = false;
+  }
+  if (output != stdout && !atomFinishFile(temp, json, result) && result) {
+    fprintf(stderr, "Rename json file failed! path: %s: %s\n", json, strerror(errno));
+    result = false;
+  }
+  return result;
+}
+
+
+/**
+ * Batch conversion of many files on a pool of threads
+ *
+ * Files are dealt to one queue per thread, largest first. A thread takes the
+ * largest file of its own queue and, once that is empty, steals the smallest
+ * of another queue, so a few big files do not leave the other threads idle.
+ * Each thread has its own heap, exporter and buffers, kept warm between files.
+ *
+ * Small files are read at once, converted in memory and written at once.
+ * Files larger than ATOM_WORKER_BATCH_INLINE are mapped and streamed like
+ * single files. Opening, reading and writing whole files are bounded by the
+ * I/O semaphore, converting is not.
+ */
+typedef struct {
+  char*  path;
+  char*  target;
+  size_t size;
+} AtomBatchFile;
+
+typedef struct {
+  pthread_mutex_t mutex;
+  size_t*         items; /* Indices of files, largest first */
+  size_t          head;
+  size_t          tail;
+} AtomBatchQueue;
+
+typedef struct AtomBatch AtomBatch;
+
+typedef struct {
+  AtomBatch*       batch;
+  int              index;
+  pthread_t        thread;
+  AtomBatchQueue   queue;
+
+  atom_heap_t      heap;     /* Nodes of the form being exported */
+  AtomJsonExporter exporter;
+  char*            input;    /* Content of small files           */
+  size_t           inputCapacity;
+  char*            output;   /* Small files converted in memory  */
+  size_t           outputCapacity;
+  char*            chunk;    /* Output buffer of large files     */
+
+  size_t           files;
+  size_t           failed;
+  size_t           stolen;
+  size_t           bytesIn;
+  size_t           bytesOut;
+} AtomBatchWorker;
+
+struct AtomBatch {
+  AtomBatchFile*   files;
+  size_t           count;
+  size_t           capacity;
+
+  bool             toJson;
+  bool             ndjson;
+  const char*      root;     /* Directory being converted, NULL for a list  */
+  const char*      outdir;   /* NULL to write outputs next to their inputs */
+
+  sem_t            io;
+  AtomBatchWorker* workers;
+  int              threads;
+};
+
+static void* atomHeapExtract(void* data, size_t size)
+{
+  (void)data;
+  return malloc(size);
+}
+
+static void atomHeapCollect(void* data, void* pointer)
+{
+  (void)data;
+  free(pointer);
+}
+
+/**
+ * Join directory and name, without doubling '/'
+ */
+static char* atomJoinPath(const char* directory, const char* name, const char* suffix)
+{
+  size_t length = strlen(directory);
+  while (length > 1 && directory[length - 1] == '/') {
+    length--;
+  }
+
+  size_t count  = strlen(name);
+  size_t extra  = strlen(suffix);
+  char*  result = (char*)malloc(length + 1 + count + extra + 1);
+  if (result) {
+    memcpy(result, directory, length);
+    result[length] = '/';
+    memcpy(result + length + 1, name, count);
+    memcpy(result + length + 1 + count, suffix, extra + 1);
+  }
+  return result;
+}
+
+/**
+ * Output path of a file: same name with the other extension, below outdir
+ * when given, keeping the path relative to the converted directory
+ */
+static char* atomBatchTarget(AtomBatch* batch, const char* path)
+{
+  const char* from     = batch->toJson ? ".atom" : ".json";
+  const char* to       = batch->toJson ? ".json" : ".atom";
+  const char* relative = path;
+  if (batch->outdir) {
+    size_t length = batch->root ? strlen(batch->root) : 0;
+    if (length > 0 && strncmp(path, batch->root, length) == 0) {
+      relative = path + length;
+    }
+    while (relative[0] == '/' || (relative[0] == '.' && relative[1] == '/')) {
+      relative += relative[0] == '/' ? 1 : 2;
+    }
+  }
+
+  size_t length = strlen(relative);
+  if (atomHasExtension(relative, from)) {
+    length -= strlen(from);
+  }
+  char* name = (char*)malloc(length + 1);
+  if (!name) {
+    return NULL;
+  }
+  memcpy(name, relative, length);
+  name[length] = 0;
+
+  char* target = NULL;
+  if (batch->outdir) {
+    target = atomJoinPath(batch->outdir, name, to);
+  } else if ((target = (char*)malloc(length + strlen(to) + 1))) {
+    memcpy(target, name, length);
+    strcpy(target + length, to);
+  }
+  free(name);
+  return target;
+}
+
+static bool atomBatchAdd(AtomBatch* batch, const char* path, size_t size)
+{
+  if (batch->count == batch->capacity) {
+    size_t         capacity = batch->capacity > 0 ? batch->capacity * 2 : 256;
+    AtomBatchFile* files    = (AtomBatchFile*)realloc(batch->files, capacity * sizeof(AtomBatchFile));
+    if (!files) {
+      return false;
+    }
+    batch->files    = files;
+    batch->capacity = capacity;
+  }
+
+  AtomBatchFile* file = &batch->files[batch->count];
+  file->path   = strdup(path);
+  file->target = file->path ? atomBatchTarget(batch, path) : NULL;
+  file->size   = size;
+  if (!file->target) {
+    free(file->path);
+    return false;
+  }
+  batch->count++;
+  return true;
+}
+
+/**
+ * Add files with the source extension of a directory and its sub-directories
+ */
+static bool atomBatchScan(AtomBatch* batch, const char* directory)
+{
+  DIR* dir = opendir(directory);
+  if (!dir) {
+    fprintf(stderr, "Open directory failed! path: %s: %s\n", directory, strerror(errno));
+    return false;
+  }
+
+  const char*    extension = batch->toJson ? ".atom" : ".json";
+  bool           result    = true;
+  struct dirent* entry;
+  while (result && (entry = readdir(dir))) {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+      continue;
+    }
+
+    char*       path = atomJoinPath(directory, entry->d_name, "");
+    struct stat info;
+    if (!path) {
+      result = false;
+    } else if (lstat(path, &info) == 0 && S_ISDIR(info.st_mode)) {
+      result = atomBatchScan(batch, path); /* Links to directories are not followed */
+    } else if (atomHasExtension(path, extension) && stat(path, &info) == 0 && S_ISREG(info.st_mode)) {
+      result = atomBatchAdd(batch, path, (size_t)info.st_size);
+    }
+    free(path);
+  }
+  closedir(dir);
+  return result;
+}
+
+/**
+ * Add files listed one per line, '-' to read the list from stdin
+ */
+static bool atomBatchList(AtomBatch* batch, const char* list)
+{
+  FILE* input = strcmp(list, "-") == 0 ? stdin : fopen(list, "r");
+  if (!input) {
+    fprintf(stderr, "List of files not found! path: %s\n", list);
+    return false;
+  }
+
+  bool result = true;
+  char path[4096];
+  while (result && fgets(path, sizeof(path), input)) {
+    size_t length = strlen(path);
+    while (length > 0 && (path[length - 1] == '\n' || path[length - 1] == '\r')) {
+      path[--length] = 0;
+    }
+    if (length == 0) {
+      continue;
+    }
+
+    /* Missing files are still added, they fail with their error
+     */
+    struct stat info;
+    result = atomBatchAdd(batch, path, stat(path, &info) == 0 ? (size_t)info.st_size : 0);
+  }
+  if (input != stdin) fclose(input);
+  return result;
+}
+
+static int atomBatchCompare(const void* a, const void* b)
+{
+  const AtomBatchFile* left  = (const AtomBatchFile*)a;
+  const AtomBatchFile* right = (const AtomBatchFile*)b;
+  if (left->size != right->size) {
+    return left->size > right->size ? -1 : 1;
+  }
+  return strcmp(left->path, right->path);
+}
+
+/**
+ * Read the whole file in a buffer grown as needed, return false on error
+ */
+static bool atomReadFile(const char* path, char** buffer, size_t* capacity, size_t* size)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+
+  bool result = true;
+  *size = 0;
+  while (true) {
+    if (*size == *capacity) {
+      size_t grown = *capacity > 0 ? *capacity * 2 : ATOM_WORKER_CHUNK;
+      char*  data  = (char*)realloc(*buffer, grown);
+      if (!data) {
+	errno  = ENOMEM;
+	result = false;
+	break;
+      }
+      *buffer   = data;
+      *capacity = grown;
+    }
+
+    ssize_t count = read(fd, *buffer + *size, *capacity - *size);
+    if (count < 0 && errno == EINTR) {
+      continue;
+    }
+    if (count <= 0) {
+      result = count == 0;
+      break;
+    }
+    *size += (size_t)count;
+  }
+
+  int error = errno;
+  close(fd);
+  errno = error;
+  return result;
+}
+
+/**
+ * Write data to file, return NULL or the error
+ */
+static const char* atomWriteFile(const char* path, const char* data, size_t size)
+{
+  char temp[4096];
+  if (snprintf(temp, sizeof(temp), "%s.tmp", path) >= (int)sizeof(temp)) {
+    return strerror(ENAMETOOLONG);
+  }
+  int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (fd < 0) {
+    return strerror(errno);
+  }
+
+  while (size > 0) {
+    ssize_t count = write(fd, data, size);
+    if (count < 0 && errno == EINTR) {
+      continue;
+    }
+    if (count < 0) {
+      close(fd);
+      atomFinishFile(temp, path, false);
+      return strerror(errno);
+    }
+    data += count;
+    size -= (size_t)count;
+  }
+  bool result = close(fd) == 0;
+  return atomFinishFile(temp, path, result) ? NULL : strerror(errno);
+}
+
+/**
+ * Create the missing parent directories of a path
+ */
+static void atomMakeParents(const char* path)
+{
+  char   buffer[4096];
+  size_t length = strlen(path);
+  if (length >= sizeof(buffer)) {
+    return;
+  }
+
+  memcpy(buffer, path, length + 1);
+  for (char* c = buffer + 1; *c; c++) {
+    if (*c == '/') {
+      *c = 0;
+      mkdir(buffer, 0777);
+      *c = '/';
+    }
+  }
+}
+
+/**
+ * Convert a file with the buffers of worker, errors are reported here
+ */
+static void atomBatchConvert(AtomBatchWorker* worker, AtomBatchFile* file)
+{
+  AtomBatch*  batch   = worker->batch;
+  bool        small   = file->size <= ATOM_WORKER_BATCH_INLINE;
+  const char* error   = NULL;
+  int         line    = 0;
+  int         column  = 0;
+  char*       text    = NULL;
+  size_t      size    = 0;
+  bool        mapped  = false;
+  FILE*       stream  = NULL;
+  char        temp[4096];
+
+  /* Small files are read at once, large files are mapped and streamed
+   */
+  sem_wait(&batch->io);
+  if (small) {
+    text = atomReadFile(file->path, &worker->input, &worker->inputCapacity, &size) ? worker->input : NULL;
+  } else if ((text = atomMapFile(file->path, &size, &mapped))) {
+    if (batch->outdir) atomMakeParents(file->target);
+    if (!(stream = atomCreateFile(file->target, temp, sizeof(temp)))) {
+      error = strerror(errno);
+    }
+  }
+  if (!text) {
+    error = strerror(errno);
+  }
+  sem_post(&batch->io);
+
+  AtomJsonTranscoder transcoder;
+  AtomOutput*        output = NULL;
+  if (!error && batch->toJson) {
+    AtomJsonExporter* exporter = &worker->exporter;
+    exporter->forms = 0;
+    exporter->error = NULL;
+    if (small) {
+      atomOutputInitMemory(&exporter->output, worker->output, worker->outputCapacity);
+    } else {
+      atomOutputInit(&exporter->output, stream, worker->chunk);
+    }
+    atom_lexer_init(&exporter->lexer, ATOM_LEXER_STRING, (void*)"");
+
+    line = 1;
+    atomExportForms(exporter, text, size, batch->ndjson, &line);
+    atomOutputFlush(&exporter->output);
+    error  = exporter->error ? exporter->error : exporter->output.error;
+    output = &exporter->output;
+  } else if (!error) {
+    atomJsonInit(&transcoder, stream, worker->chunk);
+    if (small) {
+      atomOutputInitMemory(&transcoder.output, worker->output, worker->outputCapacity);
+    }
+    if (atomJsonFeed(&transcoder, text, size)) {
+      atomJsonFinish(&transcoder);
+    } else {
+      atomOutputFlush(&transcoder.output);
+    }
+    atomJsonFree(&transcoder);
+    if ((error = transcoder.error)) {
+      line   = transcoder.line;
+      column = transcoder.column;
+    }
+    output = &transcoder.output;
+  }
+
+  /* Take back the grown buffer, then write small files at once
+   */
+  size_t written = output ? output->written : 0;
+  if (output && small) {
+    worker->output         = output->buffer;
+    worker->outputCapacity = output->capacity;
+  }
+  if (!error && small) {
+    sem_wait(&batch->io);
+    if (batch->outdir) atomMakeParents(file->target);
+    error = atomWriteFile(file->target, worker->output, written);
+    sem_post(&batch->io);
+  }
+  if (stream && fclose(stream) != 0 && !error) {
+    error = strerror(errno);
+  }
+  if (stream && !atomFinishFile(temp, file->target, !error) && !error) {
+    error = strerror(errno);
+  }
+  if (mapped) {
+    munmap(text, size);
+  }
+
+  worker->files++;
+  worker->bytesIn += size;
+  if (error) {
+    worker->failed++;
+    if (column > 0) {
+      fprintf(stderr, "Failed to convert! %s:%d:%d: %s\n", file->path, line, column, error);
+    } else if (line > 0) {
+      fprintf(stderr, "Failed to convert! %s:%d: %s\n", file->path, line, error);
+    } else {
+      fprintf(stderr, "Failed to convert! %s: %s\n", file->path, error);
+    }
+  } else {
+    worker->bytesOut += written;
+  }
+}
+
+/**
+ * Next file of worker, its own largest one or the smallest of another queue
+ */
+static bool atomBatchNext(AtomBatchWorker* worker, size_t* index)
+{
+  AtomBatch* batch = worker->batch;
+  for (int i = 0; i < batch->threads; i++) {
+    AtomBatchWorker* victim = &batch->workers[(worker->index + i) % batch->threads];
+    AtomBatchQueue*  queue  = &victim->queue;
+    bool             found  = false;
+    pthread_mutex_lock(&queue->mutex);
+    if (queue->head < queue->tail) {
+      *index = i == 0 ? queue->items[queue->head++] : queue->items[--queue->tail];
+      found  = true;
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    if (found) {
+      worker->stolen += i > 0;
+      return true;
+    }
+  }
+  return false;
+}
+
+static void* atomBatchRun(void* data)
+{
+  AtomBatchWorker* worker = (AtomBatchWorker*)data;
+  atom_useheap(&worker->heap);
+  atom_init(NULL, 0, atomHeapExtract, atomHeapCollect);
+
+  size_t index;
+  while (atomBatchNext(worker, &index)) {
+    atomBatchConvert(worker, &worker->batch->files[index]);
+  }
+
+  atom_release();
+  atom_useheap(NULL);
+  return NULL;
+}
+
+/* @function: atomBatchConvertAll
+ */
+bool atomBatchConvertAll(const char* input, const char* outdir, bool toJson, bool ndjson, int threads, int io)
+{
+  AtomBatch batch;
+  memset(&batch, 0, sizeof(batch));
+  batch.toJson = toJson;
+  batch.ndjson = ndjson;
+  batch.outdir = outdir;
+
+  struct timespec start, end;
+  timespec_get(&start, TIME_UTC);
+
+  /* Collect files, then deal them largest first to the queues
+   */
+  struct stat info;
+  bool        result;
+  if (strcmp(input, "-") != 0 && stat(input, &info) == 0 && S_ISDIR(info.st_mode)) {
+    batch.root = input;
+    result     = atomBatchScan(&batch, input);
+  } else {
+    result = atomBatchList(&batch, input);
+  }
+  if (!result) {
+    fprintf(stderr, "Failed to collect files to convert!\n");
+  }
+  qsort(batch.files, batch.count, sizeof(AtomBatchFile), atomBatchCompare);
+
+  if (threads <= 0) {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = count > 0 ? (int)count : 1;
+  }
+#ifndef ATOM_THREADS
+  if (toJson) {
+    threads = 1; /* Without ATOM_THREADS, all threads would parse into the global heap */
+  }
+#endif
+  if ((size_t)threads > batch.count) {
+    threads = batch.count > 0 ? (int)batch.count : 1;
+  }
+  batch.threads = threads;
+  batch.workers = (AtomBatchWorker*)calloc((size_t)threads, sizeof(AtomBatchWorker));
+  sem_init(&batch.io, 0, io > 0 ? (unsigned)io : ATOM_WORKER_BATCH_IO);
+  if (!batch.workers) {
+    fprintf(stderr, "Out of memory!\n");
+    result  = false;
+    threads = 0;
+  }
+
+  for (int i = 0; i < threads; i++) {
+    AtomBatchWorker* worker = &batch.workers[i];
+    worker->batch       = &batch;
+    worker->index       = i;
+    worker->queue.items = (size_t*)malloc((batch.count / threads + 1) * sizeof(size_t));
+    worker->chunk       = (char*)malloc(ATOM_WORKER_CHUNK);
+    if (result && (!worker->queue.items || !worker->chunk)) {
+      fprintf(stderr, "Out of memory!\n");
+      result = false;
+    }
+    pthread_mutex_init(&worker->queue.mutex, NULL);
+  }
+  for (size_t i = 0; result && i < batch.count; i++) {
+    AtomBatchQueue* queue = &batch.workers[i % threads].queue;
+    queue->items[queue->tail++] = i;
+  }
+
+  /* Convert, the calling thread is the first worker
+   */
+  int started = 1;
+  for (; result && started < threads; started++) {
+    if (pthread_create(&batch.workers[started].thread, NULL, atomBatchRun, &batch.workers[started]) != 0) {
+      break;
+    }
+  }
+  if (result) {
+    atomBatchRun(&batch.workers[0]);
+  }
+
+  /* All threads are joined before any queue is freed, they steal from all of them
+   */
+  for (int i = 1; i < started && i < threads; i++) {
+    pthread_join(batch.workers[i].thread, NULL);
+  }
+
+  size_t files = 0, failed = 0, stolen = 0, bytesIn = 0, bytesOut = 0;
+  for (int i = 0; i < threads; i++) {
+    AtomBatchWorker* worker = &batch.workers[i];
+    files    += worker->files;
+    failed   += worker->failed;
+    stolen   += worker->stolen;
+    bytesIn  += worker->bytesIn;
+    bytesOut += worker->bytesOut;
+
+    free(worker->exporter.slots);
+    free(worker->input);
+    free(worker->output);
+    free(worker->chunk);
+    free(worker->queue.items);
+    pthread_mutex_destroy(&worker->queue.mutex);
+  }
+
+  if (result) {
+    timespec_get(&end, TIME_UTC);
+    double seconds = (double)(end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf(stderr, "Batch converted! %zu files, %zu failed, %zu bytes to %zu bytes in %.3f s", files, failed, bytesIn, bytesOut, seconds);
+    if (seconds > 0) {
+      fprintf(stderr, ", %.1f MB/s, %.0f files/s", bytesIn / seconds / 1e6, files / seconds);
+    }
+    fprintf(stderr, " (%d threads, %zu stolen)\n", threads, stolen);
+  }
+
+  sem_destroy(&batch.io);
+  free(batch.workers);
+  for (size_t i = 0; i < batch.count; i++) {
+    free(batch.files[i].path);
+    free(batch.files[i].target);
+  }
+  free(batch.files);
+  return result && failed == 0;
+}
+
+
+/**
+ * Daemon serving requests on a Unix socket
+ *
+ * Messages both ways are a 4-byte big-endian length then that many bytes.
+ * A request is a header line then its data, a reply is "ok\n" then the
+ * result, or "error\n" then the message:
+ *   parse\n<atom>           -> document in canonical form, one line per top-level form
+ *   validate [json]\n<data> -> empty result, or the error
+ *   convert atom\n<json>    -> json converted to atom
+ *   convert json\n<atom>    -> atom exported to json, "convert ndjson" for NDJSON
+ *   query <path>\n<atom>    -> matches in canonical form, one per line
+ *   stats                   -> requests, cache and memory of the thread serving it
+ *
+ * The event loop only accepts, reads and writes. A connection hands one
+ * request at a time to the threads, and read the next when the reply is
+ * sent. Threads keep their heap and node pools warm, with the compiled
+ * queries and recent documents: documents are frozen (atom_freeze), names
+ * interned in one block, and found again by their content.
+ */
+enum {
+  DAEMON_READING,
+  DAEMON_BUSY,    /* Request is served by a thread, which owns the buffers */
+  DAEMON_WRITING,
+};
+
+typedef struct AtomConnection AtomConnection;
+struct AtomConnection {
+  int             fd;
+  int             state;
+  uint32_t        events;   /* Watched by epoll                                  */
+  bool            eof;      /* Peer sent everything                              */
+  bool            closed;   /* Closed while busy, freed when the reply come back */
+  char*           input;
+  size_t          inputLength;
+  size_t          inputCapacity;
+  char*           reply;
+  size_t          replyLength;
+  size_t          replyCapacity;
+  size_t          replySent;
+  AtomConnection* queue;    /* Next request or reply                             */
+  AtomConnection* prev;     /* All connections, freed at exit                    */
+  AtomConnection* next;
+};
+
+typedef struct {
+  uint64_t     hash;
+  size_t       size;
+  char*        text;
+  atom_node_t* tree;        /* Frozen */
+  uint64_t     used;
+} AtomDocument;
+
+typedef struct {
+  char*         path;
+  atom_query_t* query;
+  uint64_t      used;
+} AtomCachedQuery;
+
+typedef struct AtomDaemon AtomDaemon;
+
+typedef struct {
+  AtomDaemon*      daemon;
+  int              index;
+  pthread_t        thread;
+
+  atom_heap_t      heap;
+  AtomJsonExporter exporter;
+  unsigned char*   frames;  /* Kept from json transcoders */
+  size_t           framesCapacity;
+  AtomDocument     documents[ATOM_WORKER_DAEMON_DOCUMENTS];
+  AtomCachedQuery  queries[ATOM_WORKER_DAEMON_QUERIES];
+  uint64_t         tick;
+
+  size_t           requests;
+  size_t           hits;
+  size_t           misses;
+} AtomDaemonWorker;
+
+struct AtomDaemon {
+  int               listener;
+  int               epoll;
+  int               wakeup;   /* eventfd, replies are ready */
+
+  pthread_mutex_t   mutex;
+  pthread_cond_t    cond;
+  AtomConnection*   requests;
+  AtomConnection*   requestsTail;
+  AtomConnection*   replies;
+  bool              stopping;
+
+  AtomConnection*   connections;
+  AtomDaemonWorker* workers;
+  int               threads;
+};
+
+static volatile sig_atomic_t atomDaemonStopped;
+
+static void atomDaemonSignal(int signal)
+{
+  (void)signal;
+  atomDaemonStopped = 1;
+}
+
+static size_t atomFrameLength(const char* data)
+{
+  const unsigned char* bytes = (const unsigned char*)data;
+  return (size_t)bytes[0] << 24 | (size_t)bytes[1] << 16 | (size_t)bytes[2] << 8 | (size_t)bytes[3];
+}
+
+static uint64_t atomDaemonHash(const char* data, size_t size)
+{
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ (unsigned char)data[i]) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+static const char* atomErrorMessage(int errcode)
+{
+  switch (errcode) {
+  case ATOM_ERROR_UNBALANCED:   return "Unbalanced list";
+  case ATOM_ERROR_UNEXPECTED:   return "Unexpected character";
+  case ATOM_ERROR_UNTERMINATED: return "Unterminated text";
+  case ATOM_ERROR_OVERFLOW:     return "Out of memory";
+  default:                      return "Invalid atom";
+  }
+}
+
+/**
+ * Replace the reply with an error, line and column are 0 when unknown
+ */
+static void atomReplyError(AtomOutput* reply, int line, int column, const char* message)
+{
+  char   text[256];
+  size_t length = 0;
+  if (column > 0) {
+    length = (size_t)snprintf(text, sizeof(text), "error\n%d:%d: %s", line, column, message);
+  } else if (line > 0) {
+    length = (size_t)snprintf(text, sizeof(text), "error\n%d: %s", line, message);
+  } else {
+    length = (size_t)snprintf(text, sizeof(text), "error\n%s", message);
+  }
+
+  reply->length  = 4;
+  reply->written = 4;
+  reply->error   = NULL;
+  atomOutputWrite(reply, text, length < sizeof(text) ? length : sizeof(text) - 1);
+}
+
+/**
+ * Write node in canonical form, the reply grows until it fits
+ */
+static void atomReplyNode(AtomOutput* reply, atom_node_t* node)
+{
+  while (!reply->error) {
+    size_t room = reply->capacity - reply->length;
+    if (room > 1) {
+      char* string = reply->buffer + reply->length;
+      int   error  = atom_save_canonical_string(NULL, node, string, room);
+      if (error == ATOM_ERROR_NONE) {
+	size_t length = strlen(string);
+	reply->length  += length;
+	reply->written += length;
+	return;
+      }
+      if (error != ATOM_ERROR_OVERFLOW) {
+	reply->error = atomErrorMessage(error);
+	return;
+      }
+    }
+    atomOutputDrain(reply);
+  }
+}
+
+static atom_bool_t atomReplyMatch(void* context, atom_node_t* node)
+{
+  AtomOutput* reply = (AtomOutput*)context;
+  atomReplyNode(reply, node);
+  atomOutputPutc(reply, '\n');
+  return reply->error == NULL;
+}
+
+/**
+ * Frozen tree of an atom document, from the cache of worker when it was
+ * seen recently. *tree is NULL for an empty document.
+ * Return false on error, with the error in the reply.
+ */
+static bool atomDaemonDocument(AtomDaemonWorker* worker, const char* text, size_t size, atom_node_t** tree, AtomOutput* reply)
+{
+  uint64_t      hash   = atomDaemonHash(text, size);
+  AtomDocument* oldest = &worker->documents[0];
+  for (int i = 0; i < ATOM_WORKER_DAEMON_DOCUMENTS; i++) {
+    AtomDocument* document = &worker->documents[i];
+    if (document->text && document->hash == hash && document->size == size && memcmp(document->text, text, size) == 0) {
+      document->used = ++worker->tick;
+      worker->hits++;
+      *tree = document->tree;
+      return true;
+    }
+    if (document->used < oldest->used) {
+      oldest = document;
+    }
+  }
+  worker->misses++;
+
+  atom_lexer_t lexer;
+  atom_lexer_init(&lexer, ATOM_LEXER_STRING, (void*)"");
+  lexer.string = text;
+  lexer.length = size;
+  atom_node_t* node = atom_parse(&lexer);
+  if (lexer.errcode != ATOM_ERROR_NONE) {
+    atom_delete(node);
+    atomReplyError(reply, lexer.line, lexer.column, atomErrorMessage(lexer.errcode));
+    return false;
+  }
+  *tree = NULL;
+  if (!node) {
+    return true;
+  }
+
+  /* Frozen tree does not need the text, and is one block
+   */
+  atom_node_t* frozen = atom_freeze(&lexer, node, 0);
+  atom_delete(node);
+  if (!frozen) {
+    atomReplyError(reply, 0, 0, "Out of memory");
+    return false;
+  }
+
+  if (oldest->text) {
+    atom_delete(oldest->tree);
+    free(oldest->text);
+    oldest->text = NULL;
+  }
+  if (size <= ATOM_WORKER_BATCH_INLINE && (oldest->text = (char*)malloc(size > 0 ? size : 1))) {
+    memcpy(oldest->text, text, size);
+    oldest->hash = hash;
+    oldest->size = size;
+    oldest->tree = frozen;
+    oldest->used = ++worker->tick;
+  } else {
+    /* Not cached, delete it after this request
+     */
+    oldest->tree = frozen;
+  }
+  *tree = frozen;
+  return true;
+}
+
+/**
+ * Compiled query of path, from the cache of worker
+ */
+static atom_query_t* atomDaemonQuery(AtomDaemonWorker* worker, const char* path)
+{
+  AtomCachedQuery* oldest = &worker->queries[0];
+  for (int i = 0; i < ATOM_WORKER_DAEMON_QUERIES; i++) {
+    AtomCachedQuery* cached = &worker->queries[i];
+    if (cached->path && strcmp(cached->path, path) == 0) {
+      cached->used = ++worker->tick;
+      return cached->query;
+    }
+    if (cached->used < oldest->used) {
+      oldest = cached;
+    }
+  }
+
+  atom_query_t* query = atom_query_compile(path);
+  char*         copy  = query ? strdup(path) : NULL;
+  if (!copy) {
+    atom_query_free(query);
+    return NULL;
+  }
+  if (oldest->path) {
+    atom_query_free(oldest->query);
+    free(oldest->path);
+  }
+  oldest->path  = copy;
+  oldest->query = query;
+  oldest->used  = ++worker->tick;
+  return query;
+}
+
+/**
+ * Json to atom in the reply, keeping the frames of the transcoder warm
+ */
+static void atomDaemonJson(AtomDaemonWorker* worker, const char* data, size_t size, AtomOutput* reply, bool keep)
+{
+  AtomJsonTranscoder transcoder;
+  atomJsonInit(&transcoder, NULL, NULL);
+  transcoder.output   = *reply;
+  transcoder.frames   = worker->frames;
+  transcoder.capacity = worker->framesCapacity;
+
+  size_t length = transcoder.output.length;
+  if (atomJsonFeed(&transcoder, data, size)) {
+    atomJsonFinish(&transcoder);
+  }
+  *reply                 = transcoder.output;
+  worker->frames         = transcoder.frames;
+  worker->framesCapacity = transcoder.capacity;
+  if (transcoder.error) {
+    atomReplyError(reply, transcoder.line, transcoder.column, transcoder.error);
+  } else if (!keep) {
+    reply->length = reply->written = length;
+  }
+}
+
+/**
+ * Serve the request of connection, the reply replace the previous one
+ */
+static void atomDaemonServe(AtomDaemonWorker* worker, AtomConnection* connection)
+{
+  size_t      size    = atomFrameLength(connection->input);
+  const char* request = connection->input + 4;
+  const char* end     = memchr(request, '\n', size);
+  const char* data    = end ? end + 1 : request + size;
+  size_t      length  = (size_t)(request + size - data);
+
+  char   header[1024];
+  size_t count = (size_t)((end ? end : request + size) - request);
+  if (count >= sizeof(header)) {
+    count = sizeof(header) - 1;
+  }
+  memcpy(header, request, count);
+  header[count] = 0;
+
+  char* argument = strchr(header, ' ');
+  if (argument) {
+    *argument++ = 0;
+  } else {
+    argument = header + count;
+  }
+
+  AtomOutput reply;
+  atomOutputInitMemory(&reply, connection->reply, connection->replyCapacity);
+  atomOutputWrite(&reply, "\0\0\0\0ok\n", 7);
+  worker->requests++;
+
+  atom_node_t* tree = NULL;
+  if (strcmp(header, "parse") == 0) {
+    if (atomDaemonDocument(worker, data, length, &tree, &reply) && tree) {
+      if (tree->type == ATOM_LIST && tree->data.is_root && atom_istextnull(tree->name)) {
+	for (atom_node_t* child = tree->children; child; child = child->next) {
+	  atomReplyMatch(&reply, child);
+	}
+      } else {
+	atomReplyMatch(&reply, tree);
+      }
+    }
+  } else if (strcmp(header, "validate") == 0) {
+    if (strcmp(argument, "json") == 0) {
+      atomDaemonJson(worker, data, length, &reply, false);
+    } else {
+      atomDaemonDocument(worker, data, length, &tree, &reply);
+    }
+  } else if (strcmp(header, "convert") == 0 && strcmp(argument, "atom") == 0) {
+    atomDaemonJson(worker, data, length, &reply, true);
+  } else if (strcmp(header, "convert") == 0 && (strcmp(argument, "json") == 0 || strcmp(argument, "ndjson") == 0)) {
+    AtomJsonExporter* exporter = &worker->exporter;
+    int               line     = 1;
+    exporter->forms  = 0;
+    exporter->error  = NULL;
+    exporter->output = reply;
+    atom_lexer_init(&exporter->lexer, ATOM_LEXER_STRING, (void*)"");
+    atomExportForms(exporter, data, length, strcmp(argument, "ndjson") == 0, &line);
+    reply = exporter->output;
+    if (exporter->error) {
+      atomReplyError(&reply, line, 0, exporter->error);
+    }
+  } else if (strcmp(header, "query") == 0) {
+    atom_query_t* query = atomDaemonQuery(worker, argument);
+    if (!query) {
+      atomReplyError(&reply, 0, 0, "Invalid query");
+    } else if (atomDaemonDocument(worker, data, length, &tree, &reply) && tree) {
+      atom_query_each(query, NULL, tree, atomReplyMatch, &reply);
+    }
+  } else if (strcmp(header, "stats") == 0) {
+    atom_memory_t memory;
+    atom_getmemory(NULL, &memory);
+
+    char   text[256];
+    size_t count = (size_t)snprintf(text, sizeof(text), "thread %d: %zu requests, %zu documents found, %zu parsed, %zu nodes, %zu bytes reserved\n",
+				    worker->index, worker->requests, worker->hits, worker->misses, memory.nodes, memory.reserved);
+    atomOutputWrite(&reply, text, count < sizeof(text) ? count : sizeof(text) - 1);
+  } else {
+    atomReplyError(&reply, 0, 0, "Unknown request");
+  }
+
+  /* Documents that are too large to be cached are not kept
+   */
+  for (int i = 0; i < ATOM_WORKER_DAEMON_DOCUMENTS; i++) {
+    AtomDocument* document = &worker->documents[i];
+    if (!document->text && document->tree) {
+      atom_delete(document->tree);
+      document->tree = NULL;
+    }
+  }
+
+  if (reply.error) {
+    atomReplyError(&reply, 0, 0, reply.error);
+  }
+  if (reply.length - 4 > UINT32_MAX) {
+    atomReplyError(&reply, 0, 0, "Reply is too large");
+  }
+  if (reply.buffer && reply.length >= 4) {
+    size_t frame = reply.length - 4;
+    reply.buffer[0] = (char)(frame >> 24);
+    reply.buffer[1] = (char)(frame >> 16);
+    reply.buffer[2] = (char)(frame >> 8);
+    reply.buffer[3] = (char)frame;
+  }
+  connection->reply         = reply.buffer;
+  connection->replyCapacity = reply.capacity;
+  connection->replyLength   = reply.buffer ? reply.length : 0;
+  connection->replySent     = 0;
+}
+
+static void* atomDaemonRun(void* data)
+{
+  AtomDaemonWorker* worker = (AtomDaemonWorker*)data;
+  AtomDaemon*       daemon = worker->daemon;
+  atom_useheap(&worker->heap);
+  atom_init(NULL, 0, atomHeapExtract, atomHeapCollect);
+
+  while (true) {
+    pthread_mutex_lock(&daemon->mutex);
+    while (!daemon->requests && !daemon->stopping) {
+      pthread_cond_wait(&daemon->cond, &daemon->mutex);
+    }
+    AtomConnection* connection = daemon->requests;
+    if (connection) {
+      daemon->requests = connection->queue;
+    }
+    pthread_mutex_unlock(&daemon->mutex);
+    if (!connection) {
+      break;
+    }
+
+    atomDaemonServe(worker, connection);
+
+    pthread_mutex_lock(&daemon->mutex);
+    connection->queue = daemon->replies;
+    daemon->replies   = connection;
+    pthread_mutex_unlock(&daemon->mutex);
+
+    uint64_t one = 1;
+    if (write(daemon->wakeup, &one, sizeof(one)) < 0) {
+      /* Counter is already set, the loop wakes up anyway */
+    }
+  }
+
+  for (int i = 0; i < ATOM_WORKER_DAEMON_DOCUMENTS; i++) {
+    atom_delete(worker->documents[i].tree);
+    free(worker->documents[i].text);
+  }
+  for (int i = 0; i < ATOM_WORKER_DAEMON_QUERIES; i++) {
+    atom_query_free(worker->queries[i].query);
+    free(worker->queries[i].path);
+  }
+  free(worker->exporter.slots);
+  free(worker->frames);
+  atom_release();
+  atom_useheap(NULL);
+  return NULL;
+}
+
+static void atomDaemonWatch(AtomDaemon* daemon, AtomConnection* connection, uint32_t events)
+{
+  if (connection->events != events) {
+    struct epoll_event event;
+    event.events   = events;
+    event.data.ptr = connection;
+    epoll_ctl(daemon->epoll, EPOLL_CTL_MOD, connection->fd, &event);
+    connection->events = events;
+  }
+}
+
+static void atomDaemonFree(AtomDaemon* daemon, AtomConnection* connection)
+{
+  if (connection->prev) {
+    connection->prev->next = connection->next;
+  } else {
+    daemon->connections = connection->next;
+  }
+  if (connection->next) {
+    connection->next->prev = connection->prev;
+  }
+  free(connection->input);
+  free(connection->reply);
+  free(connection);
+}
+
+/**
+ * Close connection, a busy one is freed when its reply come back
+ */
+static void atomDaemonClose(AtomDaemon* daemon, AtomConnection* connection)
+{
+  if (connection->fd >= 0) {
+    epoll_ctl(daemon->epoll, EPOLL_CTL_DEL, connection->fd, NULL);
+    close(connection->fd);
+    connection->fd = -1;
+  }
+  if (connection->state == DAEMON_BUSY) {
+    connection->closed = true;
+  } else {
+    atomDaemonFree(daemon, connection);
+  }
+}
+
+/**
+ * Hand the next buffered request to the threads, or wait for more
+ */
+static void atomDaemonNext(AtomDaemon* daemon, AtomConnection* connection)
+{
+  if (connection->inputLength >= 4 && atomFrameLength(connection->input) > ATOM_WORKER_DAEMON_MAX) {
+    atomDaemonClose(daemon, connection);
+  } else if (connection->inputLength >= 4 && connection->inputLength - 4 >= atomFrameLength(connection->input)) {
+    connection->state = DAEMON_BUSY;
+    atomDaemonWatch(daemon, connection, 0);
+
+    pthread_mutex_lock(&daemon->mutex);
+    connection->queue = NULL;
+    if (daemon->requests) {
+      daemon->requestsTail->queue = connection;
+    } else {
+      daemon->requests = connection;
+    }
+    daemon->requestsTail = connection;
+    pthread_cond_signal(&daemon->cond);
+    pthread_mutex_unlock(&daemon->mutex);
+  } else if (connection->eof) {
+    atomDaemonClose(daemon, connection);
+  } else {
+    connection->state = DAEMON_READING;
+    atomDaemonWatch(daemon, connection, EPOLLIN);
+  }
+}
+
+/**
+ * Read what is available, return false on error
+ */
+static bool atomDaemonRead(AtomConnection* connection)
+{
+  while (!connection->eof) {
+    if (connection->inputLength == connection->inputCapacity) {
+      size_t capacity = connection->inputCapacity > 0 ? connection->inputCapacity * 2 : ATOM_WORKER_CHUNK;
+      char*  input    = (char*)realloc(connection->input, capacity);
+      if (!input) {
+	return false;
+      }
+      connection->input         = input;
+      connection->inputCapacity = capacity;
+    }
+
+    ssize_t count = recv(connection->fd, connection->input + connection->inputLength, connection->inputCapacity - connection->inputLength, 0);
+    if (count > 0) {
+      connection->inputLength += (size_t)count;
+      if (connection->inputLength >= 4 && connection->inputLength - 4 >= atomFrameLength(connection->input)) {
+	break; /* A whole request, the rest is read after the reply */
+      }
+    } else if (count == 0) {
+      connection->eof = true;
+    } else if (errno != EINTR) {
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+  }
+  return true;
+}
+
+/**
+ * Send the reply, then go to the next request
+ */
+static void atomDaemonWrite(AtomDaemon* daemon, AtomConnection* connection)
+{
+  if (connection->replyLength == 0) {
+    atomDaemonClose(daemon, connection); /* Out of memory for a reply */
+    return;
+  }
+
+  while (connection->replySent < connection->replyLength) {
+    ssize_t count = send(connection->fd, connection->reply + connection->replySent, connection->replyLength - connection->replySent, MSG_NOSIGNAL);
+    if (count > 0) {
+      connection->replySent += (size_t)count;
+    } else if (count < 0 && errno == EINTR) {
+      continue;
+    } else if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      atomDaemonWatch(daemon, connection, EPOLLOUT);
+      return;
+    } else {
+      atomDaemonClose(daemon, connection);
+      return;
+    }
+  }
+
+  size_t used = 4 + atomFrameLength(connection->input);
+  memmove(connection->input, connection->input + used, connection->inputLength - used);
+  connection->inputLength -= used;
+  atomDaemonNext(daemon, connection);
+}
+
+static void atomDaemonAccept(AtomDaemon* daemon)
+{
+  while (true) {
+    int fd = accept(daemon->listener, NULL, NULL);
+    if (fd < 0) {
+      if (errno == EINTR) {
+	continue;
+      }
+      return;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    AtomConnection* connection = (AtomConnection*)calloc(1, sizeof(AtomConnection));
+    if (!connection) {
+      close(fd);
+      continue;
+    }
+    connection->fd     = fd;
+    connection->state  = DAEMON_READING;
+    connection->events = EPOLLIN;
+
+    struct epoll_event event;
+    event.events   = EPOLLIN;
+    event.data.ptr = connection;
+    if (epoll_ctl(daemon->epoll, EPOLL_CTL_ADD, fd, &event) != 0) {
+      close(fd);
+      free(connection);
+      continue;
+    }
+    connection->next = daemon->connections;
+    if (connection->next) {
+      connection->next->prev = connection;
+    }
+    daemon->connections = connection;
+  }
+}
+
+/**
+ * Replies made by the threads
+ */
+static void atomDaemonReplies(AtomDaemon* daemon)
+{
+  uint64_t count;
+  if (read(daemon->wakeup, &count, sizeof(count)) < 0) {
+    /* Nothing to read, replies are still taken */
+  }
+
+  pthread_mutex_lock(&daemon->mutex);
+  AtomConnection* connection = daemon->replies;
+  daemon->replies = NULL;
+  pthread_mutex_unlock(&daemon->mutex);
+
+  while (connection) {
+    AtomConnection* next = connection->queue;
+    if (connection->closed) {
+      atomDaemonFree(daemon, connection);
+    } else {
+      connection->state = DAEMON_WRITING;
+      atomDaemonWrite(daemon, connection);
+    }
+    connection = next;
+  }
+}
+
+/**
+ * Listening socket at path, a socket file left by a daemon that is gone is
+ * replaced, a live one is not
+ */
+static int atomDaemonListen(const char* path)
+{
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(address.sun_path)) {
+    fprintf(stderr, "Socket path is too long! path: %s\n", path);
+    return -1;
+  }
+  strcpy(address.sun_path, path);
+
+  int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (probe >= 0 && connect(probe, (struct sockaddr*)&address, sizeof(address)) == 0) {
+    fprintf(stderr, "Socket is already served! path: %s\n", path);
+    close(probe);
+    return -1;
+  }
+  if (probe >= 0) {
+    close(probe);
+  }
+  unlink(path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0 || bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0) {
+    fprintf(stderr, "Listen on socket failed! path: %s: %s\n", path, strerror(errno));
+    if (fd >= 0) close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/* @function: atomServe
+ */
+bool atomServe(const char* path, int threads)
+{
+  AtomDaemon daemon;
+  memset(&daemon, 0, sizeof(daemon));
+  if ((daemon.listener = atomDaemonListen(path)) < 0) {
+    return false;
+  }
+
+  daemon.epoll  = epoll_create1(EPOLL_CLOEXEC);
+  daemon.wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (daemon.epoll < 0 || daemon.wakeup < 0) {
+    fprintf(stderr, "Create event loop failed! %s\n", strerror(errno));
+    if (daemon.epoll >= 0) close(daemon.epoll);
+    if (daemon.wakeup >= 0) close(daemon.wakeup);
+    close(daemon.listener);
+    unlink(path);
+    return false;
+  }
+
+  struct epoll_event event;
+  event.events   = EPOLLIN;
+  event.data.ptr = &daemon.listener;
+  epoll_ctl(daemon.epoll, EPOLL_CTL_ADD, daemon.listener, &event);
+  event.data.ptr = &daemon.wakeup;
+  epoll_ctl(daemon.epoll, EPOLL_CTL_ADD, daemon.wakeup, &event);
+
+  /* Stop on SIGINT and SIGTERM. They stay blocked, in the threads too, and
+   * are only let in by epoll_pwait, so one arriving after the atomDaemonStopped
+   * check is still pending when epoll_pwait starts and interrupts it
+   */
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = atomDaemonSignal;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+
+  sigset_t blocked;
+  sigset_t waiting;
+  sigemptyset(&blocked);
+  sigaddset(&blocked, SIGINT);
+  sigaddset(&blocked, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &blocked, &waiting);
+  sigdelset(&waiting, SIGINT);
+  sigdelset(&waiting, SIGTERM);
+
+  if (threads <= 0) {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = count > 0 ? (int)count : 1;
+  }
+#ifndef ATOM_THREADS
+  threads = 1; /* Without ATOM_THREADS, all threads would parse into the global heap */
+#endif
+  pthread_mutex_init(&daemon.mutex, NULL);
+  pthread_cond_init(&daemon.cond, NULL);
+  daemon.workers = (AtomDaemonWorker*)calloc((size_t)threads, sizeof(AtomDaemonWorker));
+  for (int i = 0; daemon.workers && i < threads; i++) {
+    AtomDaemonWorker* worker = &daemon.workers[i];
+    worker->daemon = &daemon;
+    worker->index  = i;
+    if (pthread_create(&worker->thread, NULL, atomDaemonRun, worker) != 0) {
+      break;
+    }
+    daemon.threads++;
+  }
+
+  bool result = daemon.threads > 0;
+  if (result) {
+    fprintf(stderr, "Atom worker serving! path: %s, %d threads\n", path, daemon.threads);
+  } else {
+    fprintf(stderr, "Start threads failed!\n");
+  }
+
+  struct epoll_event events[64];
+  while (result && !atomDaemonStopped) {
+    int count = epoll_pwait(daemon.epoll, events, 64, -1, &waiting);
+    if (count < 0) {
+      if (errno == EINTR) {
+	continue;
+      }
+      fprintf(stderr, "Wait for events failed! %s\n", strerror(errno));
+      result = false;
+      break;
+    }
+
+    /* Connections before replies and new ones, those may free connections
+     * that still have events in this batch
+     */
+    bool accepting = false;
+    bool replying  = false;
+    for (int i = 0; i < count; i++) {
+      void*           target     = events[i].data.ptr;
+      AtomConnection* connection = (AtomConnection*)target;
+      if (target == &daemon.listener) {
+	accepting = true;
+	continue;
+      }
+      if (target == &daemon.wakeup) {
+	replying = true;
+	continue;
+      }
+      if (connection->state == DAEMON_READING && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+	if (atomDaemonRead(connection)) {
+	  atomDaemonNext(&daemon, connection);
+	} else {
+	  atomDaemonClose(&daemon, connection);
+	}
+      } else if (connection->state == DAEMON_WRITING && (events[i].events & EPOLLOUT)) {
+	atomDaemonWrite(&daemon, connection);
+      } else if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+	atomDaemonClose(&daemon, connection);
+      }
+    }
+    if (replying) {
+      atomDaemonReplies(&daemon);
+    }
+    if (accepting) {
+      atomDaemonAccept(&daemon);
+    }
+  }
+
+  /* Threads finish the requests they have, then connections are freed
+   */
+  pthread_mutex_lock(&daemon.mutex);
+  daemon.stopping = true;
+  pthread_cond_broadcast(&daemon.cond);
+  pthread_mutex_unlock(&daemon.mutex);
+  for (int i = 0; i < daemon.threads; i++) {
+    pthread_join(daemon.workers[i].thread, NULL);
+  }
+  while (daemon.connections) {
+    AtomConnection* connection = daemon.connections;
+    if (connection->fd >= 0) close(connection->fd);
+    atomDaemonFree(&daemon, connection);
+  }
+
+  free(daemon.workers);
+  pthread_sigmask(SIG_UNBLOCK, &blocked, NULL);
+  pthread_cond_destroy(&daemon.cond);
+  pthread_mutex_destroy(&daemon.mutex);
+  close(daemon.wakeup);
+  close(daemon.epoll);
+  close(daemon.listener);
+  unlink(path);
+  fprintf(stderr, "Atom worker stopped! path: %s\n", path);
   return result;
 }